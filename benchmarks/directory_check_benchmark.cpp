@@ -0,0 +1,116 @@
+// Times how long checking a clicked directory takes, which
+// VerifyAndCleanDirectoryUpdate() used to do by listing the whole directory
+// with GetDirectoryFiles(), and now does with CheckDirectory(), which only
+// opens it. Runs on directories of 10 up to 100k files generated below
+// DIRECTORY, which is removed again at the end.
+//
+// Every click is timed on its own, and the median and slowest of kClickCount
+// are printed, since a click is as slow as the one check it waits for.
+//
+// Usage:
+// ./directory_check_benchmark DIRECTORY
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "filesystem.hpp"
+
+namespace {
+
+constexpr int kClickCount = 101;
+constexpr size_t kFileCounts[] = {10, 1000, 10000, 100000};
+
+// Adds empty files named first, first + 1 and so on up to count to directory.
+bool CreateFiles(const std::string &directory, size_t first, size_t count) {
+  for (size_t i = first; i < count; i++) {
+    const std::string path = directory + "/" + std::to_string(i);
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1) return false;
+    close(fd);
+  }
+  return true;
+}
+
+struct ClickTimes {
+  double median_microseconds = -1;
+  double slowest_microseconds = -1;
+};
+
+// Times check kClickCount times, each on its own. Returns negative times if
+// any check failed.
+template <typename Check>
+ClickTimes TimeClicks(const Check &check) {
+  std::vector<double> microseconds;
+  for (int click = 0; click < kClickCount; click++) {
+    const auto start = std::chrono::steady_clock::now();
+    const bool is_ok = check();
+    const std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (!is_ok) return {};
+    microseconds.push_back(elapsed.count());
+  }
+  std::sort(microseconds.begin(), microseconds.end());
+  return {microseconds[microseconds.size() / 2], microseconds.back()};
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "Usage: %s DIRECTORY\n", argv[0]);
+    return 1;
+  }
+  const std::string directory =
+      std::string(argv[1]) + "/directory_check_benchmark";
+  if (mkdir(directory.c_str(), 0755) == -1) {
+    std::perror(directory.c_str());
+    return 1;
+  }
+
+  std::printf("%9s %12s %12s %12s %12s\n", "entries", "list us",
+              "list max us", "check us", "check max us");
+  const POSIXFileSystem file_system;
+  size_t created_count = 0;
+  int status = 0;
+  for (size_t file_count : kFileCounts) {
+    if (!CreateFiles(directory, created_count, file_count)) {
+      std::perror(directory.c_str());
+      status = 1;
+      break;
+    }
+    created_count = file_count;
+
+    const ClickTimes list_times = TimeClicks([&file_system, &directory]() {
+      return file_system.GetDirectoryFiles(directory).ok();
+    });
+    const ClickTimes check_times = TimeClicks([&file_system, &directory]() {
+      return file_system.CheckDirectory(directory).ok();
+    });
+    if (list_times.median_microseconds < 0 ||
+        check_times.median_microseconds < 0) {
+      std::fprintf(stderr, "Could not check %s.\n", directory.c_str());
+      status = 1;
+      break;
+    }
+    std::printf("%9zu %12.1f %12.1f %12.1f %12.1f\n", file_count,
+                list_times.median_microseconds,
+                list_times.slowest_microseconds,
+                check_times.median_microseconds,
+                check_times.slowest_microseconds);
+  }
+
+  std::error_code error;
+  std::filesystem::remove_all(directory, error);
+  return status;
+}
@@ -0,0 +1,217 @@
+// Measures the memory and allocations a directory listing costs, comparing
+// DirectoryListing's name arena against the std::vector of files, each with
+// its own std::string name, that POSIXFileSystem::GetDirectoryFiles() used to
+// return. Both read the directory with getdents64() into 256 KiB buffers.
+//
+// Counts every operator new, and the bytes malloc actually handed out for it,
+// on directories generated below DIRECTORY: one of 1M short names and one of
+// 100k 32-byte names, which no longer fit std::string's inline buffer.
+//
+// Usage:
+// ./directory_listing_benchmark DIRECTORY
+
+#include <absl/status/statusor.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "filesystem.hpp"
+
+namespace {
+
+constexpr size_t kBufferSize = 256 * 1024;
+
+struct AllocationCounts {
+  size_t allocations = 0;
+  size_t live_bytes = 0;
+  size_t peak_bytes = 0;
+};
+
+AllocationCounts allocation_counts;
+
+void *Allocate(size_t size) {
+  void *memory = std::malloc(size == 0 ? 1 : size);
+  if (memory == nullptr) throw std::bad_alloc();
+  allocation_counts.allocations++;
+  allocation_counts.live_bytes += malloc_usable_size(memory);
+  allocation_counts.peak_bytes =
+      std::max(allocation_counts.peak_bytes, allocation_counts.live_bytes);
+  return memory;
+}
+
+void Deallocate(void *memory) {
+  if (memory == nullptr) return;
+  allocation_counts.live_bytes -= malloc_usable_size(memory);
+  std::free(memory);
+}
+
+}  // namespace
+
+void *operator new(size_t size) { return Allocate(size); }
+void *operator new[](size_t size) { return Allocate(size); }
+void operator delete(void *memory) noexcept { Deallocate(memory); }
+void operator delete[](void *memory) noexcept { Deallocate(memory); }
+void operator delete(void *memory, size_t /*size*/) noexcept {
+  Deallocate(memory);
+}
+void operator delete[](void *memory, size_t /*size*/) noexcept {
+  Deallocate(memory);
+}
+
+namespace {
+
+struct DirectoryCase {
+  const char *description;
+  size_t file_count;
+  size_t name_length;
+};
+
+constexpr DirectoryCase kDirectoryCases[] = {
+    {"1M short names", 1000000, 0},
+    {"100k 32-byte names", 100000, 32},
+};
+
+// What every entry took before listings kept their names in one arena.
+struct LegacyFile {
+  std::string name;
+  bool is_dir;
+  FileMetadata metadata;
+};
+
+// Lists directory the way GetDirectoryFiles() did before the name arena,
+// growing the result at most once per buffer. Returns the number of files
+// listed, or -1 on failure.
+ssize_t ListLegacyFiles(const std::string &directory,
+                        std::vector<LegacyFile> &files) {
+  int dir_fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd == -1) return -1;
+  std::vector<char> buffer(kBufferSize);
+  for (;;) {
+    const ssize_t read_bytes =
+        syscall(SYS_getdents64, dir_fd, buffer.data(), buffer.size());
+    if (read_bytes <= 0) {
+      close(dir_fd);
+      return read_bytes == 0 ? files.size() : -1;
+    }
+
+    std::vector<const dirent64 *> entries;
+    for (ssize_t offset = 0; offset < read_bytes;) {
+      const auto *entry =
+          reinterpret_cast<const dirent64 *>(buffer.data() + offset);
+      offset += entry->d_reclen;
+      const std::string_view name = entry->d_name;
+      if ((entry->d_type == DT_REG || entry->d_type == DT_DIR) &&
+          name != "." && name != "..")
+        entries.push_back(entry);
+    }
+    if (files.capacity() < files.size() + entries.size())
+      files.reserve(std::max(files.size() + entries.size(),
+                             2 * files.capacity()));
+    for (const dirent64 *entry : entries)
+      files.push_back({entry->d_name, entry->d_type == DT_DIR, {}});
+  }
+}
+
+// Creates directory and fills it with the case's empty files, named by their
+// index and padded with x to name_length if it is set.
+bool CreateDirectory(const std::string &directory,
+                     const DirectoryCase &directory_case) {
+  if (mkdir(directory.c_str(), 0755) == -1) return false;
+  for (size_t i = 0; i < directory_case.file_count; i++) {
+    std::string name = std::to_string(i);
+    if (name.size() < directory_case.name_length)
+      name.append(directory_case.name_length - name.size(), 'x');
+    const std::string path = directory + "/" + name;
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1) return false;
+    close(fd);
+  }
+  return true;
+}
+
+// Runs list and prints the allocations it made, the bytes still held by the
+// listing afterwards, the most held at once and how long it took.
+template <typename List>
+bool PrintListingCosts(const char *description, size_t file_count,
+                       const List &list) {
+  const AllocationCounts before = allocation_counts;
+  allocation_counts.peak_bytes = allocation_counts.live_bytes;
+  const auto start = std::chrono::steady_clock::now();
+  const ssize_t listed_count = list();
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  const AllocationCounts after = allocation_counts;
+  if (listed_count != static_cast<ssize_t>(file_count)) return false;
+
+  std::printf("%-20s %12zu %12.1f %12.1f %10.2f\n", description,
+              after.allocations - before.allocations,
+              (after.live_bytes - before.live_bytes) / (1024.0 * 1024.0),
+              (after.peak_bytes - before.live_bytes) / (1024.0 * 1024.0),
+              elapsed.count() * 1000);
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "Usage: %s DIRECTORY\n", argv[0]);
+    return 1;
+  }
+
+  int status = 0;
+  for (const DirectoryCase &directory_case : kDirectoryCases) {
+    const std::string directory =
+        std::string(argv[1]) + "/directory_listing_benchmark";
+    if (!CreateDirectory(directory, directory_case)) {
+      std::perror(directory.c_str());
+      status = 1;
+    } else {
+      std::printf("%s\n%-20s %12s %12s %12s %10s\n",
+                  directory_case.description, "", "allocations", "held MiB",
+                  "peak MiB", "ms");
+      // Kept alive until both are measured, so held bytes are what the
+      // listings themselves cost.
+      std::vector<LegacyFile> legacy_files;
+      absl::StatusOr<DirectoryListing> listing;
+      POSIXFileSystem file_system;
+      const auto list_legacy_files = [&directory, &legacy_files]() {
+        return ListLegacyFiles(directory, legacy_files);
+      };
+      const auto list_directory = [&file_system, &directory, &listing]() {
+        listing = file_system.GetDirectoryFiles(directory);
+        return listing.ok() ? static_cast<ssize_t>(listing->size()) : -1;
+      };
+      const bool listed =
+          PrintListingCosts("vector of files", directory_case.file_count,
+                            list_legacy_files) &&
+          PrintListingCosts("DirectoryListing", directory_case.file_count,
+                            list_directory);
+      if (!listed) {
+        std::fprintf(stderr, "Listing %s missed files.\n", directory.c_str());
+        status = 1;
+      }
+      std::printf("\n");
+    }
+
+    std::error_code error;
+    std::filesystem::remove_all(directory, error);
+    if (status != 0) break;
+  }
+  return status;
+}
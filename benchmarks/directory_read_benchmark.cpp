@@ -0,0 +1,144 @@
+// Times listing directories of 1k up to 5M entries with POSIXFileSystem, which
+// reads them with getdents64() into 256 KiB buffers, against the readdir()
+// loop it replaced, which built and pushed back one file at a time.
+//
+// Generates the entries in a directory created below DIRECTORY, adding files
+// as the counts grow, and removes it again at the end. Creating 5M files takes
+// minutes and needs as many free inodes, so MAX_FILE_COUNT can stop earlier.
+// Both paths list a warm page cache, so this mostly measures syscalls and
+// allocations rather than the disk.
+//
+// Usage:
+// ./directory_read_benchmark DIRECTORY [MAX_FILE_COUNT]
+
+#include <absl/status/statusor.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "filesystem.hpp"
+
+namespace {
+
+constexpr int kRunCount = 3;
+constexpr size_t kFileCounts[] = {1000, 10000, 100000, 1000000, 5000000};
+
+// What the readdir() loop built for every entry.
+struct ReaddirFile {
+  std::string name;
+  bool is_dir;
+  FileMetadata metadata;
+};
+
+// The listing POSIXFileSystem::GetDirectoryFiles() did before it used
+// getdents64(). Returns the number of files listed, or -1 on failure.
+ssize_t ListWithReaddir(const std::string &directory) {
+  DIR *dir = opendir(directory.c_str());
+  if (dir == nullptr) return -1;
+  std::vector<ReaddirFile> files;
+  for (dirent *entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+    const std::string_view name = entry->d_name;
+    if ((entry->d_type != DT_REG && entry->d_type != DT_DIR) || name == "." ||
+        name == "..")
+      continue;
+    files.push_back({std::string(name), entry->d_type == DT_DIR, {}});
+  }
+  closedir(dir);
+  return files.size();
+}
+
+ssize_t ListWithGetdents(const POSIXFileSystem &file_system,
+                         const std::string &directory) {
+  absl::StatusOr<DirectoryListing> files =
+      file_system.GetDirectoryFiles(directory);
+  return files.ok() ? files->size() : -1;
+}
+
+// Adds empty files named 0, 1 and so on to directory until it holds count.
+bool CreateFiles(const std::string &directory, size_t first, size_t count) {
+  for (size_t i = first; i < count; i++) {
+    const std::string path = directory + "/" + std::to_string(i);
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1) return false;
+    close(fd);
+  }
+  return true;
+}
+
+// Lists directory kRunCount times with list and returns the fastest time in
+// seconds, or a negative number if any listing missed files.
+template <typename List>
+double TimeListing(size_t file_count, const List &list) {
+  double best_seconds = -1;
+  for (int run = 0; run < kRunCount; run++) {
+    const auto start = std::chrono::steady_clock::now();
+    const ssize_t listed_count = list();
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (listed_count != static_cast<ssize_t>(file_count)) return -1;
+    if (best_seconds < 0 || elapsed.count() < best_seconds)
+      best_seconds = elapsed.count();
+  }
+  return best_seconds;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "Usage: %s DIRECTORY [MAX_FILE_COUNT]\n", argv[0]);
+    return 1;
+  }
+  const std::string directory =
+      std::string(argv[1]) + "/directory_read_benchmark";
+  const size_t max_file_count =
+      argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 5000000;
+  if (mkdir(directory.c_str(), 0755) == -1) {
+    std::perror(directory.c_str());
+    return 1;
+  }
+
+  std::printf("%9s %12s %12s\n", "entries", "readdir ms", "getdents ms");
+  size_t created_count = 0;
+  int status = 0;
+  for (size_t file_count : kFileCounts) {
+    if (file_count > max_file_count) break;
+    if (!CreateFiles(directory, created_count, file_count)) {
+      std::perror(directory.c_str());
+      status = 1;
+      break;
+    }
+    created_count = file_count;
+
+    const double readdir_seconds = TimeListing(
+        file_count, [&directory]() { return ListWithReaddir(directory); });
+    // A fresh file system for every count, so directory handles it keeps do
+    // not carry over.
+    POSIXFileSystem file_system;
+    const double getdents_seconds =
+        TimeListing(file_count, [&file_system, &directory]() {
+          return ListWithGetdents(file_system, directory);
+        });
+    if (readdir_seconds < 0 || getdents_seconds < 0) {
+      std::fprintf(stderr, "Listing %s missed files.\n", directory.c_str());
+      status = 1;
+      break;
+    }
+    std::printf("%9zu %12.2f %12.2f\n", file_count, readdir_seconds * 1000,
+                getdents_seconds * 1000);
+  }
+
+  std::error_code error;
+  std::filesystem::remove_all(directory, error);
+  return status;
+}
@@ -0,0 +1,113 @@
+// Times FileCopier with each copy method in turn on the file system holding a
+// directory, once for a file full of data and once for a sparse one.
+//
+// Usage:
+// ./file_copier_benchmark DIRECTORY [SIZE_MIB]
+//
+// run_file_copier_benchmarks.sh runs it on tmpfs, ext4, Btrfs and XFS.
+
+#include <absl/status/statusor.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "file_copier.hpp"
+
+namespace {
+
+constexpr int kRunCount = 3;
+constexpr size_t kMiB = 1024 * 1024;
+// The sparse file has one MiB of data at the start of every run of this many.
+constexpr size_t kSparseStrideMiB = 16;
+
+bool WriteFile(const std::string &path, size_t size_mib, bool is_sparse) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) return false;
+  // Random data, so no file system can compress it away.
+  std::mt19937_64 random(1);
+  std::vector<uint64_t> data(kMiB / sizeof(uint64_t));
+  bool ok = ftruncate(fd, size_mib * kMiB) == 0;
+  for (size_t mib = 0; ok && mib < size_mib; mib++) {
+    if (is_sparse && mib % kSparseStrideMiB != 0) continue;
+    for (uint64_t &word : data) word = random();
+    ok = pwrite(fd, data.data(), kMiB, mib * kMiB) ==
+         static_cast<ssize_t>(kMiB);
+  }
+  ok = ok && fsync(fd) == 0;
+  close(fd);
+  return ok;
+}
+
+// Copies source once with options, including writing the copy back to disk,
+// and returns how long that took in seconds, or a negative number on failure.
+double TimeCopy(const std::string &source, const std::string &destination,
+                FileCopier::Options options, CopyMethod &method) {
+  const auto start = std::chrono::steady_clock::now();
+  absl::StatusOr<FileCopier::Result> result =
+      FileCopier(options).Copy(source, destination);
+  if (!result.ok()) {
+    std::fprintf(stderr, "%s\n", result.status().ToString().c_str());
+    return -1;
+  }
+  int fd = open(destination.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd != -1) {
+    fsync(fd);
+    close(fd);
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  unlink(destination.c_str());
+  method = result->method;
+  return elapsed.count();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "Usage: %s DIRECTORY [SIZE_MIB]\n", argv[0]);
+    return 1;
+  }
+  const std::string directory = argv[1];
+  const size_t size_mib = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1024;
+  const std::string destination = directory + "/file_copier_benchmark.copy";
+
+  std::printf("%-7s %-16s %-16s %10s %10s\n", "file", "fastest method",
+              "method used", "best ms", "MiB/s");
+  for (bool is_sparse : {false, true}) {
+    const std::string source = directory + "/file_copier_benchmark." +
+                               (is_sparse ? "sparse" : "dense");
+    if (!WriteFile(source, size_mib, is_sparse)) {
+      std::perror(source.c_str());
+      return 1;
+    }
+
+    for (CopyMethod fastest_method :
+         {CopyMethod::kReflink, CopyMethod::kCopyFileRange,
+          CopyMethod::kSendfile, CopyMethod::kReadWrite}) {
+      FileCopier::Options options;
+      options.fastest_method = fastest_method;
+      CopyMethod method = fastest_method;
+      double best_seconds = -1;
+      for (int run = 0; run < kRunCount; run++) {
+        const double seconds = TimeCopy(source, destination, options, method);
+        if (seconds < 0) break;
+        if (best_seconds < 0 || seconds < best_seconds) best_seconds = seconds;
+      }
+      if (best_seconds < 0) continue;
+      std::printf("%-7s %-16s %-16s %10.1f %10.0f\n",
+                  is_sparse ? "sparse" : "dense",
+                  GetCopyMethodName(fastest_method), GetCopyMethodName(method),
+                  best_seconds * 1000, size_mib / best_seconds);
+    }
+    unlink(source.c_str());
+  }
+  return 0;
+}
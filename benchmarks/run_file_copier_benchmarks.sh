@@ -0,0 +1,60 @@
+#!/bin/bash
+#
+# Runs file_copier_benchmark on a tmpfs mount and on ext4, Btrfs and XFS
+# loopback images, so every copy method can be compared on each of them. Btrfs
+# and XFS are the ones that support reflinks. File systems whose mkfs is not
+# installed are skipped.
+#
+# Needs root to mount. Inside the Docker container, that means running it with
+# --privileged.
+#
+# Usage:
+# sudo ./run_file_copier_benchmarks.sh BENCHMARK_BINARY [SIZE_MIB]
+
+set -e
+
+if [ -z "$1" ]
+then
+    echo "Usage: $0 BENCHMARK_BINARY [SIZE_MIB]"
+    exit 1
+fi
+benchmark=$(readlink -f "$1")
+size_mib=${2:-1024}
+# Room for the source, its copy and file system overhead.
+image_mib=$((size_mib * 3 + 512))
+
+work_dir=$(mktemp -d)
+cleanup() {
+    for mount_point in "$work_dir"/*/
+    do
+        umount "$mount_point" 2> /dev/null || true
+    done
+    rm -rf "$work_dir"
+}
+trap cleanup EXIT
+
+run() {
+    echo "== $1 =="
+    "$benchmark" "$work_dir/$1" "$size_mib"
+    echo
+}
+
+mkdir "$work_dir/tmpfs"
+mount -t tmpfs -o size=${image_mib}m tmpfs "$work_dir/tmpfs"
+run tmpfs
+
+for file_system in ext4 btrfs xfs
+do
+    if ! command -v mkfs.$file_system > /dev/null
+    then
+        echo "== $file_system skipped, mkfs.$file_system not found =="
+        echo
+        continue
+    fi
+    truncate -s ${image_mib}M "$work_dir/$file_system.img"
+    mkfs.$file_system -q "$work_dir/$file_system.img" > /dev/null
+    mkdir "$work_dir/$file_system"
+    mount -o loop "$work_dir/$file_system.img" "$work_dir/$file_system"
+    run $file_system
+    umount "$work_dir/$file_system"
+done
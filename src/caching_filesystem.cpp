@@ -0,0 +1,364 @@
+#include "caching_filesystem.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/strings/str_cat.h>
+#include <errno.h>
+#include <glibmm/ustring.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Changes that can make a listing of a watched directory stale. Attribute and
+// content changes are left out since only names and types are cached.
+constexpr uint32_t kInotifyWatchMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                       IN_MOVED_TO | IN_DELETE_SELF |
+                                       IN_MOVE_SELF | IN_ONLYDIR;
+
+// Big enough to drain many events per read() call.
+constexpr size_t kInotifyReadBufferSize = 64 * 1024;
+
+// Directories are cached by path without a trailing slash, so "/a/b" and
+// "/a/b/" share an entry.
+std::string GetCacheKey(const Glib::ustring &directory) {
+  std::string key = directory;
+  while (key.size() > 1 && key.back() == '/') key.pop_back();
+  return key;
+}
+
+}  // namespace
+
+DirectoryWatcher::~DirectoryWatcher() {}
+
+InotifyDirectoryWatcher::InotifyDirectoryWatcher()
+    : inotify_fd_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) {}
+
+InotifyDirectoryWatcher::~InotifyDirectoryWatcher() {
+  if (inotify_fd_ >= 0) close(inotify_fd_);
+}
+
+absl::Status InotifyDirectoryWatcher::Watch(const Glib::ustring &directory) {
+  if (inotify_fd_ < 0)
+    return absl::UnavailableError("inotify could not be initialized!");
+  if (watches_by_directory_.count(directory)) return absl::OkStatus();
+
+  int watch = inotify_add_watch(inotify_fd_, directory.c_str(),
+                                kInotifyWatchMask);
+  if (watch < 0)
+    return absl::UnavailableError(absl::StrCat(
+        "inotify_add_watch(", directory.c_str(), "): ", strerror(errno)));
+
+  // The kernel hands out the same watch for a directory reached through two
+  // different paths, such as through a symbolic link. Changes are reported
+  // for every one of them.
+  directories_by_watch_[watch].insert(directory);
+  watches_by_directory_[directory] = watch;
+  return absl::OkStatus();
+}
+
+void InotifyDirectoryWatcher::Unwatch(const Glib::ustring &directory) {
+  auto watch = watches_by_directory_.find(directory);
+  if (watch == watches_by_directory_.end()) return;
+
+  // The watch is only removed from the kernel along with the last path to
+  // its directory.
+  auto directories = directories_by_watch_.find(watch->second);
+  directories->second.erase(directory);
+  if (directories->second.empty()) {
+    inotify_rm_watch(inotify_fd_, watch->second);
+    directories_by_watch_.erase(directories);
+  }
+  watches_by_directory_.erase(watch);
+}
+
+std::vector<Glib::ustring> InotifyDirectoryWatcher::PollChangedDirectories() {
+  std::vector<Glib::ustring> changed_directories;
+  if (inotify_fd_ < 0) return changed_directories;
+
+  alignas(inotify_event) char buffer[kInotifyReadBufferSize];
+  bool overflowed = false;
+  ssize_t bytes_read;
+  while ((bytes_read = read(inotify_fd_, buffer, sizeof(buffer))) > 0) {
+    for (ssize_t offset = 0; offset < bytes_read;) {
+      const auto *event =
+          reinterpret_cast<const inotify_event *>(&buffer[offset]);
+      offset += sizeof(inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        overflowed = true;
+        continue;
+      }
+
+      auto directories = directories_by_watch_.find(event->wd);
+      if (directories == directories_by_watch_.end()) continue;
+      for (const std::string &directory : directories->second) {
+        changed_directories.push_back(directory);
+
+        // A removed directory only gets IN_DELETE_SELF once nothing has it
+        // open anymore, such as POSIXFileSystem keeping it to resolve paths
+        // below it, so its removal from a watched parent is reported for it
+        // as well.
+        if ((event->mask & IN_ISDIR) &&
+            (event->mask & (IN_DELETE | IN_MOVED_FROM)) && event->len > 0) {
+          std::string subdirectory = absl::StrCat(
+              directory, directory.back() == '/' ? "" : "/", event->name);
+          if (watches_by_directory_.count(subdirectory))
+            changed_directories.push_back(std::move(subdirectory));
+        }
+      }
+
+      // The kernel drops the watch of a removed directory on its own.
+      if (event->mask & IN_IGNORED) {
+        for (const std::string &directory : directories->second)
+          watches_by_directory_.erase(directory);
+        directories_by_watch_.erase(directories);
+      }
+    }
+  }
+
+  if (overflowed) {
+    for (const auto &[watch, directories] : directories_by_watch_)
+      changed_directories.insert(changed_directories.end(),
+                                 directories.begin(), directories.end());
+  }
+
+  // A busy directory produces many events between polls.
+  std::sort(changed_directories.begin(), changed_directories.end());
+  changed_directories.erase(
+      std::unique(changed_directories.begin(), changed_directories.end()),
+      changed_directories.end());
+  return changed_directories;
+}
+
+absl::Status MockDirectoryWatcher::Watch(const Glib::ustring &directory) {
+  watched_directories_.insert(directory);
+  return absl::OkStatus();
+}
+
+void MockDirectoryWatcher::Unwatch(const Glib::ustring &directory) {
+  watched_directories_.erase(directory);
+}
+
+std::vector<Glib::ustring> MockDirectoryWatcher::PollChangedDirectories() {
+  return std::exchange(changed_directories_, {});
+}
+
+void MockDirectoryWatcher::SignalChange(const Glib::ustring &directory) {
+  if (IsWatching(directory)) changed_directories_.push_back(directory);
+}
+
+bool MockDirectoryWatcher::IsWatching(const Glib::ustring &directory) const {
+  return watched_directories_.count(directory) > 0;
+}
+
+CachingFileSystem::CachingFileSystem(FileSystem &file_system,
+                                     DirectoryWatcher &watcher,
+                                     size_t memory_budget)
+    : file_system_(&file_system),
+      watcher_(&watcher),
+      memory_budget_(memory_budget) {}
+
+absl::StatusOr<DirectoryListing> CachingFileSystem::GetDirectoryFiles(
+    const Glib::ustring &directory) const {
+  const std::string key = GetCacheKey(directory);
+  bool is_pending_read = false;
+  if (std::shared_ptr<const DirectoryListing> files =
+          Lookup(key, is_pending_read, /*count_access=*/true))
+    return *files;
+
+  absl::StatusOr<DirectoryListing> files =
+      file_system_->GetDirectoryFiles(directory);
+  if (is_pending_read) FinishRead(key, files.ok() ? &*files : nullptr);
+  return files;
+}
+
+absl::Status CachingFileSystem::CheckDirectory(
+    const Glib::ustring &directory) const {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    InvalidateChangedDirectories();
+    if (entries_by_directory_.count(GetCacheKey(directory)))
+      return absl::OkStatus();
+  }
+  return file_system_->CheckDirectory(directory);
+}
+
+absl::Status CachingFileSystem::StreamDirectoryFiles(
+    const Glib::ustring &directory, size_t batch_size,
+    const FileBatchCallback &callback) const {
+  if (batch_size == 0)
+    return absl::InvalidArgumentError("Batch size cannot be zero!");
+
+  const std::string key = GetCacheKey(directory);
+  bool is_pending_read = false;
+  if (std::shared_ptr<const DirectoryListing> files =
+          Lookup(key, is_pending_read, /*count_access=*/true)) {
+    DirectoryListing batch;
+    for (File file : *files) {
+      batch.Add(file);
+      if (batch.size() < batch_size) continue;
+
+      if (!callback(batch)) return absl::OkStatus();
+      batch.Clear();
+    }
+
+    if (!batch.empty()) callback(batch);
+    return absl::OkStatus();
+  }
+
+  // Keep a copy of every batch so the whole listing can be cached once the
+  // directory has been read to the end.
+  DirectoryListing files;
+  bool stopped = false;
+  absl::Status status = file_system_->StreamDirectoryFiles(
+      directory, batch_size, [&](const DirectoryListing &batch) {
+        if (is_pending_read) files.Append(batch);
+        stopped = !callback(batch);
+        return !stopped;
+      });
+  if (is_pending_read)
+    FinishRead(key, status.ok() && !stopped ? &files : nullptr);
+  return status;
+}
+
+absl::Status CachingFileSystem::WarmDirectory(
+    const Glib::ustring &directory) const {
+  const std::string key = GetCacheKey(directory);
+  bool is_pending_read = false;
+  if (Lookup(key, is_pending_read, /*count_access=*/false) != nullptr)
+    return absl::OkStatus();
+  if (!is_pending_read)
+    return absl::UnavailableError("Directory cannot be cached!");
+
+  absl::StatusOr<DirectoryListing> files =
+      file_system_->GetDirectoryFiles(directory);
+  FinishRead(key, files.ok() ? &*files : nullptr);
+  return files.status();
+}
+
+absl::Status CachingFileSystem::FillFileMetadata(
+    const Glib::ustring &directory, DirectoryListing &files,
+    FileMetadataMask fields) const {
+  return file_system_->FillFileMetadata(directory, files, fields);
+}
+
+absl::StatusOr<FileMetadata> CachingFileSystem::GetFileMetadata(
+    const Glib::ustring &path, FileMetadataMask fields) const {
+  return file_system_->GetFileMetadata(path, fields);
+}
+
+void CachingFileSystem::InvalidatePath(const Glib::ustring &path) const {
+  file_system_->InvalidatePath(path);
+}
+
+size_t CachingFileSystem::GetCacheMemoryUsage() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return memory_usage_;
+}
+
+size_t CachingFileSystem::GetCachedDirectoryCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+uint64_t CachingFileSystem::GetCacheHitCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hit_count_;
+}
+
+uint64_t CachingFileSystem::GetCacheMissCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return miss_count_;
+}
+
+std::shared_ptr<const DirectoryListing> CachingFileSystem::Lookup(
+    const std::string &directory, bool &is_pending_read,
+    bool count_access) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  InvalidateChangedDirectories();
+
+  auto entry = entries_by_directory_.find(directory);
+  if (entry != entries_by_directory_.end()) {
+    if (count_access) ++hit_count_;
+    entries_.splice(entries_.begin(), entries_, entry->second);
+    return entry->second->files;
+  }
+
+  // Watch before reading, so changes made while the directory is being read
+  // are noticed once the read finishes.
+  if (count_access) ++miss_count_;
+  is_pending_read = watcher_->Watch(directory).ok();
+  if (is_pending_read) ++pending_reads_[directory].readers;
+  return nullptr;
+}
+
+void CachingFileSystem::FinishRead(const std::string &directory,
+                                   const DirectoryListing *files) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  InvalidateChangedDirectories();
+
+  auto pending_read = pending_reads_.find(directory);
+  const bool is_stale = pending_read->second.invalidated;
+  if (--pending_read->second.readers == 0) pending_reads_.erase(pending_read);
+
+  if (files != nullptr && !is_stale) {
+    // Copying trims the listing down to the memory it actually needs.
+    auto cached_files = std::make_shared<const DirectoryListing>(*files);
+    const size_t memory_usage = cached_files->GetMemoryUsage() +
+                                sizeof(CacheEntry) + 2 * directory.size();
+    if (memory_usage <= memory_budget_) {
+      // Another read of the same directory may have finished first.
+      auto existing_entry = entries_by_directory_.find(directory);
+      if (existing_entry != entries_by_directory_.end())
+        RemoveEntry(existing_entry->second);
+
+      while (memory_usage_ + memory_usage > memory_budget_)
+        Evict(std::prev(entries_.end()));
+
+      entries_.push_front({directory, std::move(cached_files), memory_usage});
+      entries_by_directory_[directory] = entries_.begin();
+      memory_usage_ += memory_usage;
+    }
+  }
+
+  ReleaseWatch(directory);
+}
+
+void CachingFileSystem::InvalidateChangedDirectories() const {
+  for (const Glib::ustring &directory : watcher_->PollChangedDirectories()) {
+    auto pending_read = pending_reads_.find(directory);
+    if (pending_read != pending_reads_.end())
+      pending_read->second.invalidated = true;
+
+    auto entry = entries_by_directory_.find(directory);
+    if (entry != entries_by_directory_.end()) Evict(entry->second);
+  }
+}
+
+void CachingFileSystem::Evict(std::list<CacheEntry>::iterator entry) const {
+  const std::string directory = entry->directory;
+  RemoveEntry(entry);
+  ReleaseWatch(directory);
+}
+
+void CachingFileSystem::RemoveEntry(
+    std::list<CacheEntry>::iterator entry) const {
+  memory_usage_ -= entry->memory_usage;
+  entries_by_directory_.erase(entry->directory);
+  entries_.erase(entry);
+}
+
+void CachingFileSystem::ReleaseWatch(const std::string &directory) const {
+  if (!entries_by_directory_.count(directory) &&
+      !pending_reads_.count(directory))
+    watcher_->Unwatch(directory);
+}
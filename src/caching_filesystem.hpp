@@ -0,0 +1,190 @@
+#ifndef CACHING_FILESYSTEM_HPP
+#define CACHING_FILESYSTEM_HPP
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <glibmm/ustring.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "filesystem.hpp"
+
+// Interface for getting told when the entries of a directory change. A change
+// is anything that could make a listing of the directory stale, such as a file
+// being created, deleted or renamed inside it, or the directory itself being
+// removed.
+class DirectoryWatcher {
+ public:
+  virtual ~DirectoryWatcher();
+
+  // Starts reporting changes to directory. Watching a directory that is
+  // already watched does nothing. Returns an error if the directory cannot be
+  // watched, in which case no changes to it will be reported.
+  virtual absl::Status Watch(const Glib::ustring &directory) = 0;
+
+  // Stops reporting changes to directory. Does nothing if it is not watched.
+  virtual void Unwatch(const Glib::ustring &directory) = 0;
+
+  // Returns every watched directory that changed since the last call, without
+  // blocking. A directory that was removed is reported once and is no longer
+  // watched afterwards.
+  virtual std::vector<Glib::ustring> PollChangedDirectories() = 0;
+};
+
+// Watches directories through Linux's inotify API. If the kernel's event queue
+// overflows, every watched directory is reported as changed.
+class InotifyDirectoryWatcher : public DirectoryWatcher {
+ public:
+  InotifyDirectoryWatcher();
+
+  InotifyDirectoryWatcher(const InotifyDirectoryWatcher &) = delete;
+  InotifyDirectoryWatcher &operator=(const InotifyDirectoryWatcher &) = delete;
+  virtual ~InotifyDirectoryWatcher();
+
+  absl::Status Watch(const Glib::ustring &directory) override;
+  void Unwatch(const Glib::ustring &directory) override;
+  std::vector<Glib::ustring> PollChangedDirectories() override;
+
+ private:
+  // -1 if inotify could not be initialized, in which case Watch() fails.
+  int inotify_fd_;
+  // Every path a directory was watched through, by its watch.
+  std::unordered_map<int, std::set<std::string>> directories_by_watch_;
+  std::unordered_map<std::string, int> watches_by_directory_;
+};
+
+// Can be used to test classes depending on a DirectoryWatcher. Changes are
+// only reported when SignalChange() is called for a watched directory.
+class MockDirectoryWatcher : public DirectoryWatcher {
+ public:
+  virtual ~MockDirectoryWatcher() = default;
+
+  absl::Status Watch(const Glib::ustring &directory) override;
+  void Unwatch(const Glib::ustring &directory) override;
+  std::vector<Glib::ustring> PollChangedDirectories() override;
+
+  // Reports directory as changed on the next poll if it is being watched.
+  void SignalChange(const Glib::ustring &directory);
+  bool IsWatching(const Glib::ustring &directory) const;
+
+ private:
+  std::set<std::string> watched_directories_;
+  std::vector<Glib::ustring> changed_directories_;
+};
+
+// FileSystem that remembers the listings read through another FileSystem, so
+// visiting a directory again is a hash lookup instead of a full read. Every
+// cached directory is watched, and its listing is dropped as soon as the
+// watcher reports a change to it. Directories that cannot be watched are never
+// cached. Once the cached listings use more than memory_budget bytes, the least
+// recently used ones are dropped.
+//
+// Metadata is never cached, so FillFileMetadata() and GetFileMetadata() always
+// go to the wrapped file system. Safe to use from multiple threads.
+class CachingFileSystem : public FileSystem {
+ public:
+  // Dependancy injection method that will take ownership of passed in objects.
+  CachingFileSystem(FileSystem &file_system, DirectoryWatcher &watcher,
+                    size_t memory_budget);
+
+  CachingFileSystem(const CachingFileSystem &) = delete;
+  CachingFileSystem &operator=(const CachingFileSystem &) = delete;
+  virtual ~CachingFileSystem() = default;
+
+  absl::StatusOr<DirectoryListing> GetDirectoryFiles(
+      const Glib::ustring &directory) const override;
+  // Succeeds right away for cached directories.
+  absl::Status CheckDirectory(const Glib::ustring &directory) const override;
+  absl::Status StreamDirectoryFiles(
+      const Glib::ustring &directory, size_t batch_size,
+      const FileBatchCallback &callback) const override;
+  absl::Status FillFileMetadata(const Glib::ustring &directory,
+                                DirectoryListing &files,
+                                FileMetadataMask fields) const override;
+  absl::StatusOr<FileMetadata> GetFileMetadata(
+      const Glib::ustring &path, FileMetadataMask fields) const override;
+  // Only passed on, since changed listings are found through the watcher.
+  void InvalidatePath(const Glib::ustring &path) const override;
+
+  // Reads directory into the cache unless it is cached already, without
+  // handing out a copy of its listing. Meant for reading ahead of the user, so
+  // it does not count towards the cache hits and misses. Returns an
+  // absl::UnavailableError without reading anything if directory cannot be
+  // cached.
+  absl::Status WarmDirectory(const Glib::ustring &directory) const;
+
+  // Bytes currently used by the cached listings.
+  size_t GetCacheMemoryUsage() const;
+  size_t GetCachedDirectoryCount() const;
+  // Number of listings served from the cache, or read from the wrapped file
+  // system, since construction.
+  uint64_t GetCacheHitCount() const;
+  uint64_t GetCacheMissCount() const;
+
+ private:
+  struct CacheEntry {
+    std::string directory;
+    // Shared so a listing that is being streamed out survives its eviction.
+    std::shared_ptr<const DirectoryListing> files;
+    size_t memory_usage;
+  };
+
+  // Reads of a directory that started on a cache miss and have not finished
+  // yet.
+  struct PendingRead {
+    int readers = 0;
+    // Set if the directory changed while it was being read, in which case the
+    // listings being read may already be stale.
+    bool invalidated = false;
+  };
+
+  // Returns the cached listing of directory and marks it as the most recently
+  // used, or nullptr if it is not cached. On a miss, starts watching directory
+  // and sets is_pending_read if that worked. Only then may the read that
+  // follows be cached, and FinishRead() must be called once it is done.
+  // Counts a hit or miss if count_access is set.
+  std::shared_ptr<const DirectoryListing> Lookup(const std::string &directory,
+                                                 bool &is_pending_read,
+                                                 bool count_access) const;
+  // Caches files as the listing of directory unless the read failed, which is
+  // signaled by files being nullptr, or the directory changed while it was
+  // being read. Evicts older listings to stay within the memory budget.
+  void FinishRead(const std::string &directory,
+                  const DirectoryListing *files) const;
+
+  // The methods below expect mutex_ to be held.
+
+  // Drops every listing the watcher reports as changed.
+  void InvalidateChangedDirectories() const;
+  // Drops a listing and stops watching its directory if nothing else needs it.
+  void Evict(std::list<CacheEntry>::iterator entry) const;
+  // Only drops a listing, leaving its directory watched.
+  void RemoveEntry(std::list<CacheEntry>::iterator entry) const;
+  // Stops watching directory if it is neither cached nor being read.
+  void ReleaseWatch(const std::string &directory) const;
+
+  std::unique_ptr<FileSystem> file_system_;
+  std::unique_ptr<DirectoryWatcher> watcher_;
+  size_t memory_budget_;
+
+  // Guards everything below, as well as watcher_.
+  mutable std::mutex mutex_;
+  // Most recently used listings first.
+  mutable std::list<CacheEntry> entries_;
+  mutable std::unordered_map<std::string, std::list<CacheEntry>::iterator>
+      entries_by_directory_;
+  mutable std::unordered_map<std::string, PendingRead> pending_reads_;
+  mutable size_t memory_usage_ = 0;
+  mutable uint64_t hit_count_ = 0;
+  mutable uint64_t miss_count_ = 0;
+};
+
+#endif  // CACHING_FILESYSTEM_HPP
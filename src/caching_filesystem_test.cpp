@@ -0,0 +1,508 @@
+#include "caching_filesystem.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <fcntl.h>
+#include <glibmm/ustring.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "temp_directory_test.hpp"
+
+namespace absl {
+template <typename T>
+void PrintTo(const ::absl::StatusOr<T>& data, std::ostream* os) {
+  *os << data.status();
+}
+}  // namespace absl
+
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::Not;
+using ::testing::SizeIs;
+using ::testing::UnorderedElementsAre;
+
+
+inline const ::absl::Status& GetStatus(const ::absl::Status& status) {
+  return status;
+}
+
+template <typename T>
+inline const ::absl::Status& GetStatus(const ::absl::StatusOr<T>& status) {
+  return status.status();
+}
+
+// Monomorphic implementation of matcher IsOkAndHolds(m).  StatusOrType is a
+// reference to StatusOr<T>.
+template <typename StatusOrType>
+class IsOkAndHoldsMatcherImpl
+    : public ::testing::MatcherInterface<StatusOrType> {
+ public:
+  typedef
+      typename std::remove_reference<StatusOrType>::type::value_type value_type;
+
+  template <typename InnerMatcher>
+  explicit IsOkAndHoldsMatcherImpl(InnerMatcher&& inner_matcher)
+      : inner_matcher_(::testing::SafeMatcherCast<const value_type&>(
+            std::forward<InnerMatcher>(inner_matcher))) {}
+
+  void DescribeTo(std::ostream* os) const override {
+    *os << "is OK and has a value that ";
+    inner_matcher_.DescribeTo(os);
+  }
+
+  void DescribeNegationTo(std::ostream* os) const override {
+    *os << "isn't OK or has a value that ";
+    inner_matcher_.DescribeNegationTo(os);
+  }
+
+  bool MatchAndExplain(
+      StatusOrType actual_value,
+      ::testing::MatchResultListener* result_listener) const override {
+    if (!actual_value.ok()) {
+      *result_listener << "which has status " << actual_value.status();
+      return false;
+    }
+
+    ::testing::StringMatchResultListener inner_listener;
+    const bool matches =
+        inner_matcher_.MatchAndExplain(*actual_value, &inner_listener);
+    const std::string inner_explanation = inner_listener.str();
+    if (!inner_explanation.empty()) {
+      *result_listener << "which contains value "
+                       << ::testing::PrintToString(*actual_value) << ", "
+                       << inner_explanation;
+    }
+    return matches;
+  }
+
+ private:
+  const ::testing::Matcher<const value_type&> inner_matcher_;
+};
+
+// Implements IsOkAndHolds(m) as a polymorphic matcher.
+template <typename InnerMatcher>
+class IsOkAndHoldsMatcher {
+ public:
+  explicit IsOkAndHoldsMatcher(InnerMatcher inner_matcher)
+      : inner_matcher_(std::move(inner_matcher)) {}
+
+  // Converts this polymorphic matcher to a monomorphic matcher of the
+  // given type.  StatusOrType can be either StatusOr<T> or a
+  // reference to StatusOr<T>.
+  template <typename StatusOrType>
+  operator ::testing::Matcher<StatusOrType>() const {  // NOLINT
+    return ::testing::Matcher<StatusOrType>(
+        new IsOkAndHoldsMatcherImpl<const StatusOrType&>(inner_matcher_));
+  }
+
+ private:
+  const InnerMatcher inner_matcher_;
+};
+
+// Monomorphic implementation of matcher IsOk() for a given type T.
+// T can be Status, StatusOr<>, or a reference to either of them.
+template <typename T>
+class MonoIsOkMatcherImpl : public ::testing::MatcherInterface<T> {
+ public:
+  void DescribeTo(std::ostream* os) const override { *os << "is OK"; }
+  void DescribeNegationTo(std::ostream* os) const override {
+    *os << "is not OK";
+  }
+  bool MatchAndExplain(T actual_value,
+                       ::testing::MatchResultListener*) const override {
+    return GetStatus(actual_value).ok();
+  }
+};
+
+// Implements IsOk() as a polymorphic matcher.
+class IsOkMatcher {
+ public:
+  template <typename T>
+  operator ::testing::Matcher<T>() const {  // NOLINT
+    return ::testing::Matcher<T>(new MonoIsOkMatcherImpl<T>());
+  }
+};
+
+// Macros for testing the results of functions that return absl::Status or
+// absl::StatusOr<T> (for any type T).
+#define EXPECT_OK(expression) EXPECT_THAT(expression, IsOk())
+#define ASSERT_OK(expression) ASSERT_THAT(expression, IsOk())
+
+// Returns a gMock matcher that matches a StatusOr<> whose status is
+// OK and whose value matches the inner matcher.
+template <typename InnerMatcher>
+IsOkAndHoldsMatcher<typename std::decay<InnerMatcher>::type> IsOkAndHolds(
+    InnerMatcher&& inner_matcher) {
+  return IsOkAndHoldsMatcher<typename std::decay<InnerMatcher>::type>(
+      std::forward<InnerMatcher>(inner_matcher));
+}
+
+// Returns a gMock matcher that matches a Status or StatusOr<> which is OK.
+inline IsOkMatcher IsOk() { return IsOkMatcher(); }
+
+
+// Wraps a MockFileSystem and counts how many times directories were actually
+// read from it. before_read, if set, runs at the start of every read.
+class CountingFileSystem : public FileSystem {
+ public:
+  CountingFileSystem(std::initializer_list<MockFile*> files)
+      : file_system_(files) {}
+
+  absl::StatusOr<DirectoryListing> GetDirectoryFiles(
+      const Glib::ustring& directory) const override {
+    ++read_count_;
+    if (before_read_) before_read_();
+    return file_system_.GetDirectoryFiles(directory);
+  }
+  absl::Status CheckDirectory(const Glib::ustring& directory) const override {
+    return file_system_.CheckDirectory(directory);
+  }
+  absl::Status StreamDirectoryFiles(
+      const Glib::ustring& directory, size_t batch_size,
+      const FileBatchCallback& callback) const override {
+    ++read_count_;
+    if (before_read_) before_read_();
+    return file_system_.StreamDirectoryFiles(directory, batch_size, callback);
+  }
+  absl::Status FillFileMetadata(const Glib::ustring& directory,
+                                DirectoryListing& files,
+                                FileMetadataMask fields) const override {
+    return file_system_.FillFileMetadata(directory, files, fields);
+  }
+  absl::StatusOr<FileMetadata> GetFileMetadata(
+      const Glib::ustring& path, FileMetadataMask fields) const override {
+    return file_system_.GetFileMetadata(path, fields);
+  }
+
+  int GetReadCount() const { return read_count_; }
+  void BeforeRead(std::function<void()> callback) { before_read_ = callback; }
+
+ private:
+  MockFileSystem file_system_;
+  mutable int read_count_ = 0;
+  std::function<void()> before_read_;
+};
+
+// Watcher for a system without inotify, or out of watches.
+class FailingDirectoryWatcher : public DirectoryWatcher {
+ public:
+  absl::Status Watch(const Glib::ustring& /*directory*/) override {
+    return absl::UnavailableError("No watches left!");
+  }
+  void Unwatch(const Glib::ustring& /*directory*/) override {}
+  std::vector<Glib::ustring> PollChangedDirectories() override { return {}; }
+};
+
+class CachingFileSystemTest : public ::testing::Test {
+ protected:
+  CachingFileSystemTest()
+      : file_system_(new CountingFileSystem(
+            {new MockFile("meow.txt"),
+             new MockDirectory("dog", {new MockFile("woof.txt")}),
+             new MockDirectory("cat", {new MockFile("purr.txt")}),
+             new MockDirectory("empty", {})})),
+        watcher_(new MockDirectoryWatcher()),
+        caching_fs_(*file_system_, *watcher_, /*memory_budget=*/1 << 20) {}
+
+  // Owned by caching_fs_.
+  CountingFileSystem* file_system_;
+  MockDirectoryWatcher* watcher_;
+  CachingFileSystem caching_fs_;
+};
+
+TEST_F(CachingFileSystemTest, ReadsDirectoryOnlyOnce) {
+  EXPECT_THAT(caching_fs_.GetDirectoryFiles("/dog/"),
+              IsOkAndHolds(ElementsAre("woof.txt")));
+  EXPECT_THAT(caching_fs_.GetDirectoryFiles("/dog/"),
+              IsOkAndHolds(ElementsAre("woof.txt")));
+
+  EXPECT_EQ(file_system_->GetReadCount(), 1);
+  EXPECT_EQ(caching_fs_.GetCacheHitCount(), 1);
+  EXPECT_EQ(caching_fs_.GetCacheMissCount(), 1);
+  EXPECT_TRUE(watcher_->IsWatching("/dog"));
+}
+
+TEST_F(CachingFileSystemTest, TrailingSlashSharesCachedListing) {
+  ASSERT_OK(caching_fs_.GetDirectoryFiles("/dog/"));
+  EXPECT_THAT(caching_fs_.GetDirectoryFiles("/dog"),
+              IsOkAndHolds(ElementsAre("woof.txt")));
+
+  EXPECT_EQ(file_system_->GetReadCount(), 1);
+}
+
+TEST_F(CachingFileSystemTest, CachesEmptyDirectories) {
+  EXPECT_THAT(caching_fs_.GetDirectoryFiles("/empty/"),
+              IsOkAndHolds(IsEmpty()));
+  EXPECT_THAT(caching_fs_.GetDirectoryFiles("/empty/"),
+              IsOkAndHolds(IsEmpty()));
+
+  EXPECT_EQ(file_system_->GetReadCount(), 1);
+}
+
+TEST_F(CachingFileSystemTest, ReadsDirectoryAgainAfterItChanges) {
+  ASSERT_OK(caching_fs_.GetDirectoryFiles("/dog/"));
+  ASSERT_OK(caching_fs_.GetDirectoryFiles("/cat/"));
+
+  watcher_->SignalChange("/dog");
+  ASSERT_OK(caching_fs_.GetDirectoryFiles("/dog/"));
+  ASSERT_OK(caching_fs_.GetDirectoryFiles("/cat/"));
+
+  // Only the changed directory is read again.
+  EXPECT_EQ(file_system_->GetReadCount(), 3);
+}
+
+TEST_F(CachingFileSystemTest, DoesNotCacheDirectoryChangedWhileBeingRead) {
+  file_system_->BeforeRead([this]() { watcher_->SignalChange("/dog"); });
+  ASSERT_OK(caching_fs_.GetDirectoryFiles("/dog/"));
+
+  file_system_->BeforeRead(nullptr);
+  ASSERT_OK(caching_fs_.GetDirectoryFiles("/dog/"));
+  ASSERT_OK(caching_fs_.GetDirectoryFiles("/dog/"));
+
+  EXPECT_EQ(file_system_->GetReadCount(), 2);
+}
+
+TEST_F(CachingFileSystemTest, DoesNotCacheErrors) {
+  EXPECT_THAT(caching_fs_.GetDirectoryFiles("/bird/"), Not(IsOk()));
+  EXPECT_THAT(caching_fs_.GetDirectoryFiles("/bird/"), Not(IsOk()));
+
+  EXPECT_EQ(file_system_->GetReadCount(), 2);
+  EXPECT_EQ(caching_fs_.GetCachedDirectoryCount(), 0);
+  EXPECT_FALSE(watcher_->IsWatching("/bird"));
+}
+
+TEST_F(CachingFileSystemTest, ChecksDirectories) {
+  ASSERT_OK(caching_fs_.GetDirectoryFiles("/dog/"));
+
+  EXPECT_OK(caching_fs_.CheckDirectory("/dog/"));
+  EXPECT_OK(caching_fs_.CheckDirectory("/cat/"));
+  EXPECT_THAT(caching_fs_.CheckDirectory("/dog/bark/"), Not(IsOk()));
+  EXPECT_THAT(caching_fs_.CheckDirectory("/bird/"), Not(IsOk()));
+  EXPECT_EQ(file_system_->GetReadCount(), 1);
+}
+
+TEST_F(CachingFileSystemTest, WarmsDirectoryWithoutCountingAccess) {
+  EXPECT_OK(caching_fs_.WarmDirectory("/dog/"));
+  EXPECT_OK(caching_fs_.WarmDirectory("/dog"));
+  EXPECT_EQ(file_system_->GetReadCount(), 1);
+  EXPECT_EQ(caching_fs_.GetCacheHitCount(), 0);
+  EXPECT_EQ(caching_fs_.GetCacheMissCount(), 0);
+
+  EXPECT_THAT(caching_fs_.GetDirectoryFiles("/dog/"),
+              IsOkAndHolds(ElementsAre("woof.txt")));
+  EXPECT_EQ(file_system_->GetReadCount(), 1);
+  EXPECT_EQ(caching_fs_.GetCacheHitCount(), 1);
+
+  EXPECT_THAT(caching_fs_.WarmDirectory("/bird/"), Not(IsOk()));
+  EXPECT_FALSE(watcher_->IsWatching("/bird"));
+}
+
+TEST_F(CachingFileSystemTest, StreamsCachedListingInBatches) {
+  ASSERT_OK(caching_fs_.GetDirectoryFiles("/"));
+
+  std::vector<size_t> batch_sizes;
+  std::vector<std::string> file_names;
+  EXPECT_OK(caching_fs_.StreamDirectoryFiles(
+      "/", 2, [&](const DirectoryListing& files) {
+        batch_sizes.push_back(files.size());
+        for (File file : files) file_names.emplace_back(file.GetName());
+        return true;
+      }));
+
+  EXPECT_THAT(batch_sizes, ElementsAre(2, 2));
+  EXPECT_THAT(file_names,
+              UnorderedElementsAre("meow.txt", "dog", "cat", "empty"));
+  EXPECT_EQ(file_system_->GetReadCount(), 1);
+}
+
+TEST_F(CachingFileSystemTest, CachesStreamedListing) {
+  ASSERT_OK(caching_fs_.StreamDirectoryFiles(
+      "/", 1, [](const DirectoryListing& /*files*/) { return true; }));
+
+  EXPECT_THAT(caching_fs_.GetDirectoryFiles("/"), IsOkAndHolds(SizeIs(4)));
+  EXPECT_EQ(file_system_->GetReadCount(), 1);
+}
+
+TEST_F(CachingFileSystemTest, DoesNotCacheStreamStoppedEarly) {
+  ASSERT_OK(caching_fs_.StreamDirectoryFiles(
+      "/", 1, [](const DirectoryListing& /*files*/) { return false; }));
+
+  EXPECT_THAT(caching_fs_.GetDirectoryFiles("/"), IsOkAndHolds(SizeIs(4)));
+  EXPECT_EQ(file_system_->GetReadCount(), 2);
+}
+
+TEST(CachingFileSystemBudgetTest, EvictsLeastRecentlyUsedListing) {
+  auto* file_system = new CountingFileSystem(
+      {new MockDirectory("dog", {new MockFile("woof.txt")}),
+       new MockDirectory("cat", {new MockFile("purr.txt")}),
+       new MockDirectory("cow", {new MockFile("moo.txt")})});
+  auto* watcher = new MockDirectoryWatcher();
+  // Measure a single listing to size the budget for exactly two of them.
+  size_t listing_memory_usage;
+  {
+    CachingFileSystem measuring_fs(*new MockFileSystem({new MockDirectory(
+                                       "dog", {new MockFile("woof.txt")})}),
+                                   *new MockDirectoryWatcher(), 1 << 20);
+    ASSERT_OK(measuring_fs.GetDirectoryFiles("/dog/"));
+    listing_memory_usage = measuring_fs.GetCacheMemoryUsage();
+  }
+  CachingFileSystem caching_fs(*file_system, *watcher,
+                               2 * listing_memory_usage);
+
+  ASSERT_OK(caching_fs.GetDirectoryFiles("/dog/"));
+  ASSERT_OK(caching_fs.GetDirectoryFiles("/cat/"));
+  // Makes the cat listing the least recently used one.
+  ASSERT_OK(caching_fs.GetDirectoryFiles("/dog/"));
+  ASSERT_OK(caching_fs.GetDirectoryFiles("/cow/"));
+
+  EXPECT_EQ(caching_fs.GetCachedDirectoryCount(), 2);
+  EXPECT_LE(caching_fs.GetCacheMemoryUsage(), 2 * listing_memory_usage);
+  EXPECT_FALSE(watcher->IsWatching("/cat"));
+  EXPECT_TRUE(watcher->IsWatching("/dog"));
+
+  ASSERT_OK(caching_fs.GetDirectoryFiles("/dog/"));
+  ASSERT_OK(caching_fs.GetDirectoryFiles("/cow/"));
+  EXPECT_EQ(file_system->GetReadCount(), 3);
+  ASSERT_OK(caching_fs.GetDirectoryFiles("/cat/"));
+  EXPECT_EQ(file_system->GetReadCount(), 4);
+}
+
+TEST(CachingFileSystemBudgetTest, DoesNotCacheListingLargerThanBudget) {
+  auto* file_system = new CountingFileSystem({new MockFile("meow.txt")});
+  auto* watcher = new MockDirectoryWatcher();
+  CachingFileSystem caching_fs(*file_system, *watcher, /*memory_budget=*/1);
+
+  ASSERT_OK(caching_fs.GetDirectoryFiles("/"));
+  ASSERT_OK(caching_fs.GetDirectoryFiles("/"));
+
+  EXPECT_EQ(file_system->GetReadCount(), 2);
+  EXPECT_EQ(caching_fs.GetCacheMemoryUsage(), 0);
+  EXPECT_FALSE(watcher->IsWatching("/"));
+}
+
+TEST(CachingFileSystemWatcherTest, DoesNotCacheUnwatchableDirectories) {
+  auto* file_system = new CountingFileSystem({new MockFile("meow.txt")});
+  CachingFileSystem caching_fs(*file_system, *new FailingDirectoryWatcher(),
+                               1 << 20);
+
+  EXPECT_THAT(caching_fs.GetDirectoryFiles("/"),
+              IsOkAndHolds(ElementsAre("meow.txt")));
+  EXPECT_THAT(caching_fs.GetDirectoryFiles("/"),
+              IsOkAndHolds(ElementsAre("meow.txt")));
+
+  EXPECT_EQ(file_system->GetReadCount(), 2);
+}
+
+TEST(CachingFileSystemWatcherTest, DoesNotWarmUnwatchableDirectories) {
+  auto* file_system = new CountingFileSystem({new MockFile("meow.txt")});
+  CachingFileSystem caching_fs(*file_system, *new FailingDirectoryWatcher(),
+                               1 << 20);
+
+  EXPECT_THAT(caching_fs.WarmDirectory("/"), Not(IsOk()));
+  EXPECT_EQ(file_system->GetReadCount(), 0);
+}
+
+class InotifyCachingFileSystemTest : public TempDirectoryTest {
+ protected:
+  InotifyCachingFileSystemTest()
+      : caching_fs_(*new POSIXFileSystem(), *new InotifyDirectoryWatcher(),
+                    1 << 20) {}
+
+  CachingFileSystem caching_fs_;
+};
+
+TEST_F(InotifyCachingFileSystemTest, ServesUnchangedDirectoryFromCache) {
+  CreateFile("meow.txt");
+
+  ASSERT_OK(caching_fs_.GetDirectoryFiles(root_));
+  EXPECT_THAT(caching_fs_.GetDirectoryFiles(root_),
+              IsOkAndHolds(ElementsAre("meow.txt")));
+  EXPECT_EQ(caching_fs_.GetCacheHitCount(), 1);
+}
+
+TEST_F(InotifyCachingFileSystemTest, NoticesCreatedFile) {
+  CreateFile("meow.txt");
+  ASSERT_OK(caching_fs_.GetDirectoryFiles(root_));
+
+  CreateFile("woof.txt");
+  EXPECT_THAT(caching_fs_.GetDirectoryFiles(root_),
+              IsOkAndHolds(UnorderedElementsAre("meow.txt", "woof.txt")));
+}
+
+TEST_F(InotifyCachingFileSystemTest, NoticesRemovedFile) {
+  CreateFile("meow.txt");
+  ASSERT_OK(caching_fs_.GetDirectoryFiles(root_));
+
+  std::remove((root_ + "/meow.txt").c_str());
+  EXPECT_THAT(caching_fs_.GetDirectoryFiles(root_), IsOkAndHolds(IsEmpty()));
+}
+
+TEST_F(InotifyCachingFileSystemTest, NoticesRemovedDirectory) {
+  const std::string directory = root_ + "/dir";
+  mkdir(directory.c_str(), 0755);
+  ASSERT_OK(caching_fs_.GetDirectoryFiles(directory));
+
+  rmdir(directory.c_str());
+  EXPECT_THAT(caching_fs_.GetDirectoryFiles(directory), Not(IsOk()));
+}
+
+TEST_F(InotifyCachingFileSystemTest, NoticesRemovedDirectoryKeptOpen) {
+  const std::string directory = root_ + "/dir";
+  mkdir(directory.c_str(), 0755);
+  ASSERT_OK(caching_fs_.GetDirectoryFiles(root_));
+  ASSERT_OK(caching_fs_.GetDirectoryFiles(directory));
+  int dir_fd = open(directory.c_str(), O_PATH | O_DIRECTORY);
+  ASSERT_NE(dir_fd, -1);
+
+  rmdir(directory.c_str());
+  EXPECT_THAT(caching_fs_.GetDirectoryFiles(directory), Not(IsOk()));
+  close(dir_fd);
+}
+
+TEST_F(InotifyCachingFileSystemTest, NoticesChangesThroughEveryPathToSameDir) {
+  CreateDirectory("dir");
+  ASSERT_EQ(symlink("dir", GetPath("link").c_str()), 0);
+  ASSERT_OK(caching_fs_.GetDirectoryFiles(GetPath("dir")));
+  ASSERT_OK(caching_fs_.GetDirectoryFiles(GetPath("link")));
+
+  CreateFile("dir/meow.txt");
+  EXPECT_THAT(caching_fs_.GetDirectoryFiles(GetPath("dir")),
+              IsOkAndHolds(ElementsAre("meow.txt")));
+  EXPECT_THAT(caching_fs_.GetDirectoryFiles(GetPath("link")),
+              IsOkAndHolds(ElementsAre("meow.txt")));
+}
+
+class InotifyDirectoryWatcherTest : public TempDirectoryTest {};
+
+TEST_F(InotifyDirectoryWatcherTest, KeepsWatchUntilLastPathIsUnwatched) {
+  CreateDirectory("dir");
+  ASSERT_EQ(symlink("dir", GetPath("link").c_str()), 0);
+  InotifyDirectoryWatcher watcher;
+  ASSERT_OK(watcher.Watch(GetPath("dir")));
+  ASSERT_OK(watcher.Watch(GetPath("link")));
+
+  watcher.Unwatch(GetPath("link"));
+  CreateFile("dir/meow.txt");
+  EXPECT_THAT(watcher.PollChangedDirectories(), ElementsAre(GetPath("dir")));
+
+  watcher.Unwatch(GetPath("dir"));
+  CreateFile("dir/woof.txt");
+  EXPECT_THAT(watcher.PollChangedDirectories(), IsEmpty());
+}
+
+}  // namespace
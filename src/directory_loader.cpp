@@ -0,0 +1,135 @@
+#include "directory_loader.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <glibmm/ustring.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+
+DirectoryLoader::DirectoryLoader(const FileSystem &file_system,
+                                 size_t batch_size,
+                                 std::function<void()> notify)
+    : file_system_(file_system),
+      batch_size_(batch_size),
+      notify_(std::move(notify)) {}
+
+DirectoryLoader::~DirectoryLoader() {
+  Cancel();
+  for (Worker &worker : workers_) worker.thread.join();
+}
+
+void DirectoryLoader::Load(const Glib::ustring &directory,
+                           BatchCallback on_batch, DoneCallback on_done,
+                           PrepareCallback prepare, StartCallback start) {
+  Cancel();
+  JoinFinishedWorkers();
+
+  current_load_ = std::make_shared<LoadState>();
+  const bool deliver_batches = on_batch != nullptr;
+  on_batch_ = std::move(on_batch);
+  on_done_ = std::move(on_done);
+  workers_.push_back(
+      {std::thread(&DirectoryLoader::ReadDirectory, this, directory,
+                   deliver_batches, std::move(prepare), std::move(start),
+                   current_load_),
+       current_load_});
+}
+
+void DirectoryLoader::Cancel() {
+  if (current_load_ == nullptr) return;
+
+  current_load_->is_cancelled = true;
+  current_load_ = nullptr;
+  on_batch_ = nullptr;
+  on_done_ = nullptr;
+}
+
+void DirectoryLoader::DeliverResults() {
+  // Results of cancelled loads are dropped along with their state.
+  std::shared_ptr<LoadState> load = current_load_;
+  if (load == nullptr) return;
+
+  std::optional<DirectoryListing> batch;
+  std::optional<absl::StatusOr<DirectoryListing>> files;
+  {
+    std::lock_guard<std::mutex> lock(load->mutex);
+    if (!load->batches.empty()) {
+      batch = std::move(load->batches.front());
+      load->batches.pop_front();
+    } else {
+      files = std::move(load->files);
+      load->files.reset();
+    }
+  }
+
+  if (batch.has_value()) {
+    // Copied since on_batch may start another load, replacing on_batch_.
+    BatchCallback on_batch = on_batch_;
+    on_batch(*batch);
+    return;
+  }
+  if (!files.has_value()) return;
+
+  // The load is over, so later calls have nothing left to deliver.
+  DoneCallback on_done = std::move(on_done_);
+  current_load_ = nullptr;
+  on_batch_ = nullptr;
+  on_done_ = nullptr;
+  on_done(std::move(*files));
+}
+
+void DirectoryLoader::ReadDirectory(
+    const Glib::ustring &directory, bool deliver_batches,
+    const PrepareCallback &prepare, const StartCallback &start,
+    const std::shared_ptr<LoadState> &load) const {
+  DirectoryListing all_files;
+  absl::Status status = absl::OkStatus();
+  if (start && !load->is_cancelled && !start())
+    status = absl::AbortedError("Load stopped before reading the directory.");
+  if (status.ok()) {
+    status = file_system_.StreamDirectoryFiles(
+        directory, batch_size_, [&](const DirectoryListing &files) {
+          if (load->is_cancelled) return false;
+
+          all_files.Append(files);
+          if (deliver_batches) {
+            {
+              std::lock_guard<std::mutex> lock(load->mutex);
+              load->batches.push_back(files);
+            }
+            notify_();
+          }
+          return !load->is_cancelled;
+        });
+  }
+  if (status.ok()) {
+    all_files.SortByName();
+    if (prepare && !load->is_cancelled) prepare(all_files);
+  }
+
+  if (!load->is_cancelled) {
+    {
+      std::lock_guard<std::mutex> lock(load->mutex);
+      if (status.ok())
+        load->files = std::move(all_files);
+      else
+        load->files = status;
+    }
+    notify_();
+  }
+  load->is_finished = true;
+}
+
+void DirectoryLoader::JoinFinishedWorkers() {
+  auto first_finished = std::partition(
+      workers_.begin(), workers_.end(),
+      [](const Worker &worker) { return !worker.load->is_finished; });
+  for (auto worker = first_finished; worker != workers_.end(); ++worker)
+    worker->thread.join();
+  workers_.erase(first_finished, workers_.end());
+}
@@ -0,0 +1,110 @@
+#ifndef DIRECTORY_LOADER_HPP
+#define DIRECTORY_LOADER_HPP
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <glibmm/ustring.h>
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "filesystem.hpp"
+
+// Lists directories on worker threads, so a slow or huge directory never
+// stalls the thread that asked for it, usually the GTK main loop.
+//
+// Batches of files read by a worker are queued, and notify is called from the
+// worker for every one of them. notify must arrange for DeliverResults() to be
+// called on the thread that started the load, for example by emitting a
+// Glib::Dispatcher. Each DeliverResults() call hands over at most one batch,
+// which bounds the work done per main loop iteration.
+//
+// Starting a load cancels the previous one. A cancelled load stops reading at
+// its next batch, and nothing it read is delivered. Its worker is only joined
+// once it finishes on its own, or when the loader is destroyed.
+class DirectoryLoader {
+ public:
+  using BatchCallback = std::function<void(const DirectoryListing &files)>;
+  // Called once every batch was delivered, with the whole directory sorted by
+  // name, or with the error that stopped it from being read. Sorting is done
+  // by the worker. Not called for cancelled loads.
+  using DoneCallback =
+      std::function<void(absl::StatusOr<DirectoryListing> files)>;
+  // Called on the worker with the whole directory sorted by name, before it
+  // is handed to on_done, so work on every file, such as filling in metadata,
+  // does not hold up the thread that started the load either.
+  using PrepareCallback = std::function<void(DirectoryListing &files)>;
+  // Called on the worker before the directory is read, so anything it records
+  // predates every file read, such as the directory's modification time.
+  // Returning false ends the load right there, and on_done is called with an
+  // Aborted error instead of any files.
+  using StartCallback = std::function<bool()>;
+
+  // file_system must outlive the loader, and be safe to use from multiple
+  // threads.
+  DirectoryLoader(const FileSystem &file_system, size_t batch_size,
+                  std::function<void()> notify);
+
+  DirectoryLoader(const DirectoryLoader &) = delete;
+  DirectoryLoader &operator=(const DirectoryLoader &) = delete;
+
+  // Cancels the current load and waits for every worker to finish.
+  ~DirectoryLoader();
+
+  // Starts reading directory in the background, cancelling any load still in
+  // flight. on_batch may be empty if only the whole directory is of interest,
+  // and prepare and start if there is nothing to do on the worker.
+  void Load(const Glib::ustring &directory, BatchCallback on_batch,
+            DoneCallback on_done, PrepareCallback prepare = nullptr,
+            StartCallback start = nullptr);
+  void Cancel();
+
+  // Hands the oldest batch waiting to on_batch, or reports the end of the load
+  // to on_done once every batch was handed over. Does nothing if no results
+  // are waiting.
+  void DeliverResults();
+
+ private:
+  // State shared between one load's worker and the loader.
+  struct LoadState {
+    std::atomic<bool> is_cancelled = false;
+    std::atomic<bool> is_finished = false;
+
+    // Guards everything below.
+    std::mutex mutex;
+    std::deque<DirectoryListing> batches;
+    // Set once the worker is done reading.
+    std::optional<absl::StatusOr<DirectoryListing>> files;
+  };
+
+  struct Worker {
+    std::thread thread;
+    std::shared_ptr<LoadState> load;
+  };
+
+  // Runs on the worker thread.
+  void ReadDirectory(const Glib::ustring &directory, bool deliver_batches,
+                     const PrepareCallback &prepare,
+                     const StartCallback &start,
+                     const std::shared_ptr<LoadState> &load) const;
+  // Joins workers that have already finished, without blocking.
+  void JoinFinishedWorkers();
+
+  const FileSystem &file_system_;
+  size_t batch_size_;
+  std::function<void()> notify_;
+
+  std::shared_ptr<LoadState> current_load_;
+  BatchCallback on_batch_;
+  DoneCallback on_done_;
+  std::vector<Worker> workers_;
+};
+
+#endif  // DIRECTORY_LOADER_HPP
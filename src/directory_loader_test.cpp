@@ -0,0 +1,270 @@
+#include "directory_loader.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <glibmm/ustring.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::UnorderedElementsAre;
+
+// Lets the test thread step through a load like a main loop would, by waiting
+// for the loader to signal results and then delivering them.
+class DirectoryLoaderTest : public ::testing::Test {
+ protected:
+  DirectoryLoaderTest()
+      : file_system_({new MockFile("meow.txt"), new MockFile("woof.txt"),
+                      new MockFile("moo.txt"),
+                      new MockDirectory("dir", {new MockFile("purr.txt")}),
+                      new MockDirectory("empty", {})}),
+        loader_(file_system_, /*batch_size=*/2, [this]() {
+          std::lock_guard<std::mutex> lock(mutex_);
+          pending_notifications_++;
+          notified_.notify_one();
+        }) {}
+
+  // Runs the load started last to completion, and returns its status.
+  absl::Status DeliverUntilDone() {
+    std::optional<absl::Status> status;
+    on_done_ = [&status](absl::StatusOr<DirectoryListing> files) {
+      status = files.status();
+    };
+    while (!status.has_value()) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (!notified_.wait_for(lock, std::chrono::seconds(10),
+                              [this]() { return pending_notifications_ > 0; }))
+        return absl::DeadlineExceededError("Load never finished!");
+      pending_notifications_--;
+      lock.unlock();
+      loader_.DeliverResults();
+    }
+    return *status;
+  }
+
+  void Load(const Glib::ustring& directory) {
+    loader_.Load(
+        directory,
+        [this](const DirectoryListing& files) {
+          batch_sizes_.push_back(files.size());
+          for (File file : files) file_names_.emplace_back(file.GetName());
+        },
+        [this](absl::StatusOr<DirectoryListing> files) {
+          done_count_++;
+          if (files.ok()) all_files_ = std::move(*files);
+          if (on_done_) on_done_(files);
+        });
+  }
+
+  MockFileSystem file_system_;
+  std::mutex mutex_;
+  std::condition_variable notified_;
+  int pending_notifications_ = 0;
+  std::function<void(absl::StatusOr<DirectoryListing>)> on_done_;
+
+  std::vector<size_t> batch_sizes_;
+  std::vector<std::string> file_names_;
+  DirectoryListing all_files_;
+  int done_count_ = 0;
+  DirectoryLoader loader_;
+};
+
+TEST_F(DirectoryLoaderTest, DeliversWholeDirectoryInBatches) {
+  Load("/");
+
+  EXPECT_TRUE(DeliverUntilDone().ok());
+  EXPECT_THAT(batch_sizes_, ElementsAre(2, 2, 1));
+  EXPECT_THAT(file_names_, UnorderedElementsAre("meow.txt", "woof.txt",
+                                                "moo.txt", "dir", "empty"));
+  EXPECT_EQ(done_count_, 1);
+}
+
+TEST_F(DirectoryLoaderTest, HandsWholeDirectorySortedToDoneCallback) {
+  Load("/");
+
+  EXPECT_TRUE(DeliverUntilDone().ok());
+  EXPECT_THAT(all_files_,
+              ElementsAre("dir", "empty", "meow.txt", "moo.txt", "woof.txt"));
+}
+
+TEST_F(DirectoryLoaderTest, OnlyDeliversWholeDirectoryWithoutBatchCallback) {
+  std::optional<absl::StatusOr<DirectoryListing>> files;
+  loader_.Load("/dir/", nullptr,
+               [&files](absl::StatusOr<DirectoryListing> loaded_files) {
+                 files = std::move(loaded_files);
+               });
+
+  while (!files.has_value()) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ASSERT_TRUE(notified_.wait_for(lock, std::chrono::seconds(10), [this]() {
+      return pending_notifications_ > 0;
+    }));
+    pending_notifications_--;
+    lock.unlock();
+    loader_.DeliverResults();
+  }
+
+  ASSERT_TRUE(files->ok());
+  EXPECT_THAT(**files, ElementsAre("purr.txt"));
+}
+
+TEST_F(DirectoryLoaderTest, PreparesWholeDirectoryOnWorkerBeforeDone) {
+  std::thread::id prepare_thread;
+  loader_.Load(
+      "/", nullptr,
+      [this](absl::StatusOr<DirectoryListing> files) {
+        if (files.ok()) all_files_ = std::move(*files);
+        on_done_(files);
+      },
+      [&prepare_thread](DirectoryListing& files) {
+        prepare_thread = std::this_thread::get_id();
+        FileMetadata metadata;
+        metadata.filled_fields = kFileMetadataSize;
+        metadata.size = 42;
+        files.SetMetadata(0, metadata);
+      });
+
+  EXPECT_TRUE(DeliverUntilDone().ok());
+  EXPECT_NE(prepare_thread, std::this_thread::get_id());
+  ASSERT_THAT(all_files_, ElementsAre("dir", "empty", "meow.txt", "moo.txt",
+                                      "woof.txt"));
+  EXPECT_EQ(all_files_[0].GetMetadata().size, 42);
+}
+
+TEST_F(DirectoryLoaderTest, StartsOnWorkerBeforeReading) {
+  std::thread::id start_thread;
+  bool was_read_before_start = false;
+  loader_.Load(
+      "/", [&](const DirectoryListing& /*files*/) {
+        was_read_before_start = start_thread == std::thread::id();
+      },
+      [this](absl::StatusOr<DirectoryListing> files) { on_done_(files); },
+      nullptr,
+      [&start_thread]() {
+        start_thread = std::this_thread::get_id();
+        return true;
+      });
+
+  EXPECT_TRUE(DeliverUntilDone().ok());
+  EXPECT_NE(start_thread, std::thread::id());
+  EXPECT_NE(start_thread, std::this_thread::get_id());
+  EXPECT_FALSE(was_read_before_start);
+}
+
+TEST_F(DirectoryLoaderTest, StartCanStopLoadBeforeReading) {
+  loader_.Load(
+      "/",
+      [this](const DirectoryListing& files) {
+        for (File file : files) file_names_.emplace_back(file.GetName());
+      },
+      [this](absl::StatusOr<DirectoryListing> files) { on_done_(files); },
+      nullptr, []() { return false; });
+
+  EXPECT_TRUE(absl::IsAborted(DeliverUntilDone()));
+  EXPECT_THAT(file_names_, IsEmpty());
+}
+
+TEST_F(DirectoryLoaderTest, DeliversNothingButDoneForEmptyDirectory) {
+  Load("/empty/");
+
+  EXPECT_TRUE(DeliverUntilDone().ok());
+  EXPECT_THAT(file_names_, IsEmpty());
+}
+
+TEST_F(DirectoryLoaderTest, ReportsErrors) {
+  Load("/nope/");
+
+  EXPECT_FALSE(DeliverUntilDone().ok());
+  EXPECT_THAT(file_names_, IsEmpty());
+}
+
+TEST_F(DirectoryLoaderTest, NewLoadCancelsPreviousOne) {
+  Load("/");
+  Load("/dir/");
+
+  EXPECT_TRUE(DeliverUntilDone().ok());
+  // Notifications of the first load may still arrive, and must not deliver
+  // anything of it.
+  for (int i = 0; i < 10; i++) loader_.DeliverResults();
+
+  EXPECT_THAT(file_names_, ElementsAre("purr.txt"));
+  EXPECT_EQ(done_count_, 1);
+}
+
+TEST_F(DirectoryLoaderTest, CancelledLoadDeliversNothing) {
+  Load("/");
+  loader_.Cancel();
+  for (int i = 0; i < 10; i++) loader_.DeliverResults();
+
+  Load("/empty/");
+  EXPECT_TRUE(DeliverUntilDone().ok());
+
+  EXPECT_THAT(file_names_, IsEmpty());
+  EXPECT_EQ(done_count_, 1);
+}
+
+// A file system whose reads stay blocked until the test releases them, like a
+// directory on a hung network mount.
+class BlockingFileSystem : public MockFileSystem {
+ public:
+  BlockingFileSystem() : MockFileSystem({new MockFile("meow.txt")}) {}
+
+  absl::Status StreamDirectoryFiles(
+      const Glib::ustring& directory, size_t batch_size,
+      const FileBatchCallback& callback) const override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    released_.wait(lock, [this]() { return is_released_; });
+    return MockFileSystem::StreamDirectoryFiles(directory, batch_size,
+                                                callback);
+  }
+
+  void Release() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_released_ = true;
+    released_.notify_all();
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  mutable std::condition_variable released_;
+  bool is_released_ = false;
+};
+
+TEST(DirectoryLoaderBlockingTest, LoadReturnsWhileDirectoryIsStillRead) {
+  BlockingFileSystem file_system;
+  std::atomic<int> notification_count = 0;
+  {
+    DirectoryLoader loader(file_system, /*batch_size=*/1,
+                           [&notification_count]() { notification_count++; });
+
+    loader.Load(
+        "/", [](const DirectoryListing& files) {},
+        [](absl::StatusOr<DirectoryListing> files) {});
+    loader.Load(
+        "/", [](const DirectoryListing& files) {},
+        [](absl::StatusOr<DirectoryListing> files) {});
+    loader.DeliverResults();
+
+    // Destroying the loader waits for the blocked reads, which only then find
+    // out they were cancelled.
+    file_system.Release();
+  }
+
+  // Only the second load was still current, and it was cancelled by the
+  // destructor before or after reading.
+  EXPECT_LE(notification_count, 2);
+}
+
+}  // namespace
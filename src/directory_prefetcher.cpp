@@ -0,0 +1,140 @@
+#include "directory_prefetcher.hpp"
+
+#include <glibmm/ustring.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace {
+
+// Highest niceness there is, so prefetching only gets CPU time left over.
+constexpr int kPrefetchNiceness = 19;
+
+// From linux/ioprio.h, which older kernel headers lack.
+constexpr int kIOPrioWhoProcess = 1;
+constexpr int kIOPrioClassIdle = 3;
+constexpr int kIOPrioClassShift = 13;
+
+// Directories are tracked the way CachingFileSystem keys them, so "/a/b" and
+// "/a/b/" are the same directory.
+std::string GetDirectoryKey(const Glib::ustring &directory) {
+  std::string key = directory;
+  while (key.size() > 1 && key.back() == '/') key.pop_back();
+  return key;
+}
+
+// Both priorities apply to the calling thread only on Linux, when given its
+// thread id. Failing to lower them is harmless, so errors are ignored.
+void LowerCurrentThreadPriority() {
+  const pid_t thread_id = syscall(SYS_gettid);
+  setpriority(PRIO_PROCESS, thread_id, kPrefetchNiceness);
+  syscall(SYS_ioprio_set, kIOPrioWhoProcess, thread_id,
+          kIOPrioClassIdle << kIOPrioClassShift);
+}
+
+}  // namespace
+
+DirectoryPrefetcher::DirectoryPrefetcher(const CachingFileSystem &cache,
+                                         size_t max_concurrent_reads,
+                                         size_t max_queued_directories)
+    : cache_(cache), max_queued_directories_(max_queued_directories) {
+  for (size_t i = 0; i < max_concurrent_reads; i++)
+    workers_.emplace_back(&DirectoryPrefetcher::PrefetchDirectories, this);
+}
+
+DirectoryPrefetcher::~DirectoryPrefetcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_stopping_ = true;
+    queued_directories_.clear();
+  }
+  directory_queued_.notify_all();
+  for (std::thread &worker : workers_) worker.join();
+}
+
+void DirectoryPrefetcher::Prefetch(
+    const std::vector<Glib::ustring> &directories) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queued_directories_.clear();
+    prefetched_directories_.clear();
+    for (const Glib::ustring &directory : directories) {
+      if (queued_directories_.size() == max_queued_directories_) break;
+
+      std::string key = GetDirectoryKey(directory);
+      if (std::find(queued_directories_.begin(), queued_directories_.end(),
+                    key) == queued_directories_.end())
+        queued_directories_.push_back(std::move(key));
+    }
+  }
+  directory_queued_.notify_all();
+}
+
+void DirectoryPrefetcher::PrefetchFirst(const Glib::ustring &directory) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string key = GetDirectoryKey(directory);
+    if (prefetched_directories_.count(key)) return;
+
+    queued_directories_.erase(std::remove(queued_directories_.begin(),
+                                          queued_directories_.end(), key),
+                              queued_directories_.end());
+    queued_directories_.push_front(std::move(key));
+    if (queued_directories_.size() > max_queued_directories_)
+      queued_directories_.pop_back();
+  }
+  directory_queued_.notify_one();
+}
+
+void DirectoryPrefetcher::RecordNavigation(const Glib::ustring &directory) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (prefetched_directories_.count(GetDirectoryKey(directory)))
+    ++hit_count_;
+  else
+    ++miss_count_;
+}
+
+uint64_t DirectoryPrefetcher::GetPrefetchCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return prefetch_count_;
+}
+
+uint64_t DirectoryPrefetcher::GetHitCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hit_count_;
+}
+
+uint64_t DirectoryPrefetcher::GetMissCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return miss_count_;
+}
+
+void DirectoryPrefetcher::PrefetchDirectories() {
+  LowerCurrentThreadPriority();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    directory_queued_.wait(lock, [this]() {
+      return is_stopping_ || !queued_directories_.empty();
+    });
+    if (is_stopping_) return;
+
+    std::string directory = std::move(queued_directories_.front());
+    queued_directories_.pop_front();
+
+    lock.unlock();
+    const bool is_cached = cache_.WarmDirectory(directory).ok();
+    lock.lock();
+
+    if (is_cached) {
+      ++prefetch_count_;
+      prefetched_directories_.insert(std::move(directory));
+    }
+  }
+}
@@ -0,0 +1,77 @@
+#ifndef DIRECTORY_PREFETCHER_HPP
+#define DIRECTORY_PREFETCHER_HPP
+
+#include <glibmm/ustring.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "caching_filesystem.hpp"
+
+// Reads directories the user is likely to open next into a CachingFileSystem
+// ahead of time, so opening them is served from the cache.
+//
+// At most max_concurrent_reads directories are read at once, each on a worker
+// thread of its own running at idle CPU and I/O priority, so prefetching stays
+// out of the way of the directory being shown. Directories waiting to be read
+// are replaced as a whole whenever the user moves on, since they were only
+// guesses for where the user was.
+class DirectoryPrefetcher {
+ public:
+  // cache must outlive the prefetcher. At most max_queued_directories wait to
+  // be read, the rest of any longer list is dropped.
+  DirectoryPrefetcher(const CachingFileSystem &cache,
+                      size_t max_concurrent_reads,
+                      size_t max_queued_directories);
+
+  DirectoryPrefetcher(const DirectoryPrefetcher &) = delete;
+  DirectoryPrefetcher &operator=(const DirectoryPrefetcher &) = delete;
+
+  // Drops every directory still waiting, and waits for the reads in flight.
+  ~DirectoryPrefetcher();
+
+  // Replaces the directories waiting to be read with directories, which are
+  // read in order.
+  void Prefetch(const std::vector<Glib::ustring> &directories);
+  // Reads directory before every other waiting directory, keeping the rest.
+  void PrefetchFirst(const Glib::ustring &directory);
+
+  // Records that the user opened directory. It counts as a hit if directory
+  // was read since the last call to Prefetch(), and as a miss otherwise.
+  void RecordNavigation(const Glib::ustring &directory);
+
+  // Number of directories made sure to be cached, and of navigations recorded
+  // as hits or misses, since construction.
+  uint64_t GetPrefetchCount() const;
+  uint64_t GetHitCount() const;
+  uint64_t GetMissCount() const;
+
+ private:
+  // Runs on every worker thread until the prefetcher is destroyed.
+  void PrefetchDirectories();
+
+  const CachingFileSystem &cache_;
+  size_t max_queued_directories_;
+
+  // Guards everything below.
+  mutable std::mutex mutex_;
+  std::condition_variable directory_queued_;
+  bool is_stopping_ = false;
+  std::deque<std::string> queued_directories_;
+  // Directories read since the last call to Prefetch(), as cache keys.
+  std::set<std::string> prefetched_directories_;
+  uint64_t prefetch_count_ = 0;
+  uint64_t hit_count_ = 0;
+  uint64_t miss_count_ = 0;
+
+  std::vector<std::thread> workers_;
+};
+
+#endif  // DIRECTORY_PREFETCHER_HPP
@@ -0,0 +1,196 @@
+#include "directory_prefetcher.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <glibmm/ustring.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "caching_filesystem.hpp"
+#include "filesystem.hpp"
+
+namespace {
+
+using ::testing::ElementsAre;
+
+// Wraps a MockFileSystem and holds every directory read until the gate is
+// opened, while recording which directories were read and how many reads were
+// in flight at once.
+class GatedFileSystem : public FileSystem {
+ public:
+  GatedFileSystem(std::initializer_list<MockFile*> files)
+      : file_system_(files) {}
+
+  absl::StatusOr<DirectoryListing> GetDirectoryFiles(
+      const Glib::ustring& directory) const override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    read_directories_.push_back(directory);
+    reads_in_flight_++;
+    max_reads_in_flight_ = std::max(max_reads_in_flight_, reads_in_flight_);
+    changed_.notify_all();
+    changed_.wait(lock, [this]() { return is_open_; });
+    reads_in_flight_--;
+    return file_system_.GetDirectoryFiles(directory);
+  }
+  absl::Status CheckDirectory(const Glib::ustring& directory) const override {
+    return file_system_.CheckDirectory(directory);
+  }
+  absl::Status StreamDirectoryFiles(
+      const Glib::ustring& directory, size_t batch_size,
+      const FileBatchCallback& callback) const override {
+    return file_system_.StreamDirectoryFiles(directory, batch_size, callback);
+  }
+  absl::Status FillFileMetadata(const Glib::ustring& directory,
+                                DirectoryListing& files,
+                                FileMetadataMask fields) const override {
+    return file_system_.FillFileMetadata(directory, files, fields);
+  }
+  absl::StatusOr<FileMetadata> GetFileMetadata(
+      const Glib::ustring& path, FileMetadataMask fields) const override {
+    return file_system_.GetFileMetadata(path, fields);
+  }
+
+  void Open() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_open_ = true;
+    changed_.notify_all();
+  }
+
+  // Waits until reads reads have started.
+  bool WaitForReads(size_t reads) const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return changed_.wait_for(lock, std::chrono::seconds(10), [&]() {
+      return read_directories_.size() >= reads;
+    });
+  }
+
+  std::vector<std::string> GetReadDirectories() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return read_directories_;
+  }
+
+  int GetMaxReadsInFlight() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_reads_in_flight_;
+  }
+
+ private:
+  MockFileSystem file_system_;
+  mutable std::mutex mutex_;
+  mutable std::condition_variable changed_;
+  bool is_open_ = false;
+  mutable std::vector<std::string> read_directories_;
+  mutable int reads_in_flight_ = 0;
+  mutable int max_reads_in_flight_ = 0;
+};
+
+class DirectoryPrefetcherTest : public ::testing::Test {
+ protected:
+  DirectoryPrefetcherTest()
+      : file_system_(new GatedFileSystem(
+            {new MockDirectory("a", {new MockFile("meow.txt")}),
+             new MockDirectory("b", {}), new MockDirectory("c", {}),
+             new MockDirectory("d", {}), new MockDirectory("e", {})})),
+        cache_(*file_system_, *new MockDirectoryWatcher(),
+               /*memory_budget=*/1 << 20) {}
+
+  // Waits until the prefetcher has warmed count directories.
+  bool WaitForPrefetches(const DirectoryPrefetcher& prefetcher,
+                         uint64_t count) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (prefetcher.GetPrefetchCount() < count) {
+      if (std::chrono::steady_clock::now() > deadline) return false;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+  }
+
+  // Owned by cache_.
+  GatedFileSystem* file_system_;
+  CachingFileSystem cache_;
+};
+
+TEST_F(DirectoryPrefetcherTest, WarmsCacheForNavigation) {
+  DirectoryPrefetcher prefetcher(cache_, /*max_concurrent_reads=*/2,
+                                 /*max_queued_directories=*/8);
+  file_system_->Open();
+
+  prefetcher.Prefetch({"/a/", "/b/"});
+  ASSERT_TRUE(WaitForPrefetches(prefetcher, 2));
+
+  absl::StatusOr<DirectoryListing> files = cache_.GetDirectoryFiles("/a/");
+  ASSERT_TRUE(files.ok());
+  EXPECT_THAT(*files, ElementsAre("meow.txt"));
+  EXPECT_EQ(cache_.GetCacheHitCount(), 1);
+  EXPECT_EQ(cache_.GetCacheMissCount(), 0);
+
+  prefetcher.RecordNavigation("/a");
+  prefetcher.RecordNavigation("/c/");
+  EXPECT_EQ(prefetcher.GetHitCount(), 1);
+  EXPECT_EQ(prefetcher.GetMissCount(), 1);
+}
+
+TEST_F(DirectoryPrefetcherTest, NeverReadsMoreThanMaxConcurrentReads) {
+  DirectoryPrefetcher prefetcher(cache_, /*max_concurrent_reads=*/2,
+                                 /*max_queued_directories=*/8);
+
+  prefetcher.Prefetch({"/a/", "/b/", "/c/", "/d/", "/e/"});
+  ASSERT_TRUE(file_system_->WaitForReads(2));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(file_system_->GetReadDirectories().size(), 2);
+
+  file_system_->Open();
+  ASSERT_TRUE(WaitForPrefetches(prefetcher, 5));
+  EXPECT_EQ(file_system_->GetMaxReadsInFlight(), 2);
+}
+
+TEST_F(DirectoryPrefetcherTest, PrefetchReplacesWaitingDirectories) {
+  DirectoryPrefetcher prefetcher(cache_, /*max_concurrent_reads=*/1,
+                                 /*max_queued_directories=*/8);
+
+  prefetcher.Prefetch({"/a/", "/b/"});
+  ASSERT_TRUE(file_system_->WaitForReads(1));
+  prefetcher.Prefetch({"/c/"});
+  file_system_->Open();
+
+  ASSERT_TRUE(WaitForPrefetches(prefetcher, 2));
+  EXPECT_THAT(file_system_->GetReadDirectories(), ElementsAre("/a", "/c"));
+}
+
+TEST_F(DirectoryPrefetcherTest, PrefetchFirstJumpsQueue) {
+  DirectoryPrefetcher prefetcher(cache_, /*max_concurrent_reads=*/1,
+                                 /*max_queued_directories=*/8);
+
+  prefetcher.Prefetch({"/a/", "/b/", "/c/"});
+  ASSERT_TRUE(file_system_->WaitForReads(1));
+  prefetcher.PrefetchFirst("/c/");
+  prefetcher.PrefetchFirst("/d/");
+  file_system_->Open();
+
+  ASSERT_TRUE(WaitForPrefetches(prefetcher, 4));
+  EXPECT_THAT(file_system_->GetReadDirectories(),
+              ElementsAre("/a", "/d", "/c", "/b"));
+}
+
+TEST_F(DirectoryPrefetcherTest, DropsDirectoriesBeyondQueueLimit) {
+  DirectoryPrefetcher prefetcher(cache_, /*max_concurrent_reads=*/1,
+                                 /*max_queued_directories=*/2);
+
+  prefetcher.Prefetch({"/a/", "/b/", "/c/", "/d/"});
+  file_system_->Open();
+
+  ASSERT_TRUE(WaitForPrefetches(prefetcher, 2));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_THAT(file_system_->GetReadDirectories(), ElementsAre("/a", "/b"));
+}
+
+}  // namespace
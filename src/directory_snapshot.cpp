@@ -0,0 +1,61 @@
+#include "directory_snapshot.hpp"
+
+#include <iterator>
+#include <memory>
+#include <utility>
+
+DirectoryViewState::~DirectoryViewState() {}
+
+size_t DirectorySnapshot::GetMemoryUsage() const {
+  return sizeof(DirectorySnapshot) + files.GetMemoryUsage() +
+         sorter.GetMemoryUsage() +
+         (view_state != nullptr ? view_state->GetMemoryUsage() : 0);
+}
+
+DirectorySnapshotCache::DirectorySnapshotCache(size_t memory_budget)
+    : memory_budget_(memory_budget) {}
+
+DirectorySnapshotCache::SnapshotId DirectorySnapshotCache::Add(
+    std::unique_ptr<DirectorySnapshot> snapshot) {
+  if (snapshot == nullptr) return kNoSnapshot;
+
+  const size_t memory_usage = snapshot->GetMemoryUsage() + sizeof(Entry);
+  if (memory_usage > memory_budget_) return kNoSnapshot;
+
+  while (memory_usage_ + memory_usage > memory_budget_)
+    RemoveEntry(std::prev(entries_.end()));
+
+  const SnapshotId id = next_id_++;
+  entries_.push_front({id, std::move(snapshot), memory_usage});
+  entries_by_id_[id] = entries_.begin();
+  memory_usage_ += memory_usage;
+  return id;
+}
+
+std::unique_ptr<DirectorySnapshot> DirectorySnapshotCache::Take(
+    SnapshotId id) {
+  auto entry = entries_by_id_.find(id);
+  if (entry == entries_by_id_.end()) return nullptr;
+
+  std::unique_ptr<DirectorySnapshot> snapshot =
+      std::move(entry->second->snapshot);
+  RemoveEntry(entry->second);
+  return snapshot;
+}
+
+void DirectorySnapshotCache::Remove(SnapshotId id) {
+  auto entry = entries_by_id_.find(id);
+  if (entry != entries_by_id_.end()) RemoveEntry(entry->second);
+}
+
+size_t DirectorySnapshotCache::GetMemoryUsage() const { return memory_usage_; }
+
+size_t DirectorySnapshotCache::GetSnapshotCount() const {
+  return entries_.size();
+}
+
+void DirectorySnapshotCache::RemoveEntry(std::list<Entry>::iterator entry) {
+  memory_usage_ -= entry->memory_usage;
+  entries_by_id_.erase(entry->id);
+  entries_.erase(entry);
+}
@@ -0,0 +1,92 @@
+#ifndef DIRECTORY_SNAPSHOT_HPP
+#define DIRECTORY_SNAPSHOT_HPP
+
+#include <absl/time/time.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+#include "filesystem.hpp"
+#include "listing_sorter.hpp"
+
+// Whatever a directory files view needs to show a directory again exactly as
+// it was, such as its rows, scroll offset and selection. Only ever handed back
+// to the view that made it.
+class DirectoryViewState {
+ public:
+  virtual ~DirectoryViewState();
+
+  // Bytes of memory held by the state, as far as it can tell.
+  virtual size_t GetMemoryUsage() const = 0;
+};
+
+// What a window showed of a directory when it navigated away from it, so going
+// back to it in the history can show it again without reading it.
+struct DirectorySnapshot {
+  // Modification time of the directory from before files were read. The
+  // snapshot is stale once the directory's modification time differs from it.
+  absl::Time modification_time;
+  // Sorted by name.
+  DirectoryListing files;
+  // Metadata filled in for files.
+  FileMetadataMask metadata_fields = 0;
+  // Set to files, so they can be sorted again without their collation keys.
+  ListingSorter sorter;
+  // May be null if the view kept nothing.
+  std::unique_ptr<DirectoryViewState> view_state;
+  // Order the view state shows files in.
+  SortOrder sort_order;
+
+  size_t GetMemoryUsage() const;
+};
+
+// Keeps the snapshots of a navigation history within a memory budget. Once
+// they use more than memory_budget bytes, the snapshots added the longest ago
+// are dropped. Since a snapshot is taken out when its directory is shown again
+// and added anew when it is left, that is the least recently visited one.
+class DirectorySnapshotCache {
+ public:
+  using SnapshotId = uint64_t;
+  // Never handed out for a kept snapshot.
+  static constexpr SnapshotId kNoSnapshot = 0;
+
+  explicit DirectorySnapshotCache(size_t memory_budget);
+
+  DirectorySnapshotCache(const DirectorySnapshotCache &) = delete;
+  DirectorySnapshotCache &operator=(const DirectorySnapshotCache &) = delete;
+
+  // Keeps snapshot, dropping older snapshots to make room for it. Returns the
+  // id to take it back with, or kNoSnapshot if snapshot is null or bigger than
+  // the whole budget.
+  SnapshotId Add(std::unique_ptr<DirectorySnapshot> snapshot);
+  // Hands back the snapshot kept under id and forgets it. Returns nullptr if it
+  // was dropped or already taken.
+  std::unique_ptr<DirectorySnapshot> Take(SnapshotId id);
+  // Forgets the snapshot kept under id, if any.
+  void Remove(SnapshotId id);
+
+  // Bytes currently used by the kept snapshots.
+  size_t GetMemoryUsage() const;
+  size_t GetSnapshotCount() const;
+
+ private:
+  struct Entry {
+    SnapshotId id;
+    std::unique_ptr<DirectorySnapshot> snapshot;
+    size_t memory_usage;
+  };
+
+  void RemoveEntry(std::list<Entry>::iterator entry);
+
+  size_t memory_budget_;
+  SnapshotId next_id_ = kNoSnapshot + 1;
+  // Most recently added snapshots first.
+  std::list<Entry> entries_;
+  std::unordered_map<SnapshotId, std::list<Entry>::iterator> entries_by_id_;
+  size_t memory_usage_ = 0;
+};
+
+#endif  // DIRECTORY_SNAPSHOT_HPP
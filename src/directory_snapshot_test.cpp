@@ -0,0 +1,103 @@
+#include "directory_snapshot.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+#include "filesystem.hpp"
+
+namespace {
+
+using ::testing::ElementsAre;
+
+// Stands in for the rows of a view, which are usually much bigger than the
+// listing itself.
+class FakeViewState : public DirectoryViewState {
+ public:
+  explicit FakeViewState(size_t memory_usage) : memory_usage_(memory_usage) {}
+
+  size_t GetMemoryUsage() const override { return memory_usage_; }
+
+ private:
+  size_t memory_usage_;
+};
+
+std::unique_ptr<DirectorySnapshot> MakeSnapshot(const std::string& file_name,
+                                                size_t view_memory_usage) {
+  auto snapshot = std::make_unique<DirectorySnapshot>();
+  snapshot->modification_time = absl::UnixEpoch();
+  snapshot->files.Add(file_name, /*is_dir=*/false);
+  snapshot->view_state = std::make_unique<FakeViewState>(view_memory_usage);
+  return snapshot;
+}
+
+TEST(DirectorySnapshotCacheTest, TakesBackAddedSnapshot) {
+  DirectorySnapshotCache cache(/*memory_budget=*/1 << 20);
+
+  DirectorySnapshotCache::SnapshotId id = cache.Add(MakeSnapshot("meow", 0));
+  ASSERT_NE(id, DirectorySnapshotCache::kNoSnapshot);
+  EXPECT_EQ(cache.GetSnapshotCount(), 1);
+  EXPECT_GT(cache.GetMemoryUsage(), 0);
+
+  std::unique_ptr<DirectorySnapshot> snapshot = cache.Take(id);
+  ASSERT_NE(snapshot, nullptr);
+  EXPECT_THAT(snapshot->files, ElementsAre("meow"));
+  EXPECT_EQ(cache.Take(id), nullptr);
+  EXPECT_EQ(cache.GetSnapshotCount(), 0);
+  EXPECT_EQ(cache.GetMemoryUsage(), 0);
+}
+
+TEST(DirectorySnapshotCacheTest, CountsViewStateTowardsBudget) {
+  DirectorySnapshotCache cache(/*memory_budget=*/1 << 20);
+
+  cache.Add(MakeSnapshot("meow", 0));
+  const size_t small_memory_usage = cache.GetMemoryUsage();
+  cache.Add(MakeSnapshot("meow", 1000));
+
+  EXPECT_EQ(cache.GetMemoryUsage(), 2 * small_memory_usage + 1000);
+}
+
+TEST(DirectorySnapshotCacheTest, DropsLeastRecentlyAddedSnapshots) {
+  DirectorySnapshotCache cache(/*memory_budget=*/1 << 20);
+  DirectorySnapshotCache::SnapshotId oldest_id =
+      cache.Add(MakeSnapshot("oldest", 400 << 10));
+  DirectorySnapshotCache::SnapshotId older_id =
+      cache.Add(MakeSnapshot("older", 400 << 10));
+
+  // Taking a snapshot out and adding it back makes it the most recent one.
+  DirectorySnapshotCache::SnapshotId readded_oldest_id =
+      cache.Add(cache.Take(oldest_id));
+  DirectorySnapshotCache::SnapshotId newest_id =
+      cache.Add(MakeSnapshot("newest", 400 << 10));
+
+  EXPECT_EQ(cache.GetSnapshotCount(), 2);
+  EXPECT_LE(cache.GetMemoryUsage(), 1 << 20);
+  EXPECT_EQ(cache.Take(older_id), nullptr);
+  EXPECT_NE(cache.Take(readded_oldest_id), nullptr);
+  EXPECT_NE(cache.Take(newest_id), nullptr);
+}
+
+TEST(DirectorySnapshotCacheTest, DoesNotKeepSnapshotBiggerThanBudget) {
+  DirectorySnapshotCache cache(/*memory_budget=*/1 << 20);
+  DirectorySnapshotCache::SnapshotId id = cache.Add(MakeSnapshot("meow", 0));
+
+  EXPECT_EQ(cache.Add(MakeSnapshot("huge", 2 << 20)),
+            DirectorySnapshotCache::kNoSnapshot);
+  EXPECT_EQ(cache.Add(nullptr), DirectorySnapshotCache::kNoSnapshot);
+  EXPECT_NE(cache.Take(id), nullptr);
+}
+
+TEST(DirectorySnapshotCacheTest, RemovesSnapshots) {
+  DirectorySnapshotCache cache(/*memory_budget=*/1 << 20);
+  DirectorySnapshotCache::SnapshotId id = cache.Add(MakeSnapshot("meow", 0));
+
+  cache.Remove(id);
+  cache.Remove(DirectorySnapshotCache::kNoSnapshot);
+
+  EXPECT_EQ(cache.Take(id), nullptr);
+  EXPECT_EQ(cache.GetMemoryUsage(), 0);
+}
+
+}  // namespace
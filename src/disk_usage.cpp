@@ -0,0 +1,498 @@
+#include "disk_usage.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/strings/match.h>
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
+#include <glibmm/ustring.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "tree_walker.hpp"
+
+namespace {
+
+// Directory modification times this close to the start of a scan are not
+// trusted, since file systems may store them too coarsely for a change made
+// right after to move them.
+constexpr absl::Duration kModificationTimeGranularity = absl::Seconds(2);
+
+constexpr FileMetadataMask kScannedMetadata =
+    kFileMetadataSize | kFileMetadataAllocatedSize |
+    kFileMetadataModificationTime | kFileMetadataIdentity;
+
+DiskUsage GetDiskUsage(const FileMetadata &metadata) {
+  return {metadata.size, metadata.allocated_size};
+}
+
+std::optional<absl::Time> GetModificationTime(const FileMetadata &metadata) {
+  if (!(metadata.filled_fields & kFileMetadataModificationTime))
+    return std::nullopt;
+  return metadata.modification_time;
+}
+
+// Name of the entry of the directory scanned that path, relative to it, is
+// below.
+std::string_view GetEntryName(std::string_view path) {
+  return path.substr(0, path.find('/'));
+}
+
+// Path of the directory holding the directory at path, both relative to the
+// directory scanned and ending with a slash.
+std::string_view GetParentPath(std::string_view path) {
+  const size_t slash = path.rfind('/', path.size() - 2);
+  return slash == std::string_view::npos ? std::string_view()
+                                         : path.substr(0, slash + 1);
+}
+
+}  // namespace
+
+DiskUsage &DiskUsage::operator+=(const DiskUsage &other) {
+  apparent_size += other.apparent_size;
+  allocated_size += other.allocated_size;
+  return *this;
+}
+
+DiskUsage &DiskUsage::operator-=(const DiskUsage &other) {
+  apparent_size -= other.apparent_size;
+  allocated_size -= other.allocated_size;
+  return *this;
+}
+
+bool DiskUsage::operator==(const DiskUsage &other) const {
+  return apparent_size == other.apparent_size &&
+         allocated_size == other.allocated_size;
+}
+
+class DiskUsageScanner::Walk {
+ public:
+  Walk(DiskUsageScanner &scanner, const Glib::ustring &root, ScanState &scan)
+      : scanner_(scanner), root_(root), scan_(scan) {
+    if (root_.empty() || root_.back() != '/') root_ += '/';
+  }
+
+  absl::StatusOr<DiskUsage> Run() {
+    scan_start_time_ = absl::Now();
+    // Taken before anything is read, so changes made meanwhile make the
+    // cached usage stale.
+    absl::StatusOr<FileMetadata> root_metadata =
+        scanner_.file_system_.GetFileMetadata(root_, kScannedMetadata);
+    if (!root_metadata.ok()) return root_metadata.status();
+    Node &root = nodes_[""];
+    root.inode_usage = GetDiskUsage(*root_metadata);
+    root.modification_time = GetModificationTime(*root_metadata);
+
+    TreeWalker::Options options;
+    options.thread_count = scanner_.thread_count_;
+    options.metadata_fields = kScannedMetadata;
+    options.get_known_files = [this](std::string_view path,
+                                     const File &directory) {
+      return GetCachedFiles(path, directory);
+    };
+    options.is_cancelled = &scan_.is_cancelled;
+    absl::StatusOr<TreeWalker::Stats> stats =
+        TreeWalker(scanner_.file_system_, options)
+            .Walk(root_, [this](const TreeWalker::Directory &directory) {
+              AddDirectory(directory);
+            });
+    if (!stats.ok()) return stats.status();
+
+    QueueChangedEntries();
+    const DiskUsage usage = AddUpSubtrees();
+    UpdateCache();
+    return usage;
+  }
+
+ private:
+  // Directory found below the root, keyed by its path relative to the root.
+  struct Node {
+    // Of the directory itself, from the listing of its parent.
+    DiskUsage inode_usage;
+    // Of the files directly in it, other than directories.
+    DiskUsage files_usage;
+    // Of those files, the ones not in hard_links.
+    DiskUsage single_link_usage;
+    // Of every directory right below it, once added up.
+    DiskUsage subdirectories_usage;
+    std::optional<absl::Time> modification_time;
+    // Every file in it with several links, counted in files_usage or not.
+    std::vector<HardLink> hard_links;
+    std::vector<std::string> subdirectory_names;
+    bool is_read = false;
+    // Whether the files of the directory itself were taken from the cache,
+    // rather than read.
+    bool is_cached = false;
+  };
+
+  // Set of files, shared by the threads of the walk. Split into shards with a
+  // lock each, picked by hash, so threads adding different files rarely wait
+  // on each other.
+  class FileIdentitySet {
+   public:
+    // Whether file was not in the set yet.
+    bool Insert(const FileIdentity &file) {
+      const size_t hash = Hash()(file);
+      Shard &shard = shards_[hash % kShardCount];
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      return shard.files.insert(file).second;
+    }
+
+   private:
+    static constexpr size_t kShardCount = 64;
+
+    struct Hash {
+      size_t operator()(const FileIdentity &file) const {
+        // Inodes are often close together, so they are spread out over the
+        // shards and buckets first.
+        return (static_cast<uint64_t>(file.inode) * 0x9e3779b97f4a7c15) ^
+               static_cast<uint64_t>(file.device);
+      }
+    };
+    // Aligned to a cache line each, so locking one does not slow down threads
+    // locking its neighbours.
+    struct alignas(64) Shard {
+      std::mutex mutex;
+      std::unordered_set<FileIdentity, Hash> files;
+    };
+
+    std::array<Shard, kShardCount> shards_;
+  };
+
+  // Takes the usage of the files directly in the directory at path from the
+  // cache, if it did not change since it was cached. Its subdirectories are
+  // handed back to be walked, so each is checked the same way.
+  std::optional<DirectoryListing> GetCachedFiles(std::string_view path,
+                                                 const File &directory) {
+    const std::optional<absl::Time> modification_time =
+        GetModificationTime(directory.GetMetadata());
+    if (!IsTrusted(modification_time)) return std::nullopt;
+
+    DiskUsage single_link_usage;
+    DiskUsage files_usage;
+    std::vector<HardLink> hard_links;
+    DirectoryListing subdirectories;
+    {
+      std::lock_guard<std::mutex> lock(scanner_.cache_mutex_);
+      auto cached = scanner_.cache_.find(root_ + std::string(path));
+      if (cached == scanner_.cache_.end() ||
+          cached->second.modification_time != *modification_time)
+        return std::nullopt;
+
+      single_link_usage = cached->second.files_usage;
+      files_usage = single_link_usage;
+      hard_links = cached->second.hard_links;
+      // Counted here unless a link was found elsewhere first this time,
+      // wherever it was counted last time.
+      for (const HardLink &hard_link : hard_links) {
+        if (hard_links_.Insert(hard_link.identity))
+          files_usage += hard_link.usage;
+      }
+      for (const std::string &name : cached->second.subdirectory_names)
+        subdirectories.Add(name, /*is_dir=*/true);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Node &node = nodes_[std::string(path)];
+    node.files_usage = files_usage;
+    node.single_link_usage = single_link_usage;
+    node.hard_links = std::move(hard_links);
+    node.is_cached = true;
+    return subdirectories;
+  }
+
+  // Whether a directory with modification_time is known to have changed if
+  // it changes again. Ones changed right before the scan started may not.
+  bool IsTrusted(const std::optional<absl::Time> &modification_time) const {
+    return modification_time.has_value() &&
+           *modification_time <=
+               scan_start_time_ - kModificationTimeGranularity;
+  }
+
+  void AddDirectory(const TreeWalker::Directory &directory) {
+    struct Subdirectory {
+      std::string name;
+      std::string path;
+      DiskUsage usage;
+      std::optional<absl::Time> modification_time;
+    };
+    std::vector<Subdirectory> subdirectories;
+    std::vector<HardLink> hard_links;
+    DiskUsage single_link_usage;
+    DiskUsage files_usage;
+    const bool is_root = directory.path.empty();
+    std::vector<std::pair<std::string_view, DiskUsage>> root_file_usages;
+    for (File file : directory.files) {
+      const FileMetadata &metadata = file.GetMetadata();
+      const DiskUsage usage = GetDiskUsage(metadata);
+      if (file.IsDirectory()) {
+        subdirectories.push_back(
+            {std::string(file.GetName()),
+             std::string(directory.path) + std::string(file.GetName()) + '/',
+             usage, GetModificationTime(metadata)});
+        continue;
+      }
+
+      if ((metadata.filled_fields & kFileMetadataIdentity) &&
+          metadata.link_count > 1) {
+        // Kept even if a link elsewhere was counted, in case that link is
+        // gone by the time this directory is taken from the cache.
+        const FileIdentity identity = {metadata.device, metadata.inode};
+        hard_links.push_back({identity, usage});
+        if (!hard_links_.Insert(identity)) continue;
+      } else {
+        single_link_usage += usage;
+      }
+      files_usage += usage;
+      if (is_root) root_file_usages.emplace_back(file.GetName(), usage);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Node &node = nodes_[std::string(directory.path)];
+    // The files of a directory taken from the cache were counted then, and
+    // only its subdirectories are listed.
+    if (!node.is_cached) {
+      node.files_usage = files_usage;
+      node.single_link_usage = single_link_usage;
+      node.hard_links = std::move(hard_links);
+    }
+    node.is_read = true;
+    for (Subdirectory &subdirectory : subdirectories) {
+      node.subdirectory_names.push_back(std::move(subdirectory.name));
+      AddToEntry(GetEntryName(subdirectory.path), subdirectory.usage);
+      Node &subdirectory_node = nodes_[std::move(subdirectory.path)];
+      subdirectory_node.inode_usage = subdirectory.usage;
+      subdirectory_node.modification_time = subdirectory.modification_time;
+    }
+    if (is_root) {
+      for (const auto &[name, usage] : root_file_usages)
+        AddToEntry(name, usage);
+    } else {
+      AddToEntry(GetEntryName(directory.path), node.files_usage);
+    }
+
+    const absl::Time now = absl::Now();
+    if (now >= next_progress_time_) {
+      QueueChangedEntries();
+      next_progress_time_ = now + scanner_.progress_interval_;
+    }
+  }
+
+  // Must be called with mutex_ held.
+  void AddToEntry(std::string_view name, const DiskUsage &usage) {
+    auto [index, is_new] =
+        entry_indices_.try_emplace(std::string(name), entries_.size());
+    if (is_new) {
+      entries_.push_back({std::string(name), {}});
+      is_entry_changed_.push_back(false);
+    }
+    entries_[index->second].usage += usage;
+    if (!is_entry_changed_[index->second]) {
+      is_entry_changed_[index->second] = true;
+      changed_entries_.push_back(index->second);
+    }
+  }
+
+  // Must be called with mutex_ held, unless the walk is over.
+  void QueueChangedEntries() {
+    for (size_t start = 0; start < changed_entries_.size();
+         start += scanner_.batch_size_) {
+      const size_t end =
+          std::min(start + scanner_.batch_size_, changed_entries_.size());
+      std::vector<EntryUsage> batch;
+      batch.reserve(end - start);
+      for (size_t i = start; i < end; i++) {
+        batch.push_back(entries_[changed_entries_[i]]);
+        is_entry_changed_[changed_entries_[i]] = false;
+      }
+      {
+        std::lock_guard<std::mutex> lock(scan_.mutex);
+        scan_.batches.push_back(std::move(batch));
+      }
+      scanner_.notify_();
+    }
+    changed_entries_.clear();
+  }
+
+  // Adds the usage of every directory to the one holding it, returning that
+  // of the root. Directories come after the one holding them, so going
+  // backwards reaches every directory before the one holding it.
+  DiskUsage AddUpSubtrees() {
+    for (auto node = nodes_.rbegin(); node != nodes_.rend(); ++node) {
+      const std::string &path = node->first;
+      if (path.empty()) break;
+      auto parent = nodes_.find(std::string(GetParentPath(path)));
+      if (parent == nodes_.end()) continue;
+      parent->second.subdirectories_usage += GetSubtreeUsage(node->second);
+    }
+    return GetSubtreeUsage(nodes_[""]);
+  }
+
+  static DiskUsage GetSubtreeUsage(const Node &node) {
+    DiskUsage usage = node.inode_usage;
+    usage += node.files_usage;
+    usage += node.subdirectories_usage;
+    return usage;
+  }
+
+  // Replaces what the cache held below the root with what the walk found.
+  // Directories changed too recently to be trusted are left out, so they are
+  // read again next time.
+  void UpdateCache() {
+    size_t cached_count = 0;
+    for (const auto &[path, node] : nodes_)
+      cached_count += node.is_read && IsTrusted(node.modification_time);
+
+    std::lock_guard<std::mutex> lock(scanner_.cache_mutex_);
+    std::map<std::string, CachedDirectory> &cache = scanner_.cache_;
+    // Everything below a directory comes right after it.
+    auto below_root = cache.lower_bound(root_);
+    while (below_root != cache.end() &&
+           absl::StartsWith(below_root->first, root_))
+      below_root = cache.erase(below_root);
+    if (cache.size() + cached_count > scanner_.max_cached_directory_count_)
+      cache.clear();
+
+    for (auto &[path, node] : nodes_) {
+      if (!node.is_read || !IsTrusted(node.modification_time)) continue;
+      CachedDirectory &cached = cache[root_ + path];
+      cached.modification_time = *node.modification_time;
+      cached.files_usage = node.single_link_usage;
+      cached.hard_links = std::move(node.hard_links);
+      cached.subdirectory_names = std::move(node.subdirectory_names);
+    }
+  }
+
+  DiskUsageScanner &scanner_;
+  std::string root_;
+  ScanState &scan_;
+  FileIdentitySet hard_links_;
+
+  // Guards everything below.
+  std::mutex mutex_;
+  std::map<std::string, Node> nodes_;
+  std::unordered_map<std::string, size_t> entry_indices_;
+  std::vector<EntryUsage> entries_;
+  std::vector<bool> is_entry_changed_;
+  // Indices of the entries whose usage grew since they were last queued.
+  std::vector<size_t> changed_entries_;
+  absl::Time next_progress_time_ = absl::InfinitePast();
+  absl::Time scan_start_time_;
+};
+
+DiskUsageScanner::DiskUsageScanner(const FileSystem &file_system,
+                                   size_t thread_count, size_t batch_size,
+                                   absl::Duration progress_interval,
+                                   size_t max_cached_directory_count,
+                                   std::function<void()> notify)
+    : file_system_(file_system),
+      thread_count_(thread_count),
+      batch_size_(batch_size),
+      progress_interval_(progress_interval),
+      max_cached_directory_count_(max_cached_directory_count),
+      notify_(std::move(notify)) {}
+
+DiskUsageScanner::~DiskUsageScanner() {
+  Cancel();
+  for (Worker &worker : workers_) worker.thread.join();
+}
+
+void DiskUsageScanner::Scan(const Glib::ustring &directory,
+                            ProgressCallback on_progress,
+                            DoneCallback on_done) {
+  Cancel();
+  JoinFinishedWorkers();
+
+  current_scan_ = std::make_shared<ScanState>();
+  on_progress_ = std::move(on_progress);
+  on_done_ = std::move(on_done);
+  workers_.push_back({std::thread(&DiskUsageScanner::RunScan, this, directory,
+                                  current_scan_),
+                      current_scan_});
+}
+
+void DiskUsageScanner::Cancel() {
+  if (current_scan_ == nullptr) return;
+
+  current_scan_->is_cancelled = true;
+  current_scan_ = nullptr;
+  on_progress_ = nullptr;
+  on_done_ = nullptr;
+}
+
+void DiskUsageScanner::DeliverResults() {
+  // Results of cancelled scans are dropped along with their state.
+  std::shared_ptr<ScanState> scan = current_scan_;
+  if (scan == nullptr) return;
+
+  std::optional<std::vector<EntryUsage>> batch;
+  std::optional<absl::StatusOr<DiskUsage>> usage;
+  {
+    std::lock_guard<std::mutex> lock(scan->mutex);
+    if (!scan->batches.empty()) {
+      batch = std::move(scan->batches.front());
+      scan->batches.pop_front();
+    } else {
+      usage = std::move(scan->usage);
+      scan->usage.reset();
+    }
+  }
+
+  if (batch.has_value()) {
+    // Copied since on_progress may start another scan, replacing
+    // on_progress_.
+    ProgressCallback on_progress = on_progress_;
+    on_progress(*batch);
+    return;
+  }
+  if (!usage.has_value()) return;
+
+  // The scan is over, so later calls have nothing left to deliver.
+  DoneCallback on_done = std::move(on_done_);
+  current_scan_ = nullptr;
+  on_progress_ = nullptr;
+  on_done_ = nullptr;
+  on_done(std::move(*usage));
+}
+
+size_t DiskUsageScanner::GetCachedDirectoryCount() {
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  return cache_.size();
+}
+
+void DiskUsageScanner::RunScan(const Glib::ustring &directory,
+                               const std::shared_ptr<ScanState> &scan) {
+  absl::StatusOr<DiskUsage> usage = Walk(*this, directory, *scan).Run();
+
+  if (!scan->is_cancelled) {
+    {
+      std::lock_guard<std::mutex> lock(scan->mutex);
+      scan->usage = std::move(usage);
+    }
+    notify_();
+  }
+  scan->is_finished = true;
+}
+
+void DiskUsageScanner::JoinFinishedWorkers() {
+  auto first_finished = std::partition(
+      workers_.begin(), workers_.end(),
+      [](const Worker &worker) { return !worker.scan->is_finished; });
+  for (auto worker = first_finished; worker != workers_.end(); ++worker)
+    worker->thread.join();
+  workers_.erase(first_finished, workers_.end());
+}
@@ -0,0 +1,179 @@
+#ifndef DISK_USAGE_HPP
+#define DISK_USAGE_HPP
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/time/time.h>
+#include <absl/types/span.h>
+#include <glibmm/ustring.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "filesystem.hpp"
+
+// Space taken up by a file, or by a directory and everything below it.
+struct DiskUsage {
+  // Sum of the sizes of the files, as ls shows them.
+  uint64_t apparent_size = 0;
+  // Bytes the files take up on disk, as du shows them.
+  uint64_t allocated_size = 0;
+
+  DiskUsage &operator+=(const DiskUsage &other);
+  DiskUsage &operator-=(const DiskUsage &other);
+  bool operator==(const DiskUsage &other) const;
+};
+
+// Works out the disk usage of every entry of a directory on worker threads,
+// the same way DirectoryLoader lists directories. Subtrees are read by a
+// TreeWalker with thread_count threads, filling in metadata a directory at a
+// time. Files with several hard links are only counted the first time any of
+// their links is found.
+//
+// The usage of the files directly in every directory below the one scanned is
+// cached along with its modification time and the names of its
+// subdirectories. Later scans below the same directory check every directory
+// again, and take the usage of the files of those whose modification time did
+// not change from the cache, without reading them. Modification times within
+// two seconds of the start of a scan are not trusted, since file systems may
+// store them too coarsely for later changes to move them. Only adding,
+// removing or renaming entries changes the modification time of a directory,
+// so files that grew in place are missed until the directory holding them
+// changes too.
+//
+// Totals of the entries are queued as they grow, at most every
+// progress_interval, and once more when the scan is done. notify is called
+// from the worker for every batch of them. notify must arrange for
+// DeliverResults() to be called on the thread that started the scan, and each
+// DeliverResults() call hands over at most one batch.
+//
+// Starting a scan cancels the previous one. Nothing a cancelled scan found is
+// delivered or cached.
+class DiskUsageScanner {
+ public:
+  struct EntryUsage {
+    std::string name;
+    DiskUsage usage;
+  };
+
+  // Receives the entries whose usage grew since the last batch, at most
+  // batch_size of them.
+  using ProgressCallback =
+      std::function<void(absl::Span<const EntryUsage> entries)>;
+  // Called once every batch was delivered, with the usage of the directory
+  // and everything below it, or with the error that stopped it from being
+  // read. Not called for cancelled scans.
+  using DoneCallback = std::function<void(absl::StatusOr<DiskUsage> usage)>;
+
+  // file_system must outlive the scanner, and be safe to use from multiple
+  // threads. Once more than max_cached_directory_count directories are
+  // cached, the cache starts over.
+  DiskUsageScanner(const FileSystem &file_system, size_t thread_count,
+                   size_t batch_size, absl::Duration progress_interval,
+                   size_t max_cached_directory_count,
+                   std::function<void()> notify);
+
+  DiskUsageScanner(const DiskUsageScanner &) = delete;
+  DiskUsageScanner &operator=(const DiskUsageScanner &) = delete;
+
+  // Cancels the current scan and waits for every worker to finish.
+  ~DiskUsageScanner();
+
+  // Starts working out the usage of everything below directory, which must be
+  // a full path, cancelling any scan still in flight.
+  void Scan(const Glib::ustring &directory, ProgressCallback on_progress,
+            DoneCallback on_done);
+  void Cancel();
+
+  // Hands the oldest batch waiting to on_progress, or reports the end of the
+  // scan to on_done once every batch was handed over. Does nothing if no
+  // results are waiting.
+  void DeliverResults();
+
+  // Directories whose usage is cached.
+  size_t GetCachedDirectoryCount();
+
+ private:
+  // Identifies a file whatever link it was found through.
+  struct FileIdentity {
+    dev_t device;
+    ino_t inode;
+
+    bool operator==(const FileIdentity &other) const {
+      return device == other.device && inode == other.inode;
+    }
+  };
+
+  struct HardLink {
+    FileIdentity identity;
+    DiskUsage usage;
+  };
+
+  struct CachedDirectory {
+    absl::Time modification_time;
+    // Of the files directly in the directory, other than directories and the
+    // ones in hard_links.
+    DiskUsage files_usage;
+    // Every file with several links in the directory, whether it was counted
+    // there or through a link elsewhere, which may be gone by the next scan.
+    std::vector<HardLink> hard_links;
+    std::vector<std::string> subdirectory_names;
+  };
+
+  // State shared between one scan's worker and the scanner.
+  struct ScanState {
+    std::atomic<bool> is_cancelled = false;
+    std::atomic<bool> is_finished = false;
+
+    // Guards everything below.
+    std::mutex mutex;
+    std::deque<std::vector<EntryUsage>> batches;
+    // Set once the worker is done scanning.
+    std::optional<absl::StatusOr<DiskUsage>> usage;
+  };
+
+  struct Worker {
+    std::thread thread;
+    std::shared_ptr<ScanState> scan;
+  };
+
+  // State of one walk below a directory, shared by its threads.
+  class Walk;
+
+  // Runs on the worker thread.
+  void RunScan(const Glib::ustring &directory,
+               const std::shared_ptr<ScanState> &scan);
+  // Joins workers that have already finished, without blocking.
+  void JoinFinishedWorkers();
+
+  const FileSystem &file_system_;
+  size_t thread_count_;
+  size_t batch_size_;
+  absl::Duration progress_interval_;
+  size_t max_cached_directory_count_;
+  std::function<void()> notify_;
+
+  // Guards cache_, which workers share. Keyed by the full path of each
+  // directory, ending with a slash, so every directory below one comes right
+  // after it.
+  std::mutex cache_mutex_;
+  std::map<std::string, CachedDirectory> cache_;
+
+  std::shared_ptr<ScanState> current_scan_;
+  ProgressCallback on_progress_;
+  DoneCallback on_done_;
+  std::vector<Worker> workers_;
+};
+
+#endif  // DISK_USAGE_HPP
@@ -0,0 +1,301 @@
+#include "disk_usage.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
+#include <glibmm/ustring.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include "filesystem.hpp"
+
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Pair;
+
+// Wraps a MockFileSystem, counting how many directories were read. Every
+// directory reports the modification time last set for its full path, ending
+// with a slash, or the epoch.
+class CountingFileSystem : public FileSystem {
+ public:
+  CountingFileSystem(std::initializer_list<MockFile*> files)
+      : file_system_(std::make_unique<MockFileSystem>(files)) {}
+
+  absl::StatusOr<DirectoryListing> GetDirectoryFiles(
+      const Glib::ustring& directory) const override {
+    read_count_++;
+    return file_system_->GetDirectoryFiles(directory);
+  }
+  absl::Status CheckDirectory(const Glib::ustring& directory) const override {
+    return file_system_->CheckDirectory(directory);
+  }
+  absl::Status StreamDirectoryFiles(
+      const Glib::ustring& directory, size_t batch_size,
+      const FileBatchCallback& callback) const override {
+    return file_system_->StreamDirectoryFiles(directory, batch_size, callback);
+  }
+  absl::Status FillFileMetadata(const Glib::ustring& directory,
+                                DirectoryListing& files,
+                                FileMetadataMask fields) const override {
+    absl::Status status =
+        file_system_->FillFileMetadata(directory, files, fields);
+    for (size_t i = 0; i < files.size(); i++) {
+      if (!files[i].IsDirectory()) continue;
+      FileMetadata metadata = files[i].GetMetadata();
+      metadata.modification_time = GetModificationTime(
+          std::string(directory) + std::string(files[i].GetName()) + "/");
+      files.SetMetadata(i, metadata);
+    }
+    return status;
+  }
+  absl::StatusOr<FileMetadata> GetFileMetadata(
+      const Glib::ustring& path, FileMetadataMask fields) const override {
+    absl::StatusOr<FileMetadata> metadata =
+        file_system_->GetFileMetadata(path, fields);
+    if (metadata.ok()) metadata->modification_time = GetModificationTime(path);
+    return metadata;
+  }
+
+  int GetReadCount() const { return read_count_; }
+  // Only while nothing is being scanned.
+  void SetFiles(std::initializer_list<MockFile*> files) {
+    file_system_ = std::make_unique<MockFileSystem>(files);
+  }
+  void SetModificationTime(const std::string& directory, int64_t seconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    modification_times_[directory] = absl::FromUnixSeconds(seconds);
+  }
+
+ private:
+  absl::Time GetModificationTime(const std::string& directory) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto modification_time = modification_times_.find(directory);
+    return modification_time == modification_times_.end()
+               ? absl::UnixEpoch()
+               : modification_time->second;
+  }
+
+  std::unique_ptr<MockFileSystem> file_system_;
+  mutable std::atomic<int> read_count_ = 0;
+  mutable std::mutex mutex_;
+  std::map<std::string, absl::Time> modification_times_;
+};
+
+// Lets the test thread step through a scan like a main loop would, by waiting
+// for the scanner to signal results and then delivering them.
+class DiskUsageScannerTest : public ::testing::Test {
+ protected:
+  DiskUsageScannerTest()
+      : file_system_(
+            {new MockFile("a.txt", /*size=*/100),
+             new MockDirectory(
+                 "dir", {new MockFile("b.txt", /*size=*/5000),
+                         new MockDirectory("sub", {new MockFile("c.txt", 1)})}),
+             new MockDirectory("empty", {})}),
+        scanner_(MakeScanner(file_system_)) {}
+
+  DiskUsageScanner MakeScanner(const FileSystem& file_system) {
+    return DiskUsageScanner(file_system, /*thread_count=*/2, /*batch_size=*/2,
+                            absl::ZeroDuration(),
+                            /*max_cached_directory_count=*/100, [this]() {
+                              std::lock_guard<std::mutex> lock(mutex_);
+                              pending_notifications_++;
+                              notified_.notify_one();
+                            });
+  }
+
+  // Scans directory with scanner to completion, keeping the last usage
+  // delivered for every entry in entries_, and returns the usage of the whole
+  // directory.
+  absl::StatusOr<DiskUsage> Scan(DiskUsageScanner& scanner,
+                                 const Glib::ustring& directory) {
+    entries_.clear();
+    std::optional<absl::StatusOr<DiskUsage>> usage;
+    scanner.Scan(
+        directory,
+        [this](absl::Span<const DiskUsageScanner::EntryUsage> entries) {
+          for (const DiskUsageScanner::EntryUsage& entry : entries)
+            entries_[entry.name] = entry.usage;
+        },
+        [&usage](absl::StatusOr<DiskUsage> result) { usage = result; });
+
+    while (!usage.has_value()) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (!notified_.wait_for(lock, std::chrono::seconds(10),
+                              [this]() { return pending_notifications_ > 0; }))
+        return absl::DeadlineExceededError("Scan never finished!");
+      pending_notifications_--;
+      lock.unlock();
+      scanner.DeliverResults();
+    }
+    return *usage;
+  }
+  absl::StatusOr<DiskUsage> Scan(const Glib::ustring& directory) {
+    return Scan(scanner_, directory);
+  }
+
+  CountingFileSystem file_system_;
+  std::mutex mutex_;
+  std::condition_variable notified_;
+  int pending_notifications_ = 0;
+  DiskUsageScanner scanner_;
+
+  std::map<std::string, DiskUsage> entries_;
+};
+
+TEST_F(DiskUsageScannerTest, AddsUpEveryEntryOfDirectory) {
+  absl::StatusOr<DiskUsage> usage = Scan("/");
+
+  ASSERT_TRUE(usage.ok());
+  // Mock files take up whole 4 KiB blocks, and mock directories none.
+  EXPECT_EQ(*usage, (DiskUsage{5101, 16384}));
+  EXPECT_THAT(entries_,
+              ElementsAre(Pair("a.txt", DiskUsage{100, 4096}),
+                          Pair("dir", DiskUsage{5001, 12288}),
+                          Pair("empty", DiskUsage{0, 0})));
+}
+
+TEST_F(DiskUsageScannerTest, CountsHardLinksOnce) {
+  CountingFileSystem file_system(
+      {new MockDirectory("x", {new MockFile("link", 4096, /*inode=*/99,
+                                            /*link_count=*/2)}),
+       new MockDirectory("y", {new MockFile("link", 4096, /*inode=*/99,
+                                            /*link_count=*/2),
+                               new MockFile("other", 4096)})});
+  DiskUsageScanner scanner = MakeScanner(file_system);
+
+  absl::StatusOr<DiskUsage> usage = Scan(scanner, "/");
+
+  ASSERT_TRUE(usage.ok());
+  EXPECT_EQ(*usage, (DiskUsage{8192, 8192}));
+  EXPECT_EQ(entries_["x"].apparent_size + entries_["y"].apparent_size, 8192);
+}
+
+TEST_F(DiskUsageScannerTest, CountsHardLinkAfterCountingLinkIsRemoved) {
+  CountingFileSystem file_system(
+      {new MockDirectory("x", {new MockFile("link", 4096, /*inode=*/99,
+                                            /*link_count=*/2)}),
+       new MockDirectory("y", {new MockFile("link", 4096, /*inode=*/99,
+                                            /*link_count=*/2),
+                               new MockFile("other", 4096)})});
+  DiskUsageScanner scanner = MakeScanner(file_system);
+  ASSERT_TRUE(Scan(scanner, "/").ok());
+
+  // Either directory may have counted the file, depending on which was read
+  // first. The link in that one is removed, and the other one, which is taken
+  // from the cache, counts it instead.
+  if (entries_["x"].apparent_size > 0) {
+    file_system.SetFiles(
+        {new MockDirectory("x", {}),
+         new MockDirectory("y", {new MockFile("link", 4096, /*inode=*/99,
+                                              /*link_count=*/1),
+                                 new MockFile("other", 4096)})});
+    file_system.SetModificationTime("/x/", 1);
+  } else {
+    file_system.SetFiles(
+        {new MockDirectory("x", {new MockFile("link", 4096, /*inode=*/99,
+                                              /*link_count=*/1)}),
+         new MockDirectory("y", {new MockFile("other", 4096)})});
+    file_system.SetModificationTime("/y/", 1);
+  }
+  absl::StatusOr<DiskUsage> usage = Scan(scanner, "/");
+
+  // Only the root and the directory the link was removed from are read.
+  EXPECT_EQ(file_system.GetReadCount(), 5);
+  ASSERT_TRUE(usage.ok());
+  EXPECT_EQ(*usage, (DiskUsage{8192, 8192}));
+}
+
+TEST_F(DiskUsageScannerTest, RescansOnlyDirectoriesThatChanged) {
+  ASSERT_TRUE(Scan("/").ok());
+  EXPECT_EQ(file_system_.GetReadCount(), 4);
+  EXPECT_EQ(scanner_.GetCachedDirectoryCount(), 4);
+
+  absl::StatusOr<DiskUsage> usage = Scan("/");
+
+  // Only the root is read again.
+  EXPECT_EQ(file_system_.GetReadCount(), 5);
+  ASSERT_TRUE(usage.ok());
+  EXPECT_EQ(*usage, (DiskUsage{5101, 16384}));
+  EXPECT_EQ(entries_["dir"], (DiskUsage{5001, 12288}));
+
+  file_system_.SetModificationTime("/dir/", 1);
+  usage = Scan("/");
+
+  // The unchanged directory below the one that changed comes from the cache.
+  EXPECT_EQ(file_system_.GetReadCount(), 7);
+  ASSERT_TRUE(usage.ok());
+  EXPECT_EQ(*usage, (DiskUsage{5101, 16384}));
+  EXPECT_EQ(scanner_.GetCachedDirectoryCount(), 4);
+}
+
+TEST_F(DiskUsageScannerTest, NoticesChangesBelowUnchangedDirectories) {
+  ASSERT_TRUE(Scan("/").ok());
+  EXPECT_EQ(file_system_.GetReadCount(), 4);
+
+  file_system_.SetFiles(
+      {new MockFile("a.txt", /*size=*/100),
+       new MockDirectory(
+           "dir", {new MockFile("b.txt", /*size=*/5000),
+                   new MockDirectory("sub", {new MockFile("c.txt", 1),
+                                             new MockFile("d.txt", 4096)})}),
+       new MockDirectory("empty", {})});
+  file_system_.SetModificationTime("/dir/sub/", 1);
+  absl::StatusOr<DiskUsage> usage = Scan("/");
+
+  // Only the root and the directory that changed are read again.
+  EXPECT_EQ(file_system_.GetReadCount(), 6);
+  ASSERT_TRUE(usage.ok());
+  EXPECT_EQ(*usage, (DiskUsage{9197, 20480}));
+  EXPECT_EQ(entries_["dir"], (DiskUsage{9097, 16384}));
+}
+
+TEST_F(DiskUsageScannerTest, RescansDirectoriesChangedRightBeforeScan) {
+  file_system_.SetModificationTime("/dir/", absl::ToUnixSeconds(absl::Now()));
+  ASSERT_TRUE(Scan("/").ok());
+  EXPECT_EQ(scanner_.GetCachedDirectoryCount(), 3);
+
+  absl::StatusOr<DiskUsage> usage = Scan("/");
+
+  // The directory whose modification time may not have moved with its last
+  // change is read again, unlike the one below it.
+  EXPECT_EQ(file_system_.GetReadCount(), 6);
+  ASSERT_TRUE(usage.ok());
+  EXPECT_EQ(*usage, (DiskUsage{5101, 16384}));
+}
+
+TEST_F(DiskUsageScannerTest, ScansBelowDirectoryFromCacheOfItsParent) {
+  ASSERT_TRUE(Scan("/").ok());
+
+  absl::StatusOr<DiskUsage> usage = Scan("/dir");
+
+  EXPECT_EQ(file_system_.GetReadCount(), 5);
+  ASSERT_TRUE(usage.ok());
+  EXPECT_EQ(*usage, (DiskUsage{5001, 12288}));
+  EXPECT_THAT(entries_, ElementsAre(Pair("b.txt", DiskUsage{5000, 8192}),
+                                    Pair("sub", DiskUsage{1, 4096})));
+  EXPECT_EQ(scanner_.GetCachedDirectoryCount(), 4);
+}
+
+TEST_F(DiskUsageScannerTest, ReportsDirectoryThatCannotBeScanned) {
+  absl::StatusOr<DiskUsage> usage = Scan("/nope");
+
+  EXPECT_EQ(usage.status().code(), absl::StatusCode::kNotFound);
+  EXPECT_TRUE(entries_.empty());
+}
+
+}  // namespace
@@ -0,0 +1,249 @@
+#include "file_copier.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/strings/str_cat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glibmm/ustring.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Errors with which the kernel turns down a method that the file systems
+// involved do not support, rather than failing the copy.
+bool IsUnsupported(int error) {
+  return error == EOPNOTSUPP || error == ENOTTY || error == ENOSYS ||
+         error == EXDEV || error == EINVAL;
+}
+
+// Finds the first run of data in the bytes of fd from offset up to end.
+// Returns false if there are only holes left. File systems that cannot tell
+// holes apart report everything as data.
+bool FindData(int fd, uint64_t offset, uint64_t end, uint64_t &data_start,
+              uint64_t &data_end) {
+  const off_t start = lseek(fd, offset, SEEK_DATA);
+  if (start == -1) {
+    if (errno == ENXIO) return false;
+    data_start = offset;
+    data_end = end;
+    return true;
+  }
+  if (static_cast<uint64_t>(start) >= end) return false;
+
+  const off_t hole = lseek(fd, start, SEEK_HOLE);
+  data_start = start;
+  data_end = hole == -1 ? end : std::min<uint64_t>(hole, end);
+  return true;
+}
+
+}  // namespace
+
+const char *GetCopyMethodName(CopyMethod method) {
+  switch (method) {
+    case CopyMethod::kReflink:
+      return "reflink";
+    case CopyMethod::kCopyFileRange:
+      return "copy_file_range";
+    case CopyMethod::kSendfile:
+      return "sendfile";
+    case CopyMethod::kReadWrite:
+      return "read/write";
+  }
+  return "unknown";
+}
+
+absl::Status MakeFileError(const char *call, int error) {
+  const std::string message = absl::StrCat(call, ": ", strerror(error));
+  switch (error) {
+    case ENOENT:
+      return absl::NotFoundError(message);
+    case EEXIST:
+      return absl::AlreadyExistsError(message);
+    case EACCES:
+    case EPERM:
+      return absl::PermissionDeniedError(message);
+    case ENOSPC:
+    case EDQUOT:
+      return absl::ResourceExhaustedError(message);
+    // Only files on another file system can be copied instead, so nothing
+    // else shares its code.
+    case EXDEV:
+      return absl::FailedPreconditionError(message);
+    case ENOTEMPTY:
+    case ENOTDIR:
+    case EISDIR:
+      return absl::InvalidArgumentError(message);
+  }
+  return absl::InternalError(message);
+}
+
+FileCopier::FileCopier(Options options) : options_(options) {}
+
+absl::StatusOr<FileCopier::Result> FileCopier::Copy(
+    const Glib::ustring &source, const Glib::ustring &destination,
+    const ProgressCallback &on_progress) const {
+  // A symbolic link is not copied as the file it points to.
+  int source_fd = open(source.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (source_fd == -1 && errno == ELOOP)
+    return absl::InvalidArgumentError("Only regular files can be copied!");
+  if (source_fd == -1) return MakeFileError("open(source)", errno);
+  struct stat source_info;
+  if (fstat(source_fd, &source_info) == -1) {
+    const int error = errno;
+    close(source_fd);
+    return MakeFileError("fstat()", error);
+  }
+  if (!S_ISREG(source_info.st_mode)) {
+    close(source_fd);
+    return absl::InvalidArgumentError("Only regular files can be copied!");
+  }
+
+  int destination_fd =
+      open(destination.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+           source_info.st_mode & 0777);
+  if (destination_fd == -1) {
+    const int error = errno;
+    close(source_fd);
+    return MakeFileError("open(destination)", error);
+  }
+
+  absl::StatusOr<Result> result =
+      CopyContents(source_fd, destination_fd, on_progress);
+  close(source_fd);
+  if (close(destination_fd) == -1 && result.ok())
+    result = MakeFileError("close(destination)", errno);
+  if (!result.ok()) unlink(destination.c_str());
+  return result;
+}
+
+absl::StatusOr<FileCopier::Result> FileCopier::CopyContents(
+    int source_fd, int destination_fd,
+    const ProgressCallback &on_progress) const {
+  struct stat source_info;
+  if (fstat(source_fd, &source_info) == -1)
+    return MakeFileError("fstat()", errno);
+  if (!S_ISREG(source_info.st_mode))
+    return absl::InvalidArgumentError("Only regular files can be copied!");
+  const uint64_t size = source_info.st_size;
+
+  Result result = {options_.fastest_method, 0};
+  if (result.method == CopyMethod::kReflink) {
+    if (ioctl(destination_fd, FICLONE, source_fd) == 0) {
+      result.copied_bytes = size;
+      if (on_progress && !on_progress(size))
+        return absl::CancelledError("Copy was stopped!");
+      return result;
+    }
+    if (!IsUnsupported(errno)) return MakeFileError("ioctl(FICLONE)", errno);
+    result.method = CopyMethod::kCopyFileRange;
+  }
+
+  // Growing the copy to its full size up front leaves the holes of the
+  // source as holes, since only the runs of data are written.
+  if (ftruncate(destination_fd, size) == -1)
+    return MakeFileError("ftruncate()", errno);
+
+  std::vector<char> buffer;
+  uint64_t offset = 0;
+  uint64_t data_start;
+  uint64_t data_end;
+  while (offset < size &&
+         FindData(source_fd, offset, size, data_start, data_end)) {
+    if (fallocate(destination_fd, 0, data_start, data_end - data_start) ==
+            -1 &&
+        !IsUnsupported(errno))
+      return MakeFileError("fallocate()", errno);
+
+    const uint64_t expected_end = data_end;
+    absl::Status status = CopyRange(source_fd, destination_fd, data_start,
+                                    data_end, buffer, result, on_progress);
+    if (!status.ok()) return status;
+    if (data_end < expected_end) {
+      // The source shrank while being copied, so the copy ends where the
+      // source did.
+      if (ftruncate(destination_fd, data_end) == -1)
+        return MakeFileError("ftruncate()", errno);
+      break;
+    }
+    offset = data_end;
+  }
+  return result;
+}
+
+absl::Status FileCopier::CopyRange(int source_fd, int destination_fd,
+                                   uint64_t start, uint64_t &end,
+                                   std::vector<char> &buffer, Result &result,
+                                   const ProgressCallback &on_progress) const {
+  uint64_t position = start;
+  while (position < end) {
+    const size_t length =
+        std::min<uint64_t>(options_.chunk_size, end - position);
+    ssize_t copied = -1;
+    switch (result.method) {
+      case CopyMethod::kReflink:
+      case CopyMethod::kCopyFileRange: {
+        loff_t source_offset = position;
+        loff_t destination_offset = position;
+        copied = copy_file_range(source_fd, &source_offset, destination_fd,
+                                 &destination_offset, length, 0);
+        if (copied == -1 && IsUnsupported(errno)) {
+          result.method = CopyMethod::kSendfile;
+          continue;
+        }
+        break;
+      }
+      case CopyMethod::kSendfile: {
+        // sendfile() writes at the current offset of the destination.
+        if (lseek(destination_fd, position, SEEK_SET) == -1)
+          return MakeFileError("lseek()", errno);
+        off_t source_offset = position;
+        copied = sendfile(destination_fd, source_fd, &source_offset, length);
+        if (copied == -1 && IsUnsupported(errno)) {
+          result.method = CopyMethod::kReadWrite;
+          continue;
+        }
+        break;
+      }
+      case CopyMethod::kReadWrite: {
+        if (buffer.empty()) buffer.resize(options_.chunk_size);
+        copied = pread(source_fd, buffer.data(), length, position);
+        for (ssize_t written = 0; written < copied;) {
+          const ssize_t count =
+              pwrite(destination_fd, buffer.data() + written, copied - written,
+                     position + written);
+          if (count == -1) {
+            if (errno == EINTR) continue;
+            return MakeFileError("pwrite()", errno);
+          }
+          written += count;
+        }
+        break;
+      }
+    }
+
+    if (copied == -1) {
+      if (errno == EINTR) continue;
+      return MakeFileError(GetCopyMethodName(result.method), errno);
+    }
+    if (copied == 0) {
+      end = position;
+      break;
+    }
+    position += copied;
+    result.copied_bytes += copied;
+    if (on_progress && !on_progress(result.copied_bytes))
+      return absl::CancelledError("Copy was stopped!");
+  }
+  return absl::OkStatus();
+}
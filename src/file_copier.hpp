@@ -0,0 +1,91 @@
+#ifndef FILE_COPIER_HPP
+#define FILE_COPIER_HPP
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <glibmm/ustring.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Ways of copying the contents of a file, from the fastest to the slowest.
+enum class CopyMethod {
+  // ioctl(FICLONE) shares the blocks of the source with the copy on file
+  // systems such as Btrfs and XFS, without copying any data.
+  kReflink,
+  // copy_file_range() copies inside the kernel, and lets file systems such as
+  // NFS copy on the server.
+  kCopyFileRange,
+  // sendfile() copies through the page cache without going through user
+  // space.
+  kSendfile,
+  // pread() and pwrite() through a buffer, which works everywhere.
+  kReadWrite,
+};
+
+const char *GetCopyMethodName(CopyMethod method);
+
+// Status for the errno error of call, with a code callers can act on, such as
+// absl::AlreadyExistsError for EEXIST. Only EXDEV gives an
+// absl::FailedPreconditionError.
+absl::Status MakeFileError(const char *call, int error);
+
+// Copies regular files with the fastest method both file systems support,
+// falling back to the next one whenever a method turns out not to be
+// supported. Holes of sparse sources are found with SEEK_DATA and SEEK_HOLE
+// and left as holes in the copy, and the blocks of every run of data are
+// preallocated with fallocate() before being copied, so the copy is not
+// fragmented and a full disk is found out early.
+class FileCopier {
+ public:
+  struct Options {
+    // Methods faster than this one are not tried, so the slower ones can be
+    // compared and tested.
+    CopyMethod fastest_method = CopyMethod::kReflink;
+    // Bytes copied at a time, and so between progress reports.
+    size_t chunk_size = 8 * 1024 * 1024;
+  };
+
+  struct Result {
+    // Slowest method used for any part of the file.
+    CopyMethod method;
+    // Bytes of data copied, not counting holes. Reflinked files count as
+    // copied whole.
+    uint64_t copied_bytes;
+  };
+
+  // Receives the bytes of data copied so far. Returning false stops the copy.
+  using ProgressCallback = std::function<bool(uint64_t copied_bytes)>;
+
+  explicit FileCopier(Options options);
+
+  // Copies the regular file at source to destination, which must not exist,
+  // giving it the permission bits of source. A symbolic link at source is an
+  // absl::InvalidArgumentError, not followed. If the copy fails or is stopped,
+  // destination is removed again.
+  absl::StatusOr<Result> Copy(
+      const Glib::ustring &source, const Glib::ustring &destination,
+      const ProgressCallback &on_progress = nullptr) const;
+
+  // Copies the contents of the regular file open for reading as source_fd to
+  // the empty file open for writing as destination_fd.
+  absl::StatusOr<Result> CopyContents(
+      int source_fd, int destination_fd,
+      const ProgressCallback &on_progress = nullptr) const;
+
+ private:
+  // Copies the bytes from start up to end, at the same offsets, switching
+  // result.method to slower methods as needed. Sets end to where the source
+  // ended if it shrank while being copied. buffer is only allocated once
+  // reading and writing is needed, and kept for the following ranges.
+  absl::Status CopyRange(int source_fd, int destination_fd, uint64_t start,
+                         uint64_t &end, std::vector<char> &buffer,
+                         Result &result,
+                         const ProgressCallback &on_progress) const;
+
+  Options options_;
+};
+
+#endif  // FILE_COPIER_HPP
@@ -0,0 +1,169 @@
+#include "file_copier.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "temp_directory_test.hpp"
+
+namespace {
+
+constexpr CopyMethod kCopyMethods[] = {
+    CopyMethod::kReflink, CopyMethod::kCopyFileRange, CopyMethod::kSendfile,
+    CopyMethod::kReadWrite};
+
+class FileCopierTest : public TempDirectoryTest {
+ protected:
+  static std::string ReadFile(const std::string& path) {
+    std::ifstream file(path);
+    return std::string(std::istreambuf_iterator<char>(file), {});
+  }
+
+  static bool Exists(const std::string& path) {
+    return access(path.c_str(), F_OK) == 0;
+  }
+
+  static FileCopier MakeCopier(CopyMethod fastest_method,
+                               size_t chunk_size = 4096) {
+    FileCopier::Options options;
+    options.fastest_method = fastest_method;
+    options.chunk_size = chunk_size;
+    return FileCopier(options);
+  }
+};
+
+TEST_F(FileCopierTest, CopiesContentsAndPermissionsWithEveryMethod) {
+  std::string contents;
+  for (int i = 0; i < 5000; i++) contents += std::to_string(i);
+  const std::string source = CreateFile("source", contents, 0750);
+
+  for (CopyMethod method : kCopyMethods) {
+    SCOPED_TRACE(GetCopyMethodName(method));
+    const std::string destination =
+        GetPath("copy_" + std::to_string(static_cast<int>(method)));
+
+    absl::StatusOr<FileCopier::Result> result =
+        MakeCopier(method).Copy(source, destination);
+
+    ASSERT_TRUE(result.ok()) << result.status();
+    EXPECT_GE(result->method, method);
+    EXPECT_EQ(result->copied_bytes, contents.size());
+    EXPECT_EQ(ReadFile(destination), contents);
+    struct stat info;
+    ASSERT_EQ(stat(destination.c_str(), &info), 0);
+    EXPECT_EQ(info.st_mode & 0777, 0750 & ~umask(umask(0)));
+  }
+}
+
+TEST_F(FileCopierTest, CopiesEmptyFile) {
+  const std::string source = CreateFile("source", "");
+  const std::string destination = GetPath("copy");
+
+  absl::StatusOr<FileCopier::Result> result =
+      MakeCopier(CopyMethod::kCopyFileRange).Copy(source, destination);
+
+  ASSERT_TRUE(result.ok()) << result.status();
+  EXPECT_EQ(result->copied_bytes, 0);
+  EXPECT_TRUE(Exists(destination));
+  EXPECT_EQ(ReadFile(destination), "");
+}
+
+TEST_F(FileCopierTest, LeavesHolesOfSparseFiles) {
+  constexpr off_t kHoleSize = 1024 * 1024;
+  const std::string source = CreateFile("source", "start");
+  {
+    int fd = open(source.c_str(), O_WRONLY);
+    ASSERT_NE(fd, -1);
+    ASSERT_EQ(pwrite(fd, "end", 3, kHoleSize), 3);
+    close(fd);
+  }
+  struct stat source_info;
+  ASSERT_EQ(stat(source.c_str(), &source_info), 0);
+  if (source_info.st_blocks * 512 >= source_info.st_size)
+    GTEST_SKIP() << "The temporary directory does not support sparse files.";
+
+  for (CopyMethod method : {CopyMethod::kCopyFileRange, CopyMethod::kSendfile,
+                            CopyMethod::kReadWrite}) {
+    SCOPED_TRACE(GetCopyMethodName(method));
+    const std::string destination =
+        GetPath("copy_" + std::to_string(static_cast<int>(method)));
+
+    absl::StatusOr<FileCopier::Result> result =
+        MakeCopier(method).Copy(source, destination);
+
+    ASSERT_TRUE(result.ok()) << result.status();
+    EXPECT_LT(result->copied_bytes, kHoleSize);
+    struct stat info;
+    ASSERT_EQ(stat(destination.c_str(), &info), 0);
+    EXPECT_EQ(info.st_size, kHoleSize + 3);
+    EXPECT_LT(info.st_blocks * 512, kHoleSize);
+    const std::string copy = ReadFile(destination);
+    EXPECT_EQ(copy.substr(0, 5), "start");
+    EXPECT_EQ(copy.substr(kHoleSize), "end");
+    EXPECT_EQ(copy.find_first_not_of('\0', 5), kHoleSize);
+  }
+}
+
+TEST_F(FileCopierTest, DoesNotOverwriteDestination) {
+  const std::string source = CreateFile("source", "new");
+  const std::string destination = CreateFile("copy", "old");
+
+  absl::StatusOr<FileCopier::Result> result =
+      MakeCopier(CopyMethod::kReflink).Copy(source, destination);
+
+  EXPECT_EQ(result.status().code(), absl::StatusCode::kAlreadyExists);
+  EXPECT_EQ(ReadFile(destination), "old");
+}
+
+TEST_F(FileCopierTest, ReportsProgressAndRemovesStoppedCopy) {
+  const std::string source =
+      CreateFile("source", std::string(10 * 4096 + 1, 'x'));
+  const std::string destination = GetPath("copy");
+  std::vector<uint64_t> progress;
+
+  absl::StatusOr<FileCopier::Result> result =
+      MakeCopier(CopyMethod::kReadWrite)
+          .Copy(source, destination, [&progress](uint64_t copied_bytes) {
+            progress.push_back(copied_bytes);
+            return progress.size() < 3;
+          });
+
+  EXPECT_EQ(result.status().code(), absl::StatusCode::kCancelled);
+  EXPECT_EQ(progress, (std::vector<uint64_t>{4096, 8192, 12288}));
+  EXPECT_FALSE(Exists(destination));
+}
+
+TEST_F(FileCopierTest, RefusesToCopyDirectoriesAndMissingFiles) {
+  const std::string destination = GetPath("copy");
+  FileCopier copier = MakeCopier(CopyMethod::kReflink);
+
+  EXPECT_EQ(copier.Copy(root_, destination).status().code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(copier.Copy(root_ + "/nope", destination).status().code(),
+            absl::StatusCode::kNotFound);
+  EXPECT_FALSE(Exists(destination));
+}
+
+TEST_F(FileCopierTest, RefusesToFollowSymlinks) {
+  CreateFile("target", "contents");
+  ASSERT_EQ(symlink("target", GetPath("link").c_str()), 0);
+  const std::string destination = GetPath("copy");
+
+  EXPECT_EQ(MakeCopier(CopyMethod::kReflink)
+                .Copy(GetPath("link"), destination)
+                .status()
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_FALSE(Exists(destination));
+}
+
+}  // namespace
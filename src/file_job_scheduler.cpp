@@ -0,0 +1,499 @@
+#include "file_job_scheduler.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/strings/match.h>
+#include <absl/strings/str_cat.h>
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
+#include <glibmm/ustring.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "tree_walker.hpp"
+
+namespace {
+
+constexpr FileMetadataMask kCopiedMetadata =
+    kFileMetadataMode | kFileMetadataSize;
+
+// Weight of the latest measurement in the rate of copying reported. Lower
+// values keep the time left from jumping around as files of different sizes
+// go by.
+constexpr double kRateSmoothing = 0.3;
+
+std::string WithoutTrailingSlashes(std::string path) {
+  while (path.size() > 1 && path.back() == '/') path.pop_back();
+  return path;
+}
+
+std::string_view GetBaseName(std::string_view path) {
+  return path.substr(path.rfind('/') + 1);
+}
+
+absl::Status MakeUncopiableError(const std::string &path) {
+  return absl::InvalidArgumentError(absl::StrCat(
+      "Only files, directories and symbolic links can be copied: ", path));
+}
+
+}  // namespace
+
+FileJobScheduler::FileJobScheduler(const FileSystem &file_system,
+                                   const FileSystemWriter &writer,
+                                   Options options,
+                                   std::function<void()> notify)
+    : file_system_(file_system),
+      writer_(writer),
+      options_(options),
+      notify_(std::move(notify)) {
+  options_.io_concurrency = std::max<size_t>(options_.io_concurrency, 1);
+}
+
+FileJobScheduler::~FileJobScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &[id, job] : jobs_) {
+      job->is_cancelled = true;
+      job->tasks.clear();
+    }
+  }
+  job_changed_.notify_all();
+  for (auto &[id, job] : jobs_) job->thread.join();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_stopping_ = true;
+  }
+  task_ready_.notify_all();
+  for (std::thread &worker : workers_) worker.join();
+}
+
+FileJobScheduler::JobId FileJobScheduler::Start(
+    FileJobType type, std::vector<Glib::ustring> sources,
+    const Glib::ustring &destination_directory, ProgressCallback on_progress,
+    DoneCallback on_done) {
+  auto job = std::make_unique<Job>();
+  job->type = type;
+  job->sources = std::move(sources);
+  job->destination_directory = destination_directory;
+  job->on_progress = std::move(on_progress);
+  job->on_done = std::move(on_done);
+  job->rate_start_time = job->last_report_time = absl::Now();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  job->id = next_job_id_++;
+  Job &started_job = *job;
+  jobs_[job->id] = std::move(job);
+  while (workers_.size() < options_.io_concurrency)
+    workers_.emplace_back(&FileJobScheduler::RunWorker, this);
+  started_job.thread =
+      std::thread(&FileJobScheduler::RunJob, this, std::ref(started_job));
+  return started_job.id;
+}
+
+void FileJobScheduler::Pause(JobId job) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto paused_job = jobs_.find(job);
+  if (paused_job != jobs_.end()) paused_job->second->is_paused = true;
+}
+
+void FileJobScheduler::Resume(JobId job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto resumed_job = jobs_.find(job);
+    if (resumed_job == jobs_.end() || !resumed_job->second->is_paused) return;
+    Job &resumed = *resumed_job->second;
+    resumed.is_paused = false;
+    // Time spent paused does not count towards the rate of copying.
+    resumed.rate_start_time = absl::Now();
+    resumed.rate_start_bytes = resumed.progress.done_bytes;
+  }
+  job_changed_.notify_all();
+  task_ready_.notify_all();
+}
+
+void FileJobScheduler::Cancel(JobId job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto cancelled_job = jobs_.find(job);
+    if (cancelled_job == jobs_.end()) return;
+    cancelled_job->second->is_cancelled = true;
+    cancelled_job->second->tasks.clear();
+  }
+  job_changed_.notify_all();
+}
+
+void FileJobScheduler::SetIOConcurrency(size_t io_concurrency) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    options_.io_concurrency = std::max<size_t>(io_concurrency, 1);
+    // Workers are only started along with jobs, so that none wait around
+    // before there is anything to copy. Extra workers wait for the
+    // concurrency to grow again.
+    if (!jobs_.empty()) {
+      while (workers_.size() < options_.io_concurrency)
+        workers_.emplace_back(&FileJobScheduler::RunWorker, this);
+    }
+  }
+  task_ready_.notify_all();
+}
+
+void FileJobScheduler::DeliverResults() {
+  std::deque<Report> reports;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reports.swap(reports_);
+  }
+
+  // Jobs are only ever added and removed on this thread, so they can be
+  // looked at without holding mutex_.
+  for (Report &report : reports) {
+    auto job = jobs_.find(report.job);
+    if (job == jobs_.end()) continue;
+
+    if (report.progress.has_value() && job->second->on_progress) {
+      // Copied since on_progress may cancel jobs or start others.
+      ProgressCallback on_progress = job->second->on_progress;
+      on_progress(*report.progress);
+    }
+    if (report.status.has_value()) {
+      DoneCallback on_done = std::move(job->second->on_done);
+      job->second->thread.join();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.erase(job);
+      }
+      if (on_done) on_done(*report.status);
+    }
+  }
+}
+
+void FileJobScheduler::RunJob(Job &job) {
+  std::string destination_directory = job.destination_directory;
+  if (destination_directory.empty() || destination_directory.back() != '/')
+    destination_directory += '/';
+
+  absl::Status status;
+  for (const Glib::ustring &source : job.sources) {
+    if (job.is_cancelled) break;
+    const std::string source_path = WithoutTrailingSlashes(source);
+    if (job.type == FileJobType::kDelete) {
+      status = RemoveTree(job, source_path);
+      file_system_.InvalidatePath(source_path);
+      if (!status.ok()) break;
+      continue;
+    }
+    const std::string destination =
+        destination_directory + std::string(GetBaseName(source_path));
+    if (source_path == "/" ||
+        absl::StartsWith(destination_directory, source_path + "/")) {
+      status = absl::InvalidArgumentError(
+          absl::StrCat("Cannot copy a directory into itself: ", source_path));
+      break;
+    }
+
+    if (job.type == FileJobType::kMove) {
+      status = writer_.Rename(source_path, destination);
+      if (status.ok()) {
+        file_system_.InvalidatePath(source_path);
+        std::lock_guard<std::mutex> lock(mutex_);
+        job.progress.total_file_count++;
+        job.progress.done_file_count++;
+        continue;
+      }
+      // Sources on another file system are copied instead. Renames that fail
+      // for any other reason would fail the same way as copies.
+      if (!absl::IsFailedPrecondition(status)) break;
+    }
+
+    status = CopyTree(job, source_path, destination);
+    if (!status.ok()) break;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!status.ok() && !job.is_cancelled) FailJob(job, status);
+  job.progress.is_counting_done = true;
+  job_changed_.wait(lock, [&job]() {
+    return job.tasks.empty() && job.running_task_count == 0;
+  });
+
+  if (!job.is_cancelled) {
+    // Directories are moved once everything in them was, children first,
+    // and restricted once nothing more is copied into them.
+    std::vector<Glib::ustring> moved_directories =
+        std::move(job.moved_directories);
+    std::vector<std::pair<Glib::ustring, mode_t>> restricted_directories =
+        std::move(job.restricted_directories);
+    lock.unlock();
+    for (auto directory = moved_directories.rbegin();
+         status.ok() && directory != moved_directories.rend(); ++directory) {
+      status = writer_.RemoveDirectory(*directory);
+      if (status.ok()) file_system_.InvalidatePath(*directory);
+    }
+    for (const auto &[directory, mode] : restricted_directories) {
+      absl::Status mode_status = writer_.SetMode(directory, mode);
+      if (status.ok()) status = mode_status;
+    }
+    lock.lock();
+    if (!status.ok()) FailJob(job, status);
+  }
+
+  if (job.status.ok() && job.is_cancelled)
+    job.status = absl::CancelledError("Job was cancelled!");
+  ReportProgress(job, /*is_forced=*/true);
+  reports_.push_back({job.id, std::nullopt, job.status});
+  notify_();
+}
+
+absl::Status FileJobScheduler::CopyTree(Job &job, const std::string &source,
+                                        const std::string &destination) {
+  absl::StatusOr<FileMetadata> metadata =
+      file_system_.GetFileMetadata(source, kCopiedMetadata);
+  if (!metadata.ok()) return metadata.status();
+  if (S_ISREG(metadata->mode)) {
+    QueueTask(job, {source, destination, metadata->size});
+    return absl::OkStatus();
+  }
+  if (S_ISLNK(metadata->mode)) return CopySymlink(job, source, destination);
+  if (!S_ISDIR(metadata->mode)) return MakeUncopiableError(source);
+  absl::Status status =
+      CreateDirectory(job, source, destination, metadata->mode);
+  if (!status.ok()) return status;
+
+  TreeWalker::Options options;
+  options.thread_count = options_.walk_thread_count;
+  options.metadata_fields = kCopiedMetadata;
+  options.is_cancelled = &job.is_cancelled;
+  // Creating every directory before it is read makes sure it exists before
+  // any of its files is queued.
+  options.should_descend = [&](std::string_view path, const File &directory) {
+    const std::string relative_path(path);
+    absl::Status created =
+        CreateDirectory(job, absl::StrCat(source, "/", relative_path),
+                        absl::StrCat(destination, "/", relative_path),
+                        directory.GetMetadata().mode);
+    if (created.ok()) return true;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    FailJob(job, created);
+    return false;
+  };
+  TreeWalker walker(file_system_, options);
+  absl::StatusOr<TreeWalker::Stats> stats =
+      walker.Walk(source, [&](const TreeWalker::Directory &directory) {
+        const std::string path(directory.path);
+        for (File file : directory.files) {
+          if (file.IsDirectory()) continue;
+          const std::string relative_path = path + std::string(file.GetName());
+          QueueTask(job, {absl::StrCat(source, "/", relative_path),
+                          absl::StrCat(destination, "/", relative_path),
+                          file.GetMetadata().size});
+        }
+        absl::Status copied =
+            CopySpecialFiles(job, absl::StrCat(source, "/", path),
+                             absl::StrCat(destination, "/", path));
+        if (copied.ok()) return;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        FailJob(job, copied);
+      });
+  if (!stats.ok()) return stats.status();
+  if (stats->skipped_directory_count > 0)
+    return absl::UnavailableError(
+        absl::StrCat(stats->skipped_directory_count,
+                     " directories could not be read below ", source));
+  return absl::OkStatus();
+}
+
+absl::Status FileJobScheduler::CreateDirectory(Job &job,
+                                               const std::string &source,
+                                               const std::string &destination,
+                                               mode_t mode) {
+  // Files are copied into the directory whatever its permissions are.
+  absl::Status status = writer_.CreateDirectory(destination, mode | S_IRWXU);
+  if (!status.ok()) return status;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if ((mode & S_IRWXU) != S_IRWXU)
+    job.restricted_directories.emplace_back(destination, mode);
+  if (job.type == FileJobType::kMove) job.moved_directories.push_back(source);
+  return absl::OkStatus();
+}
+
+absl::Status FileJobScheduler::CopySpecialFiles(
+    Job &job, const std::string &source_directory,
+    const std::string &destination_directory) {
+  absl::StatusOr<std::vector<FileSystemWriter::SpecialFile>> special_files =
+      writer_.ListSpecialFiles(source_directory);
+  if (!special_files.ok()) return special_files.status();
+  for (const FileSystemWriter::SpecialFile &file : *special_files) {
+    if (job.is_cancelled) break;
+    const std::string source = source_directory + file.name;
+    if (!S_ISLNK(file.type)) return MakeUncopiableError(source);
+    absl::Status status =
+        CopySymlink(job, source, destination_directory + file.name);
+    if (!status.ok()) return status;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status FileJobScheduler::CopySymlink(Job &job, const std::string &source,
+                                           const std::string &destination) {
+  // Links are small enough to be copied on the thread of the walk instead of
+  // taking a worker.
+  absl::Status status = writer_.CopySymlink(source, destination);
+  if (status.ok() && job.type == FileJobType::kMove)
+    status = writer_.RemoveFile(source);
+  if (!status.ok()) return status;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  job.progress.total_file_count++;
+  job.progress.done_file_count++;
+  ReportProgress(job, /*is_forced=*/false);
+  return absl::OkStatus();
+}
+
+absl::Status FileJobScheduler::RemoveTree(Job &job, const std::string &path) {
+  uint64_t reported_count = 0;
+  return writer_.RemoveTree(
+      path, [this, &job, &reported_count](uint64_t removed_count) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // Files are only found as they are removed.
+        job.progress.done_file_count += removed_count - reported_count;
+        job.progress.total_file_count = job.progress.done_file_count;
+        reported_count = removed_count;
+        ReportProgress(job, /*is_forced=*/false);
+        job_changed_.wait(
+            lock, [&job]() { return !job.is_paused || job.is_cancelled; });
+        return !job.is_cancelled;
+      });
+}
+
+void FileJobScheduler::QueueTask(Job &job, CopyTask task) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  job_changed_.wait(lock, [this, &job]() {
+    return job.is_cancelled ||
+           job.tasks.size() < options_.max_queued_file_count;
+  });
+  if (job.is_cancelled) return;
+
+  job.progress.total_file_count++;
+  job.progress.total_bytes += task.size;
+  job.tasks.push_back(std::move(task));
+  ReportProgress(job, /*is_forced=*/false);
+  task_ready_.notify_one();
+}
+
+void FileJobScheduler::RunWorker() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    Job *job = nullptr;
+    task_ready_.wait(lock, [this, &job]() {
+      if (is_stopping_) return true;
+      if (running_task_count_ >= options_.io_concurrency) return false;
+      job = FindRunnableJob();
+      return job != nullptr;
+    });
+    if (is_stopping_) return;
+
+    CopyTask task = std::move(job->tasks.front());
+    job->tasks.pop_front();
+    job->running_task_count++;
+    running_task_count_++;
+    job_changed_.notify_all();
+    lock.unlock();
+
+    absl::Status status = RunTask(*job, task);
+
+    lock.lock();
+    job->running_task_count--;
+    running_task_count_--;
+    if (status.ok()) {
+      job->progress.done_file_count++;
+      ReportProgress(*job, /*is_forced=*/false);
+    } else if (!job->is_cancelled) {
+      FailJob(*job, status);
+    }
+    job_changed_.notify_all();
+    task_ready_.notify_one();
+  }
+}
+
+absl::Status FileJobScheduler::RunTask(Job &job, const CopyTask &task) {
+  uint64_t reported_bytes = 0;
+  absl::Status status = writer_.CopyFile(
+      task.source, task.destination,
+      [this, &job, &reported_bytes](uint64_t copied_bytes) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        job.progress.done_bytes += copied_bytes - reported_bytes;
+        reported_bytes = copied_bytes;
+        ReportProgress(job, /*is_forced=*/false);
+        job_changed_.wait(
+            lock, [&job]() { return !job.is_paused || job.is_cancelled; });
+        return !job.is_cancelled;
+      });
+  if (status.ok() && job.type == FileJobType::kMove)
+    status = writer_.RemoveFile(task.source);
+  return status;
+}
+
+FileJobScheduler::Job *FileJobScheduler::FindRunnableJob() {
+  auto is_runnable = [](const auto &job) {
+    return !job.second->is_paused && !job.second->tasks.empty();
+  };
+  auto job = std::find_if(jobs_.upper_bound(last_served_job_), jobs_.end(),
+                          is_runnable);
+  if (job == jobs_.end())
+    job = std::find_if(jobs_.begin(), jobs_.end(), is_runnable);
+  if (job == jobs_.end()) return nullptr;
+
+  last_served_job_ = job->first;
+  return job->second.get();
+}
+
+void FileJobScheduler::FailJob(Job &job, absl::Status status) {
+  if (job.status.ok()) job.status = std::move(status);
+  job.is_cancelled = true;
+  job.tasks.clear();
+  job_changed_.notify_all();
+}
+
+void FileJobScheduler::ReportProgress(Job &job, bool is_forced) {
+  const absl::Time now = absl::Now();
+  if (!is_forced && now - job.last_report_time < options_.progress_interval)
+    return;
+  job.last_report_time = now;
+
+  FileJobProgress &progress = job.progress;
+  const absl::Duration elapsed = now - job.rate_start_time;
+  if (elapsed >= options_.progress_interval && !job.is_paused) {
+    const double rate = (progress.done_bytes - job.rate_start_bytes) /
+                        absl::ToDoubleSeconds(elapsed);
+    progress.bytes_per_second =
+        progress.bytes_per_second == 0
+            ? rate
+            : kRateSmoothing * rate +
+                  (1 - kRateSmoothing) * progress.bytes_per_second;
+    job.rate_start_time = now;
+    job.rate_start_bytes = progress.done_bytes;
+  }
+  progress.remaining_time.reset();
+  if (progress.is_counting_done && progress.bytes_per_second > 0) {
+    progress.remaining_time = absl::Seconds(
+        (progress.total_bytes - std::min(progress.done_bytes,
+                                         progress.total_bytes)) /
+        progress.bytes_per_second);
+  }
+
+  reports_.push_back({job.id, progress, std::nullopt});
+  notify_();
+}
@@ -0,0 +1,227 @@
+#ifndef FILE_JOB_SCHEDULER_HPP
+#define FILE_JOB_SCHEDULER_HPP
+
+#include <absl/status/status.h>
+#include <absl/time/time.h>
+#include <glibmm/ustring.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "file_system_writer.hpp"
+#include "filesystem.hpp"
+
+enum class FileJobType { kCopy, kMove, kDelete };
+
+// How far along a job is, as last reported.
+struct FileJobProgress {
+  // Files found so far, which keeps growing until is_counting_done is set.
+  size_t total_file_count = 0;
+  uint64_t total_bytes = 0;
+  bool is_counting_done = false;
+  size_t done_file_count = 0;
+  uint64_t done_bytes = 0;
+  // Bytes copied per second lately, not counting time spent paused.
+  double bytes_per_second = 0;
+  // Time left at bytes_per_second. Empty until every file was found, or
+  // while nothing is being copied.
+  std::optional<absl::Duration> remaining_time;
+};
+
+// Copies and moves whole trees of files in the background. Copying a tree of
+// many small files one at a time is dominated by the latency of each file, so
+// each job walks its sources with a TreeWalker and hands every file it finds
+// to a pool of workers shared by all jobs, which copy that many files at once.
+// Directories are created as the walk finds them, before any file is queued
+// for them. Walks run ahead of the copies by at most max_queued_file_count
+// files per job.
+//
+// Moves rename each source with FileSystemWriter::Rename(), which costs the
+// same however large the source is. Sources on another file system than the
+// destination are copied instead, removing each file once it was copied, and
+// every directory once everything in it was. Sources renamed or removed are
+// invalidated in file_system, which may keep their directories open.
+//
+// Deletes remove each source with FileSystemWriter::RemoveTree() on the thread
+// of the job, which lists directories on threads of its own, so they never
+// take workers from copies. Their progress counts files and directories
+// removed, and pausing one holds it between two reports of the writer.
+//
+// FileSystem only lists regular files and directories, so the special files
+// of every directory copied are listed with
+// FileSystemWriter::ListSpecialFiles() as well. Symbolic links are recreated
+// with the same target, never followed, and any other kind of file, such as a
+// FIFO, stops the job. The first error stops the job, leaving whatever it
+// copied in place.
+//
+// Progress and the end of every job are queued for the thread that started
+// it, the same way DiskUsageScanner does. notify is called from worker
+// threads whenever some are waiting, and must arrange for DeliverResults() to
+// be called on the thread that started the jobs. notify must not call into
+// the scheduler itself.
+class FileJobScheduler {
+ public:
+  using JobId = uint64_t;
+  using ProgressCallback = std::function<void(const FileJobProgress &progress)>;
+  // Called once the job is over, with the error that stopped it, or an
+  // absl::CancelledError if it was cancelled.
+  using DoneCallback = std::function<void(absl::Status status)>;
+
+  struct Options {
+    // Files copied at once across every job. Fast SSDs keep up with many
+    // more requests in flight than spinning disks do.
+    size_t io_concurrency = 16;
+    // Threads listing the directories of each job.
+    size_t walk_thread_count = 4;
+    // Files a job may have waiting for a worker before its walk waits too.
+    size_t max_queued_file_count = 10000;
+    // How often the progress of each job is reported at most.
+    absl::Duration progress_interval = absl::Milliseconds(200);
+  };
+
+  // file_system and writer must outlive the scheduler, and be safe to use
+  // from multiple threads.
+  FileJobScheduler(const FileSystem &file_system,
+                   const FileSystemWriter &writer, Options options,
+                   std::function<void()> notify);
+
+  FileJobScheduler(const FileJobScheduler &) = delete;
+  FileJobScheduler &operator=(const FileJobScheduler &) = delete;
+
+  // Cancels every job and waits for every thread to finish.
+  ~FileJobScheduler();
+
+  // Copies or moves every file or directory at the full paths of sources into
+  // destination_directory, under the same names, or deletes them, ignoring
+  // destination_directory.
+  JobId Start(FileJobType type, std::vector<Glib::ustring> sources,
+              const Glib::ustring &destination_directory,
+              ProgressCallback on_progress, DoneCallback on_done);
+
+  // Pausing stops the job from starting to copy more files, and holds the
+  // files being copied where they are, keeping their workers. Does nothing
+  // for jobs that are over.
+  void Pause(JobId job);
+  void Resume(JobId job);
+  void Cancel(JobId job);
+
+  // Changes how many files are copied at once, from the next file on.
+  void SetIOConcurrency(size_t io_concurrency);
+
+  // Hands every progress report waiting to the on_progress of its job, and
+  // reports the end of the jobs that are over.
+  void DeliverResults();
+
+ private:
+  struct CopyTask {
+    Glib::ustring source;
+    Glib::ustring destination;
+    uint64_t size;
+  };
+
+  struct Job {
+    JobId id;
+    FileJobType type;
+    std::vector<Glib::ustring> sources;
+    Glib::ustring destination_directory;
+    std::atomic<bool> is_cancelled = false;
+    std::thread thread;
+    // Only used on the thread that started the job.
+    ProgressCallback on_progress;
+    DoneCallback on_done;
+
+    // Guarded by mutex_ of the scheduler.
+    bool is_paused = false;
+    std::deque<CopyTask> tasks;
+    size_t running_task_count = 0;
+    // First error, which stops the job.
+    absl::Status status;
+    FileJobProgress progress;
+    // Where the last report of the rate of copying started from.
+    absl::Time rate_start_time;
+    uint64_t rate_start_bytes = 0;
+    absl::Time last_report_time;
+    // Source directories of a move that was copied, parents first, to be
+    // removed once the copy is done.
+    std::vector<Glib::ustring> moved_directories;
+    // Directories created with more permissions than their source, so files
+    // could be copied into them, along with the mode they get in the end.
+    std::vector<std::pair<Glib::ustring, mode_t>> restricted_directories;
+  };
+
+  // What is waiting to be delivered for a job.
+  struct Report {
+    JobId job;
+    std::optional<FileJobProgress> progress;
+    std::optional<absl::Status> status;
+  };
+
+  // Run on the thread of each job.
+  void RunJob(Job &job);
+  // Copies the file or directory at source, and everything below it, to
+  // destination.
+  absl::Status CopyTree(Job &job, const std::string &source,
+                        const std::string &destination);
+  absl::Status CreateDirectory(Job &job, const std::string &source,
+                               const std::string &destination, mode_t mode);
+  // Recreates the symbolic links directly inside source_directory in
+  // destination_directory, both ending with a slash, and fails on any other
+  // special file.
+  absl::Status CopySpecialFiles(Job &job, const std::string &source_directory,
+                                const std::string &destination_directory);
+  absl::Status CopySymlink(Job &job, const std::string &source,
+                           const std::string &destination);
+  // Removes the file or directory at path, and everything below it.
+  absl::Status RemoveTree(Job &job, const std::string &path);
+  // Waits for room in the queue of job before adding task to it.
+  void QueueTask(Job &job, CopyTask task);
+
+  // Run on every worker thread.
+  void RunWorker();
+  absl::Status RunTask(Job &job, const CopyTask &task);
+  // Job with a task that can start, taking turns between jobs. Must be called
+  // with mutex_ held.
+  Job *FindRunnableJob();
+
+  // Stops job with status, unless it already failed. Must be called with
+  // mutex_ held.
+  void FailJob(Job &job, absl::Status status);
+  // Queues the progress of job if it was last reported long enough ago, or
+  // if is_forced. Must be called with mutex_ held.
+  void ReportProgress(Job &job, bool is_forced);
+
+  const FileSystem &file_system_;
+  const FileSystemWriter &writer_;
+  Options options_;
+  std::function<void()> notify_;
+
+  std::mutex mutex_;
+  // Signals workers that a task may be able to start.
+  std::condition_variable task_ready_;
+  // Signals jobs that their queue shrank or their tasks finished.
+  std::condition_variable job_changed_;
+  std::map<JobId, std::unique_ptr<Job>> jobs_;
+  JobId next_job_id_ = 1;
+  // Job the last task was taken from, so the next one is taken from the
+  // next job.
+  JobId last_served_job_ = 0;
+  size_t running_task_count_ = 0;
+  std::deque<Report> reports_;
+  bool is_stopping_ = false;
+  std::vector<std::thread> workers_;
+};
+
+#endif  // FILE_JOB_SCHEDULER_HPP
@@ -0,0 +1,493 @@
+#include "file_job_scheduler.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/time/time.h>
+#include <glibmm/ustring.h>
+#include <errno.h>
+#include <gtest/gtest.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "file_copier.hpp"
+#include "file_system_writer.hpp"
+#include "filesystem.hpp"
+#include "temp_directory_test.hpp"
+
+namespace {
+
+// Wraps a POSIXFileSystemWriter, counting the files it copied and how many it
+// copied at once. Renames can be made to fail, such as if the destination was
+// on another file system, and copies can be held before they start.
+class TestWriter : public FileSystemWriter {
+ public:
+  absl::Status CreateDirectory(const Glib::ustring& path,
+                               mode_t mode) const override {
+    return writer_.CreateDirectory(path, mode);
+  }
+  absl::Status SetMode(const Glib::ustring& path, mode_t mode) const override {
+    return writer_.SetMode(path, mode);
+  }
+  absl::Status CopyFile(
+      const Glib::ustring& source, const Glib::ustring& destination,
+      const CopyProgressCallback& on_progress) const override {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      started_copy_count_++;
+      running_copy_count_++;
+      max_running_copy_count_ =
+          std::max(max_running_copy_count_, running_copy_count_);
+      changed_.notify_all();
+      changed_.wait(lock, [this]() { return !is_holding_copies_; });
+    }
+    absl::Status status = on_progress(0)
+                              ? writer_.CopyFile(source, destination,
+                                                 on_progress)
+                              : absl::CancelledError("Stopped.");
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_copy_count_--;
+    return status;
+  }
+  absl::Status CopySymlink(const Glib::ustring& source,
+                           const Glib::ustring& destination) const override {
+    return writer_.CopySymlink(source, destination);
+  }
+  absl::StatusOr<std::vector<SpecialFile>> ListSpecialFiles(
+      const Glib::ustring& directory) const override {
+    return writer_.ListSpecialFiles(directory);
+  }
+  absl::Status Rename(const Glib::ustring& source,
+                      const Glib::ustring& destination) const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!rename_error_.ok()) return rename_error_;
+    return writer_.Rename(source, destination);
+  }
+  absl::Status RemoveFile(const Glib::ustring& path) const override {
+    return writer_.RemoveFile(path);
+  }
+  absl::Status RemoveDirectory(const Glib::ustring& path) const override {
+    return writer_.RemoveDirectory(path);
+  }
+  absl::Status RemoveTree(
+      const Glib::ustring& path,
+      const RemoveProgressCallback& on_progress) const override {
+    return writer_.RemoveTree(path, on_progress);
+  }
+
+  // Makes every rename fail with error, unless it is OK.
+  void SetRenameError(absl::Status error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    rename_error_ = std::move(error);
+  }
+  void HoldCopies(bool is_holding_copies) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_holding_copies_ = is_holding_copies;
+    changed_.notify_all();
+  }
+  // Waits for count copies to have started.
+  void WaitForCopies(int count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock,
+                  [this, count]() { return started_copy_count_ >= count; });
+  }
+  int GetStartedCopyCount() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return started_copy_count_;
+  }
+  int GetMaxRunningCopyCount() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_running_copy_count_;
+  }
+
+ private:
+  POSIXFileSystemWriter writer_;
+  mutable std::mutex mutex_;
+  mutable std::condition_variable changed_;
+  absl::Status rename_error_;
+  bool is_holding_copies_ = false;
+  mutable int started_copy_count_ = 0;
+  mutable int running_copy_count_ = 0;
+  mutable int max_running_copy_count_ = 0;
+};
+
+// Runs jobs on trees of real files. The test thread delivers results like a
+// main loop would.
+class FileJobSchedulerTest : public TempDirectoryTest {
+ protected:
+  FileJobScheduler MakeScheduler(size_t io_concurrency = 4) {
+    FileJobScheduler::Options options;
+    options.io_concurrency = io_concurrency;
+    options.walk_thread_count = 2;
+    options.max_queued_file_count = 2;
+    options.progress_interval = absl::ZeroDuration();
+    return FileJobScheduler(file_system_, writer_, options, [this]() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_notifications_++;
+      notified_.notify_one();
+    });
+  }
+
+  // Starts a job, runs it to the end and returns how it ended, keeping the
+  // last progress delivered in progress_.
+  absl::Status Run(FileJobScheduler& scheduler, FileJobType type,
+                   std::vector<Glib::ustring> sources,
+                   const Glib::ustring& destination_directory) {
+    Start(scheduler, type, std::move(sources), destination_directory);
+    return Finish(scheduler);
+  }
+
+  FileJobScheduler::JobId Start(FileJobScheduler& scheduler, FileJobType type,
+                                std::vector<Glib::ustring> sources,
+                                const Glib::ustring& destination_directory) {
+    status_.reset();
+    return scheduler.Start(
+        type, std::move(sources), destination_directory,
+        [this](const FileJobProgress& progress) { progress_ = progress; },
+        [this](absl::Status status) { status_ = status; });
+  }
+
+  // Delivers results until the job started last is over, and returns how it
+  // ended.
+  absl::Status Finish(FileJobScheduler& scheduler) {
+    while (!status_.has_value()) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        EXPECT_TRUE(notified_.wait_for(
+            lock, std::chrono::seconds(10),
+            [this]() { return pending_notifications_ > 0; }))
+            << "Timed out waiting for the job.";
+        if (pending_notifications_ == 0) return absl::DeadlineExceededError("");
+        pending_notifications_ = 0;
+      }
+      scheduler.DeliverResults();
+    }
+    return *status_;
+  }
+
+  // Creates src/ with a.txt, dir/b.txt and dir/sub/c.txt, 13 bytes in all.
+  void CreateTree() {
+    CreateDirectory("src");
+    CreateFile("src/a.txt", "aaaa");
+    CreateDirectory("src/dir");
+    CreateFile("src/dir/b.txt", "bbbbbbbb", 0600);
+    CreateDirectory("src/dir/sub");
+    CreateFile("src/dir/sub/c.txt", "c");
+    CreateDirectory("dst");
+  }
+
+  std::string ReadFile(const std::string& path) {
+    std::ifstream file(GetPath(path));
+    return std::string(std::istreambuf_iterator<char>(file), {});
+  }
+
+  bool Exists(const std::string& path) {
+    return access(GetPath(path).c_str(), F_OK) == 0;
+  }
+
+  // Target of the symbolic link at path, or an empty string if it is not one.
+  std::string ReadLink(const std::string& path) {
+    char target[PATH_MAX];
+    const ssize_t length =
+        readlink(GetPath(path).c_str(), target, sizeof(target));
+    return length == -1 ? "" : std::string(target, length);
+  }
+
+  // Adds links to a file, to a directory and to nothing to the tree.
+  void CreateSymlinks() {
+    symlink("a.txt", GetPath("src/file_link").c_str());
+    symlink("dir", GetPath("src/dir_link").c_str());
+    symlink("missing", GetPath("src/dir/sub/dangling_link").c_str());
+  }
+
+  mode_t GetMode(const std::string& path) {
+    struct stat info;
+    EXPECT_EQ(stat(GetPath(path).c_str(), &info), 0) << path;
+    return info.st_mode & 07777;
+  }
+
+  POSIXFileSystem file_system_;
+  TestWriter writer_;
+  std::mutex mutex_;
+  std::condition_variable notified_;
+  int pending_notifications_ = 0;
+  FileJobProgress progress_;
+  std::optional<absl::Status> status_;
+};
+
+TEST_F(FileJobSchedulerTest, CopiesTreesAndFiles) {
+  CreateTree();
+  CreateFile("single.txt", "single");
+  FileJobScheduler scheduler = MakeScheduler();
+
+  absl::Status status =
+      Run(scheduler, FileJobType::kCopy,
+          {GetPath("src/"), GetPath("single.txt")}, GetPath("dst"));
+
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_EQ(ReadFile("dst/src/a.txt"), "aaaa");
+  EXPECT_EQ(ReadFile("dst/src/dir/b.txt"), "bbbbbbbb");
+  EXPECT_EQ(ReadFile("dst/src/dir/sub/c.txt"), "c");
+  EXPECT_EQ(ReadFile("dst/single.txt"), "single");
+  EXPECT_EQ(GetMode("dst/src/dir/b.txt"), 0600);
+  EXPECT_EQ(ReadFile("src/a.txt"), "aaaa");
+  EXPECT_EQ(progress_.total_file_count, 4);
+  EXPECT_EQ(progress_.done_file_count, 4);
+  EXPECT_EQ(progress_.total_bytes, 19);
+  EXPECT_EQ(progress_.done_bytes, 19);
+  EXPECT_TRUE(progress_.is_counting_done);
+}
+
+TEST_F(FileJobSchedulerTest, CopiesIntoReadOnlyDirectories) {
+  CreateTree();
+  chmod((GetPath("src/dir")).c_str(), 0555);
+  FileJobScheduler scheduler = MakeScheduler();
+
+  absl::Status status =
+      Run(scheduler, FileJobType::kCopy, {GetPath("src")}, GetPath("dst/"));
+
+  EXPECT_TRUE(status.ok()) << status;
+  EXPECT_EQ(ReadFile("dst/src/dir/sub/c.txt"), "c");
+  EXPECT_EQ(GetMode("dst/src/dir"), 0555);
+  // Lets the fixture remove both trees.
+  chmod((GetPath("src/dir")).c_str(), 0755);
+  chmod((GetPath("dst/src/dir")).c_str(), 0755);
+}
+
+TEST_F(FileJobSchedulerTest, MovesByRenaming) {
+  CreateTree();
+  FileJobScheduler scheduler = MakeScheduler();
+
+  absl::Status status =
+      Run(scheduler, FileJobType::kMove, {GetPath("src")}, GetPath("dst"));
+
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_EQ(writer_.GetStartedCopyCount(), 0);
+  EXPECT_FALSE(Exists("src"));
+  EXPECT_EQ(ReadFile("dst/src/dir/sub/c.txt"), "c");
+}
+
+TEST_F(FileJobSchedulerTest, InvalidatesMovedDirectories) {
+  CreateTree();
+  ASSERT_TRUE(file_system_.GetDirectoryFiles(GetPath("src/dir")).ok());
+  FileJobScheduler scheduler = MakeScheduler();
+
+  absl::Status status =
+      Run(scheduler, FileJobType::kMove, {GetPath("src")}, GetPath("dst"));
+  ASSERT_TRUE(status.ok()) << status;
+  CreateDirectory("src");
+  CreateDirectory("src/dir");
+
+  absl::StatusOr<DirectoryListing> files =
+      file_system_.GetDirectoryFiles(GetPath("src/dir"));
+  ASSERT_TRUE(files.ok()) << files.status();
+  EXPECT_TRUE(files->empty());
+}
+
+TEST_F(FileJobSchedulerTest, MovesToOtherFileSystemsByCopying) {
+  CreateTree();
+  writer_.SetRenameError(MakeFileError("renameat2()", EXDEV));
+  FileJobScheduler scheduler = MakeScheduler();
+
+  absl::Status status =
+      Run(scheduler, FileJobType::kMove, {GetPath("src")}, GetPath("dst"));
+
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_EQ(writer_.GetStartedCopyCount(), 3);
+  EXPECT_FALSE(Exists("src"));
+  EXPECT_EQ(ReadFile("dst/src/a.txt"), "aaaa");
+  EXPECT_EQ(ReadFile("dst/src/dir/b.txt"), "bbbbbbbb");
+  EXPECT_EQ(ReadFile("dst/src/dir/sub/c.txt"), "c");
+}
+
+TEST_F(FileJobSchedulerTest, StopsWhenRenamingFailsOnSameFileSystem) {
+  CreateTree();
+  writer_.SetRenameError(MakeFileError("renameat2()", ENOTDIR));
+  FileJobScheduler scheduler = MakeScheduler();
+
+  EXPECT_EQ(
+      Run(scheduler, FileJobType::kMove, {GetPath("src")}, GetPath("dst"))
+          .code(),
+      absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(writer_.GetStartedCopyCount(), 0);
+  EXPECT_FALSE(Exists("dst/src"));
+  EXPECT_EQ(ReadFile("src/a.txt"), "aaaa");
+}
+
+TEST_F(FileJobSchedulerTest, CopiesSymlinksWithoutFollowingThem) {
+  CreateTree();
+  CreateSymlinks();
+  FileJobScheduler scheduler = MakeScheduler();
+
+  absl::Status status =
+      Run(scheduler, FileJobType::kCopy,
+          {GetPath("src"), GetPath("src/dir_link")}, GetPath("dst"));
+
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_EQ(ReadLink("dst/src/file_link"), "a.txt");
+  EXPECT_EQ(ReadLink("dst/src/dir_link"), "dir");
+  EXPECT_EQ(ReadLink("dst/src/dir/sub/dangling_link"), "missing");
+  EXPECT_EQ(ReadLink("dst/dir_link"), "dir");
+  EXPECT_EQ(ReadFile("dst/src/dir/b.txt"), "bbbbbbbb");
+  EXPECT_EQ(writer_.GetStartedCopyCount(), 3);
+  EXPECT_EQ(progress_.done_file_count, 7);
+}
+
+TEST_F(FileJobSchedulerTest, MovesSymlinksToOtherFileSystems) {
+  CreateTree();
+  CreateSymlinks();
+  writer_.SetRenameError(MakeFileError("renameat2()", EXDEV));
+  FileJobScheduler scheduler = MakeScheduler();
+
+  absl::Status status =
+      Run(scheduler, FileJobType::kMove, {GetPath("src")}, GetPath("dst"));
+
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_FALSE(Exists("src"));
+  EXPECT_EQ(ReadLink("dst/src/file_link"), "a.txt");
+  EXPECT_EQ(ReadFile("dst/src/file_link"), "aaaa");
+  EXPECT_EQ(ReadLink("dst/src/dir_link"), "dir");
+  EXPECT_EQ(ReadLink("dst/src/dir/sub/dangling_link"), "missing");
+}
+
+TEST_F(FileJobSchedulerTest, StopsAtOtherSpecialFiles) {
+  CreateTree();
+  ASSERT_EQ(mkfifo(GetPath("src/dir/fifo").c_str(), 0644), 0);
+  FileJobScheduler scheduler = MakeScheduler();
+
+  EXPECT_EQ(
+      Run(scheduler, FileJobType::kCopy, {GetPath("src")}, GetPath("dst"))
+          .code(),
+      absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(Run(scheduler, FileJobType::kCopy, {GetPath("src/dir/fifo")},
+                GetPath("dst"))
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_FALSE(Exists("dst/src/dir/fifo"));
+  EXPECT_FALSE(Exists("dst/fifo"));
+}
+
+TEST_F(FileJobSchedulerTest, StopsAtExistingDestination) {
+  CreateTree();
+  CreateDirectory("dst/src");
+  CreateFile("dst/src/a.txt", "old");
+  FileJobScheduler scheduler = MakeScheduler();
+
+  EXPECT_EQ(Run(scheduler, FileJobType::kCopy, {GetPath("src/a.txt")},
+                GetPath("dst/src"))
+                .code(),
+            absl::StatusCode::kAlreadyExists);
+  EXPECT_EQ(Run(scheduler, FileJobType::kMove, {GetPath("src")}, GetPath("dst"))
+                .code(),
+            absl::StatusCode::kAlreadyExists);
+  EXPECT_EQ(ReadFile("dst/src/a.txt"), "old");
+  EXPECT_EQ(ReadFile("src/a.txt"), "aaaa");
+}
+
+TEST_F(FileJobSchedulerTest, RefusesToCopyDirectoryIntoItself) {
+  CreateTree();
+  FileJobScheduler scheduler = MakeScheduler();
+
+  EXPECT_EQ(Run(scheduler, FileJobType::kCopy, {GetPath("src")},
+                GetPath("src/dir"))
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(
+      Run(scheduler, FileJobType::kMove, {GetPath("src")}, GetPath("src"))
+          .code(),
+      absl::StatusCode::kInvalidArgument);
+  EXPECT_FALSE(Exists("src/dir/src"));
+  EXPECT_FALSE(Exists("src/src"));
+}
+
+TEST_F(FileJobSchedulerTest, DeletesTreesAndFiles) {
+  CreateTree();
+  CreateFile("single.txt", "single");
+  FileJobScheduler scheduler = MakeScheduler();
+
+  absl::Status status = Run(scheduler, FileJobType::kDelete,
+                            {GetPath("src/"), GetPath("single.txt")}, "");
+
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_FALSE(Exists("src"));
+  EXPECT_FALSE(Exists("single.txt"));
+  EXPECT_TRUE(Exists("dst"));
+  EXPECT_EQ(writer_.GetStartedCopyCount(), 0);
+  EXPECT_EQ(progress_.total_file_count, 7);
+  EXPECT_EQ(progress_.done_file_count, 7);
+  EXPECT_TRUE(progress_.is_counting_done);
+  EXPECT_EQ(
+      Run(scheduler, FileJobType::kDelete, {GetPath("src")}, "").code(),
+      absl::StatusCode::kNotFound);
+}
+
+TEST_F(FileJobSchedulerTest, CopiesAsManyFilesAtOnceAsAllowed) {
+  CreateDirectory("src");
+  for (int i = 0; i < 6; i++) CreateFile("src/" + std::to_string(i), "x");
+  CreateDirectory("dst");
+  FileJobScheduler scheduler = MakeScheduler(/*io_concurrency=*/3);
+  writer_.HoldCopies(true);
+
+  Start(scheduler, FileJobType::kCopy, {GetPath("src")}, GetPath("dst"));
+  writer_.WaitForCopies(3);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(writer_.GetStartedCopyCount(), 3);
+  writer_.HoldCopies(false);
+  absl::Status status = Finish(scheduler);
+
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_EQ(writer_.GetStartedCopyCount(), 6);
+  EXPECT_EQ(writer_.GetMaxRunningCopyCount(), 3);
+}
+
+TEST_F(FileJobSchedulerTest, PausesAndResumes) {
+  CreateTree();
+  FileJobScheduler scheduler = MakeScheduler(/*io_concurrency=*/1);
+  writer_.HoldCopies(true);
+
+  FileJobScheduler::JobId job =
+      Start(scheduler, FileJobType::kCopy, {GetPath("src")}, GetPath("dst"));
+  writer_.WaitForCopies(1);
+  scheduler.Pause(job);
+  writer_.HoldCopies(false);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(writer_.GetStartedCopyCount(), 1);
+  scheduler.Resume(job);
+  absl::Status status = Finish(scheduler);
+
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_EQ(writer_.GetStartedCopyCount(), 3);
+  EXPECT_EQ(ReadFile("dst/src/dir/sub/c.txt"), "c");
+}
+
+TEST_F(FileJobSchedulerTest, CancelsPausedJob) {
+  CreateTree();
+  FileJobScheduler scheduler = MakeScheduler(/*io_concurrency=*/1);
+  writer_.HoldCopies(true);
+
+  FileJobScheduler::JobId job =
+      Start(scheduler, FileJobType::kCopy, {GetPath("src")}, GetPath("dst"));
+  writer_.WaitForCopies(1);
+  scheduler.Pause(job);
+  writer_.HoldCopies(false);
+  scheduler.Cancel(job);
+
+  EXPECT_EQ(Finish(scheduler).code(), absl::StatusCode::kCancelled);
+  EXPECT_EQ(writer_.GetStartedCopyCount(), 1);
+  EXPECT_EQ(progress_.done_file_count, 0);
+}
+
+}  // namespace
@@ -0,0 +1,838 @@
+#include "file_search_index.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/strings/ascii.h>
+#include <absl/strings/str_cat.h>
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glibmm/ustring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+#include "fuzzy_matcher.hpp"
+
+namespace {
+
+constexpr size_t kTrigramLength = 3;
+
+char FoldCase(char c) { return absl::ascii_tolower(static_cast<uint8_t>(c)); }
+
+std::string FoldCase(std::string_view text) {
+  std::string folded(text);
+  for (char &c : folded) c = FoldCase(c);
+  return folded;
+}
+
+// Packs the three bytes at text, with their case folded, into one key.
+uint32_t GetTrigram(const char *text) {
+  return static_cast<uint32_t>(static_cast<uint8_t>(FoldCase(text[0])))
+             << 16 |
+         static_cast<uint32_t>(static_cast<uint8_t>(FoldCase(text[1]))) << 8 |
+         static_cast<uint32_t>(static_cast<uint8_t>(FoldCase(text[2])));
+}
+
+// Replaces trigrams with the distinct trigrams of text, sorted.
+void GetTrigrams(std::string_view text, std::vector<uint32_t> &trigrams) {
+  trigrams.clear();
+  for (size_t i = 0; i + kTrigramLength <= text.size(); i++)
+    trigrams.push_back(GetTrigram(text.data() + i));
+  std::sort(trigrams.begin(), trigrams.end());
+  trigrams.erase(std::unique(trigrams.begin(), trigrams.end()),
+                 trigrams.end());
+}
+
+// One number for every possible trigram, zero until set. Trigrams sharing
+// their first byte share a page, which is only allocated once one of them is
+// used. Names mostly start their trigrams with a few dozen distinct bytes, so
+// this takes a few megabytes where a flat table would take 64.
+class TrigramTable {
+ public:
+  static constexpr size_t kPageCount = 1 << 8;
+  static constexpr size_t kPageSize = 1 << 16;
+
+  uint32_t &operator[](uint32_t trigram) {
+    std::unique_ptr<uint32_t[]> &page = pages_[trigram >> 16];
+    if (page == nullptr) page.reset(new uint32_t[kPageSize]());
+    return page[trigram & (kPageSize - 1)];
+  }
+
+  // Returns the page of trigrams starting with first_byte, or nullptr if none
+  // of them was used.
+  uint32_t *GetPage(size_t first_byte) { return pages_[first_byte].get(); }
+
+ private:
+  std::array<std::unique_ptr<uint32_t[]>, kPageCount> pages_;
+};
+
+bool ContainsFolded(std::string_view name, std::string_view folded_query) {
+  return std::search(name.begin(), name.end(), folded_query.begin(),
+                     folded_query.end(), [](char name_char, char query_char) {
+                       return FoldCase(name_char) == query_char;
+                     }) != name.end();
+}
+
+// How far ahead of the name being scored a fuzzy search asks for names to be
+// loaded into the cache.
+constexpr size_t kPrefetchedCandidateCount = 8;
+
+// Directory modification times this close to the start of a walk are not
+// trusted, since file systems may store them too coarsely for a change made
+// right after to move them.
+constexpr absl::Duration kModificationTimeGranularity = absl::Seconds(2);
+
+// Identifies index files, followed by the version of their format, which
+// changes along with the layout of anything saved.
+constexpr char kFileMagic[8] = {'E', '7', 'F', 'I', 'N', 'D', 'E', 'X'};
+constexpr uint32_t kFileFormatVersion = 2;
+// Sections start at multiples of this, so every array in a mapped file is
+// aligned for its element type.
+constexpr size_t kFileSectionAlignment = 8;
+
+// A range of bytes of an index file.
+struct FileSection {
+  uint64_t offset;
+  uint64_t size;
+};
+
+// Start of an index file. It is followed by the sections of every shard, and
+// then by the data of every section.
+struct FileHeader {
+  char magic[sizeof(kFileMagic)];
+  uint32_t version;
+  uint32_t shard_count;
+  // Of every byte of the file after this field.
+  uint64_t checksum;
+  uint64_t file_size;
+  int64_t build_time;
+  uint64_t skipped_directory_count;
+  FileSection root;
+  FileSection directory_paths;
+  FileSection directories;
+};
+
+struct FileShardSections {
+  FileSection names;
+  FileSection entries;
+  FileSection name_masks;
+  FileSection trigrams;
+  FileSection posting_offsets;
+  FileSection postings;
+};
+
+constexpr size_t kChecksummedOffset = offsetof(FileHeader, file_size);
+
+// 64-bit checksum of bytes fed to it in pieces of any size. Mixes in eight
+// bytes at a time, so checking an index stays much faster than reading it
+// from disk.
+class Checksum {
+ public:
+  void Update(std::string_view bytes) {
+    while (!bytes.empty() && pending_size_ > 0) {
+      AddPendingByte(bytes.front());
+      bytes.remove_prefix(1);
+    }
+    for (; bytes.size() >= sizeof(uint64_t);
+         bytes.remove_prefix(sizeof(uint64_t))) {
+      uint64_t word;
+      memcpy(&word, bytes.data(), sizeof(word));
+      Mix(word);
+    }
+    for (char byte : bytes) AddPendingByte(byte);
+  }
+
+  uint64_t GetValue() const {
+    Checksum last = *this;
+    // Zeroes left pending are told apart from zeroes that were fed.
+    last.Mix(last.pending_word_);
+    last.Mix(last.size_);
+    return last.state_;
+  }
+
+ private:
+  void AddPendingByte(char byte) {
+    pending_word_ |= static_cast<uint64_t>(static_cast<uint8_t>(byte))
+                     << (8 * pending_size_);
+    if (++pending_size_ < sizeof(uint64_t)) return;
+
+    Mix(pending_word_);
+    pending_word_ = 0;
+    pending_size_ = 0;
+  }
+
+  void Mix(uint64_t word) {
+    state_ ^= word * 0x9e3779b97f4a7c15;
+    state_ = (state_ << 27 | state_ >> 37) * 0xc2b2ae3d27d4eb4f;
+    size_ += sizeof(word);
+  }
+
+  uint64_t state_ = 0;
+  uint64_t size_ = 0;
+  uint64_t pending_word_ = 0;
+  size_t pending_size_ = 0;
+};
+
+size_t AlignSectionSize(size_t size) {
+  return (size + kFileSectionAlignment - 1) / kFileSectionAlignment *
+         kFileSectionAlignment;
+}
+
+template <typename T>
+std::string_view GetBytes(absl::Span<const T> values) {
+  return std::string_view(reinterpret_cast<const char *>(values.data()),
+                          values.size() * sizeof(T));
+}
+
+template <typename T>
+absl::Span<const T> ViewAs(std::string_view bytes) {
+  return absl::Span<const T>(reinterpret_cast<const T *>(bytes.data()),
+                             bytes.size() / sizeof(T));
+}
+
+absl::Status WriteAll(int fd, std::string_view bytes) {
+  while (!bytes.empty()) {
+    ssize_t bytes_written = write(fd, bytes.data(), bytes.size());
+    if (bytes_written == -1 && errno == EINTR) continue;
+    if (bytes_written == -1)
+      return absl::InternalError(absl::StrCat("write(): ", strerror(errno)));
+    bytes.remove_prefix(bytes_written);
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+class FileSearchIndex::MappedFile {
+ public:
+  MappedFile(void *data, size_t size) : data_(data), size_(size) {}
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile() { munmap(data_, size_); }
+
+  std::string_view GetData() const {
+    return std::string_view(static_cast<const char *>(data_), size_);
+  }
+
+ private:
+  void *data_;
+  size_t size_;
+};
+
+FileSearchIndex::FileSearchIndex() = default;
+FileSearchIndex::FileSearchIndex(FileSearchIndex &&) = default;
+FileSearchIndex &FileSearchIndex::operator=(FileSearchIndex &&) = default;
+FileSearchIndex::~FileSearchIndex() = default;
+
+absl::StatusOr<FileSearchIndex> FileSearchIndex::Build(
+    const FileSystem &file_system, const Glib::ustring &root,
+    size_t thread_count, const std::atomic<bool> *is_cancelled) {
+  return Walk(file_system, root, thread_count, nullptr, is_cancelled);
+}
+
+absl::StatusOr<FileSearchIndex> FileSearchIndex::Update(
+    const FileSearchIndex &previous, const FileSystem &file_system,
+    size_t thread_count, const std::atomic<bool> *is_cancelled) {
+  return Walk(file_system, previous.root_, thread_count, &previous,
+              is_cancelled);
+}
+
+absl::StatusOr<FileSearchIndex> FileSearchIndex::Walk(
+    const FileSystem &file_system, const Glib::ustring &root,
+    size_t thread_count, const FileSearchIndex *previous,
+    const std::atomic<bool> *is_cancelled) {
+  std::string root_path = root;
+  if (root_path.empty() || root_path.back() != '/') root_path += '/';
+  const absl::Time build_time = absl::Now();
+
+  // Directories of previous by path, to find the ones that can be copied.
+  std::unordered_map<std::string_view, const Directory *> previous_directories;
+  if (previous != nullptr) {
+    for (const Directory &directory : previous->directories_)
+      previous_directories[previous->GetDirectoryPath(directory)] = &directory;
+  }
+
+  auto data = std::make_unique<Data>();
+  data->shards.resize(std::max<size_t>(thread_count, 1));
+  data->directories.emplace_back();
+
+  // Directories waiting to be read, shared by every thread.
+  struct {
+    std::mutex mutex;
+    std::condition_variable changed;
+    // Relative paths of data->directories.
+    std::vector<std::string> directory_paths = {""};
+    std::deque<uint32_t> queued_directories = {0};
+    // Threads reading a directory, which may queue more.
+    size_t busy_threads = 0;
+    absl::Status root_status;
+    size_t skipped_directory_count = 0;
+    size_t read_directory_count = 0;
+  } walk;
+
+  auto is_walk_cancelled = [is_cancelled]() {
+    return is_cancelled != nullptr && *is_cancelled;
+  };
+
+  // Returns the modification time of path in nanoseconds, or
+  // kUnknownModificationTime if it cannot be trusted to tell later changes
+  // apart.
+  auto get_modification_time = [&](const std::string &path) {
+    absl::StatusOr<FileMetadata> metadata =
+        file_system.GetFileMetadata(path, kFileMetadataModificationTime);
+    if (!metadata.ok() ||
+        !(metadata->filled_fields & kFileMetadataModificationTime) ||
+        metadata->modification_time >
+            build_time - kModificationTimeGranularity)
+      return kUnknownModificationTime;
+    return absl::ToUnixNanos(metadata->modification_time);
+  };
+
+  auto build_shard = [&](uint32_t shard_index) {
+    ShardData &shard = data->shards[shard_index];
+    std::vector<std::string> subdirectories;
+    auto add_file = [&](std::string_view name, uint32_t directory,
+                        bool is_directory) {
+      shard.entries.push_back(
+          {directory, static_cast<uint32_t>(shard.names.size()),
+           static_cast<uint16_t>(name.size()),
+           static_cast<uint8_t>(is_directory ? kEntryIsDirectory : 0)});
+      shard.names.append(name);
+      if (is_directory) subdirectories.emplace_back(name);
+    };
+
+    std::unique_lock<std::mutex> lock(walk.mutex);
+    while (true) {
+      walk.changed.wait(lock, [&]() {
+        return !walk.queued_directories.empty() || walk.busy_threads == 0 ||
+               is_walk_cancelled();
+      });
+      if (walk.queued_directories.empty() || is_walk_cancelled()) break;
+
+      const uint32_t directory = walk.queued_directories.front();
+      walk.queued_directories.pop_front();
+      const std::string relative_path = walk.directory_paths[directory];
+      walk.busy_threads++;
+      lock.unlock();
+
+      const std::string path = root_path + relative_path;
+      const int64_t modification_time = get_modification_time(path);
+      auto previous_directory = previous_directories.find(relative_path);
+      const uint32_t first_entry = shard.entries.size();
+      subdirectories.clear();
+
+      absl::Status status;
+      bool was_read = false;
+      if (previous_directory != previous_directories.end() &&
+          modification_time != kUnknownModificationTime &&
+          previous_directory->second->modification_time ==
+              modification_time) {
+        const Directory &previous_files = *previous_directory->second;
+        const Shard &previous_shard = previous->shards_[previous_files.shard];
+        for (const Entry &entry : previous_shard.entries.subspan(
+                 previous_files.first_entry, previous_files.entry_count)) {
+          add_file(previous_shard.names.substr(entry.name_offset,
+                                               entry.name_length),
+                   directory, entry.flags & kEntryIsDirectory);
+        }
+      } else {
+        absl::StatusOr<DirectoryListing> files =
+            file_system.GetDirectoryFiles(path);
+        status = files.status();
+        was_read = true;
+        if (files.ok()) {
+          for (File file : *files)
+            add_file(file.GetName(), directory, file.IsDirectory());
+        }
+      }
+
+      lock.lock();
+      walk.busy_threads--;
+      if (was_read) walk.read_directory_count++;
+      if (!status.ok() && directory == 0)
+        walk.root_status = status;
+      else if (!status.ok())
+        walk.skipped_directory_count++;
+
+      Directory &record = data->directories[directory];
+      record.modification_time =
+          status.ok() ? modification_time : kUnknownModificationTime;
+      record.shard = shard_index;
+      record.first_entry = first_entry;
+      record.entry_count = shard.entries.size() - first_entry;
+
+      for (const std::string &name : subdirectories) {
+        walk.queued_directories.push_back(data->directories.size());
+        walk.directory_paths.push_back(relative_path + name + '/');
+        data->directories.emplace_back();
+      }
+      walk.changed.notify_all();
+    }
+    lock.unlock();
+    // Wakes up threads waiting for directories that will never come.
+    walk.changed.notify_all();
+
+    if (!is_walk_cancelled()) IndexShard(shard);
+  };
+
+  std::vector<std::thread> threads;
+  for (uint32_t i = 1; i < data->shards.size(); i++)
+    threads.emplace_back(build_shard, i);
+  build_shard(0);
+  for (std::thread &thread : threads) thread.join();
+
+  if (is_walk_cancelled())
+    return absl::CancelledError("Search index build was cancelled!");
+  if (!walk.root_status.ok()) return walk.root_status;
+
+  for (size_t i = 0; i < data->directories.size(); i++) {
+    data->directories[i].path_offset = data->directory_paths.size();
+    data->directories[i].path_length = walk.directory_paths[i].size();
+    data->directory_paths += walk.directory_paths[i];
+  }
+
+  FileSearchIndex index;
+  index.root_ = root_path;
+  index.build_time_ = build_time;
+  index.skipped_directory_count_ = walk.skipped_directory_count;
+  index.read_directory_count_ = walk.read_directory_count;
+  index.SetData(std::move(data));
+  return index;
+}
+
+void FileSearchIndex::IndexShard(ShardData &shard) {
+  auto get_name = [&shard](const Entry &entry) {
+    return std::string_view(shard.names.data() + entry.name_offset,
+                            entry.name_length);
+  };
+
+  shard.name_masks.reserve(shard.entries.size());
+  for (const Entry &entry : shard.entries)
+    shard.name_masks.push_back(FuzzyMatcher::GetCharacterMask(get_name(entry)));
+
+  // Lays out the postings with a counting sort: the entries containing each
+  // trigram are counted first, which gives every trigram its range of
+  // postings, and then entries are written to their ranges in increasing
+  // order. Unlike sorting (trigram, entry) pairs, this needs no memory besides
+  // the postings themselves.
+  TrigramTable table;
+  std::vector<uint32_t> trigrams;
+  for (const Entry &entry : shard.entries) {
+    GetTrigrams(get_name(entry), trigrams);
+    for (uint32_t trigram : trigrams) table[trigram]++;
+  }
+
+  uint32_t posting_count = 0;
+  for (size_t first_byte = 0; first_byte < TrigramTable::kPageCount;
+       first_byte++) {
+    uint32_t *page = table.GetPage(first_byte);
+    if (page == nullptr) continue;
+
+    for (size_t rest = 0; rest < TrigramTable::kPageSize; rest++) {
+      if (page[rest] == 0) continue;
+
+      shard.trigrams.push_back(first_byte << 16 | rest);
+      shard.posting_offsets.push_back(posting_count);
+      // From here on, the table holds where the next entry goes.
+      posting_count += std::exchange(page[rest], posting_count);
+    }
+  }
+  shard.posting_offsets.push_back(posting_count);
+
+  shard.postings.resize(posting_count);
+  for (uint32_t i = 0; i < shard.entries.size(); i++) {
+    GetTrigrams(get_name(shard.entries[i]), trigrams);
+    for (uint32_t trigram : trigrams) shard.postings[table[trigram]++] = i;
+  }
+}
+
+std::vector<uint32_t> FileSearchIndex::GetCandidates(
+    const Shard &shard, std::string_view folded_query) {
+  std::vector<uint32_t> candidates;
+
+  // Too short to have a trigram, so every name has to be looked at.
+  if (folded_query.size() < kTrigramLength) {
+    candidates.resize(shard.entries.size());
+    for (uint32_t i = 0; i < candidates.size(); i++) candidates[i] = i;
+    return candidates;
+  }
+
+  struct PostingList {
+    const uint32_t *begin;
+    const uint32_t *end;
+  };
+  std::vector<uint32_t> trigrams;
+  GetTrigrams(folded_query, trigrams);
+  std::vector<PostingList> posting_lists;
+  for (uint32_t trigram : trigrams) {
+    auto found = std::lower_bound(shard.trigrams.begin(), shard.trigrams.end(),
+                                  trigram);
+    if (found == shard.trigrams.end() || *found != trigram) return candidates;
+
+    const size_t i = found - shard.trigrams.begin();
+    posting_lists.push_back(
+        {shard.postings.data() + shard.posting_offsets[i],
+         shard.postings.data() + shard.posting_offsets[i + 1]});
+  }
+
+  // Starting from the shortest list keeps every intersection below as small
+  // as the rarest trigram.
+  std::sort(posting_lists.begin(), posting_lists.end(),
+            [](const PostingList &left, const PostingList &right) {
+              return left.end - left.begin < right.end - right.begin;
+            });
+  candidates.assign(posting_lists[0].begin, posting_lists[0].end);
+  for (size_t i = 1; i < posting_lists.size() && !candidates.empty(); i++) {
+    const uint32_t *posting = posting_lists[i].begin;
+    size_t kept = 0;
+    for (uint32_t candidate : candidates) {
+      posting = std::lower_bound(posting, posting_lists[i].end, candidate);
+      if (posting == posting_lists[i].end) break;
+      if (*posting == candidate) candidates[kept++] = candidate;
+    }
+    candidates.resize(kept);
+  }
+  return candidates;
+}
+
+void FileSearchIndex::Search(std::string_view query, size_t batch_size,
+                             const ResultCallback &callback) const {
+  const std::string folded_query = FoldCase(query);
+
+  DirectoryListing results;
+  for (const Shard &shard : shards_) {
+    for (uint32_t candidate : GetCandidates(shard, folded_query)) {
+      const Entry &entry = shard.entries[candidate];
+      const std::string_view name(shard.names.data() + entry.name_offset,
+                                  entry.name_length);
+      if (!ContainsFolded(name, folded_query)) continue;
+
+      results.Add(
+          std::string(GetDirectoryPath(directories_[entry.directory])) +
+              std::string(name),
+          entry.flags & kEntryIsDirectory);
+      if (results.size() < batch_size) continue;
+
+      if (!callback(results)) return;
+      results.Clear();
+    }
+  }
+  if (!results.empty()) callback(results);
+}
+
+void FileSearchIndex::SearchFuzzy(std::string_view query,
+                                  size_t max_result_count, size_t batch_size,
+                                  const ResultCallback &callback) const {
+  struct Match {
+    int score;
+    uint32_t shard;
+    uint32_t entry;
+    uint16_t name_length;
+  };
+  if (max_result_count == 0) return;
+
+  // Shorter names break ties, since fewer characters went unmatched.
+  auto is_better = [](const Match &left, const Match &right) {
+    return std::tie(right.score, left.name_length, left.shard, left.entry) <
+           std::tie(left.score, right.name_length, right.shard, right.entry);
+  };
+  // Only keeps the best max_result_count matches once there are twice as
+  // many, so broad queries neither hold nor sort a match for every name.
+  // Matches scoring below the worst one kept are dropped right away.
+  std::vector<Match> matches;
+  int min_score = std::numeric_limits<int>::min();
+  auto drop_worse_matches = [&]() {
+    if (matches.size() <= max_result_count) return;
+    std::nth_element(matches.begin(), matches.begin() + max_result_count,
+                     matches.end(), is_better);
+    matches.resize(max_result_count);
+    min_score = std::min_element(matches.begin(), matches.end(),
+                                 [](const Match &left, const Match &right) {
+                                   return left.score < right.score;
+                                 })
+                    ->score;
+  };
+
+  const FuzzyMatcher matcher(query);
+  std::vector<uint32_t> candidates;
+  for (uint32_t i = 0; i < shards_.size(); i++) {
+    const Shard &shard = shards_[i];
+    candidates.clear();
+    matcher.FilterCandidates(shard.name_masks, candidates);
+
+    const char *names_end = shard.names.data() + shard.names.size();
+    for (size_t j = 0; j < candidates.size(); j++) {
+      // Candidates are spread over the names, so most names are not cached
+      // yet. Asking for the ones a few candidates ahead overlaps the waits.
+      if (j + kPrefetchedCandidateCount < candidates.size()) {
+        const Entry &next_entry =
+            shard.entries[candidates[j + kPrefetchedCandidateCount]];
+        __builtin_prefetch(shard.names.data() + next_entry.name_offset);
+      }
+      const uint32_t candidate = candidates[j];
+      const Entry &entry = shard.entries[candidate];
+      std::optional<int> score = matcher.Score(
+          shard.names.substr(entry.name_offset, entry.name_length), names_end);
+      if (!score.has_value() || *score < min_score) continue;
+
+      matches.push_back({*score, i, candidate, entry.name_length});
+      if (matches.size() >= 2 * max_result_count) drop_worse_matches();
+    }
+  }
+  drop_worse_matches();
+  std::sort(matches.begin(), matches.end(), is_better);
+
+  DirectoryListing results;
+  for (const Match &match : matches) {
+    const Shard &shard = shards_[match.shard];
+    const Entry &entry = shard.entries[match.entry];
+    results.Add(std::string(GetDirectoryPath(directories_[entry.directory])) +
+                    std::string(shard.names.substr(entry.name_offset,
+                                                   entry.name_length)),
+                entry.flags & kEntryIsDirectory);
+    if (results.size() < batch_size) continue;
+
+    if (!callback(results)) return;
+    results.Clear();
+  }
+  if (!results.empty()) callback(results);
+}
+
+absl::Status FileSearchIndex::Save(const std::string &path) const {
+  struct Section {
+    std::string_view bytes;
+    FileSection *location;
+  };
+
+  FileHeader header = {};
+  memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+  header.version = kFileFormatVersion;
+  header.shard_count = shards_.size();
+  header.build_time = absl::ToUnixNanos(build_time_);
+  header.skipped_directory_count = skipped_directory_count_;
+
+  const std::string root = root_;
+  std::vector<FileShardSections> shard_sections(shards_.size());
+  std::vector<Section> sections = {
+      {root, &header.root},
+      {directory_paths_, &header.directory_paths},
+      {GetBytes(directories_), &header.directories}};
+  for (size_t i = 0; i < shards_.size(); i++) {
+    const Shard &shard = shards_[i];
+    FileShardSections &locations = shard_sections[i];
+    sections.push_back({shard.names, &locations.names});
+    sections.push_back({GetBytes(shard.entries), &locations.entries});
+    sections.push_back({GetBytes(shard.name_masks), &locations.name_masks});
+    sections.push_back({GetBytes(shard.trigrams), &locations.trigrams});
+    sections.push_back(
+        {GetBytes(shard.posting_offsets), &locations.posting_offsets});
+    sections.push_back({GetBytes(shard.postings), &locations.postings});
+  }
+
+  uint64_t offset = AlignSectionSize(
+      sizeof(FileHeader) + shard_sections.size() * sizeof(FileShardSections));
+  for (const Section &section : sections) {
+    *section.location = {offset, section.bytes.size()};
+    offset += AlignSectionSize(section.bytes.size());
+  }
+  header.file_size = offset;
+
+  // Everything up to the first section, padded with zeroes.
+  std::string head(sections.empty() ? offset : sections[0].location->offset,
+                   '\0');
+  memcpy(head.data(), &header, sizeof(header));
+  memcpy(head.data() + sizeof(header), shard_sections.data(),
+         shard_sections.size() * sizeof(FileShardSections));
+  const std::string padding(kFileSectionAlignment, '\0');
+
+  Checksum checksum;
+  checksum.Update(std::string_view(head).substr(kChecksummedOffset));
+  for (const Section &section : sections) {
+    checksum.Update(section.bytes);
+    checksum.Update(std::string_view(padding).substr(
+        0, AlignSectionSize(section.bytes.size()) - section.bytes.size()));
+  }
+  header.checksum = checksum.GetValue();
+  memcpy(head.data(), &header, sizeof(header));
+
+  // Written next to path and renamed over it, so a reader never maps a half
+  // written index.
+  std::string temporary_path = path + ".XXXXXX";
+  int fd = mkostemp(temporary_path.data(), O_CLOEXEC);
+  if (fd == -1)
+    return absl::InternalError(
+        absl::StrCat("Can't create search index: ", strerror(errno)));
+
+  absl::Status status = WriteAll(fd, head);
+  for (const Section &section : sections) {
+    if (!status.ok()) break;
+    status = WriteAll(fd, section.bytes);
+    if (status.ok())
+      status = WriteAll(fd, std::string_view(padding).substr(
+                                0, AlignSectionSize(section.bytes.size()) -
+                                       section.bytes.size()));
+  }
+  if (close(fd) == -1 && status.ok())
+    status = absl::InternalError(absl::StrCat("close(): ", strerror(errno)));
+  if (status.ok() && rename(temporary_path.c_str(), path.c_str()) == -1)
+    status = absl::InternalError(absl::StrCat("rename(): ", strerror(errno)));
+
+  if (!status.ok()) unlink(temporary_path.c_str());
+  return status;
+}
+
+absl::StatusOr<FileSearchIndex> FileSearchIndex::Load(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return absl::NotFoundError(
+        absl::StrCat("Can't open search index: ", strerror(errno)));
+
+  struct stat file_info;
+  if (fstat(fd, &file_info) == -1) {
+    close(fd);
+    return absl::InternalError(absl::StrCat("fstat(): ", strerror(errno)));
+  }
+  const size_t file_size = file_info.st_size;
+  if (file_size < sizeof(FileHeader)) {
+    close(fd);
+    return absl::DataLossError("Search index is truncated!");
+  }
+
+  void *data = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return absl::InternalError(absl::StrCat("mmap(): ", strerror(errno)));
+  auto mapped_file = std::make_unique<MappedFile>(data, file_size);
+  const std::string_view file = mapped_file->GetData();
+
+  FileHeader header;
+  memcpy(&header, file.data(), sizeof(header));
+  if (memcmp(header.magic, kFileMagic, sizeof(kFileMagic)) != 0)
+    return absl::DataLossError("Not a search index!");
+  if (header.version != kFileFormatVersion)
+    return absl::FailedPreconditionError(
+        absl::StrCat("Search index has format version ", header.version,
+                     " instead of ", kFileFormatVersion, "!"));
+  if (header.file_size != file_size)
+    return absl::DataLossError("Search index is truncated!");
+
+  Checksum checksum;
+  checksum.Update(file.substr(kChecksummedOffset));
+  if (checksum.GetValue() != header.checksum)
+    return absl::DataLossError("Search index is corrupt!");
+
+  // The checksum only proves the file is as it was written, so sections are
+  // still checked to lie within it.
+  bool is_valid = sizeof(FileHeader) + uint64_t{header.shard_count} *
+                                           sizeof(FileShardSections) <=
+                  file_size;
+  auto get_section = [&](const FileSection &section, size_t element_size) {
+    if (section.offset % kFileSectionAlignment != 0 ||
+        section.offset > file_size ||
+        section.size > file_size - section.offset ||
+        section.size % element_size != 0) {
+      is_valid = false;
+      return std::string_view();
+    }
+    return file.substr(section.offset, section.size);
+  };
+
+  FileSearchIndex index;
+  index.root_ = std::string(get_section(header.root, 1));
+  index.build_time_ = absl::FromUnixNanos(header.build_time);
+  index.skipped_directory_count_ = header.skipped_directory_count;
+  index.directory_paths_ = get_section(header.directory_paths, 1);
+  index.directories_ = ViewAs<Directory>(
+      get_section(header.directories, sizeof(Directory)));
+  for (uint32_t i = 0; is_valid && i < header.shard_count; i++) {
+    FileShardSections sections;
+    memcpy(&sections,
+           file.data() + sizeof(FileHeader) + i * sizeof(FileShardSections),
+           sizeof(sections));
+    index.shards_.push_back(
+        {get_section(sections.names, 1),
+         ViewAs<Entry>(get_section(sections.entries, sizeof(Entry))),
+         ViewAs<uint32_t>(get_section(sections.name_masks, sizeof(uint32_t))),
+         ViewAs<uint32_t>(get_section(sections.trigrams, sizeof(uint32_t))),
+         ViewAs<uint32_t>(
+             get_section(sections.posting_offsets, sizeof(uint32_t))),
+         ViewAs<uint32_t>(get_section(sections.postings, sizeof(uint32_t)))});
+  }
+  if (!is_valid) return absl::DataLossError("Search index is corrupt!");
+
+  index.mapped_file_ = std::move(mapped_file);
+  return index;
+}
+
+void FileSearchIndex::SetData(std::unique_ptr<Data> data) {
+  directory_paths_ = data->directory_paths;
+  directories_ = data->directories;
+  shards_.clear();
+  for (const ShardData &shard : data->shards) {
+    shards_.push_back({shard.names, shard.entries, shard.name_masks,
+                       shard.trigrams, shard.posting_offsets, shard.postings});
+  }
+  data_ = std::move(data);
+}
+
+std::string_view FileSearchIndex::GetDirectoryPath(
+    const Directory &directory) const {
+  return directory_paths_.substr(directory.path_offset, directory.path_length);
+}
+
+const Glib::ustring &FileSearchIndex::GetRoot() const { return root_; }
+
+absl::Time FileSearchIndex::GetBuildTime() const { return build_time_; }
+
+size_t FileSearchIndex::GetFileCount() const {
+  size_t file_count = 0;
+  for (const Shard &shard : shards_) file_count += shard.entries.size();
+  return file_count;
+}
+
+size_t FileSearchIndex::GetSkippedDirectoryCount() const {
+  return skipped_directory_count_;
+}
+
+size_t FileSearchIndex::GetReadDirectoryCount() const {
+  return read_directory_count_;
+}
+
+size_t FileSearchIndex::GetMemoryUsage() const {
+  size_t memory_usage = shards_.capacity() * sizeof(Shard);
+  if (mapped_file_ != nullptr)
+    return memory_usage + mapped_file_->GetData().size();
+
+  memory_usage += data_->directory_paths.capacity() +
+                  data_->directories.capacity() * sizeof(Directory);
+  for (const ShardData &shard : data_->shards) {
+    memory_usage += shard.names.capacity() +
+                    shard.entries.capacity() * sizeof(Entry) +
+                    (shard.name_masks.capacity() + shard.trigrams.capacity() +
+                     shard.posting_offsets.capacity() +
+                     shard.postings.capacity()) *
+                        sizeof(uint32_t);
+  }
+  return memory_usage;
+}
@@ -0,0 +1,212 @@
+#ifndef FILE_SEARCH_INDEX_HPP
+#define FILE_SEARCH_INDEX_HPP
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/time/time.h>
+#include <absl/types/span.h>
+#include <glibmm/ustring.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "filesystem.hpp"
+
+// Index of the names of every file below a directory, answering substring
+// queries without looking at every name.
+//
+// Every name is broken into its trigrams, its runs of three bytes, and each
+// trigram keeps the sorted list of files whose name contains it. A query only
+// looks at the files on the lists of all of its own trigrams, and checks those
+// few names for the whole query. ASCII letters are matched ignoring their
+// case. Other bytes, including those of multibyte UTF-8 characters, have to
+// match exactly.
+//
+// The index is split into shards, one per thread that built it, each holding
+// the files that thread read along with their trigrams. Shards are built
+// without any coordination besides sharing out the directories to read.
+//
+// Besides substrings, the index answers fuzzy queries, ranking every name
+// holding the characters of the query in order by FuzzyMatcher's score. Each
+// name keeps its FuzzyMatcher character mask, so those only look closer at
+// names having every character of the query.
+//
+// An index can be saved to a file and mapped back into memory later. The file
+// holds the index exactly as it is searched, so loading it parses nothing.
+class FileSearchIndex {
+ public:
+  // Receives one batch of matching files. Their names are paths relative to
+  // the root of the index. Returning false stops the search.
+  using ResultCallback = std::function<bool(const DirectoryListing &results)>;
+
+  FileSearchIndex(FileSearchIndex &&);
+  FileSearchIndex &operator=(FileSearchIndex &&);
+  ~FileSearchIndex();
+
+  // Indexes every file below root, which must be a full path, reading
+  // directories from file_system on thread_count threads. Directories below
+  // root that cannot be read are left out. Returns the error from reading root
+  // itself if that fails, or an absl::CancelledError once is_cancelled is set,
+  // if given.
+  static absl::StatusOr<FileSearchIndex> Build(
+      const FileSystem &file_system, const Glib::ustring &root,
+      size_t thread_count, const std::atomic<bool> *is_cancelled = nullptr);
+
+  // Same as Build() for the root of previous, but only reads the directories
+  // that changed since previous was built. Every directory is still checked
+  // for a new modification time, which costs one metadata lookup each, so a
+  // directory that changed anywhere in the tree is found. Files of unchanged
+  // directories are copied from previous.
+  static absl::StatusOr<FileSearchIndex> Update(
+      const FileSearchIndex &previous, const FileSystem &file_system,
+      size_t thread_count, const std::atomic<bool> *is_cancelled = nullptr);
+
+  // Writes the index to the file at path. Any file already there is only
+  // replaced once the whole index was written.
+  absl::Status Save(const std::string &path) const;
+
+  // Maps an index written by Save() into memory. Searches read the mapped
+  // file directly, so pages are only read from disk once searches touch them,
+  // besides being read once to verify the file's checksum. Returns an
+  // absl::DataLossError if the file is truncated or corrupt, and an
+  // absl::FailedPreconditionError if it was written in another format version.
+  static absl::StatusOr<FileSearchIndex> Load(const std::string &path);
+
+  // Hands every file whose name contains query to callback, in batches of at
+  // most batch_size files. An empty query matches every file.
+  void Search(std::string_view query, size_t batch_size,
+              const ResultCallback &callback) const;
+
+  // Hands the max_result_count files whose name matches query best, as
+  // scored by FuzzyMatcher, to callback in batches of at most batch_size
+  // files, best first. Ties go to shorter names.
+  void SearchFuzzy(std::string_view query, size_t max_result_count,
+                   size_t batch_size, const ResultCallback &callback) const;
+
+  const Glib::ustring &GetRoot() const;
+  // When the index started reading its directories. Changes made after it are
+  // not in the index.
+  absl::Time GetBuildTime() const;
+  // Number of files and directories indexed, not counting the root.
+  size_t GetFileCount() const;
+  // Number of directories below the root that could not be read.
+  size_t GetSkippedDirectoryCount() const;
+  // Number of directories read by the Build() or Update() that made the
+  // index, rather than copied from a previous index. Zero once loaded.
+  size_t GetReadDirectoryCount() const;
+  // Bytes of memory held by the index, including a mapped file.
+  size_t GetMemoryUsage() const;
+
+ private:
+  enum EntryFlags : uint8_t {
+    kEntryIsDirectory = 1 << 0,
+  };
+
+  // Entries and directories are saved to disk as they are, so their layout is
+  // part of the file format.
+  struct Entry {
+    // Index into directories_ of the directory holding the file.
+    uint32_t directory;
+    uint32_t name_offset;
+    uint16_t name_length;
+    uint8_t flags;
+    uint8_t padding;
+  };
+  static_assert(sizeof(Entry) == 12);
+
+  struct Directory {
+    // Path relative to the root in directory_paths_, ending with a slash. The
+    // root itself has the empty path.
+    uint32_t path_offset;
+    uint32_t path_length;
+    // In nanoseconds since the Unix epoch, taken right before the directory
+    // was read, or kUnknownModificationTime if it could not be trusted to
+    // change along with the directory.
+    int64_t modification_time;
+    // Files of the directory, which are next to each other in one shard.
+    uint32_t shard;
+    uint32_t first_entry;
+    uint32_t entry_count;
+    uint32_t padding;
+  };
+  static_assert(sizeof(Directory) == 32);
+
+  // Files read by one thread, along with their trigrams. Views either a
+  // ShardData, or a mapped file.
+  struct Shard {
+    // Every name back to back, without separators.
+    std::string_view names;
+    absl::Span<const Entry> entries;
+    // FuzzyMatcher::GetCharacterMask() of the name of each entry.
+    absl::Span<const uint32_t> name_masks;
+
+    // Sorted trigrams found in the names of entries. The entries containing
+    // trigrams[i] are postings[posting_offsets[i]] up to
+    // postings[posting_offsets[i + 1]], in increasing order.
+    absl::Span<const uint32_t> trigrams;
+    absl::Span<const uint32_t> posting_offsets;
+    absl::Span<const uint32_t> postings;
+  };
+
+  // Memory behind the views of an index that was built rather than loaded.
+  struct ShardData {
+    std::string names;
+    std::vector<Entry> entries;
+    std::vector<uint32_t> name_masks;
+    std::vector<uint32_t> trigrams;
+    std::vector<uint32_t> posting_offsets;
+    std::vector<uint32_t> postings;
+  };
+  struct Data {
+    std::string directory_paths;
+    std::vector<Directory> directories;
+    std::vector<ShardData> shards;
+  };
+
+  class MappedFile;
+
+  static constexpr int64_t kUnknownModificationTime = INT64_MIN;
+
+  FileSearchIndex();
+
+  // Builds the index of root, copying the files of directories unchanged since
+  // previous, if given, was built.
+  static absl::StatusOr<FileSearchIndex> Walk(
+      const FileSystem &file_system, const Glib::ustring &root,
+      size_t thread_count, const FileSearchIndex *previous,
+      const std::atomic<bool> *is_cancelled);
+
+  // Fills in the name masks and trigrams of a shard whose entries are all
+  // added.
+  static void IndexShard(ShardData &shard);
+
+  // Indices of entries of shard whose name may contain folded_query, in
+  // increasing order.
+  static std::vector<uint32_t> GetCandidates(const Shard &shard,
+                                             std::string_view folded_query);
+
+  // Takes ownership of data and points the views at it.
+  void SetData(std::unique_ptr<Data> data);
+  std::string_view GetDirectoryPath(const Directory &directory) const;
+
+  Glib::ustring root_;
+  absl::Time build_time_;
+  size_t skipped_directory_count_ = 0;
+  size_t read_directory_count_ = 0;
+
+  std::string_view directory_paths_;
+  absl::Span<const Directory> directories_;
+  std::vector<Shard> shards_;
+
+  // Exactly one of these backs the views above.
+  std::unique_ptr<Data> data_;
+  std::unique_ptr<MappedFile> mapped_file_;
+};
+
+#endif  // FILE_SEARCH_INDEX_HPP
@@ -0,0 +1,354 @@
+#include "file_search_index.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
+#include <glibmm/ustring.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <ios>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "filesystem.hpp"
+
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::UnorderedElementsAre;
+using ::testing::UnorderedElementsAreArray;
+
+// Forwards to one of two file systems, standing in for one file system before
+// and after some of its directories changed. Directories report the
+// modification times set for them, and the Unix epoch otherwise.
+class ChangingFileSystem : public FileSystem {
+ public:
+  ChangingFileSystem(const FileSystem& before, const FileSystem& after)
+      : before_(before), after_(after) {}
+
+  void Change() { has_changed_ = true; }
+  void SetModificationTime(const std::string& path, absl::Time time) {
+    modification_times_[path] = time;
+  }
+
+  absl::StatusOr<DirectoryListing> GetDirectoryFiles(
+      const Glib::ustring& directory) const override {
+    return GetCurrent().GetDirectoryFiles(directory);
+  }
+  absl::Status CheckDirectory(const Glib::ustring& directory) const override {
+    return GetCurrent().CheckDirectory(directory);
+  }
+  absl::Status StreamDirectoryFiles(
+      const Glib::ustring& directory, size_t batch_size,
+      const FileBatchCallback& callback) const override {
+    return GetCurrent().StreamDirectoryFiles(directory, batch_size, callback);
+  }
+  absl::Status FillFileMetadata(const Glib::ustring& directory,
+                                DirectoryListing& files,
+                                FileMetadataMask fields) const override {
+    return GetCurrent().FillFileMetadata(directory, files, fields);
+  }
+  absl::StatusOr<FileMetadata> GetFileMetadata(
+      const Glib::ustring& path, FileMetadataMask fields) const override {
+    absl::StatusOr<FileMetadata> metadata =
+        GetCurrent().GetFileMetadata(path, fields);
+    auto modification_time = modification_times_.find(path);
+    if (metadata.ok() && modification_time != modification_times_.end())
+      metadata->modification_time = modification_time->second;
+    return metadata;
+  }
+
+ private:
+  const FileSystem& GetCurrent() const {
+    return has_changed_ ? after_ : before_;
+  }
+
+  const FileSystem& before_;
+  const FileSystem& after_;
+  bool has_changed_ = false;
+  std::map<std::string, absl::Time> modification_times_;
+};
+
+class FileSearchIndexTest : public ::testing::Test {
+ protected:
+  FileSearchIndexTest()
+      : file_system_(
+            {new MockFile("Meow.txt"), new MockFile("woof.txt"),
+             new MockDirectory(
+                 "cats",
+                 {new MockFile("meow_meow.png"), new MockFile("purr.txt"),
+                  new MockDirectory("kittens", {new MockFile("mew.txt"),
+                                                new MockFile("xmeowx")})}),
+             new MockDirectory("dogs", {new MockFile("bark.txt"),
+                                       new MockFile("bcabc")}),
+             new MockDirectory("empty", {})}) {}
+
+  // Returns the relative path of every match of query, with a trailing slash
+  // for directories.
+  static std::vector<std::string> Search(const FileSearchIndex& index,
+                                         std::string_view query) {
+    std::vector<std::string> paths;
+    index.Search(query, /*batch_size=*/100,
+                 [&paths](const DirectoryListing& results) {
+                   for (File file : results) {
+                     paths.emplace_back(file.GetName());
+                     if (file.IsDirectory()) paths.back() += '/';
+                   }
+                   return true;
+                 });
+    return paths;
+  }
+
+  static std::vector<std::string> SearchFuzzy(const FileSearchIndex& index,
+                                              std::string_view query,
+                                              size_t max_result_count) {
+    std::vector<std::string> paths;
+    index.SearchFuzzy(query, max_result_count, /*batch_size=*/1,
+                      [&paths](const DirectoryListing& results) {
+                        for (File file : results)
+                          paths.emplace_back(file.GetName());
+                        return true;
+                      });
+    return paths;
+  }
+
+  static std::string GetIndexPath() {
+    return ::testing::TempDir() + "/file_search_index_test.index";
+  }
+
+  // Overwrites the bytes of the file at path starting at offset.
+  static void OverwriteFile(const std::string& path, std::streamoff offset,
+                            const std::string& bytes) {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(offset);
+    file.write(bytes.data(), bytes.size());
+  }
+
+  MockFileSystem file_system_;
+};
+
+TEST_F(FileSearchIndexTest, FindsFilesInEverySubdirectory) {
+  absl::StatusOr<FileSearchIndex> index =
+      FileSearchIndex::Build(file_system_, "/", /*thread_count=*/2);
+  ASSERT_TRUE(index.ok());
+
+  EXPECT_EQ(index->GetFileCount(), 12);
+  EXPECT_EQ(index->GetSkippedDirectoryCount(), 0);
+  EXPECT_GT(index->GetMemoryUsage(), 0);
+  EXPECT_THAT(Search(*index, "meow"),
+              UnorderedElementsAre("Meow.txt", "cats/meow_meow.png",
+                                   "cats/kittens/xmeowx"));
+  EXPECT_THAT(Search(*index, "kitten"), ElementsAre("cats/kittens/"));
+}
+
+TEST_F(FileSearchIndexTest, IgnoresCaseOfAsciiLetters) {
+  absl::StatusOr<FileSearchIndex> index =
+      FileSearchIndex::Build(file_system_, "/", /*thread_count=*/1);
+  ASSERT_TRUE(index.ok());
+
+  EXPECT_THAT(Search(*index, "MEOW.TXT"), ElementsAre("Meow.txt"));
+}
+
+TEST_F(FileSearchIndexTest, ChecksWholeQueryBesidesItsTrigrams) {
+  absl::StatusOr<FileSearchIndex> index =
+      FileSearchIndex::Build(file_system_, "/", /*thread_count=*/1);
+  ASSERT_TRUE(index.ok());
+
+  // "bcabc" has every trigram of the query, but not the query.
+  EXPECT_THAT(Search(*index, "abcab"), IsEmpty());
+  EXPECT_THAT(Search(*index, "cabc"), ElementsAre("dogs/bcabc"));
+  EXPECT_THAT(Search(*index, "nothing"), IsEmpty());
+}
+
+TEST_F(FileSearchIndexTest, ScansEveryNameForShortQueries) {
+  absl::StatusOr<FileSearchIndex> index =
+      FileSearchIndex::Build(file_system_, "/", /*thread_count=*/1);
+  ASSERT_TRUE(index.ok());
+
+  EXPECT_THAT(Search(*index, "ew"),
+              UnorderedElementsAre("cats/kittens/mew.txt"));
+  EXPECT_EQ(Search(*index, "").size(), 12);
+}
+
+TEST_F(FileSearchIndexTest, IndexesSubdirectoryAsItsOwnRoot) {
+  absl::StatusOr<FileSearchIndex> index =
+      FileSearchIndex::Build(file_system_, "/cats", /*thread_count=*/1);
+  ASSERT_TRUE(index.ok());
+
+  EXPECT_EQ(index->GetRoot(), "/cats/");
+  EXPECT_THAT(Search(*index, "meow"),
+              UnorderedElementsAre("meow_meow.png", "kittens/xmeowx"));
+}
+
+TEST_F(FileSearchIndexTest, FindsSameFilesWithAnyThreadCount) {
+  absl::StatusOr<FileSearchIndex> single_threaded_index =
+      FileSearchIndex::Build(file_system_, "/", /*thread_count=*/1);
+  absl::StatusOr<FileSearchIndex> multithreaded_index =
+      FileSearchIndex::Build(file_system_, "/", /*thread_count=*/8);
+  ASSERT_TRUE(single_threaded_index.ok());
+  ASSERT_TRUE(multithreaded_index.ok());
+
+  EXPECT_THAT(Search(*multithreaded_index, ""),
+              UnorderedElementsAreArray(Search(*single_threaded_index, "")));
+  EXPECT_THAT(
+      Search(*multithreaded_index, ".txt"),
+      UnorderedElementsAreArray(Search(*single_threaded_index, ".txt")));
+}
+
+TEST_F(FileSearchIndexTest, DeliversResultsInBatchesUntilStopped) {
+  absl::StatusOr<FileSearchIndex> index =
+      FileSearchIndex::Build(file_system_, "/", /*thread_count=*/1);
+  ASSERT_TRUE(index.ok());
+
+  std::vector<size_t> batch_sizes;
+  index->Search("", /*batch_size=*/4, [&](const DirectoryListing& results) {
+    batch_sizes.push_back(results.size());
+    return batch_sizes.size() < 2;
+  });
+
+  EXPECT_THAT(batch_sizes, ElementsAre(4, 4));
+}
+
+TEST_F(FileSearchIndexTest, RanksFuzzyMatchesBestFirst) {
+  absl::StatusOr<FileSearchIndex> index =
+      FileSearchIndex::Build(file_system_, "/", /*thread_count=*/2);
+  ASSERT_TRUE(index.ok());
+
+  // Both text files start at a word boundary and match "t" right after ".",
+  // but "mew.txt" has a shorter gap in between. "empty" has neither.
+  EXPECT_THAT(SearchFuzzy(*index, "MT", /*max_result_count=*/10),
+              ElementsAre("cats/kittens/mew.txt", "Meow.txt", "empty"));
+  EXPECT_THAT(SearchFuzzy(*index, "mt", /*max_result_count=*/1),
+              ElementsAre("cats/kittens/mew.txt"));
+  EXPECT_THAT(SearchFuzzy(*index, "tm", /*max_result_count=*/10), IsEmpty());
+}
+
+TEST_F(FileSearchIndexTest, FailsIfRootCannotBeRead) {
+  absl::StatusOr<FileSearchIndex> index =
+      FileSearchIndex::Build(file_system_, "/nope/", /*thread_count=*/2);
+
+  EXPECT_EQ(index.status().code(), absl::StatusCode::kNotFound);
+}
+
+TEST_F(FileSearchIndexTest, StopsBuildingOnceCancelled) {
+  std::atomic<bool> is_cancelled = true;
+  absl::StatusOr<FileSearchIndex> index = FileSearchIndex::Build(
+      file_system_, "/", /*thread_count=*/2, &is_cancelled);
+
+  EXPECT_EQ(index.status().code(), absl::StatusCode::kCancelled);
+}
+
+TEST_F(FileSearchIndexTest, LoadsSavedIndex) {
+  absl::StatusOr<FileSearchIndex> index =
+      FileSearchIndex::Build(file_system_, "/", /*thread_count=*/2);
+  ASSERT_TRUE(index.ok());
+  ASSERT_TRUE(index->Save(GetIndexPath()).ok());
+
+  absl::StatusOr<FileSearchIndex> loaded_index =
+      FileSearchIndex::Load(GetIndexPath());
+  ASSERT_TRUE(loaded_index.ok()) << loaded_index.status();
+
+  EXPECT_EQ(loaded_index->GetRoot(), "/");
+  EXPECT_EQ(loaded_index->GetBuildTime(), index->GetBuildTime());
+  EXPECT_EQ(loaded_index->GetFileCount(), 12);
+  EXPECT_EQ(loaded_index->GetReadDirectoryCount(), 0);
+  EXPECT_THAT(Search(*loaded_index, ""),
+              UnorderedElementsAreArray(Search(*index, "")));
+  EXPECT_THAT(Search(*loaded_index, "meow"),
+              UnorderedElementsAre("Meow.txt", "cats/meow_meow.png",
+                                   "cats/kittens/xmeowx"));
+  EXPECT_THAT(SearchFuzzy(*loaded_index, "mt", /*max_result_count=*/10),
+              ElementsAre("cats/kittens/mew.txt", "Meow.txt", "empty"));
+}
+
+TEST_F(FileSearchIndexTest, RejectsCorruptIndexFile) {
+  absl::StatusOr<FileSearchIndex> index =
+      FileSearchIndex::Build(file_system_, "/", /*thread_count=*/1);
+  ASSERT_TRUE(index.ok());
+  ASSERT_TRUE(index->Save(GetIndexPath()).ok());
+
+  // Lands in the sections, past the header and the table of sections.
+  OverwriteFile(GetIndexPath(), /*offset=*/200, "X");
+
+  EXPECT_EQ(FileSearchIndex::Load(GetIndexPath()).status().code(),
+            absl::StatusCode::kDataLoss);
+}
+
+TEST_F(FileSearchIndexTest, RejectsIndexFileOfOtherFormatVersion) {
+  absl::StatusOr<FileSearchIndex> index =
+      FileSearchIndex::Build(file_system_, "/", /*thread_count=*/1);
+  ASSERT_TRUE(index.ok());
+  ASSERT_TRUE(index->Save(GetIndexPath()).ok());
+
+  // The version follows the eight bytes of magic.
+  const uint32_t version = 1000;
+  OverwriteFile(GetIndexPath(), /*offset=*/8,
+                std::string(reinterpret_cast<const char*>(&version),
+                            sizeof(version)));
+
+  EXPECT_EQ(FileSearchIndex::Load(GetIndexPath()).status().code(),
+            absl::StatusCode::kFailedPrecondition);
+  EXPECT_EQ(FileSearchIndex::Load(GetIndexPath() + ".missing").status().code(),
+            absl::StatusCode::kNotFound);
+}
+
+TEST_F(FileSearchIndexTest, UpdateOnlyReadsChangedDirectories) {
+  MockFileSystem changed_file_system(
+      {new MockFile("Meow.txt"), new MockFile("woof.txt"),
+       new MockDirectory(
+           "cats",
+           {new MockFile("meow_meow.png"), new MockFile("meow_again.txt"),
+            new MockDirectory("kittens", {new MockFile("mew.txt"),
+                                          new MockFile("xmeowx")})}),
+       new MockDirectory("dogs",
+                         {new MockFile("bark.txt"), new MockFile("bcabc")}),
+       new MockDirectory("empty", {})});
+  ChangingFileSystem file_system(file_system_, changed_file_system);
+  absl::StatusOr<FileSearchIndex> index =
+      FileSearchIndex::Build(file_system, "/", /*thread_count=*/2);
+  ASSERT_TRUE(index.ok());
+  ASSERT_TRUE(index->Save(GetIndexPath()).ok());
+  absl::StatusOr<FileSearchIndex> loaded_index =
+      FileSearchIndex::Load(GetIndexPath());
+  ASSERT_TRUE(loaded_index.ok());
+  EXPECT_EQ(index->GetReadDirectoryCount(), 5);
+
+  file_system.Change();
+  file_system.SetModificationTime("/cats/", absl::FromUnixSeconds(1));
+  absl::StatusOr<FileSearchIndex> updated_index = FileSearchIndex::Update(
+      *loaded_index, file_system, /*thread_count=*/2);
+  ASSERT_TRUE(updated_index.ok());
+
+  EXPECT_EQ(updated_index->GetReadDirectoryCount(), 1);
+  EXPECT_EQ(updated_index->GetFileCount(), 12);
+  EXPECT_THAT(Search(*updated_index, "meow"),
+              UnorderedElementsAre("Meow.txt", "cats/meow_meow.png",
+                                   "cats/meow_again.txt",
+                                   "cats/kittens/xmeowx"));
+}
+
+TEST_F(FileSearchIndexTest, UpdateReadsDirectoriesModifiedTooRecently) {
+  ChangingFileSystem file_system(file_system_, file_system_);
+  file_system.SetModificationTime("/dogs/", absl::Now());
+  absl::StatusOr<FileSearchIndex> index =
+      FileSearchIndex::Build(file_system, "/", /*thread_count=*/1);
+  ASSERT_TRUE(index.ok());
+
+  absl::StatusOr<FileSearchIndex> updated_index =
+      FileSearchIndex::Update(*index, file_system, /*thread_count=*/1);
+  ASSERT_TRUE(updated_index.ok());
+
+  // Changes within the granularity of modification times would not show up.
+  EXPECT_EQ(updated_index->GetReadDirectoryCount(), 1);
+  EXPECT_THAT(Search(*updated_index, "bark"), ElementsAre("dogs/bark.txt"));
+}
+
+}  // namespace
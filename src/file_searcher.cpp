@@ -0,0 +1,199 @@
+#include "file_searcher.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/strings/str_cat.h>
+#include <absl/time/clock.h>
+#include <glibmm/ustring.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+
+FileSearcher::FileSearcher(const FileSystem &file_system,
+                           size_t index_thread_count, size_t batch_size,
+                           size_t max_result_count,
+                           absl::Duration max_index_age,
+                           std::string index_directory,
+                           std::function<void()> notify)
+    : file_system_(file_system),
+      index_thread_count_(index_thread_count),
+      batch_size_(batch_size),
+      max_result_count_(max_result_count),
+      max_index_age_(max_index_age),
+      index_directory_(std::move(index_directory)),
+      notify_(std::move(notify)) {}
+
+FileSearcher::~FileSearcher() {
+  Cancel();
+  is_stopping_ = true;
+  for (Worker &worker : workers_) worker.thread.join();
+}
+
+void FileSearcher::Search(const Glib::ustring &directory,
+                          const std::string &query, BatchCallback on_batch,
+                          DoneCallback on_done) {
+  Cancel();
+  JoinFinishedWorkers();
+
+  current_search_ = std::make_shared<SearchState>();
+  on_batch_ = std::move(on_batch);
+  on_done_ = std::move(on_done);
+  workers_.push_back({std::thread(&FileSearcher::RunSearch, this, directory,
+                                  query, current_search_),
+                      current_search_});
+}
+
+void FileSearcher::Cancel() {
+  if (current_search_ == nullptr) return;
+
+  current_search_->is_cancelled = true;
+  current_search_ = nullptr;
+  on_batch_ = nullptr;
+  on_done_ = nullptr;
+}
+
+void FileSearcher::DeliverResults() {
+  // Results of cancelled searches are dropped along with their state.
+  std::shared_ptr<SearchState> search = current_search_;
+  if (search == nullptr) return;
+
+  std::optional<DirectoryListing> batch;
+  std::optional<absl::Status> status;
+  {
+    std::lock_guard<std::mutex> lock(search->mutex);
+    if (!search->batches.empty()) {
+      batch = std::move(search->batches.front());
+      search->batches.pop_front();
+    } else {
+      status = std::move(search->status);
+      search->status.reset();
+    }
+  }
+
+  if (batch.has_value()) {
+    // Copied since on_batch may start another search, replacing on_batch_.
+    BatchCallback on_batch = on_batch_;
+    on_batch(*batch);
+    return;
+  }
+  if (!status.has_value()) return;
+
+  // The search is over, so later calls have nothing left to deliver.
+  DoneCallback on_done = std::move(on_done_);
+  current_search_ = nullptr;
+  on_batch_ = nullptr;
+  on_done_ = nullptr;
+  on_done(std::move(*status));
+}
+
+void FileSearcher::RunSearch(const Glib::ustring &directory,
+                             const std::string &query,
+                             const std::shared_ptr<SearchState> &search) {
+  bool needs_saving = false;
+  absl::StatusOr<std::shared_ptr<const FileSearchIndex>> index =
+      GetIndex(directory, search->is_cancelled, needs_saving);
+  if (index.ok()) {
+    (*index)->SearchFuzzy(
+        query, max_result_count_, batch_size_,
+        [&](const DirectoryListing &results) {
+          if (search->is_cancelled) return false;
+          {
+            std::lock_guard<std::mutex> lock(search->mutex);
+            search->batches.push_back(results);
+          }
+          notify_();
+          return true;
+        });
+  }
+
+  if (!search->is_cancelled) {
+    {
+      std::lock_guard<std::mutex> lock(search->mutex);
+      search->status = index.status();
+    }
+    notify_();
+  }
+  // Only done once the results are out, so keeping the index current never
+  // delays them.
+  if (index.ok()) MaintainIndex(*std::move(index), needs_saving);
+  search->is_finished = true;
+}
+
+absl::StatusOr<std::shared_ptr<const FileSearchIndex>> FileSearcher::GetIndex(
+    const Glib::ustring &directory, const std::atomic<bool> &is_cancelled,
+    bool &needs_saving) {
+  std::string root = directory;
+  if (root.empty() || root.back() != '/') root += '/';
+  {
+    std::lock_guard<std::mutex> lock(index_mutex_);
+    if (index_ != nullptr && index_->GetRoot() == Glib::ustring(root))
+      return index_;
+  }
+
+  // Loaded and built without holding the lock, so a search that is cancelled
+  // meanwhile does not hold up the one replacing it. A saved index that cannot
+  // be loaded is simply built again.
+  absl::StatusOr<FileSearchIndex> index =
+      absl::NotFoundError("Search indexes are not saved!");
+  const std::string index_path = GetIndexPath(root);
+  if (!index_path.empty()) index = FileSearchIndex::Load(index_path);
+  if (!index.ok() || index->GetRoot() != Glib::ustring(root)) {
+    index = FileSearchIndex::Build(file_system_, root, index_thread_count_,
+                                   &is_cancelled);
+    if (!index.ok()) return index.status();
+    needs_saving = true;
+  }
+
+  auto shared_index = std::make_shared<const FileSearchIndex>(
+      std::move(*index));
+  std::lock_guard<std::mutex> lock(index_mutex_);
+  index_ = shared_index;
+  return shared_index;
+}
+
+void FileSearcher::MaintainIndex(std::shared_ptr<const FileSearchIndex> index,
+                                 bool needs_saving) {
+  const std::string index_path = GetIndexPath(index->GetRoot());
+  // Saving is best effort, since a missing index only costs a slower start.
+  if (needs_saving && !index_path.empty())
+    index->Save(index_path).IgnoreError();
+  if (absl::Now() - index->GetBuildTime() < max_index_age_) return;
+
+  {
+    std::lock_guard<std::mutex> lock(index_mutex_);
+    if (index_ != index || is_updating_index_) return;
+    is_updating_index_ = true;
+  }
+
+  absl::StatusOr<FileSearchIndex> updated_index = FileSearchIndex::Update(
+      *index, file_system_, index_thread_count_, &is_stopping_);
+  if (updated_index.ok() && !index_path.empty())
+    updated_index->Save(index_path).IgnoreError();
+
+  std::lock_guard<std::mutex> lock(index_mutex_);
+  is_updating_index_ = false;
+  // Searches below another directory may have replaced the index meanwhile.
+  if (updated_index.ok() && index_ == index)
+    index_ = std::make_shared<const FileSearchIndex>(std::move(*updated_index));
+}
+
+std::string FileSearcher::GetIndexPath(const Glib::ustring &root) const {
+  if (index_directory_.empty()) return "";
+  const size_t root_hash = std::hash<std::string>()(std::string(root));
+  return absl::StrCat(index_directory_, "/", absl::Hex(root_hash), ".index");
+}
+
+void FileSearcher::JoinFinishedWorkers() {
+  auto first_finished = std::partition(
+      workers_.begin(), workers_.end(),
+      [](const Worker &worker) { return !worker.search->is_finished; });
+  for (auto worker = first_finished; worker != workers_.end(); ++worker)
+    worker->thread.join();
+  workers_.erase(first_finished, workers_.end());
+}
@@ -0,0 +1,136 @@
+#ifndef FILE_SEARCHER_HPP
+#define FILE_SEARCHER_HPP
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/time/time.h>
+#include <glibmm/ustring.h>
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "file_search_index.hpp"
+#include "filesystem.hpp"
+
+// Searches the names of every file below a directory on worker threads, the
+// same way DirectoryLoader lists directories. Names are matched fuzzily and
+// only the best matches are delivered, best first.
+//
+// The first search below a directory builds a FileSearchIndex of it, which
+// later searches below the same directory reuse. Indexes are saved to
+// index_directory, so the first search after a restart maps the saved index
+// instead of reading every directory again. An index older than max_index_age
+// is still searched, and then updated in the background for later searches,
+// only reading the directories that changed. Batches of matching files are
+// queued, and notify is called from the
+// worker for every one of them. notify must arrange for DeliverResults() to be
+// called on the thread that started the search, and each DeliverResults() call
+// hands over at most one batch.
+//
+// Starting a search cancels the previous one, including the index it may be
+// building. Nothing a cancelled search found is delivered.
+class FileSearcher {
+ public:
+  // Receives matching files, named by their path relative to the directory
+  // searched.
+  using BatchCallback = std::function<void(const DirectoryListing &results)>;
+  // Called once every batch was delivered, with the error that stopped the
+  // search if any. Not called for cancelled searches.
+  using DoneCallback = std::function<void(absl::Status status)>;
+
+  // file_system must outlive the searcher, and be safe to use from multiple
+  // threads. Indexes are built with index_thread_count threads. Searches
+  // deliver at most max_result_count files. An empty index_directory keeps
+  // indexes in memory only.
+  FileSearcher(const FileSystem &file_system, size_t index_thread_count,
+               size_t batch_size, size_t max_result_count,
+               absl::Duration max_index_age, std::string index_directory,
+               std::function<void()> notify);
+
+  FileSearcher(const FileSearcher &) = delete;
+  FileSearcher &operator=(const FileSearcher &) = delete;
+
+  // Cancels the current search and any index update, and waits for every
+  // worker to finish.
+  ~FileSearcher();
+
+  // Starts looking for files below directory whose name holds the characters
+  // of query in order, as ranked by FileSearchIndex::SearchFuzzy(), cancelling
+  // any search still in flight. Matching ignores the case of ASCII letters.
+  void Search(const Glib::ustring &directory, const std::string &query,
+              BatchCallback on_batch, DoneCallback on_done);
+  void Cancel();
+
+  // Hands the oldest batch waiting to on_batch, or reports the end of the
+  // search to on_done once every batch was handed over. Does nothing if no
+  // results are waiting.
+  void DeliverResults();
+
+ private:
+  // State shared between one search's worker and the searcher.
+  struct SearchState {
+    std::atomic<bool> is_cancelled = false;
+    std::atomic<bool> is_finished = false;
+
+    // Guards everything below.
+    std::mutex mutex;
+    std::deque<DirectoryListing> batches;
+    // Set once the worker is done searching.
+    std::optional<absl::Status> status;
+  };
+
+  struct Worker {
+    std::thread thread;
+    std::shared_ptr<SearchState> search;
+  };
+
+  // Runs on the worker thread.
+  void RunSearch(const Glib::ustring &directory, const std::string &query,
+                 const std::shared_ptr<SearchState> &search);
+  // Returns the index of directory, loading it from index_directory_ or
+  // building it if it is not in memory. Sets needs_saving for built indexes.
+  // Runs on the worker thread.
+  absl::StatusOr<std::shared_ptr<const FileSearchIndex>> GetIndex(
+      const Glib::ustring &directory, const std::atomic<bool> &is_cancelled,
+      bool &needs_saving);
+  // Saves index if needed, and replaces it with an updated one if it is too
+  // old. Runs on the worker thread, once its search is done.
+  void MaintainIndex(std::shared_ptr<const FileSearchIndex> index,
+                     bool needs_saving);
+  // Where the index of root is saved, or an empty string if indexes are not
+  // saved.
+  std::string GetIndexPath(const Glib::ustring &root) const;
+  // Joins workers that have already finished, without blocking.
+  void JoinFinishedWorkers();
+
+  const FileSystem &file_system_;
+  size_t index_thread_count_;
+  size_t batch_size_;
+  size_t max_result_count_;
+  absl::Duration max_index_age_;
+  std::string index_directory_;
+  std::function<void()> notify_;
+  // Set once the searcher is destroyed, stopping index updates.
+  std::atomic<bool> is_stopping_ = false;
+
+  // Guards everything below, which workers share.
+  std::mutex index_mutex_;
+  std::shared_ptr<const FileSearchIndex> index_;
+  // Whether a worker is updating index_, so others leave it alone.
+  bool is_updating_index_ = false;
+
+  std::shared_ptr<SearchState> current_search_;
+  BatchCallback on_batch_;
+  DoneCallback on_done_;
+  std::vector<Worker> workers_;
+};
+
+#endif  // FILE_SEARCHER_HPP
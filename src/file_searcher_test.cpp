@@ -0,0 +1,246 @@
+#include "file_searcher.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/time/time.h>
+#include <glibmm/ustring.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <initializer_list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "filesystem.hpp"
+
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::UnorderedElementsAre;
+
+// Wraps a MockFileSystem, counting how many directories were read. Every file
+// reports the same modification time, which can be moved.
+class CountingFileSystem : public FileSystem {
+ public:
+  CountingFileSystem(std::initializer_list<MockFile*> files)
+      : file_system_(files) {}
+
+  absl::StatusOr<DirectoryListing> GetDirectoryFiles(
+      const Glib::ustring& directory) const override {
+    read_count_++;
+    return file_system_.GetDirectoryFiles(directory);
+  }
+  absl::Status CheckDirectory(const Glib::ustring& directory) const override {
+    return file_system_.CheckDirectory(directory);
+  }
+  absl::Status StreamDirectoryFiles(
+      const Glib::ustring& directory, size_t batch_size,
+      const FileBatchCallback& callback) const override {
+    return file_system_.StreamDirectoryFiles(directory, batch_size, callback);
+  }
+  absl::Status FillFileMetadata(const Glib::ustring& directory,
+                                DirectoryListing& files,
+                                FileMetadataMask fields) const override {
+    return file_system_.FillFileMetadata(directory, files, fields);
+  }
+  absl::StatusOr<FileMetadata> GetFileMetadata(
+      const Glib::ustring& path, FileMetadataMask fields) const override {
+    absl::StatusOr<FileMetadata> metadata =
+        file_system_.GetFileMetadata(path, fields);
+    if (metadata.ok())
+      metadata->modification_time = absl::FromUnixSeconds(modification_time_);
+    return metadata;
+  }
+
+  int GetReadCount() const { return read_count_; }
+  void SetModificationTime(int64_t seconds) { modification_time_ = seconds; }
+
+ private:
+  MockFileSystem file_system_;
+  mutable std::atomic<int> read_count_ = 0;
+  std::atomic<int64_t> modification_time_ = 0;
+};
+
+// Lets the test thread step through a search like a main loop would, by
+// waiting for the searcher to signal results and then delivering them.
+class FileSearcherTest : public ::testing::Test {
+ protected:
+  FileSearcherTest()
+      : file_system_(
+            {new MockFile("meow.txt"), new MockFile("woof.txt"),
+             new MockDirectory("cats", {new MockFile("meow.png"),
+                                        new MockDirectory("kittens", {})})}) {}
+
+  // Runs the search started last on searcher to completion, and returns its
+  // status.
+  absl::Status DeliverUntilDone(FileSearcher& searcher) {
+    while (!status_.has_value()) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (!notified_.wait_for(lock, std::chrono::seconds(10),
+                              [this]() { return pending_notifications_ > 0; }))
+        return absl::DeadlineExceededError("Search never finished!");
+      pending_notifications_--;
+      lock.unlock();
+      searcher.DeliverResults();
+    }
+    absl::Status status = *status_;
+    status_.reset();
+    return status;
+  }
+
+  void Search(FileSearcher& searcher, const Glib::ustring& directory,
+              const std::string& query) {
+    searcher.Search(
+        directory, query,
+        [this](const DirectoryListing& results) {
+          for (File file : results) paths_.emplace_back(file.GetName());
+        },
+        [this](absl::Status status) { status_ = status; });
+  }
+
+  std::function<void()> GetNotify() {
+    return [this]() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_notifications_++;
+      notified_.notify_one();
+    };
+  }
+
+  CountingFileSystem file_system_;
+  std::mutex mutex_;
+  std::condition_variable notified_;
+  int pending_notifications_ = 0;
+
+  std::vector<std::string> paths_;
+  std::optional<absl::Status> status_;
+};
+
+TEST_F(FileSearcherTest, DeliversMatchesBelowDirectory) {
+  FileSearcher searcher(file_system_, /*index_thread_count=*/2,
+                        /*batch_size=*/1, /*max_result_count=*/100,
+                        absl::InfiniteDuration(), /*index_directory=*/"",
+                        GetNotify());
+
+  Search(searcher, "/", "meow");
+  EXPECT_TRUE(DeliverUntilDone(searcher).ok());
+  EXPECT_THAT(paths_, UnorderedElementsAre("meow.txt", "cats/meow.png"));
+
+  paths_.clear();
+  Search(searcher, "/cats/", "meow");
+  EXPECT_TRUE(DeliverUntilDone(searcher).ok());
+  EXPECT_THAT(paths_, ElementsAre("meow.png"));
+}
+
+TEST_F(FileSearcherTest, ReusesIndexOfSameDirectory) {
+  FileSearcher searcher(file_system_, /*index_thread_count=*/2,
+                        /*batch_size=*/10, /*max_result_count=*/100,
+                        absl::InfiniteDuration(), /*index_directory=*/"",
+                        GetNotify());
+
+  Search(searcher, "/", "meow");
+  ASSERT_TRUE(DeliverUntilDone(searcher).ok());
+  const int read_count = file_system_.GetReadCount();
+  EXPECT_EQ(read_count, 3);
+
+  paths_.clear();
+  Search(searcher, "/", "woof");
+  ASSERT_TRUE(DeliverUntilDone(searcher).ok());
+  EXPECT_THAT(paths_, ElementsAre("woof.txt"));
+  EXPECT_EQ(file_system_.GetReadCount(), read_count);
+}
+
+TEST_F(FileSearcherTest, UpdatesIndexOnceTooOldWhileStillSearchingIt) {
+  FileSearcher searcher(file_system_, /*index_thread_count=*/2,
+                        /*batch_size=*/10, /*max_result_count=*/100,
+                        absl::ZeroDuration(), /*index_directory=*/"",
+                        GetNotify());
+
+  Search(searcher, "/", "meow");
+  ASSERT_TRUE(DeliverUntilDone(searcher).ok());
+  ASSERT_EQ(file_system_.GetReadCount(), 3);
+
+  // Every directory changed, so the update reads all of them again once, on
+  // some search after this one.
+  file_system_.SetModificationTime(1);
+  for (int i = 0; i < 1000 && file_system_.GetReadCount() < 6; i++) {
+    paths_.clear();
+    Search(searcher, "/", "meow");
+    ASSERT_TRUE(DeliverUntilDone(searcher).ok());
+    EXPECT_THAT(paths_, UnorderedElementsAre("meow.txt", "cats/meow.png"));
+  }
+
+  EXPECT_EQ(file_system_.GetReadCount(), 6);
+}
+
+TEST_F(FileSearcherTest, LoadsSavedIndexInsteadOfReading) {
+  const std::string index_directory = ::testing::TempDir();
+  {
+    FileSearcher searcher(file_system_, /*index_thread_count=*/2,
+                          /*batch_size=*/10, /*max_result_count=*/100,
+                          absl::InfiniteDuration(), index_directory,
+                          GetNotify());
+    Search(searcher, "/cats/", "meow");
+    ASSERT_TRUE(DeliverUntilDone(searcher).ok());
+  }
+  const int read_count = file_system_.GetReadCount();
+
+  paths_.clear();
+  FileSearcher searcher(file_system_, /*index_thread_count=*/2,
+                        /*batch_size=*/10, /*max_result_count=*/100,
+                        absl::InfiniteDuration(), index_directory, GetNotify());
+  Search(searcher, "/cats/", "meow");
+  ASSERT_TRUE(DeliverUntilDone(searcher).ok());
+
+  EXPECT_THAT(paths_, ElementsAre("meow.png"));
+  EXPECT_EQ(file_system_.GetReadCount(), read_count);
+}
+
+TEST_F(FileSearcherTest, DeliversOnlyBestMatches) {
+  FileSearcher searcher(file_system_, /*index_thread_count=*/2,
+                        /*batch_size=*/10, /*max_result_count=*/1,
+                        absl::InfiniteDuration(), /*index_directory=*/"",
+                        GetNotify());
+
+  // Matches every name with an "e" equally well, but "kittens" is shortest.
+  Search(searcher, "/", "e");
+  ASSERT_TRUE(DeliverUntilDone(searcher).ok());
+
+  EXPECT_THAT(paths_, ElementsAre("cats/kittens"));
+}
+
+TEST_F(FileSearcherTest, ReportsDirectoryThatCannotBeSearched) {
+  FileSearcher searcher(file_system_, /*index_thread_count=*/2,
+                        /*batch_size=*/10, /*max_result_count=*/100,
+                        absl::InfiniteDuration(), /*index_directory=*/"",
+                        GetNotify());
+
+  Search(searcher, "/nope/", "meow");
+
+  EXPECT_EQ(DeliverUntilDone(searcher).code(), absl::StatusCode::kNotFound);
+  EXPECT_THAT(paths_, IsEmpty());
+}
+
+TEST_F(FileSearcherTest, NewSearchDropsResultsOfPreviousOne) {
+  FileSearcher searcher(file_system_, /*index_thread_count=*/2,
+                        /*batch_size=*/1, /*max_result_count=*/100,
+                        absl::InfiniteDuration(), /*index_directory=*/"",
+                        GetNotify());
+
+  searcher.Search(
+      "/", "meow",
+      [](const DirectoryListing& results) { FAIL() << "Search was replaced"; },
+      [](absl::Status status) { FAIL() << "Search was replaced"; });
+  Search(searcher, "/", "woof");
+
+  EXPECT_TRUE(DeliverUntilDone(searcher).ok());
+  EXPECT_THAT(paths_, ElementsAre("woof.txt"));
+}
+
+}  // namespace
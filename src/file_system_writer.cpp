@@ -0,0 +1,142 @@
+#include "file_system_writer.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glibmm/ustring.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "file_copier.hpp"
+#include "tree_remover.hpp"
+
+namespace {
+
+// Enough to keep a local disk busy on metadata updates, most of which are
+// journalled rather than waited on.
+constexpr size_t kDefaultRemoveThreadCount = 8;
+
+}  // namespace
+
+FileSystemWriter::~FileSystemWriter() {}
+
+POSIXFileSystemWriter::POSIXFileSystemWriter()
+    : POSIXFileSystemWriter(FileCopier::Options()) {}
+
+POSIXFileSystemWriter::POSIXFileSystemWriter(FileCopier::Options copy_options)
+    : POSIXFileSystemWriter(copy_options, kDefaultRemoveThreadCount) {}
+
+POSIXFileSystemWriter::POSIXFileSystemWriter(FileCopier::Options copy_options,
+                                             size_t remove_thread_count)
+    : copier_(copy_options), remover_(remove_thread_count) {}
+
+absl::Status POSIXFileSystemWriter::CreateDirectory(const Glib::ustring &path,
+                                                    mode_t mode) const {
+  if (mkdir(path.c_str(), mode & 07777) == -1)
+    return MakeFileError("mkdir()", errno);
+  return absl::OkStatus();
+}
+
+absl::Status POSIXFileSystemWriter::SetMode(const Glib::ustring &path,
+                                            mode_t mode) const {
+  if (chmod(path.c_str(), mode & 07777) == -1)
+    return MakeFileError("chmod()", errno);
+  return absl::OkStatus();
+}
+
+absl::Status POSIXFileSystemWriter::CopyFile(
+    const Glib::ustring &source, const Glib::ustring &destination,
+    const CopyProgressCallback &on_progress) const {
+  return copier_.Copy(source, destination, on_progress).status();
+}
+
+absl::Status POSIXFileSystemWriter::CopySymlink(
+    const Glib::ustring &source, const Glib::ustring &destination) const {
+  // readlinkat() silently truncates targets that do not fit, so a target
+  // filling the whole buffer may have been cut short.
+  std::string target(PATH_MAX, '\0');
+  const ssize_t length =
+      readlinkat(AT_FDCWD, source.c_str(), target.data(), target.size());
+  if (length == -1) return MakeFileError("readlinkat()", errno);
+  if (static_cast<size_t>(length) == target.size())
+    return MakeFileError("readlinkat()", ENAMETOOLONG);
+  target.resize(length);
+  if (symlinkat(target.c_str(), AT_FDCWD, destination.c_str()) == -1)
+    return MakeFileError("symlinkat()", errno);
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::vector<FileSystemWriter::SpecialFile>>
+POSIXFileSystemWriter::ListSpecialFiles(const Glib::ustring &directory) const {
+  DIR *dir = opendir(directory.c_str());
+  if (dir == nullptr) return MakeFileError("opendir()", errno);
+
+  std::vector<SpecialFile> special_files;
+  absl::Status status;
+  errno = 0;
+  while (const dirent *entry = readdir(dir)) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+    mode_t type = DTTOIF(entry->d_type);
+    // Some file systems report every entry as DT_UNKNOWN.
+    if (entry->d_type == DT_UNKNOWN) {
+      struct stat info;
+      if (fstatat(dirfd(dir), entry->d_name, &info, AT_SYMLINK_NOFOLLOW) ==
+          -1) {
+        status = MakeFileError("fstatat()", errno);
+        break;
+      }
+      type = info.st_mode & S_IFMT;
+    }
+    if (!S_ISREG(type) && !S_ISDIR(type))
+      special_files.push_back({entry->d_name, type});
+    errno = 0;
+  }
+  if (status.ok() && errno != 0) status = MakeFileError("readdir()", errno);
+  closedir(dir);
+  if (!status.ok()) return status;
+  return special_files;
+}
+
+absl::Status POSIXFileSystemWriter::Rename(
+    const Glib::ustring &source, const Glib::ustring &destination) const {
+  if (renameat2(AT_FDCWD, source.c_str(), AT_FDCWD, destination.c_str(),
+                RENAME_NOREPLACE) == 0)
+    return absl::OkStatus();
+  if (errno != EINVAL) return MakeFileError("renameat2()", errno);
+
+  // Some file systems, such as older NFS, do not support RENAME_NOREPLACE,
+  // which leaves checking for the destination first.
+  if (access(destination.c_str(), F_OK) == 0)
+    return MakeFileError("renameat2()", EEXIST);
+  if (rename(source.c_str(), destination.c_str()) == -1)
+    return MakeFileError("rename()", errno);
+  return absl::OkStatus();
+}
+
+absl::Status POSIXFileSystemWriter::RemoveFile(
+    const Glib::ustring &path) const {
+  if (unlink(path.c_str()) == -1) return MakeFileError("unlink()", errno);
+  return absl::OkStatus();
+}
+
+absl::Status POSIXFileSystemWriter::RemoveDirectory(
+    const Glib::ustring &path) const {
+  if (rmdir(path.c_str()) == -1) return MakeFileError("rmdir()", errno);
+  return absl::OkStatus();
+}
+
+absl::Status POSIXFileSystemWriter::RemoveTree(
+    const Glib::ustring &path,
+    const RemoveProgressCallback &on_progress) const {
+  return remover_.Remove(path, on_progress);
+}
@@ -0,0 +1,118 @@
+#ifndef FILE_SYSTEM_WRITER_HPP
+#define FILE_SYSTEM_WRITER_HPP
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <glibmm/ustring.h>
+#include <sys/types.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "file_copier.hpp"
+#include "tree_remover.hpp"
+
+// Changes files on a file system. Kept apart from FileSystem, which only ever
+// reads them, so that its many wrappers need not pass these on. Every path
+// must be a full path.
+class FileSystemWriter {
+ public:
+  using CopyProgressCallback = FileCopier::ProgressCallback;
+  using RemoveProgressCallback = TreeRemover::ProgressCallback;
+
+  // Entry of a directory that FileSystem leaves out of its listings.
+  struct SpecialFile {
+    std::string name;
+    // One of the S_IFMT types, such as S_IFLNK.
+    mode_t type;
+  };
+
+  virtual ~FileSystemWriter();
+
+  // Creates the directory at path, which must not exist yet, with the
+  // permission bits of mode.
+  virtual absl::Status CreateDirectory(const Glib::ustring &path,
+                                       mode_t mode) const = 0;
+
+  // Gives the file or directory at path the permission bits of mode.
+  virtual absl::Status SetMode(const Glib::ustring &path,
+                               mode_t mode) const = 0;
+
+  // Copies the regular file at source to destination, which must not exist
+  // yet, reporting the bytes copied so far to on_progress, if given, which
+  // can stop the copy by returning false. Nothing is left at destination if
+  // the copy fails or is stopped.
+  virtual absl::Status CopyFile(
+      const Glib::ustring &source, const Glib::ustring &destination,
+      const CopyProgressCallback &on_progress) const = 0;
+
+  // Creates a symbolic link at destination, which must not exist yet, with the
+  // same target as the one at source. Neither link is followed.
+  virtual absl::Status CopySymlink(const Glib::ustring &source,
+                                   const Glib::ustring &destination) const = 0;
+
+  // Lists the entries directly inside directory that are neither regular
+  // files nor directories, such as symbolic links, FIFOs and devices, without
+  // following any of them.
+  virtual absl::StatusOr<std::vector<SpecialFile>> ListSpecialFiles(
+      const Glib::ustring &directory) const = 0;
+
+  // Moves the file or directory at source to destination, which must not
+  // exist yet, without copying anything. Returns an
+  // absl::FailedPreconditionError if they are on different file systems, and
+  // only then, so callers know when copying instead can work.
+  virtual absl::Status Rename(const Glib::ustring &source,
+                              const Glib::ustring &destination) const = 0;
+
+  // Removes the file at path, or the directory at path, which must be empty.
+  virtual absl::Status RemoveFile(const Glib::ustring &path) const = 0;
+  virtual absl::Status RemoveDirectory(const Glib::ustring &path) const = 0;
+
+  // Removes the file or directory at path along with everything below it,
+  // reporting the number of files and directories removed so far to
+  // on_progress, if given, which can stop the removal by returning false.
+  // Stops at the first error, leaving the rest in place.
+  virtual absl::Status RemoveTree(
+      const Glib::ustring &path,
+      const RemoveProgressCallback &on_progress) const = 0;
+};
+
+// Changes files with POSIX APIs, copying them with a FileCopier and removing
+// trees with a TreeRemover.
+class POSIXFileSystemWriter : public FileSystemWriter {
+ public:
+  POSIXFileSystemWriter();
+  explicit POSIXFileSystemWriter(FileCopier::Options copy_options);
+  // remove_thread_count is the number of threads each RemoveTree() call lists
+  // directories on.
+  POSIXFileSystemWriter(FileCopier::Options copy_options,
+                        size_t remove_thread_count);
+  virtual ~POSIXFileSystemWriter() = default;
+
+  absl::Status CreateDirectory(const Glib::ustring &path,
+                               mode_t mode) const override;
+  absl::Status SetMode(const Glib::ustring &path, mode_t mode) const override;
+  absl::Status CopyFile(const Glib::ustring &source,
+                        const Glib::ustring &destination,
+                        const CopyProgressCallback &on_progress) const override;
+  absl::Status CopySymlink(const Glib::ustring &source,
+                           const Glib::ustring &destination) const override;
+  absl::StatusOr<std::vector<SpecialFile>> ListSpecialFiles(
+      const Glib::ustring &directory) const override;
+  // Uses renameat2() with RENAME_NOREPLACE, so an existing destination is
+  // never replaced, even if it appears after being checked for.
+  absl::Status Rename(const Glib::ustring &source,
+                      const Glib::ustring &destination) const override;
+  absl::Status RemoveFile(const Glib::ustring &path) const override;
+  absl::Status RemoveDirectory(const Glib::ustring &path) const override;
+  absl::Status RemoveTree(
+      const Glib::ustring &path,
+      const RemoveProgressCallback &on_progress) const override;
+
+ private:
+  FileCopier copier_;
+  TreeRemover remover_;
+};
+
+#endif  // FILE_SYSTEM_WRITER_HPP
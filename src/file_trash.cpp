@@ -0,0 +1,66 @@
+#include "file_trash.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/strings/str_cat.h>
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
+#include <glibmm/ustring.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Attempts at a name before giving up, should every number tried be taken.
+// Numbers start from the current time, so only files left over from a run
+// started later than this one, such as with a clock set back, are in the way.
+constexpr int kMaxRenameAttemptCount = 100;
+
+}  // namespace
+
+FileTrash::FileTrash(const FileSystem &file_system,
+                     const FileSystemWriter &writer,
+                     const Glib::ustring &directory)
+    : file_system_(file_system),
+      writer_(writer),
+      directory_(directory),
+      next_id_(absl::ToUnixMicros(absl::Now())) {
+  if (directory_.empty() || directory_.back() != '/')
+    directory_ += '/';
+}
+
+absl::StatusOr<Glib::ustring> FileTrash::MoveToTrash(
+    const Glib::ustring &path) {
+  std::string name = path;
+  while (name.size() > 1 && name.back() == '/') name.pop_back();
+  name = name.substr(name.rfind('/') + 1);
+  if (name.empty())
+    return absl::InvalidArgumentError(
+        absl::StrCat("Cannot move to the trash: ", std::string(path)));
+
+  absl::Status status;
+  for (int i = 0; i < kMaxRenameAttemptCount; i++) {
+    const std::string trashed_path =
+        absl::StrCat(directory_, next_id_++, "-", name);
+    status = writer_.Rename(path, trashed_path);
+    if (status.ok()) {
+      file_system_.InvalidatePath(path);
+      return trashed_path;
+    }
+    if (!absl::IsAlreadyExists(status)) return status;
+  }
+  return status;
+}
+
+absl::StatusOr<std::vector<Glib::ustring>> FileTrash::GetTrashedFiles() const {
+  absl::StatusOr<DirectoryListing> files =
+      file_system_.GetDirectoryFiles(directory_);
+  if (!files.ok()) return files.status();
+
+  std::vector<Glib::ustring> paths;
+  for (File file : *files)
+    paths.push_back(directory_ + std::string(file.GetName()));
+  return paths;
+}
@@ -0,0 +1,49 @@
+#ifndef FILE_TRASH_HPP
+#define FILE_TRASH_HPP
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <glibmm/ustring.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "file_system_writer.hpp"
+#include "filesystem.hpp"
+
+// Directory files are moved into before they are removed. Renaming a tree
+// takes the same time however large it is, so files disappear from their
+// directory at once, and are removed from the trash in the background. The
+// trash is not meant to be browsed or restored from, and anything left in it,
+// such as when the process exits before a removal is done, can be found with
+// GetTrashedFiles() and removed again on the next start.
+//
+// Files are renamed to a number unique to the trash, followed by their name,
+// so files of the same name never collide.
+class FileTrash {
+ public:
+  // directory must be the full path of an existing directory, used for
+  // nothing else. file_system and writer must outlive the trash.
+  FileTrash(const FileSystem &file_system, const FileSystemWriter &writer,
+            const Glib::ustring &directory);
+
+  // Moves the file or directory at the full path path into the trash, and
+  // returns the full path it was moved to. path is invalidated in the file
+  // system of the trash. Returns an
+  // absl::FailedPreconditionError if path is on another file system than the
+  // trash, in which case it can only be removed where it is.
+  absl::StatusOr<Glib::ustring> MoveToTrash(const Glib::ustring &path);
+
+  // Full paths of everything in the trash.
+  absl::StatusOr<std::vector<Glib::ustring>> GetTrashedFiles() const;
+
+ private:
+  const FileSystem &file_system_;
+  const FileSystemWriter &writer_;
+  // Ends with a slash.
+  std::string directory_;
+  uint64_t next_id_;
+};
+
+#endif  // FILE_TRASH_HPP
@@ -0,0 +1,129 @@
+#include "file_trash.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <glibmm/ustring.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "file_system_writer.hpp"
+#include "filesystem.hpp"
+
+namespace {
+
+using ::testing::_;
+using ::testing::Return;
+using ::testing::StartsWith;
+using ::testing::UnorderedElementsAre;
+
+class MockFileSystemWriter : public FileSystemWriter {
+ public:
+  MOCK_METHOD(absl::Status, CreateDirectory,
+              (const Glib::ustring& path, mode_t mode), (const, override));
+  MOCK_METHOD(absl::Status, SetMode, (const Glib::ustring& path, mode_t mode),
+              (const, override));
+  MOCK_METHOD(absl::Status, CopyFile,
+              (const Glib::ustring& source, const Glib::ustring& destination,
+               const CopyProgressCallback& on_progress),
+              (const, override));
+  MOCK_METHOD(absl::Status, CopySymlink,
+              (const Glib::ustring& source, const Glib::ustring& destination),
+              (const, override));
+  MOCK_METHOD(absl::StatusOr<std::vector<SpecialFile>>, ListSpecialFiles,
+              (const Glib::ustring& directory), (const, override));
+  MOCK_METHOD(absl::Status, Rename,
+              (const Glib::ustring& source, const Glib::ustring& destination),
+              (const, override));
+  MOCK_METHOD(absl::Status, RemoveFile, (const Glib::ustring& path),
+              (const, override));
+  MOCK_METHOD(absl::Status, RemoveDirectory, (const Glib::ustring& path),
+              (const, override));
+  MOCK_METHOD(absl::Status, RemoveTree,
+              (const Glib::ustring& path,
+               const RemoveProgressCallback& on_progress),
+              (const, override));
+};
+
+class FileTrashTest : public ::testing::Test {
+ protected:
+  FileTrashTest()
+      : file_system_({new MockDirectory(
+            "trash", {new MockFile("1-a.txt"),
+                      new MockDirectory("2-dir", {new MockFile("b.txt")})})}),
+        trash_(file_system_, writer_, "/trash") {}
+
+  // Moves path to the trash, expecting the rename to succeed, and returns
+  // the name it got in the trash.
+  std::string MoveToTrash(const Glib::ustring& path) {
+    Glib::ustring destination;
+    EXPECT_CALL(writer_, Rename(path, _))
+        .WillOnce([&destination](const Glib::ustring& /*source*/,
+                                 const Glib::ustring& trashed_path) {
+          destination = trashed_path;
+          return absl::OkStatus();
+        });
+    absl::StatusOr<Glib::ustring> trashed_path = trash_.MoveToTrash(path);
+    EXPECT_TRUE(trashed_path.ok()) << trashed_path.status();
+    EXPECT_EQ(trashed_path.value_or(""), destination);
+    return destination;
+  }
+
+  MockFileSystem file_system_;
+  MockFileSystemWriter writer_;
+  FileTrash trash_;
+};
+
+TEST_F(FileTrashTest, MovesFilesUnderUniqueNames) {
+  const std::string first = MoveToTrash("/home/a.txt");
+  const std::string second = MoveToTrash("/other/a.txt");
+  const std::string directory = MoveToTrash("/home/dir/");
+
+  EXPECT_THAT(first, StartsWith("/trash/"));
+  EXPECT_EQ(first.substr(first.find('-')), "-a.txt");
+  EXPECT_EQ(second.substr(second.find('-')), "-a.txt");
+  EXPECT_NE(first, second);
+  EXPECT_THAT(directory, StartsWith("/trash/"));
+  EXPECT_EQ(directory.substr(directory.find('-')), "-dir");
+}
+
+TEST_F(FileTrashTest, TriesAnotherNameWhenTaken) {
+  std::vector<Glib::ustring> destinations;
+  EXPECT_CALL(writer_, Rename(Glib::ustring("/home/a.txt"), _))
+      .Times(2)
+      .WillRepeatedly([&destinations](const Glib::ustring& /*source*/,
+                                      const Glib::ustring& destination) {
+        destinations.push_back(destination);
+        return destinations.size() == 1 ? absl::AlreadyExistsError("Taken.")
+                                        : absl::OkStatus();
+      });
+
+  absl::StatusOr<Glib::ustring> trashed_path =
+      trash_.MoveToTrash("/home/a.txt");
+
+  ASSERT_TRUE(trashed_path.ok()) << trashed_path.status();
+  ASSERT_EQ(destinations.size(), 2);
+  EXPECT_NE(destinations[0], destinations[1]);
+  EXPECT_EQ(*trashed_path, destinations[1]);
+}
+
+TEST_F(FileTrashTest, ReturnsRenameErrors) {
+  EXPECT_CALL(writer_, Rename(Glib::ustring("/mnt/a.txt"), _))
+      .WillOnce(Return(absl::FailedPreconditionError("Other file system.")));
+
+  EXPECT_EQ(trash_.MoveToTrash("/mnt/a.txt").status().code(),
+            absl::StatusCode::kFailedPrecondition);
+  EXPECT_EQ(trash_.MoveToTrash("/").status().code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST_F(FileTrashTest, ListsTrashedFiles) {
+  absl::StatusOr<std::vector<Glib::ustring>> files = trash_.GetTrashedFiles();
+
+  ASSERT_TRUE(files.ok()) << files.status();
+  EXPECT_THAT(*files, UnorderedElementsAre("/trash/1-a.txt", "/trash/2-dir"));
+}
+
+}  // namespace
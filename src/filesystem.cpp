@@ -2,33 +2,211 @@
 
 #include <absl/status/status.h>
 #include <absl/status/statusor.h>
+#include <absl/strings/str_cat.h>
 #include <absl/strings/str_split.h>
 #include <absl/types/span.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <glibmm/stringutils.h>
 #include <glibmm/ustring.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 namespace {
 
-std::vector<File> GetFilesFromMockDirectory(
+// Size of the buffer handed to getdents64(). Big enough that a typical
+// directory is read in a handful of syscalls.
+constexpr size_t kDirectoryReadBufferSize = 256 * 1024;
+
+// Files that are not regular files or directories, along with the current and
+// parent directory entries, are not shown to the user. The d_type values are
+// plain enumerators, not bits, so symbolic links, sockets and devices have to
+// be told apart by comparing the whole value.
+bool ShouldListDirectoryEntry(std::string_view file_name,
+                              unsigned char file_type) {
+  return (file_type == DT_REG || file_type == DT_DIR) && file_name != "." &&
+         file_name != "..";
+}
+
+// Looks up the type of the entry file_name of the open directory dir_fd
+// without following symbolic links. Falls back to fstatat() on kernels without
+// statx(). Returns DT_UNKNOWN if neither works.
+unsigned char GetDirectoryEntryType(int dir_fd, const char *file_name) {
+  struct statx file_info;
+  if (statx(dir_fd, file_name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+            STATX_TYPE, &file_info) == 0) {
+    return (file_info.stx_mask & STATX_TYPE) ? IFTODT(file_info.stx_mode)
+                                             : DT_UNKNOWN;
+  }
+  if (errno != ENOSYS) return DT_UNKNOWN;
+
+  struct stat info;
+  if (fstatat(dir_fd, file_name, &info,
+              AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT) == 0)
+    return IFTODT(info.st_mode);
+  return DT_UNKNOWN;
+}
+
+// Some file systems (XFS without ftype, NFS, many FUSE mounts) report every
+// entry as DT_UNKNOWN. Looks the type of those entries up relative to the open
+// directory and writes it back into the entry, so they are filtered like any
+// other.
+void ResolveUnknownEntryTypes(int dir_fd, absl::Span<char> entries) {
+  for (size_t offset = 0; offset < entries.size();) {
+    auto *entry = reinterpret_cast<dirent64 *>(&entries[offset]);
+    offset += entry->d_reclen;
+    if (entry->d_type == DT_UNKNOWN)
+      entry->d_type = GetDirectoryEntryType(dir_fd, entry->d_name);
+  }
+}
+
+unsigned int GetStatxMask(FileMetadataMask fields) {
+  unsigned int statx_mask = 0;
+  if (fields & kFileMetadataType) statx_mask |= STATX_TYPE;
+  if (fields & kFileMetadataSize) statx_mask |= STATX_SIZE;
+  if (fields & kFileMetadataModificationTime) statx_mask |= STATX_MTIME;
+  if (fields & kFileMetadataMode) statx_mask |= STATX_TYPE | STATX_MODE;
+  if (fields & kFileMetadataAllocatedSize) statx_mask |= STATX_BLOCKS;
+  if (fields & kFileMetadataIdentity) statx_mask |= STATX_INO | STATX_NLINK;
+  return statx_mask;
+}
+
+// Copies the requested fields the kernel actually returned into metadata.
+FileMetadata MergeStatxMetadata(FileMetadata metadata,
+                                const struct statx &file_info,
+                                FileMetadataMask fields) {
+  if ((fields & kFileMetadataType) && (file_info.stx_mask & STATX_TYPE)) {
+    metadata.mode = (metadata.mode & ~S_IFMT) | (file_info.stx_mode & S_IFMT);
+    metadata.filled_fields |= kFileMetadataType;
+  }
+  if ((fields & kFileMetadataSize) && (file_info.stx_mask & STATX_SIZE)) {
+    metadata.size = file_info.stx_size;
+    metadata.filled_fields |= kFileMetadataSize;
+  }
+  if ((fields & kFileMetadataModificationTime) &&
+      (file_info.stx_mask & STATX_MTIME)) {
+    metadata.modification_time =
+        absl::FromUnixSeconds(file_info.stx_mtime.tv_sec) +
+        absl::Nanoseconds(file_info.stx_mtime.tv_nsec);
+    metadata.filled_fields |= kFileMetadataModificationTime;
+  }
+  if ((fields & kFileMetadataMode) &&
+      (file_info.stx_mask & (STATX_TYPE | STATX_MODE)) ==
+          (STATX_TYPE | STATX_MODE)) {
+    metadata.mode = file_info.stx_mode;
+    metadata.filled_fields |= kFileMetadataMode | kFileMetadataType;
+  }
+  if ((fields & kFileMetadataAllocatedSize) &&
+      (file_info.stx_mask & STATX_BLOCKS)) {
+    // Counted in 512-byte units whatever the block size of the file system.
+    metadata.allocated_size = file_info.stx_blocks * 512;
+    metadata.filled_fields |= kFileMetadataAllocatedSize;
+  }
+  if ((fields & kFileMetadataIdentity) &&
+      (file_info.stx_mask & (STATX_INO | STATX_NLINK)) ==
+          (STATX_INO | STATX_NLINK)) {
+    metadata.device = makedev(file_info.stx_dev_major, file_info.stx_dev_minor);
+    metadata.inode = file_info.stx_ino;
+    metadata.link_count = file_info.stx_nlink;
+    metadata.filled_fields |= kFileMetadataIdentity;
+  }
+  return metadata;
+}
+
+// Invokes callback on every record in a buffer filled by getdents64().
+template <typename Callback>
+void ForEachDirectoryEntry(absl::Span<const char> entries, Callback callback) {
+  for (size_t offset = 0; offset < entries.size();) {
+    const auto *entry = reinterpret_cast<const dirent64 *>(&entries[offset]);
+    callback(entry);
+    offset += entry->d_reclen;
+  }
+}
+
+// Hands every buffer of records getdents64() fills from the open directory
+// dir_fd to callback, until the directory is exhausted or callback returns
+// false.
+template <typename Callback>
+absl::Status ForEachDirectoryEntryBuffer(int dir_fd, Callback callback) {
+  std::vector<char> entries(kDirectoryReadBufferSize);
+  while (1) {
+    ssize_t bytes_read = getdents64(dir_fd, entries.data(), entries.size());
+    if (bytes_read == -1)
+      return absl::InternalError(
+          absl::StrCat("getdents64(): ", strerror(errno)));
+    if (bytes_read == 0) break;
+
+    ResolveUnknownEntryTypes(dir_fd,
+                             absl::Span<char>(entries.data(), bytes_read));
+    if (!callback(absl::Span<const char>(entries.data(), bytes_read))) break;
+  }
+  return absl::OkStatus();
+}
+
+std::string_view WithoutTrailingSlashes(std::string_view path) {
+  while (path.size() > 1 && path.back() == '/') path.remove_suffix(1);
+  return path;
+}
+
+// Whether the directory open as fd was removed since it was opened.
+bool IsRemovedDirectory(int fd) {
+  struct stat info;
+  return fstat(fd, &info) == 0 && info.st_nlink == 0;
+}
+
+// Calls syscall with a directory descriptor and a path relative to it that
+// together name path, starting from the deepest directory kept above it. Calls
+// it again with the whole path if it failed because that directory was
+// removed since it was opened, such as when a tree is removed and created
+// again. Returns what syscall returned last, with errno set by it.
+template <typename Syscall>
+int CallRelativeToKeptDirectory(DirectoryHandleCache &handles,
+                                const std::string &path, Syscall syscall) {
+  DirectoryHandleCache::Resolution resolution = handles.Resolve(path);
+  const int result = syscall(resolution.GetFd(), resolution.path.c_str());
+  if (result != -1 || resolution.directory == nullptr) return result;
+
+  const int error = errno;
+  if ((error != ENOENT && error != ENOTDIR) ||
+      !IsRemovedDirectory(resolution.directory->GetFd())) {
+    errno = error;
+    return result;
+  }
+  handles.Remove(*resolution.directory);
+  return syscall(AT_FDCWD, path.c_str());
+}
+
+void AddMockFile(DirectoryListing &listing, const MockFile &file) {
+  listing.Add(file.GetName(),
+              /*is_dir=*/dynamic_cast<const MockDirectory *>(&file) != nullptr);
+}
+
+DirectoryListing GetFilesFromMockDirectory(
     absl::Span<const MockFile *const> mock_directory) {
-  std::vector<File> file_names;
-  std::transform(mock_directory.begin(), mock_directory.end(),
-                 std::back_inserter(file_names), [](const MockFile *file) {
-                   absl::StatusOr<File> new_file = File::Create(*file);
-                   // Mock file creation cannot fail.
-                   new_file.IgnoreError();
-                   return new_file.value();
-                 });
+  DirectoryListing file_names;
+  for (const MockFile *file : mock_directory) AddMockFile(file_names, *file);
   return file_names;
 }
 
-absl::StatusOr<std::vector<File>> GetFileNamesFromLastMatchingDirectory(
+absl::StatusOr<DirectoryListing> GetFileNamesFromLastMatchingDirectory(
     absl::Span<const MockFile *const> nested_directory_files,
     std::vector<std::string> &nested_directory_names) {
   // On no more nested directories, we should be on the last file.
@@ -59,47 +237,431 @@ absl::StatusOr<std::vector<File>> GetFileNamesFromLastMatchingDirectory(
   const auto *next_directory_files =
       dynamic_cast<const MockDirectory *>(*next_directory);
   if (next_directory_files == nullptr) {
-    absl::StatusOr<File> file = File::Create(**next_directory);
-    // No errors possible when creating mock files.
-    file.IgnoreError();
-    return std::vector<File>({file.value()});
+    DirectoryListing file;
+    AddMockFile(file, **next_directory);
+    return file;
   }
 
   return GetFileNamesFromLastMatchingDirectory(next_directory_files->GetFiles(),
                                                nested_directory_names);
 }
 
+// Walks a full path such as "/dir/nesteddir" from the root of a mock file
+// system. Returns nullptr if any part of the path does not exist.
+const MockDirectory *FindMockDirectory(const MockDirectory &root,
+                                       const Glib::ustring &directory) {
+  const MockDirectory *current_directory = &root;
+  for (absl::string_view directory_name :
+       absl::StrSplit(directory.c_str(), '/', absl::SkipEmpty())) {
+    absl::Span<const MockFile *const> files = current_directory->GetFiles();
+    const auto *next_file =
+        std::find_if(files.begin(), files.end(), [&](const MockFile *file) {
+          return file->GetName() == directory_name;
+        });
+    if (next_file == files.end()) return nullptr;
+
+    current_directory = dynamic_cast<const MockDirectory *>(*next_file);
+    if (current_directory == nullptr) return nullptr;
+  }
+  return current_directory;
+}
+
+// Mock files are only ever plain directories and regular files that were
+// never modified, taking up whole 4 KiB blocks on disk.
+FileMetadata MergeMockFileMetadata(FileMetadata metadata,
+                                   const MockFile &mock_file,
+                                   FileMetadataMask fields) {
+  mode_t mock_mode = dynamic_cast<const MockDirectory *>(&mock_file)
+                         ? S_IFDIR | 0755
+                         : S_IFREG | 0644;
+  if (fields & (kFileMetadataType | kFileMetadataMode))
+    metadata.mode = mock_mode;
+  if (fields & kFileMetadataSize) metadata.size = mock_file.GetSize();
+  if (fields & kFileMetadataModificationTime)
+    metadata.modification_time = absl::UnixEpoch();
+  if (fields & kFileMetadataAllocatedSize)
+    metadata.allocated_size = (mock_file.GetSize() + 4095) / 4096 * 4096;
+  if (fields & kFileMetadataIdentity) {
+    metadata.device = 0;
+    metadata.inode = mock_file.GetInode();
+    metadata.link_count = mock_file.GetLinkCount();
+  }
+  metadata.filled_fields |= fields;
+  if (fields & kFileMetadataMode) metadata.filled_fields |= kFileMetadataType;
+  return metadata;
+}
+
 }  // namespace
 
-File::File(std::string name, bool is_dir) : file_name_(name), is_dir_(is_dir) {}
+// Minimal io_uring submission and completion queue pair, driven through the
+// raw system calls so there is no dependency on liburing.
+class IOUring {
+ public:
+  // Returns an error if the kernel has no io_uring support, it is disabled, or
+  // it does not support every operation in required_ops.
+  static absl::StatusOr<std::unique_ptr<IOUring>> Create(
+      unsigned entries, std::initializer_list<uint8_t> required_ops) {
+    io_uring_params params = {};
+    int ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring_fd == -1)
+      return absl::UnavailableError(
+          absl::StrCat("io_uring_setup(): ", strerror(errno)));
 
-absl::StatusOr<File> File::Create(dirent *file) {
-  if (!file) return absl::InvalidArgumentError("file argument was nullptr");
+    std::unique_ptr<IOUring> ring(new IOUring(ring_fd, params));
+    if (!ring->MapRings())
+      return absl::UnavailableError("Failed to map io_uring queues!");
+    for (uint8_t op : required_ops) {
+      if (!ring->SupportsOperation(op))
+        return absl::UnimplementedError(
+            absl::StrCat("io_uring operation ", op, " is not supported"));
+    }
+    return ring;
+  }
 
-  return File(file->d_name, file->d_type == DT_DIR);
-}
+  IOUring(const IOUring &) = delete;
+  IOUring &operator=(const IOUring &) = delete;
 
-absl::StatusOr<File> File::Create(const MockFile &file) {
-  return File(file.GetName(),
-              /*is_dir=*/dynamic_cast<const MockDirectory *>(&file) != nullptr);
-}
+  ~IOUring() {
+    if (sqes_ != nullptr) munmap(sqes_, sqes_size_);
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+      munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_ != MAP_FAILED) munmap(sq_ring_, sq_ring_size_);
+    close(ring_fd_);
+  }
+
+  unsigned GetQueueDepth() const { return params_.sq_entries; }
+
+  // Returns a zeroed submission entry to fill in, or nullptr if the submission
+  // queue is full. The entry is sent with the next Submit().
+  io_uring_sqe *GetSubmissionEntry() {
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sqe_tail_ - head >= params_.sq_entries) return nullptr;
+
+    unsigned index = sqe_tail_ & *sq_mask_;
+    io_uring_sqe *sqe = &sqes_[index];
+    *sqe = {};
+    sq_array_[index] = index;
+    sqe_tail_++;
+    return sqe;
+  }
+
+  // Submits every queued entry and blocks until at least wait_for completions
+  // are available. On failure some entries may have been taken by the kernel
+  // and others left queued, so the ring must be drained with Drain() and not
+  // used again.
+  absl::Status Submit(unsigned wait_for) {
+    unsigned tail = *sq_tail_;
+    unsigned to_submit = sqe_tail_ - tail;
+    __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+
+    while (to_submit > 0 || wait_for > 0) {
+      int submitted =
+          syscall(__NR_io_uring_enter, ring_fd_, to_submit, wait_for,
+                  wait_for > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+      if (submitted == -1) {
+        if (errno == EINTR) continue;
+        return absl::InternalError(
+            absl::StrCat("io_uring_enter(): ", strerror(errno)));
+      }
+      to_submit -= submitted;
+      pending_count_ += submitted;
+      wait_for = 0;
+    }
+    return absl::OkStatus();
+  }
+
+  // Pops the next available completion. Returns false if there is none.
+  bool PopCompletion(io_uring_cqe *completion) {
+    unsigned head = *cq_head_;
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) return false;
+
+    *completion = cqes_[head & *cq_mask_];
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    pending_count_--;
+    return true;
+  }
+
+  // Blocks until every entry the kernel took has completed, discarding the
+  // completions, so nothing it may still write to is freed early. Returns an
+  // error if that could not be waited for.
+  absl::Status Drain() {
+    io_uring_cqe completion;
+    while (pending_count_ > 0) {
+      while (PopCompletion(&completion)) continue;
+      if (pending_count_ == 0) break;
+      if (syscall(__NR_io_uring_enter, ring_fd_, 0, 1, IORING_ENTER_GETEVENTS,
+                  nullptr, 0) == -1 &&
+          errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        return absl::InternalError(
+            absl::StrCat("io_uring_enter(): ", strerror(errno)));
+    }
+    return absl::OkStatus();
+  }
+
+ private:
+  IOUring(int ring_fd, const io_uring_params &params)
+      : ring_fd_(ring_fd), params_(params) {}
+
+  bool MapRings() {
+    sq_ring_size_ = params_.sq_off.array + params_.sq_entries * sizeof(__u32);
+    cq_ring_size_ =
+        params_.cq_off.cqes + params_.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params_.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) return false;
+    cq_ring_ = single_mmap ? sq_ring_
+                           : mmap(nullptr, cq_ring_size_,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, ring_fd_,
+                                  IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) return false;
+    sqes_size_ = params_.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) return false;
+    sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+    char *sq_ring = static_cast<char *>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq_ring + params_.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq_ring + params_.sq_off.tail);
+    sq_mask_ =
+        reinterpret_cast<unsigned *>(sq_ring + params_.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned *>(sq_ring + params_.sq_off.array);
+    sqe_tail_ = *sq_tail_;
+
+    char *cq_ring = static_cast<char *>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq_ring + params_.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq_ring + params_.cq_off.tail);
+    cq_mask_ =
+        reinterpret_cast<unsigned *>(cq_ring + params_.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq_ring + params_.cq_off.cqes);
+    return true;
+  }
+
+  bool SupportsOperation(uint8_t op) {
+    size_t probe_size =
+        sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+    std::unique_ptr<char[]> probe_buffer(new char[probe_size]());
+    auto *probe = reinterpret_cast<io_uring_probe *>(probe_buffer.get());
+    if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PROBE, probe,
+                256) == -1)
+      return false;
+    return op <= probe->last_op &&
+           (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+  }
+
+  int ring_fd_;
+  io_uring_params params_;
+
+  void *sq_ring_ = MAP_FAILED;
+  void *cq_ring_ = MAP_FAILED;
+  size_t sq_ring_size_ = 0;
+  size_t cq_ring_size_ = 0;
+  size_t sqes_size_ = 0;
+
+  io_uring_sqe *sqes_ = nullptr;
+  unsigned *sq_head_ = nullptr;
+  unsigned *sq_tail_ = nullptr;
+  unsigned *sq_mask_ = nullptr;
+  unsigned *sq_array_ = nullptr;
+  // Tail of the entries handed out by GetSubmissionEntry(), which only become
+  // visible to the kernel on Submit().
+  unsigned sqe_tail_ = 0;
+
+  unsigned *cq_head_ = nullptr;
+  unsigned *cq_tail_ = nullptr;
+  unsigned *cq_mask_ = nullptr;
+  io_uring_cqe *cqes_ = nullptr;
+
+  // Entries the kernel took from the submission queue that have not been
+  // popped from the completion queue yet.
+  unsigned pending_count_ = 0;
+};
+
+
+File::File(std::string_view name, bool is_dir, const FileMetadata *metadata)
+    : file_name_(name), is_dir_(is_dir), metadata_(metadata) {}
 
 bool File::operator==(const char *file_name) const {
   return GetName() == file_name;
 }
+bool File::operator==(std::string_view file_name) const {
+  return GetName() == file_name;
+}
 
-std::string File::GetName() const { return file_name_; }
+std::string_view File::GetName() const { return file_name_; }
 bool File::IsDirectory() const { return is_dir_; }
 
+const FileMetadata &File::GetMetadata() const {
+  static const FileMetadata kNoMetadata;
+  return metadata_ != nullptr ? *metadata_ : kNoMetadata;
+}
+
+void DirectoryListing::Add(std::string_view name, bool is_dir) {
+  // Records only have room for 16-bit lengths and 32-bit offsets, which keeps
+  // them at 8 bytes.
+  assert(name.size() <= std::numeric_limits<uint16_t>::max());
+  assert(names_.size() + name.size() < std::numeric_limits<uint32_t>::max());
+  records_.push_back({static_cast<uint32_t>(names_.size()),
+                      static_cast<uint16_t>(name.size()),
+                      static_cast<uint8_t>(is_dir ? kRecordIsDirectory : 0)});
+  names_.append(name);
+  names_.push_back('\0');
+  if (!metadata_.empty()) metadata_.emplace_back();
+}
+
+void DirectoryListing::Add(const File &file) {
+  // A file of this listing points into the names and metadata that adding to
+  // it can reallocate, so it is copied first.
+  const std::string_view name = file.GetName();
+  if (std::less_equal<const char *>()(names_.data(), name.data()) &&
+      std::less<const char *>()(name.data(), names_.data() + names_.size())) {
+    const std::string own_name(name);
+    const FileMetadata metadata = file.GetMetadata();
+    Add(own_name, file.IsDirectory());
+    if (metadata.filled_fields != 0) SetMetadata(size() - 1, metadata);
+    return;
+  }
+
+  Add(name, file.IsDirectory());
+  if (file.GetMetadata().filled_fields != 0)
+    SetMetadata(size() - 1, file.GetMetadata());
+}
+
+void DirectoryListing::Append(const DirectoryListing &listing) {
+  if (&listing == this) {
+    const DirectoryListing copy = listing;
+    Append(copy);
+    return;
+  }
+  Reserve(size() + listing.size(), names_.size() + listing.names_.size());
+  for (File file : listing) Add(file);
+}
+
+void DirectoryListing::Reserve(size_t files, size_t name_bytes) {
+  // Grow geometrically so reserving a little more at a time stays amortized
+  // constant per file.
+  if (records_.capacity() < files)
+    records_.reserve(std::max(files, 2 * records_.capacity()));
+  if (names_.capacity() < name_bytes)
+    names_.reserve(std::max(name_bytes, 2 * names_.capacity()));
+}
+
+void DirectoryListing::Clear() {
+  names_.clear();
+  records_.clear();
+  metadata_.clear();
+}
+
+void DirectoryListing::SetMetadata(size_t index, const FileMetadata &metadata) {
+  // Metadata is only allocated once some file actually has any.
+  if (metadata_.empty()) metadata_.resize(records_.size());
+  metadata_[index] = metadata;
+}
+
+void DirectoryListing::SortByName() {
+  auto get_name = [this](const Record &record) {
+    return std::string_view(names_.data() + record.name_offset,
+                            record.name_length);
+  };
+
+  if (metadata_.empty()) {
+    std::sort(records_.begin(), records_.end(),
+              [&](const Record &left, const Record &right) {
+                return get_name(left) < get_name(right);
+              });
+    return;
+  }
+
+  // Sort indices instead, so the metadata can be put in the same order.
+  std::vector<uint32_t> order(records_.size());
+  for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](uint32_t left, uint32_t right) {
+    return get_name(records_[left]) < get_name(records_[right]);
+  });
+
+  std::vector<Record> sorted_records;
+  std::vector<FileMetadata> sorted_metadata;
+  sorted_records.reserve(records_.size());
+  sorted_metadata.reserve(metadata_.size());
+  for (uint32_t index : order) {
+    sorted_records.push_back(records_[index]);
+    sorted_metadata.push_back(metadata_[index]);
+  }
+  records_ = std::move(sorted_records);
+  metadata_ = std::move(sorted_metadata);
+}
+
+File DirectoryListing::operator[](size_t index) const {
+  const Record &record = records_[index];
+  return File(
+      std::string_view(names_.data() + record.name_offset, record.name_length),
+      record.flags & kRecordIsDirectory,
+      metadata_.empty() ? nullptr : &metadata_[index]);
+}
+
+size_t DirectoryListing::GetNameBytes() const { return names_.size(); }
+
+const char *DirectoryListing::GetNamesEnd() const {
+  return names_.data() + names_.size();
+}
+
+size_t DirectoryListing::GetMemoryUsage() const {
+  return names_.capacity() + records_.capacity() * sizeof(Record) +
+         metadata_.capacity() * sizeof(FileMetadata);
+}
+
+DirectoryListingDiff DiffSortedDirectoryListings(
+    const DirectoryListing &old_files, const DirectoryListing &new_files) {
+  DirectoryListingDiff diff;
+  size_t old_index = 0;
+  size_t new_index = 0;
+  while (old_index < old_files.size() && new_index < new_files.size()) {
+    File old_file = old_files[old_index];
+    File new_file = new_files[new_index];
+    if (old_file.GetName() < new_file.GetName()) {
+      diff.removed_files.push_back(old_index++);
+    } else if (new_file.GetName() < old_file.GetName()) {
+      diff.added_files.push_back(new_index++);
+    } else {
+      if (old_file.IsDirectory() != new_file.IsDirectory()) {
+        diff.removed_files.push_back(old_index);
+        diff.added_files.push_back(new_index);
+      }
+      old_index++;
+      new_index++;
+    }
+  }
+  for (; old_index < old_files.size(); old_index++)
+    diff.removed_files.push_back(old_index);
+  for (; new_index < new_files.size(); new_index++)
+    diff.added_files.push_back(new_index);
+  return diff;
+}
+
 FileSystem::~FileSystem() {}
 
+void FileSystem::InvalidatePath(const Glib::ustring &) const {}
+
 MockFileSystem::MockFileSystem(std::initializer_list<MockFile *> files)
     : root_("/", files) {}
 
-MockFile::MockFile(const Glib::ustring &name) : name_(name) {}
+MockFile::MockFile(const Glib::ustring &name, uint64_t size, ino_t inode,
+                   uint32_t link_count)
+    : name_(name),
+      size_(size),
+      inode_(inode != 0 ? inode : reinterpret_cast<uintptr_t>(this)),
+      link_count_(link_count) {}
 MockFile::~MockFile() {}
 
 std::string MockFile::GetName() const { return name_; }
+uint64_t MockFile::GetSize() const { return size_; }
+ino_t MockFile::GetInode() const { return inode_; }
+uint32_t MockFile::GetLinkCount() const { return link_count_; }
 
 MockDirectory::MockDirectory(const Glib::ustring &name,
                              std::initializer_list<MockFile *> files)
@@ -112,7 +674,7 @@ absl::Span<const MockFile *const> MockDirectory::GetFiles() const {
   return files_;
 }
 
-absl::StatusOr<std::vector<File>> MockFileSystem::GetDirectoryFiles(
+absl::StatusOr<DirectoryListing> MockFileSystem::GetDirectoryFiles(
     const Glib::ustring &directory) const {
   std::vector<std::string> file_names;
   if (directory == "/") return GetFilesFromMockDirectory(root_.GetFiles());
@@ -133,35 +695,531 @@ absl::StatusOr<std::vector<File>> MockFileSystem::GetDirectoryFiles(
                                                nested_directory_names);
 }
 
+absl::Status MockFileSystem::CheckDirectory(
+    const Glib::ustring &directory) const {
+  // Listing mock files is cheap, and walking the path the same way keeps both
+  // in agreement, including on paths that name a file.
+  return GetDirectoryFiles(directory).status();
+}
+
+absl::Status MockFileSystem::StreamDirectoryFiles(
+    const Glib::ustring &directory, size_t batch_size,
+    const FileBatchCallback &callback) const {
+  if (batch_size == 0)
+    return absl::InvalidArgumentError("Batch size cannot be zero!");
+
+  absl::StatusOr<DirectoryListing> files = GetDirectoryFiles(directory);
+  if (!files.ok()) return files.status();
+
+  DirectoryListing batch;
+  for (File file : *files) {
+    batch.Add(file);
+    if (batch.size() < batch_size) continue;
+
+    if (!callback(batch)) return absl::OkStatus();
+    batch.Clear();
+  }
+
+  if (!batch.empty()) callback(batch);
+  return absl::OkStatus();
+}
+
+absl::Status MockFileSystem::FillFileMetadata(const Glib::ustring &directory,
+                                              DirectoryListing &files,
+                                              FileMetadataMask fields) const {
+  const MockDirectory *mock_directory = FindMockDirectory(root_, directory);
+  if (mock_directory == nullptr)
+    return absl::NotFoundError("Directory not found!");
+
+  absl::Status first_error = absl::OkStatus();
+  absl::Span<const MockFile *const> mock_files = mock_directory->GetFiles();
+  for (size_t i = 0; i < files.size(); i++) {
+    File file = files[i];
+    const auto *mock_file = std::find_if(
+        mock_files.begin(), mock_files.end(),
+        [&file](const MockFile *mock_file) {
+          return mock_file->GetName() == file.GetName();
+        });
+    if (mock_file == mock_files.end()) {
+      if (first_error.ok())
+        first_error = absl::NotFoundError(
+            absl::StrCat("File not found: ", file.GetName().data()));
+      continue;
+    }
+
+    files.SetMetadata(
+        i, MergeMockFileMetadata(file.GetMetadata(), **mock_file, fields));
+  }
+
+  return first_error;
+}
+
+absl::StatusOr<FileMetadata> MockFileSystem::GetFileMetadata(
+    const Glib::ustring &path, FileMetadataMask fields) const {
+  if (path.empty() || path[0] != '/')
+    return absl::InvalidArgumentError(
+        "Must be a full path starting with \"/\"!");
+
+  std::string parent_directory = path;
+  while (parent_directory.size() > 1 && parent_directory.back() == '/')
+    parent_directory.pop_back();
+  if (parent_directory == "/")
+    return MergeMockFileMetadata(FileMetadata(), root_, fields);
+
+  const size_t name_start = parent_directory.rfind('/') + 1;
+  const std::string file_name = parent_directory.substr(name_start);
+  parent_directory.resize(name_start);
+
+  const MockDirectory *mock_directory =
+      FindMockDirectory(root_, parent_directory);
+  if (mock_directory == nullptr) return absl::NotFoundError("Not found!");
+  for (const MockFile *mock_file : mock_directory->GetFiles()) {
+    if (mock_file->GetName() == file_name)
+      return MergeMockFileMetadata(FileMetadata(), *mock_file, fields);
+  }
+  return absl::NotFoundError("Not found!");
+}
+
+DirectoryHandleCache::Handle::Handle(std::string directory, int fd)
+    : directory_(std::move(directory)), fd_(fd) {}
+
+DirectoryHandleCache::Handle::~Handle() { close(fd_); }
+
+int DirectoryHandleCache::Resolution::GetFd() const {
+  return directory != nullptr ? directory->GetFd() : AT_FDCWD;
+}
+
+DirectoryHandleCache::DirectoryHandleCache()
+    : DirectoryHandleCache(Options()) {}
+
+DirectoryHandleCache::DirectoryHandleCache(Options options)
+    : options_(options) {}
+
+DirectoryHandleCache::~DirectoryHandleCache() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_stopping_ = true;
+  }
+  stopping_.notify_all();
+  if (reaper_.joinable()) reaper_.join();
+}
+
+DirectoryHandleCache::Resolution DirectoryHandleCache::Resolve(
+    std::string_view path) {
+  Resolution resolution{nullptr, std::string(path)};
+  const std::string_view directory = WithoutTrailingSlashes(path);
+  if (directory.empty() || directory.front() != '/') return resolution;
+
+  const Clock::time_point now = Clock::now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (entries_.empty()) return resolution;
+  // Parents are looked up from the deepest one, so only the components below
+  // the one found are resolved again.
+  for (size_t name_start = directory.rfind('/'); name_start != 0;
+       name_start = directory.rfind('/', name_start - 1)) {
+    auto entry = entries_by_directory_.find(
+        std::string(directory.substr(0, name_start)));
+    if (entry == entries_by_directory_.end()) continue;
+    if (entry->second->expiry <= now) {
+      entries_.erase(entry->second);
+      entries_by_directory_.erase(entry);
+      continue;
+    }
+
+    entries_.splice(entries_.begin(), entries_, entry->second);
+    resolution.directory = entry->second->handle;
+    resolution.path = std::string(path.substr(name_start + 1));
+    return resolution;
+  }
+  // / itself is not worth keeping, since it is the start of every full path.
+  return resolution;
+}
+
+void DirectoryHandleCache::Add(std::string_view directory, int fd) {
+  const std::string_view key = WithoutTrailingSlashes(directory);
+  if (!IsEnabled() || key.size() < 2 || key.front() != '/') {
+    close(fd);
+    return;
+  }
+  auto handle = std::make_shared<const Handle>(std::string(key), fd);
+  const Clock::time_point expiry =
+      Clock::now() + absl::ToChronoNanoseconds(options_.max_age);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto entry = entries_by_directory_.find(handle->GetDirectory());
+  if (entry != entries_by_directory_.end()) {
+    entries_.erase(entry->second);
+    entries_by_directory_.erase(entry);
+  }
+  entries_.push_front({handle, expiry});
+  entries_by_directory_[handle->GetDirectory()] = entries_.begin();
+  while (entries_.size() > options_.capacity) {
+    entries_by_directory_.erase(entries_.back().handle->GetDirectory());
+    entries_.pop_back();
+  }
+
+  if (!is_reaper_running_) {
+    // A reaper that found nothing left to close is done with mutex_ already.
+    if (reaper_.joinable()) reaper_.join();
+    is_reaper_running_ = true;
+    reaper_ = std::thread(&DirectoryHandleCache::RunReaper, this);
+  }
+}
+
+void DirectoryHandleCache::Remove(const Handle &handle) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto entry = entries_by_directory_.find(handle.GetDirectory());
+  if (entry == entries_by_directory_.end() ||
+      entry->second->handle.get() != &handle)
+    return;
+  entries_.erase(entry->second);
+  entries_by_directory_.erase(entry);
+}
+
+void DirectoryHandleCache::RemoveDirectory(std::string_view directory) {
+  const std::string_view key = WithoutTrailingSlashes(directory);
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Few enough handles are kept that going through all of them is cheaper
+  // than keeping them ordered by path.
+  for (auto entry = entries_.begin(); entry != entries_.end();) {
+    const std::string &kept = entry->handle->GetDirectory();
+    const bool is_below = kept.compare(0, key.size(), key) == 0 &&
+                          (kept.size() == key.size() || key == "/" ||
+                           kept[key.size()] == '/');
+    if (!is_below) {
+      ++entry;
+      continue;
+    }
+    entries_by_directory_.erase(kept);
+    entry = entries_.erase(entry);
+  }
+}
+
+bool DirectoryHandleCache::IsEnabled() const {
+  return options_.capacity > 0 && options_.max_age > absl::ZeroDuration();
+}
+
+bool DirectoryHandleCache::Contains(std::string_view directory) const {
+  const Clock::time_point now = Clock::now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto entry = entries_by_directory_.find(
+      std::string(WithoutTrailingSlashes(directory)));
+  return entry != entries_by_directory_.end() && entry->second->expiry > now;
+}
+
+size_t DirectoryHandleCache::GetSize() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+void DirectoryHandleCache::RunReaper() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!is_stopping_ && !entries_.empty()) {
+    const Clock::time_point now = Clock::now();
+    Clock::time_point next_expiry = Clock::time_point::max();
+    for (auto entry = entries_.begin(); entry != entries_.end();) {
+      if (entry->expiry > now) {
+        next_expiry = std::min(next_expiry, entry->expiry);
+        ++entry;
+        continue;
+      }
+      entries_by_directory_.erase(entry->handle->GetDirectory());
+      entry = entries_.erase(entry);
+    }
+    if (entries_.empty()) break;
+    stopping_.wait_until(lock, next_expiry);
+  }
+  is_reaper_running_ = false;
+}
+
 // To test methods in POSIXFileSystem, make a test double that mocks POSIX APIs
 // such as this:
 // class MockPOSIXAPI : public POSIXAPIInterface {
-//     DIR *opendir(const char *str) {}
-//     dirrent *readdir(DIR *dir) { return dir->next_dir; }
+//     int open(const char *path, int flags) {}
+//     ssize_t getdents64(int fd, void *buf, size_t size) {}
 // };
 // Then pass that to POSIXFileSystem as a dependency for POSIXAPIInterface and
 // use MockPOSIXAPI to ensure POSIXFileSystem::GetDirectoryFiles() returns the
 // correct files.
-absl::StatusOr<std::vector<File>> POSIXFileSystem::GetDirectoryFiles(
+POSIXFileSystem::POSIXFileSystem()
+    : POSIXFileSystem(DirectoryHandleCache::Options()) {}
+
+POSIXFileSystem::POSIXFileSystem(DirectoryHandleCache::Options handle_options)
+    : directory_handles_(handle_options) {}
+
+absl::StatusOr<DirectoryListing> POSIXFileSystem::GetDirectoryFiles(
     const Glib::ustring &directory) const {
-  DIR *dir = opendir(directory.c_str());
-  if (dir == nullptr)
+  int dir_fd = OpenDirectory(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd == -1)
     return absl::NotFoundError(
         absl::StrCat("Can't open directory: ", strerror(errno)));
 
-  std::vector<File> file_names;
-  for (dirent *file = readdir(dir); file != nullptr; file = readdir(dir)) {
-    std::string_view file_name = file->d_name;
-    if (!(file->d_type & (DT_REG | DT_DIR)) || file_name == "." ||
-        file_name == "..")
+  DirectoryListing file_names;
+  absl::Status status = ForEachDirectoryEntryBuffer(
+      dir_fd, [&file_names](absl::Span<const char> read_entries) {
+        // Size the buffer's entries up front so the listing grows at most once
+        // per buffer instead of once per entry.
+        size_t listed_entries = 0;
+        size_t name_bytes = 0;
+        ForEachDirectoryEntry(read_entries, [&](const dirent64 *entry) {
+          if (!ShouldListDirectoryEntry(entry->d_name, entry->d_type)) return;
+          listed_entries++;
+          name_bytes += strlen(entry->d_name) + 1;
+        });
+        file_names.Reserve(file_names.size() + listed_entries,
+                           file_names.GetNameBytes() + name_bytes);
+
+        ForEachDirectoryEntry(read_entries, [&file_names](
+                                                const dirent64 *entry) {
+          if (ShouldListDirectoryEntry(entry->d_name, entry->d_type))
+            file_names.Add(entry->d_name, entry->d_type == DT_DIR);
+        });
+        return true;
+      });
+  close(dir_fd);
+  if (!status.ok()) return status;
+
+  return file_names;
+}
+
+absl::Status POSIXFileSystem::CheckDirectory(
+    const Glib::ustring &directory) const {
+  // Opening the directory checks its type and permissions the same way
+  // GetDirectoryFiles() does, in a single syscall.
+  int dir_fd = OpenDirectory(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd == -1)
+    return absl::NotFoundError(
+        absl::StrCat("Can't open directory: ", strerror(errno)));
+
+  close(dir_fd);
+  return absl::OkStatus();
+}
+
+absl::Status POSIXFileSystem::StreamDirectoryFiles(
+    const Glib::ustring &directory, size_t batch_size,
+    const FileBatchCallback &callback) const {
+  if (batch_size == 0)
+    return absl::InvalidArgumentError("Batch size cannot be zero!");
+
+  int dir_fd = OpenDirectory(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd == -1)
+    return absl::NotFoundError(
+        absl::StrCat("Can't open directory: ", strerror(errno)));
+
+  // One batch is reused throughout, so streaming only allocates up front.
+  DirectoryListing batch;
+  bool stopped = false;
+  absl::Status status = ForEachDirectoryEntryBuffer(
+      dir_fd, [&](absl::Span<const char> read_entries) {
+        ForEachDirectoryEntry(read_entries, [&](const dirent64 *entry) {
+          if (stopped ||
+              !ShouldListDirectoryEntry(entry->d_name, entry->d_type))
+            return;
+
+          batch.Add(entry->d_name, entry->d_type == DT_DIR);
+          if (batch.size() < batch_size) return;
+
+          stopped = !callback(batch);
+          batch.Clear();
+        });
+        return !stopped;
+      });
+  close(dir_fd);
+  if (!status.ok()) return status;
+
+  if (!stopped && !batch.empty()) callback(batch);
+  return absl::OkStatus();
+}
+
+absl::Status POSIXFileSystem::FillFileMetadata(const Glib::ustring &directory,
+                                               DirectoryListing &files,
+                                               FileMetadataMask fields) const {
+  // statx() relative to one directory descriptor saves resolving the full
+  // path of every file again.
+  int dir_fd = OpenDirectory(directory, O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd == -1)
+    return absl::NotFoundError(
+        absl::StrCat("Can't open directory: ", strerror(errno)));
+
+  unsigned int statx_mask = GetStatxMask(fields);
+  absl::Status first_error = absl::OkStatus();
+  for (size_t i = 0; i < files.size(); i++) {
+    File file = files[i];
+    struct statx file_info;
+    if (statx(dir_fd, file.GetName().data(),
+              AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, statx_mask,
+              &file_info) == -1) {
+      if (first_error.ok())
+        first_error = absl::NotFoundError(absl::StrCat(
+            "statx(", file.GetName().data(), "): ", strerror(errno)));
       continue;
+    }
+
+    files.SetMetadata(
+        i, MergeStatxMetadata(file.GetMetadata(), file_info, fields));
+  }
+
+  close(dir_fd);
+  return first_error;
+}
+
+absl::StatusOr<FileMetadata> POSIXFileSystem::GetFileMetadata(
+    const Glib::ustring &path, FileMetadataMask fields) const {
+  const unsigned int statx_mask = GetStatxMask(fields);
+  struct statx file_info;
+  if (CallRelativeToKeptDirectory(
+          directory_handles_, path,
+          [statx_mask, &file_info](int dir_fd, const char *relative_path) {
+            return statx(dir_fd, relative_path,
+                         AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, statx_mask,
+                         &file_info);
+          }) == -1)
+    return absl::NotFoundError(
+        absl::StrCat("statx(", path.c_str(), "): ", strerror(errno)));
+
+  return MergeStatxMetadata(FileMetadata(), file_info, fields);
+}
 
-    absl::StatusOr<File> new_file = File::Create(file);
-    if (!new_file.ok()) continue;
+void POSIXFileSystem::InvalidatePath(const Glib::ustring &path) const {
+  directory_handles_.RemoveDirectory(path.raw());
+}
 
-    file_names.push_back(new_file.value());
+int POSIXFileSystem::OpenDirectory(const std::string &directory,
+                                   int flags) const {
+  const std::string_view path = WithoutTrailingSlashes(directory);
+  const size_t name_start = path.rfind('/');
+  // Directories next to each other are read together, such as when walking a
+  // tree or reading ahead into subdirectories, so their parent is kept for the
+  // rest of them. The directory itself is not, so that removing it is reported
+  // to inotify watches right away rather than once it is closed.
+  if (name_start != std::string_view::npos && name_start > 0 &&
+      directory_handles_.IsEnabled()) {
+    const std::string parent(path.substr(0, name_start));
+    if (!directory_handles_.Contains(parent)) {
+      int parent_fd = CallRelativeToKeptDirectory(
+          directory_handles_, parent,
+          [](int dir_fd, const char *relative_path) {
+            return openat(dir_fd, relative_path,
+                          O_PATH | O_DIRECTORY | O_CLOEXEC);
+          });
+      if (parent_fd != -1) directory_handles_.Add(parent, parent_fd);
+    }
   }
 
-  closedir(dir);
-  return file_names;
+  return CallRelativeToKeptDirectory(
+      directory_handles_, directory,
+      [flags](int dir_fd, const char *relative_path) {
+        return openat(dir_fd, relative_path, flags);
+      });
+}
+
+IOUringFileSystem::IOUringFileSystem(unsigned queue_depth)
+    : queue_depth_(queue_depth) {}
+
+IOUringFileSystem::~IOUringFileSystem() = default;
+
+std::unique_ptr<IOUring> IOUringFileSystem::TakeRing() const {
+  {
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    if (!io_uring_available_) return nullptr;
+    if (!idle_rings_.empty()) {
+      std::unique_ptr<IOUring> ring = std::move(idle_rings_.back());
+      idle_rings_.pop_back();
+      return ring;
+    }
+  }
+
+  absl::StatusOr<std::unique_ptr<IOUring>> ring =
+      IOUring::Create(queue_depth_, {IORING_OP_STATX});
+  if (ring.ok()) return std::move(ring).value();
+
+  // Either the kernel lacks io_uring or its statx() operation, or io_uring is
+  // disabled. Neither changes while running, so stop trying.
+  std::lock_guard<std::mutex> lock(rings_mutex_);
+  io_uring_available_ = false;
+  return nullptr;
+}
+
+void IOUringFileSystem::ReturnRing(std::unique_ptr<IOUring> ring) const {
+  std::lock_guard<std::mutex> lock(rings_mutex_);
+  idle_rings_.push_back(std::move(ring));
+}
+
+absl::Status IOUringFileSystem::FillFileMetadata(
+    const Glib::ustring &directory, DirectoryListing &files,
+    FileMetadataMask fields) const {
+  std::unique_ptr<IOUring> ring = TakeRing();
+  if (ring == nullptr)
+    return POSIXFileSystem::FillFileMetadata(directory, files, fields);
+
+  int dir_fd = OpenDirectory(directory, O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd == -1) {
+    const int error = errno;
+    ReturnRing(std::move(ring));
+    return absl::NotFoundError(
+        absl::StrCat("Can't open directory: ", strerror(error)));
+  }
+
+  // The names and file_infos are accessed by the kernel after submission, so
+  // neither may move until every request has completed. Only metadata is
+  // written to the listing meanwhile, which leaves the names in place.
+  auto file_infos = std::make_unique<struct statx[]>(files.size());
+
+  unsigned statx_mask = GetStatxMask(fields);
+  absl::Status first_error = absl::OkStatus();
+  size_t next_to_submit = 0;
+  size_t in_flight = 0;
+  while (next_to_submit < files.size() || in_flight > 0) {
+    for (; next_to_submit < files.size() && in_flight < ring->GetQueueDepth();
+         next_to_submit++) {
+      io_uring_sqe *sqe = ring->GetSubmissionEntry();
+      if (sqe == nullptr) break;
+
+      sqe->opcode = IORING_OP_STATX;
+      sqe->fd = dir_fd;
+      sqe->addr =
+          reinterpret_cast<uint64_t>(files[next_to_submit].GetName().data());
+      sqe->len = statx_mask;
+      sqe->off = reinterpret_cast<uint64_t>(&file_infos[next_to_submit]);
+      sqe->statx_flags = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT;
+      sqe->user_data = next_to_submit;
+      in_flight++;
+    }
+
+    absl::Status status = ring->Submit(/*wait_for=*/1);
+    if (!status.ok()) {
+      // Requests the kernel took may still write into file_infos. The ring
+      // is not reused, since entries it did not take are still queued. If
+      // even waiting fails, both are leaked rather than freed under the
+      // kernel.
+      if (!ring->Drain().ok()) {
+        ring.release();
+        file_infos.release();
+      }
+      close(dir_fd);
+      return status;
+    }
+
+    io_uring_cqe completion;
+    while (ring->PopCompletion(&completion)) {
+      in_flight--;
+      File file = files[completion.user_data];
+      if (completion.res < 0) {
+        if (first_error.ok())
+          first_error = absl::NotFoundError(
+              absl::StrCat("statx(", file.GetName().data(),
+                           "): ", strerror(-completion.res)));
+        continue;
+      }
+
+      files.SetMetadata(
+          completion.user_data,
+          MergeStatxMetadata(file.GetMetadata(),
+                             file_infos[completion.user_data], fields));
+    }
+  }
+
+  close(dir_fd);
+  ReturnRing(std::move(ring));
+  return first_error;
 }
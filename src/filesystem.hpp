@@ -3,55 +3,265 @@
 
 #include <absl/status/status.h>
 #include <absl/status/statusor.h>
+#include <absl/time/time.h>
+#include <absl/types/span.h>
+#include <dirent.h>
 #include <glibmm/ustring.h>
+#include <sys/types.h>
 
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
-class MockFile;
+// Metadata that can be requested from FileSystem::FillFileMetadata(). Can be
+// combined into a FileMetadataMask to only pay for the fields needed.
+enum FileMetadataField : uint32_t {
+  kFileMetadataType = 1 << 0,
+  kFileMetadataSize = 1 << 1,
+  kFileMetadataModificationTime = 1 << 2,
+  kFileMetadataMode = 1 << 3,
+  // Bytes the file takes up on disk, which is less than its size for sparse
+  // files and usually more for small ones.
+  kFileMetadataAllocatedSize = 1 << 4,
+  // Device, inode and link count, which tell hard links to one file apart
+  // from different files.
+  kFileMetadataIdentity = 1 << 5,
+};
+using FileMetadataMask = uint32_t;
+
+// Metadata of a File. Only the fields in filled_fields hold valid values, the
+// rest are left zeroed.
+struct FileMetadata {
+  FileMetadataMask filled_fields = 0;
+  uint64_t size = 0;
+  absl::Time modification_time = absl::UnixEpoch();
+  // Contains both the file type and permission bits, as in stat::st_mode.
+  mode_t mode = 0;
+  uint64_t allocated_size = 0;
+  dev_t device = 0;
+  ino_t inode = 0;
+  uint32_t link_count = 0;
+};
 
-// Abstracted file object for all different supported file systems.
+// Abstracted file object for all different supported file systems. A File is
+// a lightweight view of one entry in a DirectoryListing and is only valid for
+// as long as that listing is alive and unmodified.
 class File {
  public:
-  static absl::StatusOr<File> Create(dirent *file);
-  static absl::StatusOr<File> Create(const MockFile &file);
-
-  std::string GetName() const;
+  // The name is always NUL-terminated, so GetName().data() can be handed
+  // directly to C APIs.
+  std::string_view GetName() const;
   bool IsDirectory() const;
 
+  // Metadata filled in by FileSystem::FillFileMetadata(). Empty if nothing was
+  // filled for this file.
+  const FileMetadata &GetMetadata() const;
+
   bool operator==(const char *file_name) const;
+  bool operator==(std::string_view file_name) const;
 
  private:
-  File(std::string name, bool is_dir);
+  friend class DirectoryListing;
+
+  File(std::string_view name, bool is_dir, const FileMetadata *metadata);
 
-  std::string file_name_;
+  std::string_view file_name_;
   bool is_dir_;
+  const FileMetadata *metadata_;
+};
+
+// Files of a single directory. All file names are stored back to back in one
+// buffer and every file is a compact record of its name's offset, length and
+// flags, so reading a directory costs a handful of large allocations instead
+// of one per file, and the whole listing is released at once.
+//
+// Behaves like a read-only container of File. Like iterators of a
+// std::vector, Files obtained from a listing are invalidated by any
+// modification of it.
+class DirectoryListing {
+ public:
+  class const_iterator {
+   public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = File;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = File;
+
+    const_iterator(const DirectoryListing *listing, size_t index)
+        : listing_(listing), index_(index) {}
+
+    File operator*() const { return (*listing_)[index_]; }
+    const_iterator &operator++() {
+      index_++;
+      return *this;
+    }
+    const_iterator operator++(int) {
+      return const_iterator(listing_, index_++);
+    }
+    bool operator==(const const_iterator &other) const {
+      return index_ == other.index_ && listing_ == other.listing_;
+    }
+    bool operator!=(const const_iterator &other) const {
+      return !(*this == other);
+    }
+
+   private:
+    const DirectoryListing *listing_;
+    size_t index_;
+  };
+  using value_type = File;
+  using iterator = const_iterator;
+  using size_type = size_t;
+
+  // Appends a file. name must be at most PATH_MAX bytes long, which leaves
+  // room for relative paths besides anything read from a directory, and the
+  // names of a listing must add up to less than 4 GiB. Both are checked in
+  // debug builds.
+  void Add(std::string_view name, bool is_dir);
+  // Appends a copy of file, including its metadata. file may be from this
+  // listing, as may the listing appended.
+  void Add(const File &file);
+  void Append(const DirectoryListing &listing);
+
+  // Makes room for at least files files whose NUL-terminated names add up to
+  // name_bytes, so they can be added without reallocating.
+  void Reserve(size_t files, size_t name_bytes);
+  // Removes every file but keeps the allocated memory for reuse.
+  void Clear();
+
+  void SetMetadata(size_t index, const FileMetadata &metadata);
+
+  // Orders the files by the bytes of their names, keeping their metadata.
+  void SortByName();
+
+  File operator[](size_t index) const;
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, size()); }
+  size_t size() const { return records_.size(); }
+  bool empty() const { return records_.empty(); }
+
+  // Bytes taken by all NUL-terminated names, as passed to Reserve().
+  size_t GetNameBytes() const;
+  // End of the buffer holding every name. Memory from the start of any name up
+  // to here can be read, so names can be scanned a whole vector at a time.
+  const char *GetNamesEnd() const;
+  // Bytes of heap memory held by the listing.
+  size_t GetMemoryUsage() const;
+
+ private:
+  enum RecordFlags : uint8_t {
+    kRecordIsDirectory = 1 << 0,
+  };
+
+  struct Record {
+    uint32_t name_offset;
+    uint16_t name_length;
+    uint8_t flags;
+  };
+
+  // Every name followed by a NUL terminator.
+  std::string names_;
+  std::vector<Record> records_;
+  // Either empty, or holds the metadata of every record at the same index.
+  std::vector<FileMetadata> metadata_;
+};
+
+// Files that differ between an old and a new listing of the same directory.
+struct DirectoryListingDiff {
+  // Indices into the old listing of files that are gone.
+  std::vector<size_t> removed_files;
+  // Indices into the new listing of files that are new.
+  std::vector<size_t> added_files;
 };
 
+// Compares two listings sorted with DirectoryListing::SortByName() in a single
+// linear pass. A file whose type changed counts as both removed and added.
+DirectoryListingDiff DiffSortedDirectoryListings(
+    const DirectoryListing &old_files, const DirectoryListing &new_files);
+
 // Abstraction layer that to interact with a file system. Provides method to
 // list all files on a given directory and open, read, and write individual
 // files on the file system.
 class FileSystem {
  public:
+  // Receives one batch of files read from a directory. Returning false stops
+  // the enumeration before the rest of the directory is read.
+  using FileBatchCallback = std::function<bool(const DirectoryListing &files)>;
+
   virtual ~FileSystem();
 
   // Obtains all the files existing in the directory specified by directory.
   // Must be a full path, no relative links will succeed. Returns an
   // absl::NotFoundError if the directory does not exist. Else will contain a
-  // an array of file names that existed in the specified directory.
-  virtual absl::StatusOr<std::vector<File>> GetDirectoryFiles(
+  // listing of the files that existed in the specified directory.
+  virtual absl::StatusOr<DirectoryListing> GetDirectoryFiles(
       const Glib::ustring &directory) const = 0;
+
+  // Checks that directory exists and could be listed by GetDirectoryFiles(),
+  // without reading any of its files. Returns the same error
+  // GetDirectoryFiles() would have if it cannot be listed.
+  virtual absl::Status CheckDirectory(const Glib::ustring &directory) const = 0;
+
+  // Same as GetDirectoryFiles(), but hands the files to callback in batches of
+  // at most batch_size files as soon as they are read, instead of returning
+  // them all at the end. Batches are only valid for the duration of the
+  // callback. If an error is returned after some batches were delivered, the
+  // listing is incomplete.
+  virtual absl::Status StreamDirectoryFiles(
+      const Glib::ustring &directory, size_t batch_size,
+      const FileBatchCallback &callback) const = 0;
+
+  // Fills in the metadata selected by fields for files, which must have been
+  // listed from directory. Fields a file already has are fetched again. Files
+  // that can no longer be found keep their old metadata, and the first such
+  // error is returned once every other file has been filled.
+  virtual absl::Status FillFileMetadata(const Glib::ustring &directory,
+                                        DirectoryListing &files,
+                                        FileMetadataMask fields) const = 0;
+
+  // Fetches the metadata selected by fields for the single file or directory
+  // at path, which must be a full path. Returns an absl::NotFoundError if it
+  // does not exist.
+  virtual absl::StatusOr<FileMetadata> GetFileMetadata(
+      const Glib::ustring &path, FileMetadataMask fields) const = 0;
+
+  // Drops anything kept about the file or directory at the full path path and
+  // everything below it, once this process renamed or removed it, so nothing
+  // is read through its old location again. Does nothing by default.
+  virtual void InvalidatePath(const Glib::ustring &path) const;
 };
 
 class MockFile {
  public:
-  MockFile(const Glib::ustring &name);
+  // Files that share an inode other than zero are hard links to each other,
+  // and should say how many there are in link_count. Every file with inode
+  // zero gets an inode of its own.
+  MockFile(const Glib::ustring &name, uint64_t size = 0, ino_t inode = 0,
+           uint32_t link_count = 1);
   virtual ~MockFile();
 
   std::string GetName() const;
+  uint64_t GetSize() const;
+  ino_t GetInode() const;
+  uint32_t GetLinkCount() const;
 
  private:
   Glib::ustring name_;
+  uint64_t size_;
+  ino_t inode_;
+  uint32_t link_count_;
 };
 
 class MockDirectory : public MockFile {
@@ -89,8 +299,17 @@ class MockFileSystem : public FileSystem {
 
   virtual ~MockFileSystem() = default;
 
-  absl::StatusOr<std::vector<File>> GetDirectoryFiles(
+  absl::StatusOr<DirectoryListing> GetDirectoryFiles(
       const Glib::ustring &directory) const override;
+  absl::Status CheckDirectory(const Glib::ustring &directory) const override;
+  absl::Status StreamDirectoryFiles(
+      const Glib::ustring &directory, size_t batch_size,
+      const FileBatchCallback &callback) const override;
+  absl::Status FillFileMetadata(const Glib::ustring &directory,
+                                DirectoryListing &files,
+                                FileMetadataMask fields) const override;
+  absl::StatusOr<FileMetadata> GetFileMetadata(
+      const Glib::ustring &path, FileMetadataMask fields) const override;
 
   const MockDirectory &GetRoot() const { return root_; }
 
@@ -98,13 +317,186 @@ class MockFileSystem : public FileSystem {
   MockDirectory root_;
 };
 
-// Interface for extracting files using POSIX APIs.
+// Keeps directories open by full path for a little while, so that paths below
+// them can be handed to openat() and statx() relative to them, instead of the
+// kernel walking every component from / again. Browsing deep trees opens the
+// same few directories over and over: listing a directory, filling in its
+// metadata, reading ahead into its subdirectories and walking them all go
+// through its parent.
+//
+// A directory kept open stays the same directory even if it is renamed, or
+// another one takes its place, so a handle is only trusted for max_age after
+// it was opened. Renames and removals this process makes itself are told to
+// RemoveDirectory() through FileSystem::InvalidatePath(), so they are never
+// missed for that long. Handles of directories that were removed are noticed
+// by the lookups that fail through them, and dropped right away. Expired
+// handles are closed by a thread of the cache, so they never keep a file
+// system from being unmounted for longer than max_age either. Safe to use from
+// multiple threads.
+class DirectoryHandleCache {
+ public:
+  struct Options {
+    // Handles kept at most. The least recently used ones are closed first.
+    size_t capacity = 64;
+    // How long a handle is used after it was opened. Zero keeps none.
+    absl::Duration max_age = absl::Seconds(2);
+  };
+
+  // Descriptor of a directory kept open, closed once neither the cache nor any
+  // Resolution holds it anymore.
+  class Handle {
+   public:
+    Handle(std::string directory, int fd);
+    Handle(const Handle &) = delete;
+    Handle &operator=(const Handle &) = delete;
+    ~Handle();
+
+    const std::string &GetDirectory() const { return directory_; }
+    int GetFd() const { return fd_; }
+
+   private:
+    std::string directory_;
+    int fd_;
+  };
+
+  // A path split into a directory kept open above it and the rest of it, as
+  // taken by the *at() family of syscalls.
+  struct Resolution {
+    // Null if no directory above the path is kept, in which case path is the
+    // whole path.
+    std::shared_ptr<const Handle> directory;
+    std::string path;
+
+    // Descriptor to resolve path relative to, AT_FDCWD if directory is null.
+    int GetFd() const;
+  };
+
+  DirectoryHandleCache();
+  explicit DirectoryHandleCache(Options options);
+
+  DirectoryHandleCache(const DirectoryHandleCache &) = delete;
+  DirectoryHandleCache &operator=(const DirectoryHandleCache &) = delete;
+  ~DirectoryHandleCache();
+
+  // Splits the full path path at the deepest directory kept strictly above it,
+  // marking that directory as the most recently used.
+  Resolution Resolve(std::string_view path);
+
+  // Keeps fd, a descriptor of the directory at the full path directory, taking
+  // ownership of it. Replaces whatever was kept for directory.
+  void Add(std::string_view directory, int fd);
+
+  // Stops keeping handle, such as once its directory was found removed.
+  // Does nothing if another handle was kept for its directory since.
+  void Remove(const Handle &handle);
+  // Stops keeping the handles of the full path directory and of every
+  // directory below it, such as once it was renamed.
+  void RemoveDirectory(std::string_view directory);
+
+  // Whether a handle is kept for the full path directory and not expired.
+  bool Contains(std::string_view directory) const;
+  // Whether handles are kept at all, which Options can turn off.
+  bool IsEnabled() const;
+
+  // Number of handles kept, expired ones included until they are closed.
+  size_t GetSize() const;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    std::shared_ptr<const Handle> handle;
+    Clock::time_point expiry;
+  };
+
+  // Closes expired handles as they expire, for as long as there are any.
+  void RunReaper();
+
+  Options options_;
+
+  // Guards everything below.
+  mutable std::mutex mutex_;
+  // Most recently used handles first.
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator>
+      entries_by_directory_;
+  // Signals the reaper to stop.
+  std::condition_variable stopping_;
+  bool is_stopping_ = false;
+  bool is_reaper_running_ = false;
+  std::thread reaper_;
+};
+
+// Interface for extracting files using POSIX APIs. Directories are read with
+// getdents64() into large buffers instead of one readdir() call per entry.
+// Entries the file system reports as DT_UNKNOWN are resolved with statx()
+// relative to the open directory, and metadata is fetched the same way, only
+// asking the kernel for the requested fields.
+//
+// Paths are resolved relative to the directories above them visited last,
+// which a DirectoryHandleCache keeps open. Reading a directory keeps its
+// parent, so its siblings and everything below it skip most of the walk.
 class POSIXFileSystem : public FileSystem {
  public:
+  POSIXFileSystem();
+  explicit POSIXFileSystem(DirectoryHandleCache::Options handle_options);
   virtual ~POSIXFileSystem() = default;
 
-  absl::StatusOr<std::vector<File>> GetDirectoryFiles(
+  absl::StatusOr<DirectoryListing> GetDirectoryFiles(
       const Glib::ustring &directory) const override;
+  absl::Status CheckDirectory(const Glib::ustring &directory) const override;
+  absl::Status StreamDirectoryFiles(
+      const Glib::ustring &directory, size_t batch_size,
+      const FileBatchCallback &callback) const override;
+  absl::Status FillFileMetadata(const Glib::ustring &directory,
+                                DirectoryListing &files,
+                                FileMetadataMask fields) const override;
+  absl::StatusOr<FileMetadata> GetFileMetadata(
+      const Glib::ustring &path, FileMetadataMask fields) const override;
+  // Closes the directories kept open at or below path.
+  void InvalidatePath(const Glib::ustring &path) const override;
+
+ protected:
+  // Opens the directory at the full path directory with flags, which must
+  // include O_DIRECTORY, relative to the deepest directory kept above it,
+  // keeping its parent first if it is not yet. Returns -1 with errno set on
+  // failure.
+  int OpenDirectory(const std::string &directory, int flags) const;
+
+ private:
+  mutable DirectoryHandleCache directory_handles_;
+};
+
+class IOUring;
+
+// POSIXFileSystem that fetches metadata through io_uring. statx() requests for
+// a whole listing are queued in large batches and complete asynchronously, so
+// slow or network-backed storage can work on many of them at once instead of
+// one round trip per file. Falls back to POSIXFileSystem's synchronous path
+// when io_uring or its statx() operation is unavailable.
+//
+// Rings are set up on first use and kept for later listings, one for each
+// thread filling metadata at the same time.
+class IOUringFileSystem : public POSIXFileSystem {
+ public:
+  // queue_depth is the maximum number of statx() requests in flight at once.
+  explicit IOUringFileSystem(unsigned queue_depth = 256);
+  virtual ~IOUringFileSystem();
+
+  absl::Status FillFileMetadata(const Glib::ustring &directory,
+                                DirectoryListing &files,
+                                FileMetadataMask fields) const override;
+
+ private:
+  // Takes an idle ring, setting a new one up if there is none. Returns nullptr
+  // if io_uring can't be used.
+  std::unique_ptr<IOUring> TakeRing() const;
+  void ReturnRing(std::unique_ptr<IOUring> ring) const;
+
+  unsigned queue_depth_;
+  mutable std::mutex rings_mutex_;
+  mutable std::vector<std::unique_ptr<IOUring>> idle_rings_;
+  mutable bool io_uring_available_ = true;
 };
 
 #endif
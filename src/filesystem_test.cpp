@@ -5,20 +5,33 @@
 #include <absl/status/status.h>
 #include <absl/status/statusor.h>
 #include <absl/strings/str_split.h>
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
 #include <absl/types/any.h>
 #include <absl/utility/utility.h>
+#include <fcntl.h>
 #include <glibmm/ustring.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <gtkmm/window.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <array>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <initializer_list>
+#include <string>
 #include <string_view>
 #include <type_traits>
 #include <utility>
 
+#include "temp_directory_test.hpp"
+
 using ::testing::Contains;
+using ::testing::ElementsAre;
 using ::testing::IsEmpty;
 using ::testing::IsNull;
 using ::testing::Not;
@@ -146,6 +159,172 @@ IsOkAndHoldsMatcher<typename std::decay<InnerMatcher>::type> IsOkAndHolds(
 // Returns a gMock matcher that matches a Status or StatusOr<> which is OK.
 inline IsOkMatcher IsOk() { return IsOkMatcher(); }
 
+TEST(DirectoryListingTest, StoresNamesAndTypes) {
+  DirectoryListing listing;
+  listing.Add("meow.txt", /*is_dir=*/false);
+  listing.Add("dir", /*is_dir=*/true);
+
+  ASSERT_THAT(listing, SizeIs(2));
+  EXPECT_EQ(listing[0].GetName(), "meow.txt");
+  EXPECT_FALSE(listing[0].IsDirectory());
+  EXPECT_EQ(listing[1].GetName(), "dir");
+  EXPECT_TRUE(listing[1].IsDirectory());
+  EXPECT_THAT(listing, ElementsAre("meow.txt", "dir"));
+}
+
+TEST(DirectoryListingTest, NamesAreNulTerminated) {
+  DirectoryListing listing;
+  listing.Add("meow.txt", /*is_dir=*/false);
+  listing.Add("dir", /*is_dir=*/true);
+
+  EXPECT_THAT(listing[0].GetName().data(), StrEq("meow.txt"));
+  EXPECT_THAT(listing[1].GetName().data(), StrEq("dir"));
+}
+
+TEST(DirectoryListingTest, MetadataIsOnlyAllocatedOnceSet) {
+  DirectoryListing listing;
+  listing.Add("meow.txt", /*is_dir=*/false);
+  listing.Add("dir", /*is_dir=*/true);
+  size_t memory_without_metadata = listing.GetMemoryUsage();
+  EXPECT_EQ(listing[0].GetMetadata().filled_fields, 0);
+
+  FileMetadata metadata;
+  metadata.filled_fields = kFileMetadataSize;
+  metadata.size = 42;
+  listing.SetMetadata(1, metadata);
+
+  EXPECT_GT(listing.GetMemoryUsage(), memory_without_metadata);
+  EXPECT_EQ(listing[0].GetMetadata().filled_fields, 0);
+  EXPECT_EQ(listing[1].GetMetadata().size, 42);
+}
+
+TEST(DirectoryListingTest, AppendCopiesFilesAndMetadata) {
+  DirectoryListing first;
+  first.Add("a", /*is_dir=*/false);
+  DirectoryListing second;
+  second.Add("b", /*is_dir=*/true);
+  FileMetadata metadata;
+  metadata.filled_fields = kFileMetadataSize;
+  metadata.size = 7;
+  second.SetMetadata(0, metadata);
+
+  first.Append(second);
+
+  EXPECT_THAT(first, ElementsAre("a", "b"));
+  EXPECT_TRUE(first[1].IsDirectory());
+  EXPECT_EQ(first[0].GetMetadata().filled_fields, 0);
+  EXPECT_EQ(first[1].GetMetadata().size, 7);
+}
+
+TEST(DirectoryListingTest, AddsCopiesOfItsOwnFiles) {
+  DirectoryListing listing;
+  listing.Add("a-name-too-long-for-small-string-storage", /*is_dir=*/false);
+  FileMetadata metadata;
+  metadata.filled_fields = kFileMetadataSize;
+  metadata.size = 7;
+  listing.SetMetadata(0, metadata);
+
+  // Adding keeps outgrowing the memory the file added points into.
+  for (int i = 0; i < 6; i++) listing.Add(listing[listing.size() - 1]);
+  listing.Append(listing);
+
+  ASSERT_EQ(listing.size(), 14);
+  for (File file : listing) {
+    EXPECT_EQ(file.GetName(), "a-name-too-long-for-small-string-storage");
+    EXPECT_EQ(file.GetMetadata().size, 7);
+  }
+}
+
+TEST(DirectoryListingTest, ClearRemovesAllFiles) {
+  DirectoryListing listing;
+  listing.Add("meow.txt", /*is_dir=*/false);
+
+  listing.Clear();
+
+  EXPECT_THAT(listing, IsEmpty());
+  EXPECT_EQ(listing.GetNameBytes(), 0);
+}
+
+TEST(DirectoryListingTest, SortsByName) {
+  DirectoryListing listing;
+  listing.Add("meow.txt", /*is_dir=*/false);
+  listing.Add("dir", /*is_dir=*/true);
+  listing.Add("Zebra", /*is_dir=*/false);
+
+  listing.SortByName();
+
+  EXPECT_THAT(listing, ElementsAre("Zebra", "dir", "meow.txt"));
+  EXPECT_TRUE(listing[1].IsDirectory());
+}
+
+TEST(DirectoryListingTest, SortingKeepsMetadataWithItsFile) {
+  DirectoryListing listing;
+  listing.Add("b", /*is_dir=*/false);
+  listing.Add("a", /*is_dir=*/false);
+  FileMetadata metadata;
+  metadata.filled_fields = kFileMetadataSize;
+  metadata.size = 42;
+  listing.SetMetadata(0, metadata);
+
+  listing.SortByName();
+
+  EXPECT_THAT(listing, ElementsAre("a", "b"));
+  EXPECT_EQ(listing[0].GetMetadata().filled_fields, 0);
+  EXPECT_EQ(listing[1].GetMetadata().size, 42);
+}
+
+TEST(DirectoryListingDiffTest, FindsAddedAndRemovedFiles) {
+  DirectoryListing old_files;
+  old_files.Add("a", /*is_dir=*/false);
+  old_files.Add("b", /*is_dir=*/false);
+  old_files.Add("d", /*is_dir=*/false);
+  DirectoryListing new_files;
+  new_files.Add("b", /*is_dir=*/false);
+  new_files.Add("c", /*is_dir=*/false);
+  new_files.Add("d", /*is_dir=*/false);
+  new_files.Add("e", /*is_dir=*/false);
+
+  DirectoryListingDiff diff = DiffSortedDirectoryListings(old_files, new_files);
+
+  EXPECT_THAT(diff.removed_files, ElementsAre(0));
+  EXPECT_THAT(diff.added_files, ElementsAre(1, 3));
+}
+
+TEST(DirectoryListingDiffTest, IdenticalListingsHaveNoDifferences) {
+  DirectoryListing files;
+  files.Add("a", /*is_dir=*/true);
+  files.Add("b", /*is_dir=*/false);
+
+  DirectoryListingDiff diff = DiffSortedDirectoryListings(files, files);
+
+  EXPECT_THAT(diff.removed_files, IsEmpty());
+  EXPECT_THAT(diff.added_files, IsEmpty());
+}
+
+TEST(DirectoryListingDiffTest, TypeChangeIsRemovalAndAddition) {
+  DirectoryListing old_files;
+  old_files.Add("a", /*is_dir=*/false);
+  DirectoryListing new_files;
+  new_files.Add("a", /*is_dir=*/true);
+
+  DirectoryListingDiff diff = DiffSortedDirectoryListings(old_files, new_files);
+
+  EXPECT_THAT(diff.removed_files, ElementsAre(0));
+  EXPECT_THAT(diff.added_files, ElementsAre(0));
+}
+
+TEST(DirectoryListingDiffTest, EverythingChangesAgainstEmptyListing) {
+  DirectoryListing empty;
+  DirectoryListing files;
+  files.Add("a", /*is_dir=*/false);
+  files.Add("b", /*is_dir=*/false);
+
+  EXPECT_THAT(DiffSortedDirectoryListings(empty, files).added_files,
+              ElementsAre(0, 1));
+  EXPECT_THAT(DiffSortedDirectoryListings(files, empty).removed_files,
+              ElementsAre(0, 1));
+}
+
 TEST(MockFileSystemTest, EmptyCheck) {
   MockFileSystem mock_fs({});
 
@@ -296,10 +475,10 @@ TEST(MockFileSystemTest, EnsureRegFilesDifferentFromDirectoriesInRoot) {
                           new MockDirectory("dir", {}),
                           new MockDirectory("meow", {})});
 
-  absl::StatusOr<std::vector<File>> root_files = mock_fs.GetDirectoryFiles("/");
+  absl::StatusOr<DirectoryListing> root_files = mock_fs.GetDirectoryFiles("/");
   EXPECT_THAT(root_files, IsOkAndHolds(SizeIs(3)));
 
-  const std::vector<File>& extracted_files = root_files.value();
+  const DirectoryListing& extracted_files = root_files.value();
   EXPECT_EQ(extracted_files[0].GetName(), "meow.txt");
   EXPECT_FALSE(extracted_files[0].IsDirectory());
   EXPECT_EQ(extracted_files[1].GetName(), "dir");
@@ -315,11 +494,11 @@ TEST(MockFileSystemTest, EnsureRegFilesDifferentFromDirectoriesInDir) {
                                  new MockFile("whyyoualwayslying.lol")}),
        new MockDirectory("meow", {})});
 
-  absl::StatusOr<std::vector<File>> dir_files =
+  absl::StatusOr<DirectoryListing> dir_files =
       mock_fs.GetDirectoryFiles("/dir");
   EXPECT_THAT(dir_files, IsOkAndHolds(SizeIs(3)));
 
-  const std::vector<File>& extracted_files = dir_files.value();
+  const DirectoryListing& extracted_files = dir_files.value();
   EXPECT_EQ(extracted_files[0].GetName(), "lmao.txt");
   EXPECT_FALSE(extracted_files[0].IsDirectory());
   EXPECT_EQ(extracted_files[1].GetName(), "nameabettertest.cpp");
@@ -338,11 +517,11 @@ TEST(MockFileSystemTest, EnsureRegFilesDifferentFromDirectoriesINestedDir) {
                                       new MockFile("whyyoualwayslying.lol")})}),
        new MockDirectory("meow", {})});
 
-  absl::StatusOr<std::vector<File>> dir_files =
+  absl::StatusOr<DirectoryListing> dir_files =
       mock_fs.GetDirectoryFiles("/dir/nesteddir");
   EXPECT_THAT(dir_files, IsOkAndHolds(SizeIs(3)));
 
-  const std::vector<File>& extracted_files = dir_files.value();
+  const DirectoryListing& extracted_files = dir_files.value();
   EXPECT_EQ(extracted_files[0].GetName(), "lmao.txt");
   EXPECT_FALSE(extracted_files[0].IsDirectory());
   EXPECT_EQ(extracted_files[1].GetName(), "nameabettertest.cpp");
@@ -351,4 +530,569 @@ TEST(MockFileSystemTest, EnsureRegFilesDifferentFromDirectoriesINestedDir) {
   EXPECT_FALSE(extracted_files[2].IsDirectory());
 }
 
-}  // namespace
\ No newline at end of file
+TEST(MockFileSystemTest, ChecksDirectoriesWithoutListingThem) {
+  MockFileSystem mock_fs(
+      {new MockFile("meow.txt"),
+       new MockDirectory("dir", {new MockDirectory("nesteddir", {})})});
+
+  EXPECT_OK(mock_fs.CheckDirectory("/"));
+  EXPECT_OK(mock_fs.CheckDirectory("/dir/nesteddir/"));
+  EXPECT_THAT(mock_fs.CheckDirectory("/nope"), Not(IsOk()));
+  EXPECT_THAT(mock_fs.CheckDirectory("dir"), Not(IsOk()));
+  EXPECT_THAT(mock_fs.CheckDirectory(""), Not(IsOk()));
+}
+
+TEST(MockFileSystemTest, ChecksDirectoriesLikeListingThem) {
+  MockFileSystem mock_fs(
+      {new MockFile("meow.txt"),
+       new MockDirectory("dir", {new MockDirectory("nesteddir", {})})});
+
+  for (const char* directory : {"/", "/meow.txt", "/dir/nesteddir/",
+                                "/dir//nope", "/dir/nope", "dir", ""}) {
+    EXPECT_EQ(mock_fs.CheckDirectory(directory).code(),
+              mock_fs.GetDirectoryFiles(directory).status().code())
+        << directory;
+  }
+}
+
+TEST(MockFileSystemTest, StreamsFilesInBatches) {
+  MockFileSystem mock_fs({new MockFile("a"), new MockFile("b"),
+                          new MockFile("c"), new MockDirectory("d", {}),
+                          new MockFile("e")});
+
+  std::vector<size_t> batch_sizes;
+  std::vector<std::string> file_names;
+  EXPECT_OK(mock_fs.StreamDirectoryFiles(
+      "/", /*batch_size=*/2, [&](const DirectoryListing& files) {
+        batch_sizes.push_back(files.size());
+        for (File file : files) file_names.emplace_back(file.GetName());
+        return true;
+      }));
+
+  EXPECT_THAT(batch_sizes, ElementsAre(2, 2, 1));
+  EXPECT_THAT(file_names, ElementsAre("a", "b", "c", "d", "e"));
+}
+
+TEST(MockFileSystemTest, StopStreamingWhenCallbackReturnsFalse) {
+  MockFileSystem mock_fs(
+      {new MockFile("a"), new MockFile("b"), new MockFile("c")});
+
+  int batches = 0;
+  EXPECT_OK(mock_fs.StreamDirectoryFiles(
+      "/", /*batch_size=*/1, [&batches](const DirectoryListing& /*files*/) {
+        batches++;
+        return false;
+      }));
+
+  EXPECT_EQ(batches, 1);
+}
+
+TEST(MockFileSystemTest, ErrorWhenStreamingMissingDirectory) {
+  MockFileSystem mock_fs({new MockFile("a")});
+
+  EXPECT_THAT(mock_fs.StreamDirectoryFiles(
+                  "/nope", /*batch_size=*/1,
+                  [](const DirectoryListing& /*files*/) { return true; }),
+              Not(IsOk()));
+}
+
+TEST(MockFileSystemTest, FillsRequestedMetadata) {
+  MockFileSystem mock_fs(
+      {new MockDirectory("dir", {new MockFile("meow.txt", /*size=*/42),
+                                 new MockDirectory("nesteddir", {})})});
+
+  absl::StatusOr<DirectoryListing> files = mock_fs.GetDirectoryFiles("/dir");
+  ASSERT_THAT(files, IsOkAndHolds(SizeIs(2)));
+  EXPECT_OK(mock_fs.FillFileMetadata(
+      "/dir", *files, kFileMetadataSize | kFileMetadataType));
+
+  const FileMetadata& file_metadata = (*files)[0].GetMetadata();
+  EXPECT_EQ(file_metadata.filled_fields,
+            kFileMetadataSize | kFileMetadataType);
+  EXPECT_EQ(file_metadata.size, 42);
+  EXPECT_TRUE(S_ISREG(file_metadata.mode));
+  EXPECT_TRUE(S_ISDIR((*files)[1].GetMetadata().mode));
+}
+
+TEST(MockFileSystemTest, FillsAllocatedSizeAndHardLinks) {
+  MockFileSystem mock_fs({new MockFile("a", /*size=*/5000, /*inode=*/7,
+                                       /*link_count=*/2),
+                          new MockFile("b", /*size=*/5000, /*inode=*/7,
+                                       /*link_count=*/2),
+                          new MockFile("c", /*size=*/1)});
+
+  absl::StatusOr<DirectoryListing> files = mock_fs.GetDirectoryFiles("/");
+  ASSERT_THAT(files, IsOkAndHolds(SizeIs(3)));
+  EXPECT_OK(mock_fs.FillFileMetadata(
+      "/", *files, kFileMetadataAllocatedSize | kFileMetadataIdentity));
+
+  EXPECT_EQ((*files)[0].GetMetadata().allocated_size, 8192);
+  EXPECT_EQ((*files)[0].GetMetadata().inode, 7);
+  EXPECT_EQ((*files)[1].GetMetadata().inode, 7);
+  EXPECT_EQ((*files)[1].GetMetadata().link_count, 2);
+  EXPECT_EQ((*files)[2].GetMetadata().allocated_size, 4096);
+  EXPECT_NE((*files)[2].GetMetadata().inode, 7);
+  EXPECT_EQ((*files)[2].GetMetadata().link_count, 1);
+}
+
+TEST(MockFileSystemTest, ErrorWhenFillingMetadataOfMissingDirectory) {
+  MockFileSystem mock_fs({new MockFile("meow.txt")});
+
+  absl::StatusOr<DirectoryListing> files = mock_fs.GetDirectoryFiles("/");
+  ASSERT_THAT(files, IsOk());
+  EXPECT_THAT(mock_fs.FillFileMetadata("/dir", *files,
+                                       kFileMetadataSize),
+              Not(IsOk()));
+}
+
+TEST(MockFileSystemTest, GetsMetadataOfSingleFiles) {
+  MockFileSystem mock_fs(
+      {new MockDirectory("dir", {new MockFile("meow.txt", /*size=*/42)})});
+
+  absl::StatusOr<FileMetadata> metadata =
+      mock_fs.GetFileMetadata("/dir/meow.txt", kFileMetadataSize);
+  ASSERT_THAT(metadata, IsOk());
+  EXPECT_EQ(metadata->filled_fields, kFileMetadataSize);
+  EXPECT_EQ(metadata->size, 42);
+
+  metadata = mock_fs.GetFileMetadata("/dir/", kFileMetadataType);
+  ASSERT_THAT(metadata, IsOk());
+  EXPECT_TRUE(S_ISDIR(metadata->mode));
+  EXPECT_THAT(mock_fs.GetFileMetadata("/", kFileMetadataType), IsOk());
+
+  EXPECT_THAT(mock_fs.GetFileMetadata("/dir/nope", kFileMetadataType),
+              Not(IsOk()));
+  EXPECT_THAT(mock_fs.GetFileMetadata("/nope/meow.txt", kFileMetadataType),
+              Not(IsOk()));
+  EXPECT_THAT(mock_fs.GetFileMetadata("dir", kFileMetadataType), Not(IsOk()));
+}
+
+class POSIXFileSystemTest : public TempDirectoryTest {
+ protected:
+  POSIXFileSystem posix_fs_;
+};
+
+TEST_F(POSIXFileSystemTest, ListsFilesAndDirectories) {
+  CreateFile("meow.txt");
+  CreateDirectory("dir");
+
+  absl::StatusOr<DirectoryListing> files =
+      posix_fs_.GetDirectoryFiles(root_);
+  ASSERT_THAT(files, IsOkAndHolds(UnorderedElementsAre("meow.txt", "dir")));
+
+  for (File file : files.value())
+    EXPECT_EQ(file.IsDirectory(), file.GetName() == "dir");
+}
+
+TEST_F(POSIXFileSystemTest, SkipsSymbolicLinksAndSpecialFiles) {
+  CreateFile("meow.txt");
+  CreateDirectory("dir");
+  ASSERT_EQ(symlink("meow.txt", GetPath("file_link").c_str()), 0);
+  ASSERT_EQ(symlink("dir", GetPath("dir_link").c_str()), 0);
+  ASSERT_EQ(symlink("nope", GetPath("dangling_link").c_str()), 0);
+  ASSERT_EQ(mkfifo(GetPath("fifo").c_str(), 0644), 0);
+
+  EXPECT_THAT(posix_fs_.GetDirectoryFiles(root_),
+              IsOkAndHolds(UnorderedElementsAre("meow.txt", "dir")));
+
+  std::vector<std::string> file_names;
+  EXPECT_OK(posix_fs_.StreamDirectoryFiles(
+      root_, /*batch_size=*/2, [&file_names](const DirectoryListing& files) {
+        for (File file : files) file_names.emplace_back(file.GetName());
+        return true;
+      }));
+  EXPECT_THAT(file_names, UnorderedElementsAre("meow.txt", "dir"));
+}
+
+TEST_F(POSIXFileSystemTest, EmptyDirectoryHasNoFiles) {
+  EXPECT_THAT(posix_fs_.GetDirectoryFiles(root_), IsOkAndHolds(IsEmpty()));
+}
+
+TEST_F(POSIXFileSystemTest, ErrorOnMissingDirectory) {
+  EXPECT_THAT(posix_fs_.GetDirectoryFiles(root_ + "/nope"), Not(IsOk()));
+}
+
+TEST_F(POSIXFileSystemTest, ErrorOnRegularFile) {
+  CreateFile("meow.txt");
+
+  EXPECT_THAT(posix_fs_.GetDirectoryFiles(root_ + "/meow.txt"), Not(IsOk()));
+}
+
+TEST_F(POSIXFileSystemTest, ChecksDirectoriesWithoutListingThem) {
+  CreateFile("meow.txt");
+  CreateDirectory("dir");
+
+  EXPECT_OK(posix_fs_.CheckDirectory(root_));
+  EXPECT_OK(posix_fs_.CheckDirectory(root_ + "/dir/"));
+  EXPECT_THAT(posix_fs_.CheckDirectory(root_ + "/meow.txt"), Not(IsOk()));
+  EXPECT_THAT(posix_fs_.CheckDirectory(root_ + "/nope"), Not(IsOk()));
+}
+
+TEST_F(POSIXFileSystemTest, ListsDirectoryLargerThanOneReadBuffer) {
+  // Long names make the raw entries span several getdents64() buffers.
+  const std::string padding(200, 'x');
+  for (int i = 0; i < 3000; i++) CreateFile(std::to_string(i) + padding);
+
+  absl::StatusOr<DirectoryListing> files =
+      posix_fs_.GetDirectoryFiles(root_);
+  ASSERT_THAT(files, IsOkAndHolds(SizeIs(3000)));
+  const std::string last_name = "2999" + padding;
+  EXPECT_THAT(files.value(), Contains(last_name.c_str()));
+}
+
+TEST_F(POSIXFileSystemTest, StreamsWholeDirectoryInBatches) {
+  for (int i = 0; i < 10; i++) CreateFile(std::to_string(i));
+
+  std::vector<std::string> file_names;
+  EXPECT_OK(posix_fs_.StreamDirectoryFiles(
+      root_, /*batch_size=*/3, [&file_names](const DirectoryListing& files) {
+        EXPECT_THAT(files, SizeIs(testing::Le(3)));
+        for (File file : files) file_names.emplace_back(file.GetName());
+        return true;
+      }));
+
+  EXPECT_THAT(file_names, UnorderedElementsAre("0", "1", "2", "3", "4", "5",
+                                               "6", "7", "8", "9"));
+}
+
+TEST_F(POSIXFileSystemTest, StopStreamingWhenCallbackReturnsFalse) {
+  for (int i = 0; i < 10; i++) CreateFile(std::to_string(i));
+
+  int batches = 0;
+  EXPECT_OK(posix_fs_.StreamDirectoryFiles(
+      root_, /*batch_size=*/3, [&batches](const DirectoryListing& /*files*/) {
+        batches++;
+        return false;
+      }));
+
+  EXPECT_EQ(batches, 1);
+}
+
+TEST_F(POSIXFileSystemTest, FillsOnlyRequestedMetadata) {
+  CreateFile("meow.txt");
+  CreateDirectory("dir");
+
+  absl::StatusOr<DirectoryListing> files = posix_fs_.GetDirectoryFiles(root_);
+  ASSERT_THAT(files, IsOkAndHolds(SizeIs(2)));
+  EXPECT_OK(posix_fs_.FillFileMetadata(root_, *files,
+                                       kFileMetadataSize | kFileMetadataMode));
+
+  for (File file : *files) {
+    const FileMetadata& metadata = file.GetMetadata();
+    EXPECT_TRUE(metadata.filled_fields & kFileMetadataSize);
+    EXPECT_TRUE(metadata.filled_fields & kFileMetadataMode);
+    EXPECT_FALSE(metadata.filled_fields & kFileMetadataModificationTime);
+    if (file.IsDirectory()) {
+      EXPECT_TRUE(S_ISDIR(metadata.mode));
+    } else {
+      EXPECT_TRUE(S_ISREG(metadata.mode));
+      EXPECT_EQ(metadata.size, 1);
+    }
+  }
+}
+
+TEST_F(POSIXFileSystemTest, FillMetadataReportsDeletedFiles) {
+  CreateFile("meow.txt");
+  CreateFile("gone.txt");
+
+  absl::StatusOr<DirectoryListing> files = posix_fs_.GetDirectoryFiles(root_);
+  ASSERT_THAT(files, IsOkAndHolds(SizeIs(2)));
+  std::remove((root_ + "/gone.txt").c_str());
+
+  EXPECT_THAT(posix_fs_.FillFileMetadata(root_, *files,
+                                         kFileMetadataModificationTime),
+              Not(IsOk()));
+  for (File file : *files) {
+    EXPECT_EQ(file.GetName() == "meow.txt",
+              static_cast<bool>(file.GetMetadata().filled_fields &
+                                kFileMetadataModificationTime));
+  }
+}
+
+TEST_F(POSIXFileSystemTest, GetsMetadataOfSingleFiles) {
+  CreateFile("meow.txt");
+  CreateDirectory("dir");
+
+  absl::StatusOr<FileMetadata> metadata = posix_fs_.GetFileMetadata(
+      root_ + "/meow.txt", kFileMetadataSize | kFileMetadataModificationTime);
+  ASSERT_THAT(metadata, IsOk());
+  EXPECT_EQ(metadata->filled_fields,
+            kFileMetadataSize | kFileMetadataModificationTime);
+  EXPECT_EQ(metadata->size, 1);
+  EXPECT_GT(metadata->modification_time, absl::UnixEpoch());
+
+  metadata = posix_fs_.GetFileMetadata(root_ + "/dir/", kFileMetadataType);
+  ASSERT_THAT(metadata, IsOk());
+  EXPECT_TRUE(S_ISDIR(metadata->mode));
+
+  EXPECT_THAT(posix_fs_.GetFileMetadata(root_ + "/nope", kFileMetadataType),
+              Not(IsOk()));
+}
+
+TEST_F(POSIXFileSystemTest, FillsAllocatedSizeAndHardLinks) {
+  CreateFile("meow.txt");
+  ASSERT_EQ(link((root_ + "/meow.txt").c_str(), (root_ + "/link").c_str()),
+            0);
+  CreateFile("other.txt");
+
+  absl::StatusOr<DirectoryListing> files = posix_fs_.GetDirectoryFiles(root_);
+  ASSERT_THAT(files, IsOkAndHolds(SizeIs(3)));
+  files->SortByName();
+  EXPECT_OK(posix_fs_.FillFileMetadata(
+      root_, *files, kFileMetadataAllocatedSize | kFileMetadataIdentity));
+
+  const FileMetadata& link_metadata = (*files)[0].GetMetadata();
+  const FileMetadata& file_metadata = (*files)[1].GetMetadata();
+  const FileMetadata& other_metadata = (*files)[2].GetMetadata();
+  EXPECT_EQ(file_metadata.filled_fields,
+            kFileMetadataAllocatedSize | kFileMetadataIdentity);
+  EXPECT_EQ(file_metadata.allocated_size % 512, 0);
+  EXPECT_EQ(link_metadata.device, file_metadata.device);
+  EXPECT_EQ(link_metadata.inode, file_metadata.inode);
+  EXPECT_EQ(file_metadata.link_count, 2);
+  EXPECT_NE(other_metadata.inode, file_metadata.inode);
+  EXPECT_EQ(other_metadata.link_count, 1);
+}
+
+TEST_F(POSIXFileSystemTest, IOUringFillsMetadataForMoreFilesThanQueueDepth) {
+  for (int i = 0; i < 100; i++) CreateFile(std::to_string(i));
+  IOUringFileSystem io_uring_fs(/*queue_depth=*/8);
+
+  absl::StatusOr<DirectoryListing> files =
+      io_uring_fs.GetDirectoryFiles(root_);
+  ASSERT_THAT(files, IsOkAndHolds(SizeIs(100)));
+  EXPECT_OK(io_uring_fs.FillFileMetadata(
+      root_, *files, kFileMetadataSize | kFileMetadataType));
+
+  for (File file : *files) {
+    EXPECT_EQ(file.GetMetadata().filled_fields,
+              kFileMetadataSize | kFileMetadataType);
+    EXPECT_EQ(file.GetMetadata().size, 1);
+    EXPECT_TRUE(S_ISREG(file.GetMetadata().mode));
+  }
+}
+
+TEST_F(POSIXFileSystemTest, IOUringReusesRingAcrossListings) {
+  CreateFile("meow.txt");
+  IOUringFileSystem io_uring_fs;
+  // Rings show up in /proc as links to "anon_inode:[io_uring]".
+  auto get_open_rings = []() {
+    std::vector<std::string> rings;
+    for (const auto& entry :
+         std::filesystem::directory_iterator("/proc/self/fd")) {
+      std::error_code error;
+      if (std::filesystem::read_symlink(entry.path(), error).native().find(
+              "io_uring") != std::string::npos)
+        rings.push_back(entry.path().filename());
+    }
+    return rings;
+  };
+  const std::vector<std::string> rings_before = get_open_rings();
+
+  absl::StatusOr<DirectoryListing> files =
+      io_uring_fs.GetDirectoryFiles(root_);
+  ASSERT_THAT(files, IsOkAndHolds(SizeIs(1)));
+  EXPECT_OK(io_uring_fs.FillFileMetadata(root_, *files, kFileMetadataSize));
+  const std::vector<std::string> rings = get_open_rings();
+  if (rings == rings_before) GTEST_SKIP() << "io_uring is unavailable.";
+  EXPECT_THAT(rings, SizeIs(rings_before.size() + 1));
+
+  for (int i = 0; i < 10; i++)
+    EXPECT_OK(io_uring_fs.FillFileMetadata(root_, *files, kFileMetadataSize));
+
+  EXPECT_EQ(get_open_rings(), rings);
+  EXPECT_EQ((*files)[0].GetMetadata().size, 1);
+}
+
+TEST_F(POSIXFileSystemTest, IOUringFillMetadataReportsDeletedFiles) {
+  CreateFile("meow.txt");
+  CreateFile("gone.txt");
+  IOUringFileSystem io_uring_fs;
+
+  absl::StatusOr<DirectoryListing> files =
+      io_uring_fs.GetDirectoryFiles(root_);
+  ASSERT_THAT(files, IsOkAndHolds(SizeIs(2)));
+  std::remove((root_ + "/gone.txt").c_str());
+
+  EXPECT_THAT(io_uring_fs.FillFileMetadata(root_, *files,
+                                           kFileMetadataSize),
+              Not(IsOk()));
+  for (File file : *files) {
+    EXPECT_EQ(file.GetName() == "meow.txt",
+              static_cast<bool>(file.GetMetadata().filled_fields &
+                                kFileMetadataSize));
+  }
+}
+
+
+TEST_F(POSIXFileSystemTest, ListsDirectoryRecreatedBelowKeptDirectory) {
+  CreateDirectory("dir");
+  CreateDirectory("dir/sub");
+  CreateFile("dir/sub/old.txt");
+  ASSERT_THAT(posix_fs_.GetDirectoryFiles(root_ + "/dir"),
+              IsOkAndHolds(SizeIs(1)));
+  ASSERT_THAT(posix_fs_.GetDirectoryFiles(root_ + "/dir/sub"),
+              IsOkAndHolds(SizeIs(1)));
+
+  std::remove((root_ + "/dir/sub/old.txt").c_str());
+  rmdir((root_ + "/dir/sub").c_str());
+  rmdir((root_ + "/dir").c_str());
+  CreateDirectory("dir");
+  CreateDirectory("dir/sub");
+  CreateFile("dir/sub/new.txt");
+
+  absl::StatusOr<DirectoryListing> files =
+      posix_fs_.GetDirectoryFiles(root_ + "/dir/sub");
+  ASSERT_THAT(files, IsOkAndHolds(SizeIs(1)));
+  EXPECT_EQ((*files)[0].GetName(), "new.txt");
+  EXPECT_THAT(posix_fs_.GetFileMetadata(root_ + "/dir/sub/new.txt",
+                                        kFileMetadataSize),
+              IsOk());
+}
+
+TEST_F(POSIXFileSystemTest, ListsDirectoryRecreatedAfterInvalidatingRename) {
+  CreateDirectory("dir");
+  CreateDirectory("dir/sub");
+  CreateFile("dir/sub/old.txt");
+  ASSERT_THAT(posix_fs_.GetDirectoryFiles(root_ + "/dir/sub"),
+              IsOkAndHolds(SizeIs(1)));
+
+  // The kept directory is still there under its new name, so nothing fails
+  // through it.
+  ASSERT_EQ(rename((root_ + "/dir").c_str(), (root_ + "/moved").c_str()), 0);
+  posix_fs_.InvalidatePath(root_ + "/dir");
+  CreateDirectory("dir");
+  CreateDirectory("dir/sub");
+  CreateFile("dir/sub/new.txt");
+
+  absl::StatusOr<DirectoryListing> files =
+      posix_fs_.GetDirectoryFiles(root_ + "/dir/sub");
+  ASSERT_THAT(files, IsOkAndHolds(SizeIs(1)));
+  EXPECT_EQ((*files)[0].GetName(), "new.txt");
+}
+
+class DirectoryHandleCacheTest : public POSIXFileSystemTest {
+ protected:
+  // Opens the directory name below root_, expecting it to exist.
+  int Open(const std::string& name) {
+    int fd = open((root_ + "/" + name).c_str(), O_PATH | O_DIRECTORY);
+    EXPECT_NE(fd, -1) << name;
+    return fd;
+  }
+
+  static bool IsOpen(int fd) { return fcntl(fd, F_GETFD) != -1; }
+};
+
+TEST_F(DirectoryHandleCacheTest, ResolvesRelativeToDeepestKeptDirectory) {
+  CreateDirectory("a");
+  CreateDirectory("a/b");
+  DirectoryHandleCache handles;
+  handles.Add(root_ + "/a", Open("a"));
+  handles.Add(root_ + "/a/b/", Open("a/b"));
+
+  DirectoryHandleCache::Resolution resolution =
+      handles.Resolve(root_ + "/a/b/c.txt");
+  ASSERT_THAT(resolution.directory, NotNull());
+  EXPECT_EQ(resolution.directory->GetDirectory(), root_ + "/a/b");
+  EXPECT_EQ(resolution.path, "c.txt");
+
+  resolution = handles.Resolve(root_ + "/a/b/");
+  ASSERT_THAT(resolution.directory, NotNull());
+  EXPECT_EQ(resolution.directory->GetDirectory(), root_ + "/a");
+  EXPECT_EQ(resolution.path, "b/");
+
+  resolution = handles.Resolve(root_ + "/c/d");
+  EXPECT_THAT(resolution.directory, IsNull());
+  EXPECT_EQ(resolution.GetFd(), AT_FDCWD);
+  EXPECT_EQ(resolution.path, root_ + "/c/d");
+
+  EXPECT_THAT(handles.Resolve("a/b/c.txt").directory, IsNull());
+}
+
+TEST_F(DirectoryHandleCacheTest, ClosesLeastRecentlyUsedHandles) {
+  CreateDirectory("a");
+  CreateDirectory("b");
+  CreateDirectory("c");
+  DirectoryHandleCache::Options options;
+  options.capacity = 2;
+  DirectoryHandleCache handles(options);
+  const int a_fd = Open("a");
+  const int b_fd = Open("b");
+  handles.Add(root_ + "/a", a_fd);
+  handles.Add(root_ + "/b", b_fd);
+  EXPECT_THAT(handles.Resolve(root_ + "/a/x").directory, NotNull());
+
+  handles.Add(root_ + "/c", Open("c"));
+
+  EXPECT_EQ(handles.GetSize(), 2);
+  EXPECT_THAT(handles.Resolve(root_ + "/a/x").directory, NotNull());
+  EXPECT_THAT(handles.Resolve(root_ + "/b/x").directory, IsNull());
+  EXPECT_TRUE(IsOpen(a_fd));
+  EXPECT_FALSE(IsOpen(b_fd));
+}
+
+TEST_F(DirectoryHandleCacheTest, RemovesDirectoryAndEverythingBelowIt) {
+  CreateDirectory("a");
+  CreateDirectory("a/b");
+  CreateDirectory("ab");
+  DirectoryHandleCache handles;
+  handles.Add(root_ + "/a", Open("a"));
+  handles.Add(root_ + "/a/b", Open("a/b"));
+  handles.Add(root_ + "/ab", Open("ab"));
+
+  handles.RemoveDirectory(root_ + "/a/");
+
+  EXPECT_EQ(handles.GetSize(), 1);
+  EXPECT_FALSE(handles.Contains(root_ + "/a"));
+  EXPECT_FALSE(handles.Contains(root_ + "/a/b"));
+  EXPECT_TRUE(handles.Contains(root_ + "/ab"));
+}
+
+TEST_F(DirectoryHandleCacheTest, KeepsResolvedHandlesOpenUntilReleased) {
+  CreateDirectory("a");
+  DirectoryHandleCache handles;
+  const int fd = Open("a");
+  handles.Add(root_ + "/a", fd);
+  DirectoryHandleCache::Resolution resolution =
+      handles.Resolve(root_ + "/a/x");
+  ASSERT_THAT(resolution.directory, NotNull());
+
+  handles.Remove(*resolution.directory);
+
+  EXPECT_EQ(handles.GetSize(), 0);
+  EXPECT_TRUE(IsOpen(fd));
+  resolution.directory.reset();
+  EXPECT_FALSE(IsOpen(fd));
+}
+
+TEST_F(DirectoryHandleCacheTest, ClosesExpiredHandles) {
+  CreateDirectory("a");
+  DirectoryHandleCache::Options options;
+  options.max_age = absl::Milliseconds(20);
+  DirectoryHandleCache handles(options);
+  const int fd = Open("a");
+  handles.Add(root_ + "/a", fd);
+  EXPECT_EQ(handles.GetSize(), 1);
+
+  for (int i = 0; i < 200 && handles.GetSize() > 0; i++)
+    absl::SleepFor(absl::Milliseconds(10));
+
+  EXPECT_EQ(handles.GetSize(), 0);
+  EXPECT_FALSE(IsOpen(fd));
+  EXPECT_THAT(handles.Resolve(root_ + "/a/x").directory, IsNull());
+}
+
+TEST_F(DirectoryHandleCacheTest, KeepsNothingWithoutMaxAge) {
+  CreateDirectory("a");
+  DirectoryHandleCache::Options options;
+  options.max_age = absl::ZeroDuration();
+  DirectoryHandleCache handles(options);
+  const int fd = Open("a");
+
+  handles.Add(root_ + "/a", fd);
+
+  EXPECT_EQ(handles.GetSize(), 0);
+  EXPECT_FALSE(IsOpen(fd));
+}
+
+}  // namespace
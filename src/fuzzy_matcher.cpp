@@ -0,0 +1,376 @@
+#include "fuzzy_matcher.hpp"
+
+#include <absl/strings/ascii.h>
+#include <absl/types/span.h>
+
+#include <string.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Scores of fzf's first matching algorithm, which finds the shortest window
+// of a name holding the query and scores that.
+constexpr int kScoreMatch = 16;
+constexpr int kScoreGapStart = -3;
+constexpr int kScoreGapExtension = -1;
+constexpr int kBonusBoundary = kScoreMatch / 2;
+constexpr int kBonusNonWord = kScoreMatch / 2;
+constexpr int kBonusCamelCase = kBonusBoundary - 1;
+// Enough to make up for the gap a consecutive match avoids.
+constexpr int kBonusConsecutive = -(kScoreGapStart + kScoreGapExtension);
+constexpr int kBonusFirstCharacterMultiplier = 2;
+
+enum class CharacterClass { kNonWord, kLower, kUpper, kDigit };
+
+CharacterClass GetCharacterClass(char c) {
+  if (absl::ascii_islower(c)) return CharacterClass::kLower;
+  if (absl::ascii_isupper(c)) return CharacterClass::kUpper;
+  if (absl::ascii_isdigit(c)) return CharacterClass::kDigit;
+  // Bytes of multibyte UTF-8 characters are taken for letters.
+  if (static_cast<uint8_t>(c) >= 0x80) return CharacterClass::kLower;
+  return CharacterClass::kNonWord;
+}
+
+int GetBonus(CharacterClass previous, CharacterClass current) {
+  if (previous == CharacterClass::kNonWord &&
+      current != CharacterClass::kNonWord)
+    return kBonusBoundary;
+  if ((previous == CharacterClass::kLower &&
+       current == CharacterClass::kUpper) ||
+      (previous != CharacterClass::kDigit &&
+       current == CharacterClass::kDigit))
+    return kBonusCamelCase;
+  if (current == CharacterClass::kNonWord) return kBonusNonWord;
+  return 0;
+}
+
+char FoldCase(char c) { return absl::ascii_tolower(static_cast<uint8_t>(c)); }
+
+// Names up to this long have their matches found with bit masks of the
+// positions of each character of the query, one bit per byte of the name.
+constexpr size_t kMaxMaskedNameLength = 64;
+// Longer queries are matched one byte at a time.
+constexpr size_t kMaxMaskedQueryLength = 32;
+
+// Sets bit i of positions[j] if byte i of name, with its case folded, is
+// folded_query[j]. name holds at most kMaxMaskedNameLength bytes. The vector
+// versions may read name up to readable_end.
+using PositionFunction = void (*)(const char *name, size_t length,
+                                  const char *readable_end,
+                                  std::string_view folded_query,
+                                  uint64_t *positions);
+
+// Keeps the indices of masks that have every bit of query_mask, offset by
+// first_index.
+using FilterFunction = void (*)(const uint32_t *masks, size_t count,
+                                uint32_t query_mask, uint32_t first_index,
+                                std::vector<uint32_t> &candidates);
+
+void FilterScalar(const uint32_t *masks, size_t count, uint32_t query_mask,
+                  uint32_t first_index, std::vector<uint32_t> &candidates) {
+  for (size_t i = 0; i < count; i++) {
+    if ((masks[i] & query_mask) == query_mask)
+      candidates.push_back(first_index + i);
+  }
+}
+
+// Returns name, or a copy of it padded to kMaxMaskedNameLength bytes in
+// buffer if vectors cannot be loaded from name directly.
+const char *GetLoadableName(const char *name, size_t length,
+                            const char *readable_end,
+                            char (&buffer)[kMaxMaskedNameLength]) {
+  if (readable_end - name >= static_cast<ptrdiff_t>(kMaxMaskedNameLength))
+    return name;
+  memset(buffer, 0, sizeof(buffer));
+  memcpy(buffer, name, length);
+  return buffer;
+}
+
+uint64_t GetValidPositions(size_t length) {
+  return length >= 64 ? ~uint64_t{0} : (uint64_t{1} << length) - 1;
+}
+
+#if defined(__x86_64__)
+
+// SSE2 is part of x86-64, so these need no check.
+__m128i FoldCaseSSE2(__m128i bytes) {
+  // Bytes of 0x80 and up are negative, and so never taken for letters.
+  const __m128i is_upper =
+      _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('A' - 1)),
+                    _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), bytes));
+  return _mm_or_si128(bytes, _mm_and_si128(is_upper, _mm_set1_epi8(0x20)));
+}
+
+void GetPositionsSSE2(const char *name, size_t length,
+                      const char *readable_end, std::string_view folded_query,
+                      uint64_t *positions) {
+  char buffer[kMaxMaskedNameLength];
+  const char *bytes = GetLoadableName(name, length, readable_end, buffer);
+  const size_t vector_count = (length + 15) / 16;
+  __m128i vectors[kMaxMaskedNameLength / 16];
+  for (size_t i = 0; i < vector_count; i++) {
+    vectors[i] = FoldCaseSSE2(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + 16 * i)));
+  }
+
+  const uint64_t valid_positions = GetValidPositions(length);
+  for (size_t j = 0; j < folded_query.size(); j++) {
+    const __m128i query = _mm_set1_epi8(folded_query[j]);
+    uint64_t found = 0;
+    for (size_t i = 0; i < vector_count; i++) {
+      found |= static_cast<uint64_t>(static_cast<uint32_t>(
+                   _mm_movemask_epi8(_mm_cmpeq_epi8(vectors[i], query))))
+               << (16 * i);
+    }
+    positions[j] = found & valid_positions;
+  }
+}
+
+void FilterSSE2(const uint32_t *masks, size_t count, uint32_t query_mask,
+                uint32_t first_index, std::vector<uint32_t> &candidates) {
+  const __m128i query = _mm_set1_epi32(query_mask);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128i words =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(masks + i));
+    uint32_t found = _mm_movemask_ps(_mm_castsi128_ps(
+        _mm_cmpeq_epi32(_mm_and_si128(words, query), query)));
+    for (; found != 0; found &= found - 1)
+      candidates.push_back(first_index + i + __builtin_ctz(found));
+  }
+  FilterScalar(masks + i, count - i, query_mask, first_index + i, candidates);
+}
+
+__attribute__((target("avx2"))) __m256i FoldCaseAVX2(__m256i bytes) {
+  const __m256i is_upper =
+      _mm256_and_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8('A' - 1)),
+                       _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), bytes));
+  return _mm256_or_si256(bytes,
+                         _mm256_and_si256(is_upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2"))) void GetPositionsAVX2(
+    const char *name, size_t length, const char *readable_end,
+    std::string_view folded_query, uint64_t *positions) {
+  char buffer[kMaxMaskedNameLength];
+  const char *bytes = GetLoadableName(name, length, readable_end, buffer);
+  const __m256i low = FoldCaseAVX2(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes)));
+  const uint64_t valid_positions = GetValidPositions(length);
+
+  // Most names fit in one vector, which saves half the comparisons.
+  if (length <= 32) {
+    for (size_t j = 0; j < folded_query.size(); j++) {
+      const __m256i query = _mm256_set1_epi8(folded_query[j]);
+      positions[j] = static_cast<uint32_t>(
+                         _mm256_movemask_epi8(_mm256_cmpeq_epi8(low, query))) &
+                     valid_positions;
+    }
+    return;
+  }
+
+  const __m256i high = FoldCaseAVX2(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + 32)));
+  for (size_t j = 0; j < folded_query.size(); j++) {
+    const __m256i query = _mm256_set1_epi8(folded_query[j]);
+    const uint64_t found =
+        static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(low, query))) |
+        static_cast<uint64_t>(static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(high, query))))
+            << 32;
+    positions[j] = found & valid_positions;
+  }
+}
+
+__attribute__((target("avx2"))) void FilterAVX2(
+    const uint32_t *masks, size_t count, uint32_t query_mask,
+    uint32_t first_index, std::vector<uint32_t> &candidates) {
+  const __m256i query = _mm256_set1_epi32(query_mask);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i words =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(masks + i));
+    uint32_t found = _mm256_movemask_ps(_mm256_castsi256_ps(
+        _mm256_cmpeq_epi32(_mm256_and_si256(words, query), query)));
+    for (; found != 0; found &= found - 1)
+      candidates.push_back(first_index + i + __builtin_ctz(found));
+  }
+  FilterSSE2(masks + i, count - i, query_mask, first_index + i, candidates);
+}
+
+bool HasAVX2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+// Picked once, for the CPU the program runs on.
+const PositionFunction kGetPositions =
+    HasAVX2() ? GetPositionsAVX2 : GetPositionsSSE2;
+const FilterFunction kFilter = HasAVX2() ? FilterAVX2 : FilterSSE2;
+
+#else
+
+void GetPositionsScalar(const char *name, size_t length,
+                        const char * /*readable_end*/,
+                        std::string_view folded_query, uint64_t *positions) {
+  for (size_t j = 0; j < folded_query.size(); j++) {
+    positions[j] = 0;
+    for (size_t i = 0; i < length; i++) {
+      if (FoldCase(name[i]) == folded_query[j])
+        positions[j] |= uint64_t{1} << i;
+    }
+  }
+}
+
+const PositionFunction kGetPositions = GetPositionsScalar;
+const FilterFunction kFilter = FilterScalar;
+
+#endif
+
+// Finds the shortest window of a name holding the query, given the positions
+// of each of its count characters in the name, and stores where each
+// character is matched in it first in matches.
+bool FindMaskedMatches(const uint64_t *positions, size_t count,
+                       size_t *matches) {
+  // The earliest end of a match is where matching each character as early as
+  // possible ends.
+  size_t end = 0;
+  uint64_t allowed_positions = ~uint64_t{0};
+  for (size_t j = 0; j < count; j++) {
+    const uint64_t found = positions[j] & allowed_positions;
+    if (found == 0) return false;
+    end = __builtin_ctzll(found) + 1;
+    allowed_positions = end == 64 ? 0 : ~uint64_t{0} << end;
+  }
+
+  // Matching backwards from there finds the latest start.
+  size_t start = end;
+  allowed_positions = GetValidPositions(end);
+  for (size_t j = count; j-- > 0;) {
+    start = 63 - __builtin_clzll(positions[j] & allowed_positions);
+    allowed_positions = (uint64_t{1} << start) - 1;
+  }
+
+  allowed_positions = ~uint64_t{0} << start;
+  for (size_t j = 0; j < count; j++) {
+    matches[j] = __builtin_ctzll(positions[j] & allowed_positions);
+    allowed_positions = ~uint64_t{0} << matches[j] << 1;
+  }
+  return true;
+}
+
+// Same as FindMaskedMatches(), one byte of name at a time.
+bool FindMatches(std::string_view name, std::string_view folded_query,
+                 size_t *matches) {
+  size_t end = 0;
+  for (char c : folded_query) {
+    while (end < name.size() && FoldCase(name[end]) != c) end++;
+    if (end == name.size()) return false;
+    end++;
+  }
+
+  size_t start = end;
+  for (size_t i = folded_query.size(); i > 0; start--) {
+    if (FoldCase(name[start - 1]) == folded_query[i - 1]) i--;
+  }
+
+  for (size_t j = 0; j < folded_query.size(); j++) {
+    while (FoldCase(name[start]) != folded_query[j]) start++;
+    matches[j] = start++;
+  }
+  return true;
+}
+
+// Scores the count characters of a query matched in name at matches, which
+// increase. Only the matched characters, the ones before them and the lengths
+// of the gaps between them count, so this never looks at the rest of the name.
+int ScoreMatches(std::string_view name, const size_t *matches, size_t count) {
+  int score = 0;
+  int first_bonus = 0;
+  for (size_t j = 0; j < count; j++) {
+    const size_t i = matches[j];
+    const CharacterClass previous_class =
+        i > 0 ? GetCharacterClass(name[i - 1]) : CharacterClass::kNonWord;
+    int bonus = GetBonus(previous_class, GetCharacterClass(name[i]));
+    if (j == 0 || i != matches[j - 1] + 1) {
+      if (j > 0)
+        score += kScoreGapStart +
+                 static_cast<int>(i - matches[j - 1] - 2) * kScoreGapExtension;
+      first_bonus = bonus;
+    } else {
+      // A boundary within a run of matches starts a new word.
+      if (bonus >= kBonusBoundary && bonus > first_bonus) first_bonus = bonus;
+      bonus = std::max({bonus, first_bonus, kBonusConsecutive});
+    }
+    score += kScoreMatch +
+             (j == 0 ? bonus * kBonusFirstCharacterMultiplier : bonus);
+  }
+  return score;
+}
+
+}  // namespace
+
+FuzzyMatcher::FuzzyMatcher(std::string_view query)
+    : folded_query_(query), query_mask_(GetCharacterMask(query)) {
+  for (char &c : folded_query_) c = FoldCase(c);
+}
+
+uint32_t FuzzyMatcher::GetCharacterMask(std::string_view text) {
+  uint32_t mask = 0;
+  for (char c : text) {
+    c = FoldCase(c);
+    if (c >= 'a' && c <= 'z') {
+      mask |= 1u << (c - 'a');
+    } else if (c >= '0' && c <= '9') {
+      mask |= 1u << (26 + (c - '0') % 3);
+    } else if (c == '.') {
+      mask |= 1u << 29;
+    } else if (c == '_' || c == '-' || c == ' ') {
+      mask |= 1u << 30;
+    } else {
+      mask |= 1u << 31;
+    }
+  }
+  return mask;
+}
+
+void FuzzyMatcher::FilterCandidates(absl::Span<const uint32_t> masks,
+                                    std::vector<uint32_t> &candidates) const {
+  kFilter(masks.data(), masks.size(), query_mask_, 0, candidates);
+}
+
+std::optional<int> FuzzyMatcher::Score(std::string_view name) const {
+  return Score(name, name.data() + name.size());
+}
+
+std::optional<int> FuzzyMatcher::Score(std::string_view name,
+                                       const char *readable_end) const {
+  if (folded_query_.empty()) return 0;
+
+  if (name.size() <= kMaxMaskedNameLength &&
+      folded_query_.size() <= kMaxMaskedQueryLength) {
+    uint64_t positions[kMaxMaskedQueryLength];
+    kGetPositions(name.data(), name.size(), readable_end, folded_query_,
+                  positions);
+    size_t matches[kMaxMaskedQueryLength];
+    if (!FindMaskedMatches(positions, folded_query_.size(), matches))
+      return std::nullopt;
+    return ScoreMatches(name, matches, folded_query_.size());
+  }
+
+  std::vector<size_t> matches(folded_query_.size());
+  if (!FindMatches(name, folded_query_, matches.data())) return std::nullopt;
+  return ScoreMatches(name, matches.data(), matches.size());
+}
@@ -0,0 +1,56 @@
+#ifndef FUZZY_MATCHER_HPP
+#define FUZZY_MATCHER_HPP
+
+#include <absl/types/span.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Matches names against a query whose characters appear in them in order,
+// though not necessarily next to each other, and scores how well they match
+// the way fzf does. Characters matched right after a word boundary, such as
+// "/", "_", "-", ".", a space or a change from lower to upper case, and
+// characters matched next to each other score higher, while gaps between
+// matched characters cost points. ASCII letters are matched ignoring their
+// case.
+//
+// The matched characters of a name are found with SIMD instructions where the
+// CPU has them, comparing 32 or 16 bytes of the name at once, and with plain
+// loops elsewhere. Names can also be ruled out in bulk by their character
+// masks, which tell which characters a name has without its order, so most
+// names never have to be looked at.
+class FuzzyMatcher {
+ public:
+  explicit FuzzyMatcher(std::string_view query);
+
+  // Bit set of the characters in text, folding the case of ASCII letters.
+  // Several characters share each bit, so a name whose mask lacks a bit of
+  // the query's mask cannot match it, but not the other way around.
+  static uint32_t GetCharacterMask(std::string_view text);
+
+  // Appends the index of every mask in masks that has every bit of the
+  // query's mask to candidates, in increasing order.
+  void FilterCandidates(absl::Span<const uint32_t> masks,
+                        std::vector<uint32_t> &candidates) const;
+
+  // Score of name, higher for better matches, or nullopt if the characters of
+  // the query do not all appear in name in order. Every name matches the
+  // empty query with a score of zero.
+  std::optional<int> Score(std::string_view name) const;
+  // Same as Score(name), for a name that is followed by readable memory up to
+  // readable_end, such as one in a buffer of names. Lets whole vectors be
+  // loaded past the end of the name.
+  std::optional<int> Score(std::string_view name,
+                           const char *readable_end) const;
+
+ private:
+  // Query with the case of ASCII letters folded to lower case.
+  std::string folded_query_;
+  uint32_t query_mask_;
+};
+
+#endif  // FUZZY_MATCHER_HPP
@@ -0,0 +1,71 @@
+#include "fuzzy_matcher.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Optional;
+
+TEST(FuzzyMatcherTest, MatchesCharactersInOrder) {
+  FuzzyMatcher matcher("mfr");
+
+  EXPECT_TRUE(matcher.Score("main_file_reader.cpp").has_value());
+  EXPECT_TRUE(matcher.Score("MyFileReader").has_value());
+  EXPECT_FALSE(matcher.Score("reader_file_main.cpp").has_value());
+  EXPECT_FALSE(matcher.Score("mf").has_value());
+}
+
+TEST(FuzzyMatcherTest, MatchesEveryNameForEmptyQuery) {
+  EXPECT_THAT(FuzzyMatcher("").Score("anything"), Optional(0));
+}
+
+TEST(FuzzyMatcherTest, PrefersWordStartsAndRuns) {
+  FuzzyMatcher matcher("fr");
+
+  EXPECT_GT(*matcher.Score("file_reader"), *matcher.Score("xfxxrx"));
+  EXPECT_GT(*matcher.Score("FileReader"), *matcher.Score("filereader"));
+  EXPECT_GT(*matcher.Score("xfrx"), *matcher.Score("xfxrx"));
+}
+
+TEST(FuzzyMatcherTest, ScoresShortestWindowHoldingQuery) {
+  FuzzyMatcher matcher("ab");
+
+  // The first "a" is too far from the only "b" to be the one matched.
+  EXPECT_EQ(matcher.Score("a_____ab"), matcher.Score("ab"));
+}
+
+TEST(FuzzyMatcherTest, ScoresSameInsideBufferOfNames) {
+  const std::string names =
+      std::string(70, 'x') + "Some_Long_File_Name.txt" + std::string(50, 'y');
+  const std::string_view name = std::string_view(names).substr(30, 63);
+  FuzzyMatcher matcher("SLFNt");
+
+  std::optional<int> score = matcher.Score(name);
+  ASSERT_TRUE(score.has_value());
+  EXPECT_EQ(matcher.Score(name, names.data() + names.size()), score);
+  // Vector loads past the end of a name must not find matches there.
+  EXPECT_FALSE(FuzzyMatcher("xy").Score(std::string_view(names).substr(0, 70),
+                                        names.data() + names.size()));
+}
+
+TEST(FuzzyMatcherTest, FiltersCandidatesByCharacterMasks) {
+  std::vector<uint32_t> masks;
+  for (int i = 0; i < 21; i++) {
+    masks.push_back(FuzzyMatcher::GetCharacterMask(
+        i % 5 == 0 ? "readme.txt" : "notes.md"));
+  }
+  std::vector<uint32_t> candidates;
+
+  FuzzyMatcher("RDM").FilterCandidates(masks, candidates);
+
+  EXPECT_THAT(candidates, ElementsAre(0, 5, 10, 15, 20));
+}
+
+}  // namespace
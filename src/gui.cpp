@@ -1,30 +1,192 @@
 #include "gui.hpp"
 
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/strings/str_cat.h>
 #include <absl/strings/str_split.h>
 #include <absl/strings/string_view.h>
+#include <absl/time/clock.h>
+#include <absl/time/time.h>
+#include <absl/types/span.h>
 #include <dirent.h>
 #include <gdk/gdkpixbuf.h>
+#include <glib.h>
+#include <glib/gstdio.h>
 #include <glibmm/fileutils.h>
+#include <glibmm/main.h>
 #include <glibmm/miscutils.h>
 #include <glibmm/ustring.h>
 #include <gtkmm/box.h>
 #include <gtkmm/button.h>
+#include <gtkmm/comboboxtext.h>
 #include <gtkmm/entry.h>
 #include <gtkmm/grid.h>
 #include <gtkmm/image.h>
+#include <gtkmm/label.h>
+#include <gtkmm/liststore.h>
+#include <gtkmm/messagedialog.h>
+#include <gtkmm/progressbar.h>
 #include <gtkmm/scrolledwindow.h>
-#include <gtkmm/togglebutton.h>
+#include <gtkmm/treemodel.h>
+#include <gtkmm/treemodelcolumn.h>
+#include <gtkmm/treeview.h>
+#include <gtkmm/treeviewcolumn.h>
 #include <gtkmm/window.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <optional>
 #include <stack>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "caching_filesystem.hpp"
+#include "icon_cache.hpp"
+#include "listing_sorter.hpp"
 
 namespace {
 
+// Number of files handed to the directory view per main loop iteration while a
+// directory is still being read.
+constexpr size_t kFileBatchSize = 512;
+
+// Listings showing more files than this only have a screenful of them sorted
+// and shown at first, and the rest a batch per main loop iteration, so the
+// first paint does not wait on sorting and adding every file. Smaller ones
+// are sorted whole, and the rows already shown are moved into place.
+constexpr size_t kLargeListingFileCount = 20000;
+// Files of a large listing shown right away, enough to fill the view.
+constexpr size_t kFirstScreenFileCount = 256;
+// Files' worth of sorting the rest of a large listing takes per main loop
+// iteration, a few milliseconds of it.
+constexpr size_t kSortStepFileCount = 100000;
+
+// Memory the listings of recently visited directories may use, so going back
+// to them does not read them from disk again.
+constexpr size_t kDirectoryCacheMemoryBudget = 64 * 1024 * 1024;
+
+// Memory the snapshots of directories in the navigation history may use. A
+// snapshot holds the view's rows on top of the listing, which takes about
+// 200 bytes per file.
+constexpr size_t kHistorySnapshotMemoryBudget = 256 * 1024 * 1024;
+
+// File systems only update modification times every few milliseconds, and
+// some, such as FAT, only every two seconds. A directory modified within that
+// long of being read may change again without its modification time changing.
+constexpr absl::Duration kModificationTimeGranularity = absl::Seconds(2);
+
+// Rough memory taken by one row of the directory files view, besides its name.
+constexpr size_t kFileRowMemoryUsage = 192;
+
+// Once a directory is shown, its parent and this many of its subdirectories
+// are read ahead, since users mostly move one level up or down.
+constexpr size_t kPrefetchedSubdirectoryCount = 8;
+// Directories read ahead at once. Each read takes a thread of its own.
+constexpr size_t kMaxConcurrentPrefetches = 2;
+// Leaves room for hovered directories on top of the parent and subdirectories.
+constexpr size_t kMaxQueuedPrefetches = 16;
+
+// Threads reading directories while a search index is built. Reads mostly
+// wait on the disk, so this is more than the number of cores usually is.
+constexpr size_t kSearchIndexThreadCount = 8;
+// Search results shown at most, best matches first. Ranking looks at every
+// match, but showing them all would take longer than ranking them.
+constexpr size_t kMaxSearchResultCount = 1000;
+// Searching the same directory again once its index is this old updates the
+// index in the background, so later searches find files changed since.
+constexpr absl::Duration kSearchIndexMaxAge = absl::Minutes(1);
+
+// Threads reading directories while disk usage is worked out.
+constexpr size_t kDiskUsageThreadCount = 8;
+// How often the sizes shown grow while disk usage is worked out.
+constexpr absl::Duration kDiskUsageProgressInterval = absl::Milliseconds(200);
+// Directories whose disk usage is kept, so scanning them again only reads
+// the ones that changed. Takes about 100 bytes each.
+constexpr size_t kMaxCachedDiskUsageDirectoryCount = 1000000;
+
+// Files copied at once across every transfer. SSDs only reach their full speed
+// with many requests in flight, and disks that cannot keep up just queue them.
+constexpr size_t kFileJobIOConcurrency = 16;
+// Threads listing the directories of each transfer.
+constexpr size_t kFileJobWalkThreadCount = 4;
+// How often the progress shown of file jobs is updated.
+constexpr absl::Duration kFileJobProgressInterval = absl::Milliseconds(250);
+
+// Orders files can be sorted in, as listed for the user to pick from.
+struct SortOrderChoice {
+  const char *label;
+  SortOrder order;
+};
+constexpr SortOrderChoice kSortOrderChoices[] = {
+    {"Name", {SortColumn::kName, /*is_descending=*/false}},
+    {"Name, descending", {SortColumn::kName, /*is_descending=*/true}},
+    {"Size", {SortColumn::kSize, /*is_descending=*/false}},
+    {"Size, descending", {SortColumn::kSize, /*is_descending=*/true}},
+    {"Modified", {SortColumn::kModificationTime, /*is_descending=*/false}},
+    {"Modified, descending",
+     {SortColumn::kModificationTime, /*is_descending=*/true}},
+    {"Type", {SortColumn::kType, /*is_descending=*/false}},
+    {"Type, descending", {SortColumn::kType, /*is_descending=*/true}},
+};
+
 Glib::ustring RemoveLastDirectoryFromPath(const Glib::ustring &full_path,
                                           const Glib::ustring &last_path);
 
+// Directory search indexes are saved to, so they outlive the process. Empty if
+// it cannot be created, which keeps indexes in memory only.
+std::string GetSearchIndexDirectory() {
+  const std::string directory = Glib::build_filename(
+      Glib::get_user_cache_dir(), "e7fmgr", "search-indexes");
+  if (g_mkdir_with_parents(directory.c_str(), 0700) == -1) return "";
+  return directory;
+}
+
+// Directory deleted files are moved to until they are removed. Empty if it
+// cannot be created, in which case nothing can be deleted, and files asked to
+// be are left in place and reported.
+std::string GetTrashDirectory() {
+  const std::string directory =
+      Glib::build_filename(Glib::get_user_cache_dir(), "e7fmgr", "trash");
+  if (g_mkdir_with_parents(directory.c_str(), 0700) == -1) return "";
+  return directory;
+}
+
+// Directories the user is likely to open after directory, whose files are
+// files: its parent first, and then its first few subdirectories.
+std::vector<Glib::ustring> GetLikelyNextDirectories(
+    const Glib::ustring &directory, const DirectoryListing &files);
+
+// Returns the modification time of directory, unless it cannot be relied upon
+// to change on the next modification.
+std::optional<absl::Time> GetTrustedModificationTime(
+    const Glib::ustring &directory, const FileSystem &fs);
+
+// Sets modification_time to the trusted modification time of directory, on
+// the worker of a DirectoryLoader before it reads the directory, so changes
+// made while it is read make the files read stale. If unchanged_time is set,
+// the load stops there while the directory still has that modification time.
+// fs must outlive the load.
+DirectoryLoader::StartCallback ReadModificationTime(
+    const FileSystem &fs, const Glib::ustring &directory,
+    std::optional<absl::Time> unchanged_time,
+    std::shared_ptr<std::optional<absl::Time>> modification_time);
+
+// Fills in metadata_fields of the files of directory, and sets sorter to them,
+// on the worker of a DirectoryLoader. fs must outlive the load.
+DirectoryLoader::PrepareCallback PrepareSorting(
+    const FileSystem &fs, const Glib::ustring &directory,
+    FileMetadataMask metadata_fields, std::shared_ptr<ListingSorter> sorter);
+
+// Ends the entered directory with a /. Returns an error if it is not a full
+// path, or if it is old_directory already.
+absl::StatusOr<Glib::ustring> CleanDirectoryUpdate(
+    const Glib::ustring &old_directory, const Glib::ustring &new_directory);
+
 // Verifies the entered directory with the file system. Returns false if the
 // directory entered is not found.
 //
@@ -38,6 +200,11 @@ absl::StatusOr<Glib::ustring> VerifyAndCleanDirectoryUpdate(
 Gtk::Image *CreateManagedImage(const std::string &image_path, int width,
                                int height, Gdk::PixbufRotation rotation_angle);
 
+FileJobScheduler::Options GetFileJobOptions();
+
+// Size in bytes for people to read, such as "1.2 MB".
+std::string FormatSize(uint64_t size);
+
 class UINavBar : public NavBar {
  public:
   UINavBar() {
@@ -103,6 +270,11 @@ class UICurrentDirectoryBar : public CurrentDirectoryBar {
 
     entry_box_border_.pack_start(file_search_entry_box_);
     entry_box_border_.pack_start(current_directory_entry_box_);
+    entry_box_border_.pack_start(sort_order_box_);
+
+    for (const SortOrderChoice &choice : kSortOrderChoices)
+      sort_order_box_.append(choice.label);
+    sort_order_box_.set_active(0);
 
     file_search_entry_box_.set_placeholder_text("File to search...");
 
@@ -123,6 +295,11 @@ class UICurrentDirectoryBar : public CurrentDirectoryBar {
   Glib::ustring GetFileSearchBarText() override {
     return this->file_search_entry_box_.get_text();
   }
+  SortOrder GetSortOrder() override {
+    const int choice = sort_order_box_.get_active_row_number();
+    if (choice < 0) return SortOrder();
+    return kSortOrderChoices[choice].order;
+  }
 
   void OnDirectoryChange(std::function<void()> callback) override {
     current_directory_entry_box_.signal_activate().connect(callback);
@@ -132,6 +309,14 @@ class UICurrentDirectoryBar : public CurrentDirectoryBar {
     file_search_entry_box_.signal_activate().connect(callback);
   }
 
+  void OnFileSearchTextChange(std::function<void()> callback) override {
+    file_search_entry_box_.signal_changed().connect(callback);
+  }
+
+  void OnSortOrderChange(std::function<void()> callback) override {
+    sort_order_box_.signal_changed().connect(callback);
+  }
+
   void SetDisplayedDirectory(const Glib::ustring &new_directory) override {
     current_directory_entry_box_.set_text(new_directory);
   }
@@ -142,16 +327,95 @@ class UICurrentDirectoryBar : public CurrentDirectoryBar {
   Gtk::Box entry_box_border_;
   Gtk::Entry file_search_entry_box_;
   Gtk::Entry current_directory_entry_box_;
+  Gtk::ComboBoxText sort_order_box_;
 };
 
+// Lists the files in a Gtk::TreeView backed by a Gtk::ListStore. A file only
+// costs a row in the store, and the view only draws the rows scrolled into
+// sight, reusing the same cell renderers for each of them. Every row shares
+// one of two icons from the IconCache. Scrolling and memory use stay flat no
+// matter how large the directory is.
 class UIDirectoryFilesView : public DirectoryFilesView {
  public:
-  UIDirectoryFilesView() {
-    file_entry_widgets_.set_halign(Gtk::ALIGN_START);
-    file_entry_widgets_.set_valign(Gtk::ALIGN_START);
+  UIDirectoryFilesView()
+      : file_entries_(Gtk::ListStore::create(file_columns_)),
+        directory_icon_(IconCache::GetInstance().GetIcon(
+            "/project/icons/folder.png", 16, 16,
+            Gdk::PixbufRotation::PIXBUF_ROTATE_NONE)),
+        file_icon_(IconCache::GetInstance().GetIcon(
+            "/project/icons/empty.png", 16, 16,
+            Gdk::PixbufRotation::PIXBUF_ROTATE_NONE)) {
+    file_column_.pack_start(file_columns_.icon, /*expand=*/false);
+    file_column_.pack_start(file_columns_.name);
+    file_column_.set_expand(true);
+    size_column_.pack_start(file_columns_.size);
+    size_column_.set_fixed_width(90);
+
+    // All rows have the same height, so the view can find the rows in sight
+    // without measuring every row in the store first.
+    file_column_.set_sizing(Gtk::TREE_VIEW_COLUMN_FIXED);
+    size_column_.set_sizing(Gtk::TREE_VIEW_COLUMN_FIXED);
+    file_entries_view_.set_fixed_height_mode(true);
+    file_entries_view_.append_column(file_column_);
+    file_entries_view_.append_column(size_column_);
+    file_entries_view_.set_headers_visible(false);
+    file_entries_view_.set_model(file_entries_);
+    file_entries_view_.get_selection()->set_mode(Gtk::SELECTION_MULTIPLE);
+
+    // Files open with a single click, like the buttons they used to be.
+    file_entries_view_.set_activate_on_single_click(true);
+    file_entries_view_.signal_row_activated().connect(
+        [this](const Gtk::TreeModel::Path &path, Gtk::TreeViewColumn *) {
+          Glib::ustring file_name =
+              (*file_entries_->get_iter(path))[file_columns_.name];
+          this->file_clicked_callback_(file_name);
+        });
 
-    // Allows adding widgets on bottom of each other.
-    file_entry_widgets_.set_orientation(Gtk::Orientation::ORIENTATION_VERTICAL);
+    // Connected before the handler of the view itself, which would take the
+    // keys for its interactive search otherwise.
+    file_entries_view_.signal_key_press_event().connect(
+        [this](GdkEventKey *event) {
+          if (event->keyval == GDK_KEY_Delete && delete_callback_) {
+            delete_callback_();
+            return true;
+          }
+          if (!(event->state & GDK_CONTROL_MASK) || !clipboard_callback_)
+            return false;
+          switch (gdk_keyval_to_lower(event->keyval)) {
+            case GDK_KEY_c:
+              clipboard_callback_(ClipboardAction::kCopy);
+              return true;
+            case GDK_KEY_x:
+              clipboard_callback_(ClipboardAction::kCut);
+              return true;
+            case GDK_KEY_v:
+              clipboard_callback_(ClipboardAction::kPaste);
+              return true;
+          }
+          return false;
+        },
+        /*after=*/false);
+
+    file_entries_view_.add_events(Gdk::POINTER_MOTION_MASK);
+    file_entries_view_.signal_motion_notify_event().connect(
+        [this](GdkEventMotion *event) {
+          Gtk::TreeModel::Path path;
+          Gtk::TreeViewColumn *column;
+          int cell_x, cell_y;
+          if (!file_entries_view_.get_path_at_pos(event->x, event->y, path,
+                                                  column, cell_x, cell_y))
+            return false;
+
+          Gtk::TreeModel::Row row = *file_entries_->get_iter(path);
+          const bool is_directory = row[file_columns_.is_directory];
+          const Glib::ustring name = row[file_columns_.name];
+          if (is_directory && name != hovered_directory_ &&
+              directory_hovered_callback_) {
+            hovered_directory_ = name;
+            directory_hovered_callback_(name);
+          }
+          return false;
+        });
 
     // Allows window to stay on the bottom right of the main window.
     file_entries_window_.set_halign(Gtk::ALIGN_END);
@@ -167,7 +431,7 @@ class UIDirectoryFilesView : public DirectoryFilesView {
     file_entries_window_.set_policy(/*hscrollbar_policy=*/Gtk::POLICY_AUTOMATIC,
                                     /*vscrollbar_policy=*/Gtk::POLICY_ALWAYS);
 
-    file_entries_window_.add(file_entry_widgets_);
+    file_entries_window_.add(file_entries_view_);
   }
 
   UIDirectoryFilesView(const UIDirectoryFilesView &) = delete;
@@ -184,41 +448,180 @@ class UIDirectoryFilesView : public DirectoryFilesView {
       std::function<void(const Glib::ustring &)> callback) override {
     directory_clicked_callback_ = callback;
   }
+  void OnDirectoryHover(
+      std::function<void(const Glib::ustring &)> callback) override {
+    directory_hovered_callback_ = callback;
+  }
+  void OnClipboardAction(
+      std::function<void(ClipboardAction)> callback) override {
+    clipboard_callback_ = callback;
+  }
+  void OnDeleteRequest(std::function<void()> callback) override {
+    delete_callback_ = callback;
+  }
+
+  std::vector<Glib::ustring> GetSelectedFiles() override {
+    std::vector<Glib::ustring> names;
+    for (const Gtk::TreeModel::Path &path :
+         file_entries_view_.get_selection()->get_selected_rows()) {
+      const Glib::ustring name =
+          (*file_entries_->get_iter(path))[file_columns_.name];
+      names.push_back(name);
+    }
+    return names;
+  }
 
   void AddFile(const File &file) override {
-    std::string icon_full_path = file.IsDirectory()
-                                     ? "/project/icons/folder.png"
-                                     : "/project/icons/empty.png";
-    auto *button = Gtk::make_managed<Gtk::ToggleButton>(file.GetName());
-    button->set_hexpand(true);
-    button->set_image(*CreateManagedImage(
-        icon_full_path, 16, 16, Gdk::PixbufRotation::PIXBUF_ROTATE_NONE));
-    button->set_always_show_image(true);
-    button->set_image_position(Gtk::PositionType::POS_LEFT);
-    button->set_alignment(0.0f, 0.5f);
-
-    button->signal_button_press_event().connect(
-        [this, file](GdkEventButton *button_event) -> bool {
-          this->file_clicked_callback_(file.GetName());
-          return true;
-        });
-    file_entry_widgets_.pack_start(*button);
+    Gtk::TreeModel::iterator row_iter = file_entries_->append();
+    Gtk::TreeModel::Row row = *row_iter;
+    row[file_columns_.icon] = file.IsDirectory() ? directory_icon_ : file_icon_;
+    row[file_columns_.is_directory] = file.IsDirectory();
+    row[file_columns_.name] =
+        Glib::ustring(file.GetName().data(), file.GetName().size());
+    rows_by_name_[std::string(file.GetName())] = row_iter;
+    name_bytes_ += file.GetName().size();
+  }
+
+  void RemoveFile(const File &file) override {
+    auto row = rows_by_name_.find(std::string(file.GetName()));
+    if (row == rows_by_name_.end()) return;
+
+    file_entries_->erase(row->second);
+    rows_by_name_.erase(row);
+    name_bytes_ -= file.GetName().size();
   }
 
   void RemoveAllFiles() override {
-    for (Gtk::Widget *file_entry : file_entry_widgets_.get_children()) {
-      file_entry_widgets_.remove(*file_entry);
-      delete file_entry;
+    scroll_restore_.disconnect();
+    hovered_directory_.clear();
+    // Saved rows belong to their state now, so they are replaced instead.
+    if (rows_are_saved_) {
+      file_entries_ = Gtk::ListStore::create(file_columns_);
+      file_entries_view_.set_model(file_entries_);
+      rows_are_saved_ = false;
+    } else {
+      file_entries_->clear();
     }
+    rows_by_name_.clear();
+    name_bytes_ = 0;
+  }
+
+  void SetFileSize(std::string_view name, uint64_t size) override {
+    auto row = rows_by_name_.find(std::string(name));
+    if (row == rows_by_name_.end()) return;
+
+    (*row->second)[file_columns_.size] = Glib::ustring(FormatSize(size));
+  }
+
+  void ReorderFiles(absl::Span<const File> files) override {
+    // The store takes the current position of the row to put at each one.
+    std::vector<int> new_order;
+    new_order.reserve(files.size());
+    for (const File &file : files) {
+      const Gtk::TreeModel::iterator &row =
+          rows_by_name_.at(std::string(file.GetName()));
+      new_order.push_back(file_entries_->get_path(row)[0]);
+    }
+    file_entries_->reorder(new_order);
+  }
+
+  std::unique_ptr<DirectoryViewState> SaveState() override {
+    auto state = std::make_unique<UIDirectoryViewState>();
+    state->file_entries = file_entries_;
+    state->rows_by_name = std::move(rows_by_name_);
+    state->name_bytes = name_bytes_;
+    state->scroll_offset = file_entries_window_.get_vadjustment()->get_value();
+    state->selected_rows =
+        file_entries_view_.get_selection()->get_selected_rows();
+
+    rows_by_name_.clear();
+    name_bytes_ = 0;
+    rows_are_saved_ = true;
+    return state;
+  }
+
+  void RestoreState(std::unique_ptr<DirectoryViewState> state) override {
+    // States are only ever made by SaveState() of this view.
+    auto &saved_state = static_cast<UIDirectoryViewState &>(*state);
+    scroll_restore_.disconnect();
+    hovered_directory_.clear();
+    file_entries_ = std::move(saved_state.file_entries);
+    rows_by_name_ = std::move(saved_state.rows_by_name);
+    name_bytes_ = saved_state.name_bytes;
+    rows_are_saved_ = false;
+
+    // Swapping the model back in shows every row at once, without adding them
+    // one by one again.
+    file_entries_view_.set_model(file_entries_);
+    for (const Gtk::TreeModel::Path &path : saved_state.selected_rows)
+      file_entries_view_.get_selection()->select(path);
+
+    // The scroll range only covers the restored rows once they are laid out.
+    const double scroll_offset = saved_state.scroll_offset;
+    scroll_restore_ = Glib::signal_idle().connect([this, scroll_offset]() {
+      file_entries_window_.get_vadjustment()->set_value(scroll_offset);
+      return false;
+    });
   }
 
   Gtk::ScrolledWindow &GetWindow() { return file_entries_window_; }
 
  private:
+  // Layout of a row in file_entries_.
+  class FileColumns : public Gtk::TreeModel::ColumnRecord {
+   public:
+    FileColumns() {
+      add(icon);
+      add(name);
+      add(is_directory);
+      add(size);
+    }
+
+    Gtk::TreeModelColumn<Glib::RefPtr<Gdk::Pixbuf>> icon;
+    Gtk::TreeModelColumn<Glib::ustring> name;
+    Gtk::TreeModelColumn<bool> is_directory;
+    // Empty until the size of the file was worked out.
+    Gtk::TreeModelColumn<Glib::ustring> size;
+  };
+
+  // Keeps the rows themselves, so restoring them only swaps the model of the
+  // tree view.
+  class UIDirectoryViewState : public DirectoryViewState {
+   public:
+    size_t GetMemoryUsage() const override {
+      return rows_by_name.size() * kFileRowMemoryUsage + 2 * name_bytes;
+    }
+
+    Glib::RefPtr<Gtk::ListStore> file_entries;
+    std::unordered_map<std::string, Gtk::TreeModel::iterator> rows_by_name;
+    size_t name_bytes = 0;
+    double scroll_offset = 0;
+    std::vector<Gtk::TreeModel::Path> selected_rows;
+  };
+
   std::function<void(const Glib::ustring &)> file_clicked_callback_;
   std::function<void(const Glib::ustring &)> directory_clicked_callback_;
+  std::function<void(const Glib::ustring &)> directory_hovered_callback_;
+  std::function<void(ClipboardAction)> clipboard_callback_;
+  std::function<void()> delete_callback_;
+  // Directory under the pointer, so moving within its row reports it once.
+  Glib::ustring hovered_directory_;
+  FileColumns file_columns_;
+  Glib::RefPtr<Gtk::ListStore> file_entries_;
+  // List store iterators stay valid until their row is removed, so single
+  // files can be removed without searching the store.
+  std::unordered_map<std::string, Gtk::TreeModel::iterator> rows_by_name_;
+  // Bytes of all the names in rows_by_name_.
+  size_t name_bytes_ = 0;
+  // Set once file_entries_ was handed to a state by SaveState().
+  bool rows_are_saved_ = false;
+  sigc::connection scroll_restore_;
+  Glib::RefPtr<Gdk::Pixbuf> directory_icon_;
+  Glib::RefPtr<Gdk::Pixbuf> file_icon_;
   Gtk::ScrolledWindow file_entries_window_;
-  Gtk::Box file_entry_widgets_;
+  Gtk::TreeView file_entries_view_;
+  Gtk::TreeViewColumn file_column_;
+  Gtk::TreeViewColumn size_column_;
 };
 
 Glib::ustring RemoveLastDirectoryFromPath(const Glib::ustring &full_path,
@@ -230,15 +633,66 @@ Glib::ustring RemoveLastDirectoryFromPath(const Glib::ustring &full_path,
   return Glib::ustring(cleaned_dir.data(), cleaned_dir.size());
 }
 
-// Verifies the entered directory with the file system. Returns false if the
-// directory entered is not found.
-//
-// Only full paths are accepted through new_directory. Relative paths are not.
-absl::StatusOr<Glib::ustring> VerifyAndCleanDirectoryUpdate(
-    const Glib::ustring &old_directory, const Glib::ustring &new_directory,
-    const FileSystem &fs) {
-  if (!fs.GetDirectoryFiles(new_directory).ok())
-    return absl::NotFoundError("Directory not found!");
+std::vector<Glib::ustring> GetLikelyNextDirectories(
+    const Glib::ustring &directory, const DirectoryListing &files) {
+  std::string path = directory;
+  while (path.size() > 1 && path.back() == '/') path.pop_back();
+
+  std::vector<Glib::ustring> directories;
+  if (path != "/") directories.push_back(path.substr(0, path.rfind('/') + 1));
+  if (path != "/") path += '/';
+
+  size_t subdirectory_count = 0;
+  for (File file : files) {
+    if (subdirectory_count == kPrefetchedSubdirectoryCount) break;
+    if (!file.IsDirectory()) continue;
+    directories.push_back(path + std::string(file.GetName()) + '/');
+    subdirectory_count++;
+  }
+  return directories;
+}
+
+std::optional<absl::Time> GetTrustedModificationTime(
+    const Glib::ustring &directory, const FileSystem &fs) {
+  absl::StatusOr<FileMetadata> metadata =
+      fs.GetFileMetadata(directory, kFileMetadataModificationTime);
+  if (!metadata.ok() ||
+      !(metadata->filled_fields & kFileMetadataModificationTime) ||
+      absl::Now() - metadata->modification_time < kModificationTimeGranularity)
+    return std::nullopt;
+  return metadata->modification_time;
+}
+
+DirectoryLoader::StartCallback ReadModificationTime(
+    const FileSystem &fs, const Glib::ustring &directory,
+    std::optional<absl::Time> unchanged_time,
+    std::shared_ptr<std::optional<absl::Time>> modification_time) {
+  return [&fs, directory, unchanged_time, modification_time]() {
+    // unchanged_time was trusted, so a directory that still has it cannot
+    // have been modified since.
+    *modification_time = GetTrustedModificationTime(directory, fs);
+    return !unchanged_time.has_value() || *modification_time != unchanged_time;
+  };
+}
+
+DirectoryLoader::PrepareCallback PrepareSorting(
+    const FileSystem &fs, const Glib::ustring &directory,
+    FileMetadataMask metadata_fields, std::shared_ptr<ListingSorter> sorter) {
+  return [&fs, directory, metadata_fields, sorter](DirectoryListing &files) {
+    // Files whose metadata cannot be read are sorted as if it was zero.
+    if (metadata_fields != 0)
+      fs.FillFileMetadata(directory, files, metadata_fields).IgnoreError();
+    sorter->SetListing(files);
+  };
+}
+
+// Ends the entered directory with a /. Returns an error if it is not a full
+// path, or if it is old_directory already.
+absl::StatusOr<Glib::ustring> CleanDirectoryUpdate(
+    const Glib::ustring &old_directory, const Glib::ustring &new_directory) {
+  if (new_directory.empty() || new_directory[0] != gunichar('/'))
+    return absl::InvalidArgumentError(
+        "Must be a full path starting with \"/\"!");
 
   Glib::ustring cleaned_new_directory = new_directory;
   if (cleaned_new_directory.at(cleaned_new_directory.length() - 1) !=
@@ -252,36 +706,45 @@ absl::StatusOr<Glib::ustring> VerifyAndCleanDirectoryUpdate(
   return cleaned_new_directory;
 }
 
+// Verifies the entered directory with the file system. Returns false if the
+// directory entered is not found.
+//
+// Only full paths are accepted through new_directory. Relative paths are not.
+absl::StatusOr<Glib::ustring> VerifyAndCleanDirectoryUpdate(
+    const Glib::ustring &old_directory, const Glib::ustring &new_directory,
+    const FileSystem &fs) {
+  if (!fs.CheckDirectory(new_directory).ok())
+    return absl::NotFoundError("Directory not found!");
+
+  return CleanDirectoryUpdate(old_directory, new_directory);
+}
+
 // Creates an image with automatic memory management, scale it to the specified
 // width and height .
 Gtk::Image *CreateManagedImage(const std::string &image_path, int width,
                                int height, Gdk::PixbufRotation rotation_angle) {
-  Glib::RefPtr<Gdk::Pixbuf> image_buf;
-  try {
-    image_buf = Gdk::Pixbuf::create_from_file(image_path, width, height);
-  } catch (const Glib::FileError &file_error) {
-    std::cerr << "Caught Glib::FileError: " << std::string(file_error.what())
-              << std::endl;
-    return nullptr;
-  } catch (const Gdk::PixbufError &pixbuf_error) {
-    std::cerr << "Caught Gdk::PixbufError: " << std::string(pixbuf_error.what())
-              << std::endl;
-    return nullptr;
-  }
-
-  if (rotation_angle != Gdk::PixbufRotation::PIXBUF_ROTATE_NONE) {
-    Glib::RefPtr<Gdk::Pixbuf> rotated_image_buf =
-        image_buf->rotate_simple(rotation_angle);
-    if (rotated_image_buf)
-      image_buf = rotated_image_buf;
-    else
-      std::cerr << "Failed to rotate " << image_path
-                << ". Returning non-rotated image\n";
-  }
+  Glib::RefPtr<Gdk::Pixbuf> image_buf = IconCache::GetInstance().GetIcon(
+      image_path, width, height, rotation_angle);
+  if (!image_buf) return nullptr;
 
   return Gtk::make_managed<Gtk::Image>(image_buf);
 }
 
+FileJobScheduler::Options GetFileJobOptions() {
+  FileJobScheduler::Options options;
+  options.io_concurrency = kFileJobIOConcurrency;
+  options.walk_thread_count = kFileJobWalkThreadCount;
+  options.progress_interval = kFileJobProgressInterval;
+  return options;
+}
+
+std::string FormatSize(uint64_t size) {
+  gchar *formatted_size = g_format_size(size);
+  std::string text = formatted_size;
+  g_free(formatted_size);
+  return text;
+}
+
 }  // namespace
 
 NavBar::NavBar() {}
@@ -296,7 +759,8 @@ Window::Window(NavBar &nav_bar, CurrentDirectoryBar &directory_bar,
     : navigate_buttons_(&nav_bar),
       current_directory_bar_(&directory_bar),
       directory_view_(&directory_view),
-      file_system_(&file_system) {
+      file_system_(&file_system),
+      snapshot_cache_(kHistorySnapshotMemoryBudget) {
   navigate_buttons_->OnBackButtonPress([this]() {
     this->GoBackDirectory();
     this->RefreshWindowComponents();
@@ -313,6 +777,12 @@ Window::Window(NavBar &nav_bar, CurrentDirectoryBar &directory_bar,
   current_directory_bar_->OnFileToSearchEntered([this]() {
     this->SearchForFile(this->GetDirectoryBar().GetFileSearchBarText());
   });
+  current_directory_bar_->OnFileSearchTextChange([this]() {
+    this->FilterFiles(this->GetDirectoryBar().GetFileSearchBarText());
+  });
+  current_directory_bar_->OnSortOrderChange([this]() {
+    this->SortFiles(this->GetDirectoryBar().GetSortOrder());
+  });
   current_directory_bar_->OnDirectoryChange([this]() {
     this->HandleFullDirectoryChange(
         this->GetDirectoryBar().GetDirectoryBarText());
@@ -334,6 +804,25 @@ Window::Window(NavBar &nav_bar, CurrentDirectoryBar &directory_bar,
     this->HandleFullDirectoryChange(new_directory);
     this->RefreshWindowComponents();
   });
+  directory_view_->OnDirectoryHover([this](
+                                        const Glib::ustring &directory_name) {
+    this->HandleLikelyDirectoryChange(this->GetCurrentDirectory() +
+                                      directory_name + "/");
+  });
+  directory_view_->OnClipboardAction([this](ClipboardAction action) {
+    switch (action) {
+      case ClipboardAction::kCopy:
+        this->KeepSelectedFiles(FileJobType::kCopy);
+        break;
+      case ClipboardAction::kCut:
+        this->KeepSelectedFiles(FileJobType::kMove);
+        break;
+      case ClipboardAction::kPaste:
+        this->PasteFiles();
+        break;
+    }
+  });
+  directory_view_->OnDeleteRequest([this]() { this->DeleteSelectedFiles(); });
 }
 
 Window::~Window() {}
@@ -341,12 +830,12 @@ Window::~Window() {}
 void Window::GoBackDirectory() {
   if (back_directory_history_.empty()) return;
 
-  std::string previous_directory = back_directory_history_.top();
+  HistoryEntry previous_directory = back_directory_history_.top();
 
-  forward_directory_history_.push(current_directory_);
+  forward_directory_history_.push(LeaveCurrentDirectory());
   back_directory_history_.pop();
 
-  UpdateDirectory(previous_directory);
+  ReturnToDirectory(previous_directory);
 }
 
 void Window::GoUpDirectory() {
@@ -363,8 +852,8 @@ void Window::GoUpDirectory() {
   }
 
   // Any directory change not using history should clear forward history.
-  back_directory_history_.push(current_directory_);
-  forward_directory_history_ = std::stack<Glib::ustring>();
+  back_directory_history_.push(LeaveCurrentDirectory());
+  ClearForwardHistory();
 
   // Second to last string in split directories should be directory to remove.
   std::string updated_path = RemoveLastDirectoryFromPath(
@@ -376,20 +865,89 @@ void Window::GoUpDirectory() {
 void Window::GoForwardDirectory() {
   if (forward_directory_history_.empty()) return;
 
-  std::string previous_directory = forward_directory_history_.top();
+  HistoryEntry previous_directory = forward_directory_history_.top();
 
-  back_directory_history_.push(current_directory_);
+  back_directory_history_.push(LeaveCurrentDirectory());
   forward_directory_history_.pop();
 
-  UpdateDirectory(previous_directory);
+  ReturnToDirectory(previous_directory);
 }
 
 dirent *Window::SearchForFile(const Glib::ustring &file_name) {
   return nullptr;
 }
 
+void Window::FilterFiles(const Glib::ustring &query) {}
+
+void Window::SortFiles(SortOrder order) {}
+
+void Window::TransferFiles(FileJobType type,
+                           const std::vector<Glib::ustring> &sources,
+                           const Glib::ustring &destination_directory) {}
+
+void Window::DeleteFiles(const std::vector<Glib::ustring> &files) {}
+
+void Window::KeepSelectedFiles(FileJobType type) {
+  std::vector<Glib::ustring> names = directory_view_->GetSelectedFiles();
+  if (names.empty()) return;
+
+  clipboard_type_ = type;
+  clipboard_files_.clear();
+  // Search results are named by their path relative to the current
+  // directory, so they are kept the same way as its files.
+  for (const Glib::ustring &name : names)
+    clipboard_files_.push_back(current_directory_ + name);
+}
+
+void Window::PasteFiles() {
+  if (clipboard_files_.empty()) return;
+
+  TransferFiles(clipboard_type_, clipboard_files_, current_directory_);
+  // Cut files are not where they were anymore.
+  if (clipboard_type_ == FileJobType::kMove) clipboard_files_.clear();
+}
+
+void Window::DeleteSelectedFiles() {
+  std::vector<Glib::ustring> files;
+  for (const Glib::ustring &name : directory_view_->GetSelectedFiles())
+    files.push_back(current_directory_ + name);
+  if (!files.empty()) DeleteFiles(files);
+}
+
 void Window::UpdateDirectory(const Glib::ustring &new_directory) {
   current_directory_ = new_directory;
+  restored_snapshot_ = nullptr;
+}
+
+Window::HistoryEntry Window::LeaveCurrentDirectory() {
+  return {current_directory_, snapshot_cache_.Add(CaptureDirectorySnapshot())};
+}
+
+void Window::ReturnToDirectory(const HistoryEntry &entry) {
+  UpdateDirectory(entry.directory);
+  restored_snapshot_ = snapshot_cache_.Take(entry.snapshot);
+}
+
+void Window::ClearForwardHistory() {
+  while (!forward_directory_history_.empty()) {
+    snapshot_cache_.Remove(forward_directory_history_.top().snapshot);
+    forward_directory_history_.pop();
+  }
+}
+
+std::unique_ptr<DirectorySnapshot> Window::CaptureDirectorySnapshot() {
+  return nullptr;
+}
+
+std::unique_ptr<DirectorySnapshot> Window::TakeRestoredSnapshot() {
+  return std::move(restored_snapshot_);
+}
+
+void Window::EnterDirectory(const Glib::ustring &new_directory) {
+  back_directory_history_.push(LeaveCurrentDirectory());
+  ClearForwardHistory();
+
+  UpdateDirectory(new_directory);
 }
 
 void Window::HandleFullDirectoryChange(const Glib::ustring &new_directory) {
@@ -398,12 +956,11 @@ void Window::HandleFullDirectoryChange(const Glib::ustring &new_directory) {
                                     *file_system_);
   if (!new_cleaned_directory.ok()) return;
 
-  back_directory_history_.push(current_directory_);
-  forward_directory_history_ = std::stack<Glib::ustring>();
-
-  UpdateDirectory(new_cleaned_directory.value());
+  EnterDirectory(new_cleaned_directory.value());
 }
 
+void Window::HandleLikelyDirectoryChange(const Glib::ustring &directory) {}
+
 void Window::ShowFileDetails(const Glib::ustring &file_name) {}
 
 NavBar &Window::GetNavBar() { return *navigate_buttons_.get(); }
@@ -418,7 +975,35 @@ Glib::ustring Window::GetCurrentDirectory() { return current_directory_; }
 
 UIWindow::UIWindow()
     : ::Window(*new UINavBar(), *new UICurrentDirectoryBar(),
-               *new UIDirectoryFilesView(), *new POSIXFileSystem()) {
+               *new UIDirectoryFilesView(),
+               *new CachingFileSystem(*new POSIXFileSystem(),
+                                      *new InotifyDirectoryWatcher(),
+                                      kDirectoryCacheMemoryBudget)),
+      directory_loader_(GetFileSystem(), kFileBatchSize,
+                        [this]() { files_loaded_dispatcher_.emit(); }),
+      directory_prefetcher_(
+          dynamic_cast<const CachingFileSystem &>(GetFileSystem()),
+          kMaxConcurrentPrefetches, kMaxQueuedPrefetches),
+      file_searcher_(search_file_system_, kSearchIndexThreadCount,
+                     kFileBatchSize, kMaxSearchResultCount, kSearchIndexMaxAge,
+                     GetSearchIndexDirectory(),
+                     [this]() { search_results_dispatcher_.emit(); }),
+      disk_usage_scanner_(search_file_system_, kDiskUsageThreadCount,
+                          kFileBatchSize, kDiskUsageProgressInterval,
+                          kMaxCachedDiskUsageDirectoryCount,
+                          [this]() { disk_usage_dispatcher_.emit(); }),
+      file_job_scheduler_(search_file_system_, file_system_writer_,
+                          GetFileJobOptions(),
+                          [this]() { file_jobs_dispatcher_.emit(); }) {
+  files_loaded_dispatcher_.connect(
+      [this]() { directory_loader_.DeliverResults(); });
+  search_results_dispatcher_.connect(
+      [this]() { file_searcher_.DeliverResults(); });
+  disk_usage_dispatcher_.connect(
+      [this]() { disk_usage_scanner_.DeliverResults(); });
+  file_jobs_dispatcher_.connect(
+      [this]() { file_job_scheduler_.DeliverResults(); });
+
   add(window_widgets_);
 
   set_default_size(600, 600);
@@ -437,22 +1022,638 @@ UIWindow::UIWindow()
       dynamic_cast<UIDirectoryFilesView &>(GetDirectoryFilesView());
   window_widgets_.attach(directory_files_view.GetWindow(), /*left=*/1,
                          /*top=*/1);
+
+  // File jobs show up below the files, one row each.
+  file_jobs_box_.set_orientation(Gtk::Orientation::ORIENTATION_VERTICAL);
+  window_widgets_.attach(file_jobs_box_, /*left=*/1, /*top=*/2);
+
+  const std::string trash_directory = GetTrashDirectory();
+  if (!trash_directory.empty()) {
+    file_trash_ = std::make_unique<FileTrash>(
+        search_file_system_, file_system_writer_, trash_directory);
+    PurgeTrash();
+  }
 }
 
 void UIWindow::RefreshWindowComponents() {
-  const Glib::ustring &new_directory = GetCurrentDirectory();
+  file_searcher_.Cancel();
 
-  absl::StatusOr<std::vector<File>> file_names =
-      GetFileSystem().GetDirectoryFiles(new_directory);
-  if (!file_names.ok()) return;
+  const bool is_entering = !entering_directory_.empty();
+  const Glib::ustring new_directory =
+      is_entering ? entering_directory_ : GetCurrentDirectory();
+  // Directories being entered only count once they turn out to be readable.
+  if (!is_entering && new_directory != displayed_directory_)
+    directory_prefetcher_.RecordNavigation(new_directory);
 
-  GetDirectoryFilesView().RemoveAllFiles();
+  if (std::unique_ptr<DirectorySnapshot> snapshot = TakeRestoredSnapshot()) {
+    ShowDirectorySnapshot(new_directory, std::move(*snapshot));
+    return;
+  }
+
+  if (new_directory == displayed_directory_) {
+    ReloadDisplayedDirectory(/*unchanged_time=*/std::nullopt);
+    return;
+  }
+
+  // Files are sorted once they are all read. Collation keys, and metadata
+  // the sort order needs, are worked out on the loader's worker.
+  const FileMetadataMask metadata_fields =
+      ListingSorter::GetRequiredMetadata(sort_order_.column);
+  auto sorter = std::make_shared<ListingSorter>();
+  auto modification_time = std::make_shared<std::optional<absl::Time>>();
+
+  // The old files stay up until the first batch of the new directory is in,
+  // so the view does not flash empty on every navigation.
+  auto is_first_batch = std::make_shared<bool>(true);
+  auto show_new_directory = [this, new_directory, is_entering,
+                             is_first_batch]() {
+    if (!*is_first_batch) return;
+    if (is_entering) {
+      entering_directory_.clear();
+      EnterDirectory(new_directory);
+      directory_prefetcher_.RecordNavigation(new_directory);
+    }
+    StopShowingMatchingFiles();
+    disk_usage_scanner_.Cancel();
+    GetDirectoryFilesView().RemoveAllFiles();
+    GetDirectoryBar().SetDisplayedDirectory(new_directory);
+    displayed_directory_.clear();
+    displayed_files_.Clear();
+    displayed_order_.clear();
+    displayed_modification_time_.reset();
+    is_filter_outdated_ = false;
+    *is_first_batch = false;
+  };
+
+  // Large listings are shown from scratch once sorted, so adding more of
+  // their files as they are read would only be undone.
+  auto streamed_file_count = std::make_shared<size_t>(0);
+  directory_loader_.Load(
+      new_directory,
+      [this, show_new_directory,
+       streamed_file_count](const DirectoryListing &files) {
+        show_new_directory();
+        for (File file : files) {
+          if (*streamed_file_count == kLargeListingFileCount) break;
+          if (listing_filter_.Matches(file.GetName())) {
+            GetDirectoryFilesView().AddFile(file);
+            ++*streamed_file_count;
+          }
+        }
+        show_all();
+      },
+      [this, new_directory, is_entering, modification_time, metadata_fields,
+       sorter, show_new_directory](absl::StatusOr<DirectoryListing> files) {
+        if (!files.ok()) {
+          // Such as a file that was clicked, which is not entered.
+          if (is_entering) entering_directory_.clear();
+          return;
+        }
+
+        // Empty directories never receive a batch.
+        show_new_directory();
+        directory_prefetcher_.Prefetch(
+            GetLikelyNextDirectories(new_directory, *files));
+        displayed_directory_ = new_directory;
+        displayed_files_ = std::move(*files);
+        displayed_modification_time_ = *modification_time;
+        listing_filter_.SetListing(displayed_files_);
+        SetDisplayedSorter(std::move(*sorter), metadata_fields);
+        // Files came in the order they were read.
+        if (is_filter_outdated_)
+          ShowMatchingFiles();
+        else
+          SortMatchingFiles();
+        ScanDiskUsage();
+        show_all();
+        if (IsMissingSortMetadata()) RefreshWindowComponents();
+      },
+      PrepareSorting(GetFileSystem(), new_directory, metadata_fields, sorter),
+      ReadModificationTime(GetFileSystem(), new_directory,
+                           /*unchanged_time=*/std::nullopt, modification_time));
+}
+
+void UIWindow::ReloadDisplayedDirectory(
+    std::optional<absl::Time> unchanged_time) {
+  const FileMetadataMask metadata_fields =
+      ListingSorter::GetRequiredMetadata(sort_order_.column);
+  auto sorter = std::make_shared<ListingSorter>();
+  auto modification_time = std::make_shared<std::optional<absl::Time>>();
+  directory_loader_.Load(
+      displayed_directory_, nullptr,
+      [this, modification_time, metadata_fields,
+       sorter](absl::StatusOr<DirectoryListing> files) {
+        if (!files.ok()) return;
+
+        // Removing a file the filter hides, or one that is yet to be shown,
+        // does nothing. Files still being shown are shown again from
+        // scratch once sorted anyway.
+        DirectoryListingDiff diff =
+            DiffSortedDirectoryListings(displayed_files_, *files);
+        for (size_t index : diff.removed_files)
+          GetDirectoryFilesView().RemoveFile(displayed_files_[index]);
+        for (size_t index : diff.added_files) {
+          const File file = (*files)[index];
+          if (listing_filter_.Matches(file.GetName())) ShowFile(file);
+        }
+        displayed_files_ = std::move(*files);
+        displayed_modification_time_ = *modification_time;
+        listing_filter_.SetListing(displayed_files_);
+        // Added files went to the end.
+        SetDisplayedSorter(std::move(*sorter), metadata_fields);
+        SortMatchingFiles();
+        ScanDiskUsage();
+        show_all();
+        if (IsMissingSortMetadata()) RefreshWindowComponents();
+      },
+      PrepareSorting(GetFileSystem(), displayed_directory_, metadata_fields,
+                     sorter),
+      ReadModificationTime(GetFileSystem(), displayed_directory_,
+                           unchanged_time, modification_time));
+}
 
-  for (const File &file : file_names.value()) {
-    GetDirectoryFilesView().AddFile(file);
+void UIWindow::GoBackDirectory() {
+  entering_directory_.clear();
+  Window::GoBackDirectory();
+}
+
+void UIWindow::GoForwardDirectory() {
+  entering_directory_.clear();
+  Window::GoForwardDirectory();
+}
+
+void UIWindow::GoUpDirectory() {
+  entering_directory_.clear();
+  Window::GoUpDirectory();
+}
+
+void UIWindow::HandleFullDirectoryChange(const Glib::ustring &new_directory) {
+  absl::StatusOr<Glib::ustring> new_cleaned_directory =
+      CleanDirectoryUpdate(GetCurrentDirectory(), new_directory);
+  // Entering the current directory again, or a relative path, stays in the
+  // current directory.
+  if (new_cleaned_directory.ok())
+    entering_directory_ = new_cleaned_directory.value();
+  else
+    entering_directory_.clear();
+}
+
+void UIWindow::HandleLikelyDirectoryChange(const Glib::ustring &directory) {
+  directory_prefetcher_.PrefetchFirst(directory);
+}
+
+dirent *UIWindow::SearchForFile(const Glib::ustring &file_name) {
+  if (file_name.empty()) {
+    RefreshWindowComponents();
+    return nullptr;
   }
 
-  GetDirectoryBar().SetDisplayedDirectory(new_directory);
+  // Searches are of the current directory, not of one being entered.
+  directory_loader_.Cancel();
+  entering_directory_.clear();
+
+  // Like a directory, the files shown stay up until the first results are in.
+  auto is_first_batch = std::make_shared<bool>(true);
+  auto show_results = [this, is_first_batch]() {
+    if (!*is_first_batch) return;
+    StopShowingMatchingFiles();
+    disk_usage_scanner_.Cancel();
+    GetDirectoryFilesView().RemoveAllFiles();
+    displayed_directory_.clear();
+    displayed_files_.Clear();
+    displayed_order_.clear();
+    displayed_modification_time_.reset();
+    is_filter_outdated_ = false;
+    *is_first_batch = false;
+  };
+
+  file_searcher_.Search(
+      GetCurrentDirectory(), file_name,
+      [this, show_results](const DirectoryListing &results) {
+        show_results();
+        for (File file : results) GetDirectoryFilesView().AddFile(file);
+        show_all();
+      },
+      [this, show_results](absl::Status status) {
+        // Searches without any match never receive a batch.
+        if (status.ok()) show_results();
+        show_all();
+      });
+  return nullptr;
+}
+
+void UIWindow::FilterFiles(const Glib::ustring &query) {
+  // Files still loading, or search results, are only filtered as they come
+  // in.
+  if (displayed_directory_.empty()) {
+    listing_filter_.SetQuery(displayed_files_, query);
+    is_filter_outdated_ = true;
+    return;
+  }
+
+  DirectoryListingDiff diff = listing_filter_.SetQuery(displayed_files_, query);
+  // Removing rows one by one costs more than adding the few left back. Files
+  // added back to a large listing would have to be sorted in among all the
+  // others, and files yet to be shown were filtered by the old query.
+  if (diff.removed_files.size() > listing_filter_.GetMatches().size() ||
+      (!diff.added_files.empty() && IsLargeListing()) ||
+      show_rest_connection_.connected()) {
+    ShowMatchingFiles();
+  } else {
+    for (size_t index : diff.removed_files)
+      GetDirectoryFilesView().RemoveFile(displayed_files_[index]);
+    for (size_t index : diff.added_files) ShowFile(displayed_files_[index]);
+    // Files added back went to the end.
+    if (!diff.added_files.empty()) SortMatchingFiles();
+  }
+  show_all();
+}
+
+void UIWindow::SortFiles(SortOrder order) {
+  sort_order_ = order;
+  displayed_order_.clear();
+  displayed_sort_.reset();
+  // Files still loading are sorted once they are all in.
+  if (displayed_directory_.empty()) return;
+
+  if (IsMissingSortMetadata()) {
+    RefreshWindowComponents();
+    return;
+  }
+  SortMatchingFiles();
+  show_all();
+}
+
+void UIWindow::TransferFiles(FileJobType type,
+                             const std::vector<Glib::ustring> &sources,
+                             const Glib::ustring &destination_directory) {
+  if (!sources.empty()) StartFileJob(type, sources, destination_directory);
+}
+
+void UIWindow::DeleteFiles(const std::vector<Glib::ustring> &files) {
+  if (files.empty()) return;
+
+  // Files are removed from the trash right away, so they cannot be restored.
+  const std::string question =
+      files.size() == 1
+          ? absl::StrCat("Delete ", Glib::path_get_basename(files.front()), "?")
+          : absl::StrCat("Delete ", files.size(), " files?");
+  Gtk::MessageDialog confirmation(*this, question, /*use_markup=*/false,
+                                  Gtk::MESSAGE_QUESTION,
+                                  Gtk::BUTTONS_OK_CANCEL, /*modal=*/true);
+  confirmation.set_secondary_text("Deleted files cannot be restored.");
+  if (confirmation.run() != Gtk::RESPONSE_OK) return;
+  confirmation.hide();
+
+  std::vector<Glib::ustring> trashed_files;
+  std::string errors;
+  for (const Glib::ustring &file : files) {
+    absl::StatusOr<Glib::ustring> trashed_file =
+        file_trash_ != nullptr ? file_trash_->MoveToTrash(file)
+                               : absl::UnavailableError("No trash.");
+    // Files that cannot be moved to the trash, such as ones on another file
+    // system, are left where they are.
+    if (trashed_file.ok()) {
+      // The trash only invalidates file in the file system of searches, not
+      // in the one directories are shown from.
+      GetFileSystem().InvalidatePath(file);
+      trashed_files.push_back(*std::move(trashed_file));
+    } else {
+      absl::StrAppend(&errors, std::string(file), ": ",
+                      trashed_file.status().message(), "\n");
+    }
+  }
+  if (!trashed_files.empty()) {
+    if (!displayed_directory_.empty() &&
+        displayed_directory_ == GetCurrentDirectory())
+      RefreshWindowComponents();
+    StartFileJob(FileJobType::kDelete, trashed_files, "");
+  }
+
+  if (errors.empty()) return;
+  errors.pop_back();
+  Gtk::MessageDialog error_dialog(*this, "Some files could not be deleted",
+                                  /*use_markup=*/false, Gtk::MESSAGE_ERROR,
+                                  Gtk::BUTTONS_OK, /*modal=*/true);
+  error_dialog.set_secondary_text(errors);
+  error_dialog.run();
+}
+
+void UIWindow::StartFileJob(FileJobType type,
+                            const std::vector<Glib::ustring> &sources,
+                            const Glib::ustring &destination_directory) {
+  auto row = std::make_unique<FileJobRow>();
+  FileJobRow &shown_row = *row;
+  row->type = type;
+  row->sources = sources;
+  row->destination_directory = destination_directory;
+  row->job = file_job_scheduler_.Start(
+      type, sources, destination_directory,
+      [this, &shown_row](const FileJobProgress &progress) {
+        ShowFileJobProgress(shown_row, progress);
+      },
+      [this, &shown_row](absl::Status status) {
+        FinishFileJob(shown_row, std::move(status));
+      });
+
+  row->label.set_xalign(0);
+  row->pause_button.set_label("Pause");
+  row->pause_button.signal_clicked().connect([this, &shown_row]() {
+    shown_row.is_paused = !shown_row.is_paused;
+    if (shown_row.is_paused)
+      file_job_scheduler_.Pause(shown_row.job);
+    else
+      file_job_scheduler_.Resume(shown_row.job);
+    shown_row.pause_button.set_label(shown_row.is_paused ? "Resume" : "Pause");
+  });
+  row->cancel_button.set_label("Cancel");
+  row->cancel_button.signal_clicked().connect([this, &shown_row]() {
+    if (shown_row.is_over)
+      RemoveFileJobRow(shown_row);
+    else
+      file_job_scheduler_.Cancel(shown_row.job);
+  });
+  row->box.pack_start(row->label);
+  row->box.pack_start(row->progress_bar, Gtk::PackOptions::PACK_SHRINK);
+  row->box.pack_start(row->pause_button, Gtk::PackOptions::PACK_SHRINK);
+  row->box.pack_start(row->cancel_button, Gtk::PackOptions::PACK_SHRINK);
+  file_jobs_box_.pack_start(row->box, Gtk::PackOptions::PACK_SHRINK);
+
+  ShowFileJobProgress(*row, FileJobProgress());
+  file_jobs_[row->job] = std::move(row);
+  show_all();
+}
+
+void UIWindow::PurgeTrash() {
+  absl::StatusOr<std::vector<Glib::ustring>> files =
+      file_trash_->GetTrashedFiles();
+  if (files.ok() && !files->empty())
+    StartFileJob(FileJobType::kDelete, *files, "");
+}
+
+std::unique_ptr<DirectorySnapshot> UIWindow::CaptureDirectorySnapshot() {
+  if (displayed_directory_ != GetCurrentDirectory() ||
+      !displayed_modification_time_.has_value())
+    return nullptr;
+
+  // Rows of files still being shown are not worth keeping.
+  const bool is_every_match_shown = !show_rest_connection_.connected();
+  StopShowingMatchingFiles();
+
+  auto snapshot = std::make_unique<DirectorySnapshot>();
+  snapshot->modification_time = *displayed_modification_time_;
+  snapshot->files = std::move(displayed_files_);
+  snapshot->metadata_fields = displayed_metadata_fields_;
+  snapshot->sorter = std::move(listing_sorter_);
+  snapshot->sort_order = sort_order_;
+  // Only the view of every file can be shown again whatever the filter is by
+  // then.
+  if (listing_filter_.GetQuery().empty() && is_every_match_shown)
+    snapshot->view_state = GetDirectoryFilesView().SaveState();
+
+  // The view may not change its saved files, which leaving the directory
+  // behind makes sure of, since the next directory shown starts by removing
+  // all of them.
+  displayed_directory_.clear();
+  displayed_files_.Clear();
+  displayed_order_.clear();
+  displayed_modification_time_.reset();
+  return snapshot;
+}
 
+void UIWindow::ShowDirectorySnapshot(const Glib::ustring &directory,
+                                     DirectorySnapshot snapshot) {
+  directory_loader_.Cancel();
+  StopShowingMatchingFiles();
+
+  displayed_directory_ = directory;
+  displayed_files_ = std::move(snapshot.files);
+  displayed_modification_time_ = snapshot.modification_time;
+  listing_filter_.SetListing(displayed_files_);
+  is_filter_outdated_ = false;
+  SetDisplayedSorter(std::move(snapshot.sorter), snapshot.metadata_fields);
+
+  if (snapshot.view_state != nullptr &&
+      listing_filter_.GetMatches().size() == displayed_files_.size()) {
+    GetDirectoryFilesView().RestoreState(std::move(snapshot.view_state));
+    if (snapshot.sort_order != sort_order_) SortMatchingFiles();
+  } else {
+    ShowMatchingFiles();
+  }
+  GetDirectoryBar().SetDisplayedDirectory(directory);
+  ScanDiskUsage();
   show_all();
+  // Whether the directory changed since the snapshot is only checked now, off
+  // the main loop, and its files read again if it did.
+  ReloadDisplayedDirectory(IsMissingSortMetadata()
+                               ? std::nullopt
+                               : displayed_modification_time_);
+}
+
+void UIWindow::ScanDiskUsage() {
+  if (displayed_directory_ != file_sizes_directory_) {
+    file_sizes_.clear();
+    file_sizes_directory_ = displayed_directory_;
+  }
+  // Sizes already shown stay up until they are replaced.
+  disk_usage_scanner_.Scan(
+      displayed_directory_,
+      [this](absl::Span<const DiskUsageScanner::EntryUsage> entries) {
+        for (const DiskUsageScanner::EntryUsage &entry : entries) {
+          file_sizes_[entry.name] = entry.usage.apparent_size;
+          GetDirectoryFilesView().SetFileSize(entry.name,
+                                              entry.usage.apparent_size);
+        }
+      },
+      [](absl::StatusOr<DiskUsage> usage) {});
+}
+
+void UIWindow::ShowFile(const File &file) {
+  GetDirectoryFilesView().AddFile(file);
+  if (file_sizes_.empty() || displayed_directory_ != file_sizes_directory_)
+    return;
+  auto size = file_sizes_.find(std::string(file.GetName()));
+  if (size != file_sizes_.end())
+    GetDirectoryFilesView().SetFileSize(file.GetName(), size->second);
+}
+
+void UIWindow::ShowMatchingFiles() {
+  StopShowingMatchingFiles();
+  GetDirectoryFilesView().RemoveAllFiles();
+  is_filter_outdated_ = false;
+  if (!IsLargeListing()) {
+    for (const File &file : GetMatchingFilesInOrder()) ShowFile(file);
+    return;
+  }
+
+  // Only the first screenful is picked out and sorted before the first
+  // paint. The main loop draws before it runs idle handlers.
+  const std::vector<uint32_t> first_files =
+      listing_sorter_.SortFirst(displayed_files_, listing_filter_.GetMatches(),
+                                sort_order_, kFirstScreenFileCount);
+  for (uint32_t index : first_files) ShowFile(displayed_files_[index]);
+  next_file_to_show_ = first_files.size();
+  show_rest_connection_ =
+      Glib::signal_idle().connect([this]() { return ShowMoreMatchingFiles(); });
+}
+
+bool UIWindow::ShowMoreMatchingFiles() {
+  if (displayed_order_.size() != displayed_files_.size()) {
+    if (!displayed_sort_.has_value()) {
+      displayed_sort_ =
+          listing_sorter_.StartSort(displayed_files_, sort_order_);
+    }
+    if (displayed_sort_->Step(kSortStepFileCount)) return true;
+    displayed_order_ = displayed_sort_->TakeOrder();
+    displayed_sort_.reset();
+    return true;
+  }
+  if (files_to_show_.empty()) {
+    files_to_show_ = GetMatchingFilesInOrder();
+    return true;
+  }
+
+  const size_t end =
+      std::min(next_file_to_show_ + kFileBatchSize, files_to_show_.size());
+  for (; next_file_to_show_ < end; next_file_to_show_++)
+    ShowFile(files_to_show_[next_file_to_show_]);
+  if (next_file_to_show_ < files_to_show_.size()) return true;
+
+  files_to_show_.clear();
+  return false;
+}
+
+void UIWindow::StopShowingMatchingFiles() {
+  show_rest_connection_.disconnect();
+  displayed_sort_.reset();
+  files_to_show_.clear();
+}
+
+void UIWindow::SortMatchingFiles() {
+  // Files still being shown are sorted along with the rest anyway.
+  if (IsLargeListing() || show_rest_connection_.connected()) {
+    ShowMatchingFiles();
+    return;
+  }
+  GetDirectoryFilesView().ReorderFiles(GetMatchingFilesInOrder());
+}
+
+std::vector<File> UIWindow::GetMatchingFilesInOrder() {
+  if (displayed_order_.size() != displayed_files_.size())
+    displayed_order_ = listing_sorter_.Sort(displayed_files_, sort_order_);
+
+  std::vector<bool> is_match(displayed_files_.size());
+  for (size_t index : listing_filter_.GetMatches()) is_match[index] = true;
+
+  std::vector<File> files;
+  files.reserve(listing_filter_.GetMatches().size());
+  for (uint32_t index : displayed_order_) {
+    if (is_match[index]) files.push_back(displayed_files_[index]);
+  }
+  return files;
+}
+
+bool UIWindow::IsLargeListing() const {
+  return listing_filter_.GetMatches().size() > kLargeListingFileCount;
+}
+
+void UIWindow::SetDisplayedSorter(ListingSorter sorter,
+                                  FileMetadataMask metadata_fields) {
+  listing_sorter_ = std::move(sorter);
+  displayed_metadata_fields_ = metadata_fields;
+  displayed_order_.clear();
+  displayed_sort_.reset();
+}
+
+bool UIWindow::IsMissingSortMetadata() const {
+  return (ListingSorter::GetRequiredMetadata(sort_order_.column) &
+          ~displayed_metadata_fields_) != 0;
+}
+
+void UIWindow::ShowFileJobProgress(FileJobRow &row,
+                                   const FileJobProgress &progress) {
+  std::string text;
+  if (row.type == FileJobType::kDelete) {
+    // Files are only found as they are removed, so there is no total to
+    // show.
+    text = absl::StrCat("Deleting ", row.sources.size(),
+                        row.sources.size() == 1 ? " item: " : " items: ",
+                        progress.done_file_count, " removed");
+  } else {
+    text = absl::StrCat(
+        row.type == FileJobType::kCopy ? "Copying " : "Moving ",
+        row.sources.size(),
+        row.sources.size() == 1 ? " item to " : " items to ",
+        std::string(row.destination_directory), ": ",
+        FormatSize(progress.done_bytes), " of ",
+        FormatSize(progress.total_bytes));
+    if (!progress.is_counting_done) absl::StrAppend(&text, " found so far");
+  }
+  if (row.is_paused) {
+    absl::StrAppend(&text, ", paused");
+  } else if (progress.bytes_per_second > 0) {
+    absl::StrAppend(
+        &text, ", ",
+        FormatSize(static_cast<uint64_t>(progress.bytes_per_second)), "/s");
+  }
+  if (progress.remaining_time.has_value()) {
+    absl::StrAppend(&text, ", ",
+                    absl::FormatDuration(absl::Ceil(*progress.remaining_time,
+                                                    absl::Seconds(1))),
+                    " left");
+  }
+  row.label.set_text(text);
+
+  // Files found later would move the bar back.
+  if (progress.is_counting_done && progress.total_bytes > 0) {
+    row.progress_bar.set_fraction(
+        std::min(1.0, static_cast<double>(progress.done_bytes) /
+                          progress.total_bytes));
+  } else {
+    row.progress_bar.pulse();
+  }
+}
+
+void UIWindow::FinishFileJob(FileJobRow &row, absl::Status status) {
+  row.is_over = true;
+  // The scheduler only invalidates the sources it moved or removed in the
+  // file system of searches.
+  if (row.type != FileJobType::kCopy) {
+    for (const Glib::ustring &source : row.sources)
+      GetFileSystem().InvalidatePath(source);
+  }
+  // Jobs in or out of the directory shown change its files.
+  if (!displayed_directory_.empty() &&
+      displayed_directory_ == GetCurrentDirectory())
+    RefreshWindowComponents();
+
+  if (status.ok() || absl::IsCancelled(status)) {
+    RemoveFileJobRow(row);
+    return;
+  }
+
+  // Failed jobs stay up until closed, so the error can be read.
+  if (row.type == FileJobType::kDelete) {
+    row.label.set_text(absl::StrCat("Could not delete: ", status.message()));
+  } else {
+    row.label.set_text(absl::StrCat(
+        row.type == FileJobType::kCopy ? "Could not copy to "
+                                       : "Could not move to ",
+        std::string(row.destination_directory), ": ", status.message()));
+  }
+  row.box.remove(row.progress_bar);
+  row.box.remove(row.pause_button);
+  row.cancel_button.set_label("Close");
+}
+
+void UIWindow::RemoveFileJobRow(FileJobRow &row) {
+  const FileJobScheduler::JobId job = row.job;
+  Glib::signal_idle().connect([this, job]() {
+    auto row = file_jobs_.find(job);
+    if (row != file_jobs_.end()) {
+      file_jobs_box_.remove(row->second->box);
+      file_jobs_.erase(row);
+    }
+    return false;
+  });
 }
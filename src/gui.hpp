@@ -1,16 +1,39 @@
 #ifndef GUI_HPP
 #define GUI_HPP
 
+#include <absl/types/span.h>
 #include <dirent.h>
+#include <glibmm/dispatcher.h>
 #include <glibmm/ustring.h>
+#include <gtkmm/box.h>
+#include <gtkmm/button.h>
 #include <gtkmm/grid.h>
+#include <gtkmm/label.h>
+#include <gtkmm/progressbar.h>
 #include <gtkmm/window.h>
 
+#include <cstdint>
 #include <functional>
+#include <map>
 #include <memory>
+#include <optional>
 #include <stack>
-
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "directory_loader.hpp"
+#include "directory_prefetcher.hpp"
+#include "directory_snapshot.hpp"
+#include "disk_usage.hpp"
+#include "file_job_scheduler.hpp"
+#include "file_searcher.hpp"
+#include "file_system_writer.hpp"
+#include "file_trash.hpp"
 #include "filesystem.hpp"
+#include "listing_filter.hpp"
+#include "listing_sorter.hpp"
 
 // A base interface for creating derived instances of the navigation bar,
 // containing a back, forward, and up button. Can be derived to provide
@@ -48,6 +71,7 @@ class CurrentDirectoryBar {
 
   virtual Glib::ustring GetDirectoryBarText() = 0;
   virtual Glib::ustring GetFileSearchBarText() = 0;
+  virtual SortOrder GetSortOrder() = 0;
 
   // This sets the internal text displayed for the current directory text box
   // (located below the file search box), to the argument. Expects the directory
@@ -62,8 +86,20 @@ class CurrentDirectoryBar {
   // Registers an action to take when there is a request to search for a file.
   // Happens when the user types a file name into the file search bar.
   virtual void OnFileToSearchEntered(std::function<void()> callback) = 0;
+
+  // Registers an action to take whenever the text in the file search bar
+  // changes, such as on every keystroke.
+  virtual void OnFileSearchTextChange(std::function<void()> callback) = 0;
+
+  // Registers an action to take when the user picks another order to sort
+  // files in.
+  virtual void OnSortOrderChange(std::function<void()> callback) = 0;
 };
 
+// What the user asked to do with the files selected, or to the ones copied or
+// cut before.
+enum class ClipboardAction { kCopy, kCut, kPaste };
+
 // Represents the window that lists the files in a directory on the file system.
 // Provides updates when a file or directory is clicked.
 class DirectoryFilesView {
@@ -90,13 +126,56 @@ class DirectoryFilesView {
   virtual void OnDirectoryClick(
       std::function<void(const Glib::ustring &)> callback) = 0;
 
+  // Registers the action to take when the pointer moves onto a directory in
+  // the directory view, which hints that it may be clicked next.
+  virtual void OnDirectoryHover(
+      std::function<void(const Glib::ustring &)> callback) = 0;
+
+  // Registers the action to take when the user asks to copy or cut the
+  // selected files, or to paste them, such as with Ctrl+C, Ctrl+X and Ctrl+V.
+  virtual void OnClipboardAction(
+      std::function<void(ClipboardAction)> callback) = 0;
+
+  // Registers the action to take when the user asks to delete the selected
+  // files, such as with the Delete key.
+  virtual void OnDeleteRequest(std::function<void()> callback) = 0;
+
+  // Names of the files selected in the view, in the order they are shown.
+  virtual std::vector<Glib::ustring> GetSelectedFiles() = 0;
+
   // Adds a file to be displayed on the file view. This can be a file or a
   // directory (following Unix's everything is a file ideology). Will register
   // the callback specified in OnFileClick() to this file.
   virtual void AddFile(const File &file) = 0;
 
+  // Removes the displayed file with the same name as file. Does nothing if
+  // there is none. Files that stay are left untouched, so a view can be moved
+  // from one listing of a directory to the next with only as much work as
+  // there are changes.
+  virtual void RemoveFile(const File &file) = 0;
+
   // Removes all files that are currently displaying in the window view.
   virtual void RemoveAllFiles() = 0;
+
+  // Shows size, in bytes, next to the displayed file named name. The size of
+  // a directory is that of everything below it. Does nothing if no file of
+  // that name is displayed.
+  virtual void SetFileSize(std::string_view name, uint64_t size) = 0;
+
+  // Moves the files shown into the order of files, which holds each of them
+  // exactly once. Cheaper than removing and adding them all again.
+  virtual void ReorderFiles(absl::Span<const File> files) = 0;
+
+  // Hands out everything needed to show the current files again later exactly
+  // as they are now, including the scroll offset and selection. The files stay
+  // on screen, but no file may be added or removed until RemoveAllFiles() or
+  // RestoreState() was called. May return nullptr if there is nothing worth
+  // keeping.
+  virtual std::unique_ptr<DirectoryViewState> SaveState() = 0;
+
+  // Shows a state returned by SaveState() of this view again, in place of the
+  // files currently shown.
+  virtual void RestoreState(std::unique_ptr<DirectoryViewState> state) = 0;
 };
 
 // Base data structure for application window that holds all internal state,
@@ -123,11 +202,33 @@ class Window {
   virtual void GoUpDirectory();
   virtual void HandleFullDirectoryChange(const Glib::ustring &new_directory);
 
+  // Called with the full path of a directory the user is about to open,
+  // such as one under the pointer. Does nothing by default.
+  virtual void HandleLikelyDirectoryChange(const Glib::ustring &directory);
+
   // Will search for the file passed in, relative to the current directory.
   //
   // Returns nullptr if the file name does not exist.
   virtual dirent *SearchForFile(const Glib::ustring &file_name);
 
+  // Narrows the files shown down to the ones of the current directory whose
+  // name contains query, as it is typed. Does nothing by default.
+  virtual void FilterFiles(const Glib::ustring &query);
+
+  // Shows the files in order. Does nothing by default.
+  virtual void SortFiles(SortOrder order);
+
+  // Copies or moves the files at the full paths of sources into
+  // destination_directory, such as when files copied or cut are pasted. Does
+  // nothing by default.
+  virtual void TransferFiles(FileJobType type,
+                             const std::vector<Glib::ustring> &sources,
+                             const Glib::ustring &destination_directory);
+
+  // Deletes the files at the full paths of files, along with everything below
+  // them. Does nothing by default.
+  virtual void DeleteFiles(const std::vector<Glib::ustring> &files);
+
   // Shows window containing details of a file and a preview of it if possible.
   //
   // Does nothing if file does not exist.
@@ -145,10 +246,47 @@ class Window {
   // widget update such as a directory change.
   virtual void RefreshWindowComponents() = 0;
 
+ protected:
+  // Called right before the window leaves the current directory, to keep what
+  // it shows of it in the navigation history. Returns nullptr by default,
+  // which keeps nothing.
+  virtual std::unique_ptr<DirectorySnapshot> CaptureDirectorySnapshot();
+
+  // Returns the snapshot kept for the current directory, if the last directory
+  // change went back or forward in the history. Returns nullptr otherwise, or
+  // once it was taken. The directory may have been modified since the
+  // snapshot was captured, which is left to the caller to check, since that
+  // takes a syscall.
+  std::unique_ptr<DirectorySnapshot> TakeRestoredSnapshot();
+
+  // Moves to new_directory, which must be valid and end with a /, keeping the
+  // current directory in the back history and clearing the forward one.
+  void EnterDirectory(const Glib::ustring &new_directory);
+
  private:
+  // A directory in the navigation history, along with the id of its snapshot
+  // in snapshot_cache_.
+  struct HistoryEntry {
+    Glib::ustring directory;
+    DirectorySnapshotCache::SnapshotId snapshot;
+  };
+
+  // Keeps the full paths of the files selected, to be copied or moved by the
+  // next paste.
+  void KeepSelectedFiles(FileJobType type);
+  void PasteFiles();
+  void DeleteSelectedFiles();
+
   // Asssumes new_directory to be valid.
   void UpdateDirectory(const Glib::ustring &new_directory);
 
+  // Makes the history entry for the current directory, which is being left.
+  HistoryEntry LeaveCurrentDirectory();
+  // Moves to a directory from the history, restoring its snapshot if it has
+  // one.
+  void ReturnToDirectory(const HistoryEntry &entry);
+  void ClearForwardHistory();
+
   std::unique_ptr<NavBar> navigate_buttons_;
   std::unique_ptr<CurrentDirectoryBar> current_directory_bar_;
   std::unique_ptr<DirectoryFilesView> directory_view_;
@@ -157,10 +295,19 @@ class Window {
   std::unique_ptr<FileSystem> file_system_;
 
   // Needed for handling going back and forth using the navigation bar.
-  std::stack<Glib::ustring> back_directory_history_;
-  std::stack<Glib::ustring> forward_directory_history_;
+  std::stack<HistoryEntry> back_directory_history_;
+  std::stack<HistoryEntry> forward_directory_history_;
+  // Snapshots of directories in the history, so going back and forth shows
+  // them right away instead of reading them again.
+  DirectorySnapshotCache snapshot_cache_;
+  std::unique_ptr<DirectorySnapshot> restored_snapshot_;
 
   Glib::ustring current_directory_ = "/";
+
+  // Files copied or cut, by full path, and which of the two it was. Cut files
+  // are only pasted once.
+  FileJobType clipboard_type_ = FileJobType::kCopy;
+  std::vector<Glib::ustring> clipboard_files_;
 };
 
 // Represents the whole GUI structure including the file manager's internal
@@ -178,10 +325,204 @@ class UIWindow : public Gtk::Window, public Window {
   // Updates all the window widgets after an internal update. Must be called
   // after instantiation of the window. TODO: Maybe create a better design so
   // the user doesn't have to call this themselves?
+  //
+  // The current directory is read in the background, and its files show up
+  // batch by batch as the main loop gets to them. A refresh cancels the one
+  // before it if that is still loading. Directories returned to through the
+  // history are shown from their snapshot instead, and read again in the
+  // background if it turns out to be stale.
+  //
+  // Once a directory is loaded, the directories the user is likely to open
+  // next are read into the cache in the background.
   void RefreshWindowComponents() override;
 
+  // Going back, forward or up drops the directory being entered, if any.
+  void GoBackDirectory() override;
+  void GoForwardDirectory() override;
+  void GoUpDirectory() override;
+  // Only moves to new_directory once the refresh that follows has read its
+  // first files on the loader's worker, which is what checks it is a
+  // directory that can be read, instead of checking it on the main loop.
+  // Until then the current directory and its files stay as they are, and
+  // they are left that way if new_directory cannot be read.
+  void HandleFullDirectoryChange(const Glib::ustring &new_directory) override;
+
+  // Reads directory into the cache ahead of every other prefetched directory.
+  void HandleLikelyDirectoryChange(const Glib::ustring &directory) override;
+
+  // Shows every file below the current directory whose name contains
+  // file_name in the directory files view, as they are found, named by their
+  // path relative to the current directory. An empty file_name shows the
+  // current directory again. Always returns nullptr.
+  dirent *SearchForFile(const Glib::ustring &file_name) override;
+
+  // Only shows the files of the current directory whose name contains query,
+  // ignoring case. The files shown are updated with only the ones that start
+  // or stop matching, without reading the directory again. Directories shown
+  // later are filtered by the same query, until it is changed again.
+  void FilterFiles(const Glib::ustring &query) override;
+
+  // Shows the files of the current directory in order, which later
+  // directories are sorted in too. Sorting by size or modification time
+  // reads the directory again first if their metadata was not filled in.
+  // Search results stay in the order of how well they match.
+  void SortFiles(SortOrder order) override;
+
+  // Runs the transfer in the background, showing how far along it is below
+  // the files, with buttons to pause and cancel it. The current directory is
+  // shown again once the transfer is over, in case it changed.
+  void TransferFiles(FileJobType type,
+                     const std::vector<Glib::ustring> &sources,
+                     const Glib::ustring &destination_directory) override;
+
+  // Asks for confirmation, then moves the files to the trash, which only
+  // renames them, so they are gone from the current directory right away,
+  // and removes them from the trash in the background, shown like transfers
+  // are. Files that cannot be moved to the trash, such as ones on another
+  // file system, are left in place and reported in a dialog.
+  void DeleteFiles(const std::vector<Glib::ustring> &files) override;
+
+ protected:
+  // Keeps the displayed files along with the view's rows, scroll offset and
+  // selection, if the current directory finished loading.
+  std::unique_ptr<DirectorySnapshot> CaptureDirectorySnapshot() override;
+
  private:
+  // Shows the snapshot right away, and then reads its directory again in the
+  // background if it was modified since the snapshot was captured.
+  void ShowDirectorySnapshot(const Glib::ustring &directory,
+                             DirectorySnapshot snapshot);
+  // Reads displayed_directory_ again in full in the background, and then only
+  // updates the files that changed in the view. If unchanged_time is set,
+  // nothing is read while the directory still has that modification time.
+  void ReloadDisplayedDirectory(std::optional<absl::Time> unchanged_time);
+  // Works out the disk usage of every file of displayed_directory_ in the
+  // background, showing it in the view as it grows.
+  void ScanDiskUsage();
+  // Adds file of displayed_files_ to the view, along with its size if it was
+  // worked out already.
+  void ShowFile(const File &file);
+  // Shows the files of displayed_files_ that match the filter, in
+  // sort_order_, in place of every file shown. Large listings only have
+  // their first screenful sorted and shown right away, and the rest is
+  // sorted and shown a batch per main loop iteration, so the first paint
+  // does not depend on how many files there are.
+  void ShowMatchingFiles();
+  // Adds the next batch of files shown by ShowMatchingFiles(), sorting all
+  // of them a step per call first. Returns whether any are left.
+  bool ShowMoreMatchingFiles();
+  void StopShowingMatchingFiles();
+  // Moves the files shown, which must be the ones that match the filter,
+  // into sort_order_. Large listings are shown from scratch instead.
+  void SortMatchingFiles();
+  // Files of displayed_files_ that match the filter, in sort_order_.
+  std::vector<File> GetMatchingFilesInOrder();
+  bool IsLargeListing() const;
+  // Takes over the sorter set to displayed_files_.
+  void SetDisplayedSorter(ListingSorter sorter,
+                          FileMetadataMask metadata_fields);
+  // Whether displayed_files_ lack metadata sort_order_ needs, such as when it
+  // was picked while they were read.
+  bool IsMissingSortMetadata() const;
+
+  // What is shown of a file job that is not over yet, or that failed.
+  struct FileJobRow {
+    FileJobScheduler::JobId job;
+    FileJobType type;
+    std::vector<Glib::ustring> sources;
+    Glib::ustring destination_directory;
+    bool is_paused = false;
+    bool is_over = false;
+    Gtk::Box box;
+    Gtk::Label label;
+    Gtk::ProgressBar progress_bar;
+    Gtk::Button pause_button;
+    Gtk::Button cancel_button;
+  };
+  // Starts the job in the background and shows a row for it.
+  void StartFileJob(FileJobType type, const std::vector<Glib::ustring> &sources,
+                    const Glib::ustring &destination_directory);
+  // Removes whatever is left in the trash, such as files a previous run did
+  // not finish removing.
+  void PurgeTrash();
+  void ShowFileJobProgress(FileJobRow &row, const FileJobProgress &progress);
+  void FinishFileJob(FileJobRow &row, absl::Status status);
+  // Removes row once the main loop is idle, since it may be removed from a
+  // handler of one of its own buttons.
+  void RemoveFileJobRow(FileJobRow &row);
+
   Gtk::Grid window_widgets_;
+
+  // Wakes up the main loop whenever directory_loader_ has files to show. Must
+  // outlive directory_loader_, whose workers emit it.
+  Glib::Dispatcher files_loaded_dispatcher_;
+  DirectoryLoader directory_loader_;
+  DirectoryPrefetcher directory_prefetcher_;
+
+  // Searches walk whole subtrees, which would evict everything the user
+  // browsed from the caching file system and watch every directory, so they
+  // read directories straight from disk instead. Must outlive file_searcher_,
+  // as must the dispatcher its workers emit.
+  POSIXFileSystem search_file_system_;
+  Glib::Dispatcher search_results_dispatcher_;
+  FileSearcher file_searcher_;
+  // Scans walk whole subtrees too, so they also read straight from disk.
+  Glib::Dispatcher disk_usage_dispatcher_;
+  DiskUsageScanner disk_usage_scanner_;
+  // Sizes of the files of file_sizes_directory_ scanned so far, by name, so
+  // files shown again get theirs back.
+  Glib::ustring file_sizes_directory_;
+  std::unordered_map<std::string, uint64_t> file_sizes_;
+
+  // Directory HandleFullDirectoryChange() moves to once its first files are
+  // read, ending with a /. Empty if none is being entered.
+  Glib::ustring entering_directory_;
+
+  // What the directory files view shows once no load is in flight, sorted by
+  // name. Refreshing the same directory again only applies the differences to
+  // the view. Empty while a different directory is being shown.
+  Glib::ustring displayed_directory_;
+  DirectoryListing displayed_files_;
+  // Modification time of displayed_directory_ from before it was read. Empty
+  // if it could not be trusted to tell later changes apart, in which case no
+  // snapshot is kept.
+  std::optional<absl::Time> displayed_modification_time_;
+  // Picks which of displayed_files_ the view shows.
+  ListingFilter listing_filter_;
+  // Set if the query changed while the files shown were not all in
+  // displayed_files_ yet, so some of them were filtered by an older query.
+  bool is_filter_outdated_ = false;
+  // Metadata filled in for displayed_files_.
+  FileMetadataMask displayed_metadata_fields_ = 0;
+  // Set to displayed_files_, unless a different directory is being shown.
+  ListingSorter listing_sorter_;
+  // Indices of displayed_files_ in sort_order_. Empty until they are needed
+  // in that order.
+  std::vector<uint32_t> displayed_order_;
+  // Sorts displayed_files_ into displayed_order_ while the rest of a large
+  // listing is yet to be shown.
+  std::optional<ListingSorter::StepwiseSort> displayed_sort_;
+  SortOrder sort_order_;
+  // Connected while ShowMatchingFiles() has files left to show. Those are
+  // the ones from next_file_to_show_ on of files_to_show_, which is empty
+  // until they were all sorted.
+  sigc::connection show_rest_connection_;
+  std::vector<File> files_to_show_;
+  size_t next_file_to_show_ = 0;
+
+  // Copies, moves and deletes files in the background, reading the trees
+  // copied straight from disk like searches do. The writer must outlive
+  // file_job_scheduler_, as must the dispatcher its workers emit.
+  POSIXFileSystemWriter file_system_writer_;
+  Glib::Dispatcher file_jobs_dispatcher_;
+  FileJobScheduler file_job_scheduler_;
+  // Where deleted files go until they are removed. Null if its directory
+  // could not be created, in which case files to delete are left in place and
+  // listed in an error dialog.
+  std::unique_ptr<FileTrash> file_trash_;
+  // Rows of the jobs shown, stacked in file_jobs_box_, by job.
+  Gtk::Box file_jobs_box_;
+  std::map<FileJobScheduler::JobId, std::unique_ptr<FileJobRow>> file_jobs_;
 };
 
 #endif  // GUI_HPP
@@ -4,7 +4,9 @@
 #include <absl/memory/memory.h>
 #include <absl/status/status.h>
 #include <absl/status/statusor.h>
+#include <absl/time/time.h>
 #include <absl/types/any.h>
+#include <absl/types/span.h>
 #include <absl/utility/utility.h>
 #include <dirent.h>
 #include <glibmm/ustring.h>
@@ -13,15 +15,23 @@
 #include <gtkmm/window.h>
 
 #include <array>
+#include <cstdint>
 #include <initializer_list>
 #include <memory>
+#include <optional>
 #include <stack>
+#include <string>
+#include <string_view>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
+#include "file_job_scheduler.hpp"
 #include "filesystem.hpp"
+#include "listing_sorter.hpp"
 
 using ::testing::_;
+using ::testing::ElementsAre;
 using ::testing::Exactly;
 using ::testing::InitGoogleTest;
 using ::testing::InSequence;
@@ -236,9 +246,32 @@ class MockCurrentDirectoryBar : public CurrentDirectoryBar {
     mock_file_entry_box_.callback_();
   }
 
+  void OnFileSearchTextChange(std::function<void()> callback) override {
+    file_search_text_changed_callback_ = callback;
+  }
+
+  void SimulateFileSearchTextChange(const Glib::ustring& text) {
+    mock_file_entry_box_.text_ = text;
+    file_search_text_changed_callback_();
+  }
+
+  SortOrder GetSortOrder() override { return sort_order_; }
+
+  void OnSortOrderChange(std::function<void()> callback) override {
+    sort_order_changed_callback_ = callback;
+  }
+
+  void SimulateSortOrderChange(SortOrder order) {
+    sort_order_ = order;
+    sort_order_changed_callback_();
+  }
+
  private:
   MockTextBox mock_file_entry_box_;
   MockTextBox mock_current_directory_box_;
+  std::function<void()> file_search_text_changed_callback_;
+  SortOrder sort_order_;
+  std::function<void()> sort_order_changed_callback_;
 };
 
 class MockDirectoryFilesView : public DirectoryFilesView {
@@ -252,7 +285,15 @@ class MockDirectoryFilesView : public DirectoryFilesView {
   MockDirectoryFilesView& operator=(MockDirectoryFilesView&&) = delete;
 
   MOCK_METHOD(void, AddFile, (const File& file), (override));
+  MOCK_METHOD(void, RemoveFile, (const File& file), (override));
   MOCK_METHOD(void, RemoveAllFiles, (), (override));
+  MOCK_METHOD(void, SetFileSize, (std::string_view name, uint64_t size),
+              (override));
+  MOCK_METHOD(void, ReorderFiles, (absl::Span<const File> files), (override));
+  MOCK_METHOD(std::unique_ptr<DirectoryViewState>, SaveState, (), (override));
+  MOCK_METHOD(void, RestoreState, (std::unique_ptr<DirectoryViewState> state),
+              (override));
+  MOCK_METHOD(std::vector<Glib::ustring>, GetSelectedFiles, (), (override));
 
   void OnFileClick(
       std::function<void(const Glib::ustring&)> callback) override {
@@ -264,6 +305,20 @@ class MockDirectoryFilesView : public DirectoryFilesView {
     directory_clicked_callback_ = callback;
   }
 
+  void OnDirectoryHover(
+      std::function<void(const Glib::ustring&)> callback) override {
+    directory_hovered_callback_ = callback;
+  }
+
+  void OnClipboardAction(
+      std::function<void(ClipboardAction)> callback) override {
+    clipboard_callback_ = callback;
+  }
+
+  void OnDeleteRequest(std::function<void()> callback) override {
+    delete_callback_ = callback;
+  }
+
   // Must only contain names of files without any path notation to it, as that
   // is how the program will receive the files.
   void SimulateFileClick(const Glib::ustring& file_name) {
@@ -276,9 +331,25 @@ class MockDirectoryFilesView : public DirectoryFilesView {
     directory_clicked_callback_(directory_name);
   }
 
+  // Same as SimulateDirectoryClick, but for the pointer moving onto directory.
+  void SimulateDirectoryHover(const Glib::ustring& directory_name) {
+    directory_hovered_callback_(directory_name);
+  }
+
+  // Copies, cuts or pastes the files GetSelectedFiles() returns.
+  void SimulateClipboardAction(ClipboardAction action) {
+    clipboard_callback_(action);
+  }
+
+  // Deletes the files GetSelectedFiles() returns.
+  void SimulateDeleteRequest() { delete_callback_(); }
+
  private:
   std::function<void(const Glib::ustring&)> file_clicked_callback_;
   std::function<void(const Glib::ustring&)> directory_clicked_callback_;
+  std::function<void(const Glib::ustring&)> directory_hovered_callback_;
+  std::function<void(ClipboardAction)> clipboard_callback_;
+  std::function<void()> delete_callback_;
 };
 
 // Acts as regular window, and is used to ensure methods of Window are invoked
@@ -301,9 +372,19 @@ class MockWindow : public Window {
   MOCK_METHOD(void, GoUpDirectory, (), (override));
   MOCK_METHOD(void, HandleFullDirectoryChange,
               (const Glib::ustring& new_directory), (override));
+  MOCK_METHOD(void, HandleLikelyDirectoryChange,
+              (const Glib::ustring& directory), (override));
 
   MOCK_METHOD(dirent*, SearchForFile, (const Glib::ustring& file_name),
               (override));
+  MOCK_METHOD(void, FilterFiles, (const Glib::ustring& query), (override));
+  MOCK_METHOD(void, SortFiles, (SortOrder order), (override));
+  MOCK_METHOD(void, TransferFiles,
+              (FileJobType type, const std::vector<Glib::ustring>& sources,
+               const Glib::ustring& destination_directory),
+              (override));
+  MOCK_METHOD(void, DeleteFiles, (const std::vector<Glib::ustring>& files),
+              (override));
 
   MOCK_METHOD(void, ShowFileDetails, (const Glib::ustring& file_name),
               (override));
@@ -317,10 +398,33 @@ class MockWindow : public Window {
 
   void RefreshWindowComponents() override {
     GetDirectoryBar().SetDisplayedDirectory(GetCurrentDirectory());
-    absl::StatusOr<File> mock_file = File::Create(MockFile("meow.txt"));
-    mock_file.IgnoreError();
-    GetDirectoryFilesView().AddFile(mock_file.value());
+    DirectoryListing mock_files;
+    mock_files.Add("meow.txt", /*is_dir=*/false);
+    GetDirectoryFilesView().AddFile(mock_files[0]);
+  }
+
+  std::unique_ptr<DirectorySnapshot> CallTakeRestoredSnapshot() {
+    return TakeRestoredSnapshot();
+  }
+
+  // Once set, every directory left is kept as a snapshot with this
+  // modification time, whose only file is named after the directory.
+  void KeepSnapshots(absl::Time modification_time) {
+    snapshot_modification_time_ = modification_time;
+  }
+
+ protected:
+  std::unique_ptr<DirectorySnapshot> CaptureDirectorySnapshot() override {
+    if (!snapshot_modification_time_.has_value()) return nullptr;
+
+    auto snapshot = std::make_unique<DirectorySnapshot>();
+    snapshot->modification_time = *snapshot_modification_time_;
+    snapshot->files.Add(std::string(GetCurrentDirectory()), /*is_dir=*/true);
+    return snapshot;
   }
+
+ private:
+  std::optional<absl::Time> snapshot_modification_time_;
 };
 
 class WindowTest : public ::testing::Test {
@@ -833,6 +937,25 @@ TEST_F(WindowTest, EnsureFileIsSearchedFor) {
       "hello.txt");  // NOLINT
 }
 
+TEST_F(WindowTest, FilesAreFilteredOnEveryKeystroke) {
+  {
+    InSequence sequence;
+    EXPECT_CALL(mock_window_, FilterFiles(Glib::ustring("m"))).Times(1);
+    EXPECT_CALL(mock_window_, FilterFiles(Glib::ustring("me"))).Times(1);
+  }
+  EXPECT_CALL(mock_window_, SearchForFile(_)).Times(0);
+
+  mock_current_directory_bar_.SimulateFileSearchTextChange("m");
+  mock_current_directory_bar_.SimulateFileSearchTextChange("me");
+}
+
+TEST_F(WindowTest, FilesAreSortedInPickedOrder) {
+  const SortOrder order = {SortColumn::kSize, /*is_descending=*/true};
+  EXPECT_CALL(mock_window_, SortFiles(order)).Times(1);
+
+  mock_current_directory_bar_.SimulateSortOrderChange(order);
+}
+
 TEST_F(WindowTest, EnsureWindowDirectoryUpdatesUponDirectoryBarChange) {
   EXPECT_CALL(mock_window_,
               HandleFullDirectoryChange(Glib::ustring("/dir/")))  // NOLINT
@@ -857,6 +980,123 @@ TEST_F(WindowTest, EnsureDirectoryWidgetUpdatesUponRequestFromWindow) {
   mock_directory_files_view_.SimulateDirectoryClick("dir");  // NOLINT
 }
 
+TEST_F(WindowTest, HoveredDirectoryIsReportedAsLikelyNext) {
+  EXPECT_CALL(mock_window_,
+              HandleLikelyDirectoryChange(Glib::ustring("/dir/")))  // NOLINT
+      .Times(Exactly(1));
+  EXPECT_CALL(mock_window_, HandleFullDirectoryChange(_)).Times(0);
+
+  mock_directory_files_view_.SimulateDirectoryHover("dir");  // NOLINT
+
+  ASSERT_STREQ(mock_window_.GetCurrentDirectory().c_str(), "/");
+}
+
+TEST_F(WindowTest, CopiedFilesArePastedIntoCurrentDirectory) {
+  EXPECT_CALL(mock_directory_files_view_, GetSelectedFiles())
+      .WillOnce(Return(std::vector<Glib::ustring>{"meow.txt", "meow"}));
+  EXPECT_CALL(mock_window_,
+              TransferFiles(FileJobType::kCopy,
+                            ElementsAre(Glib::ustring("/meow.txt"),
+                                        Glib::ustring("/meow")),
+                            Glib::ustring("/dir/")))
+      .Times(Exactly(2));
+
+  mock_directory_files_view_.SimulateClipboardAction(ClipboardAction::kCopy);
+  mock_window_.CallFullDirectoryChange("/dir/");
+  mock_directory_files_view_.SimulateClipboardAction(ClipboardAction::kPaste);
+  mock_directory_files_view_.SimulateClipboardAction(ClipboardAction::kPaste);
+}
+
+TEST_F(WindowTest, CutFilesArePastedOnce) {
+  EXPECT_CALL(mock_directory_files_view_, GetSelectedFiles())
+      .WillOnce(Return(std::vector<Glib::ustring>{"lmao.txt"}));
+  const Glib::ustring cut_file = "/dir/nesteddir/lmao.txt";
+  EXPECT_CALL(mock_window_, TransferFiles(FileJobType::kMove,
+                                          ElementsAre(cut_file),
+                                          Glib::ustring("/")))
+      .Times(Exactly(1));
+
+  mock_window_.CallFullDirectoryChange("/dir/nesteddir/");
+  mock_directory_files_view_.SimulateClipboardAction(ClipboardAction::kCut);
+  mock_window_.CallGoBackDirectory();
+  mock_directory_files_view_.SimulateClipboardAction(ClipboardAction::kPaste);
+  mock_directory_files_view_.SimulateClipboardAction(ClipboardAction::kPaste);
+}
+
+TEST_F(WindowTest, NothingIsPastedUntilFilesAreCopied) {
+  EXPECT_CALL(mock_directory_files_view_, GetSelectedFiles())
+      .WillOnce(Return(std::vector<Glib::ustring>()));
+  EXPECT_CALL(mock_window_, TransferFiles(_, _, _)).Times(0);
+
+  mock_directory_files_view_.SimulateClipboardAction(ClipboardAction::kPaste);
+  mock_directory_files_view_.SimulateClipboardAction(ClipboardAction::kCopy);
+  mock_directory_files_view_.SimulateClipboardAction(ClipboardAction::kPaste);
+}
+
+TEST_F(WindowTest, SelectedFilesAreDeletedFromCurrentDirectory) {
+  EXPECT_CALL(mock_directory_files_view_, GetSelectedFiles())
+      .WillOnce(Return(std::vector<Glib::ustring>()))
+      .WillOnce(Return(std::vector<Glib::ustring>{"meow.txt", "nesteddir"}));
+  EXPECT_CALL(mock_window_,
+              DeleteFiles(ElementsAre(Glib::ustring("/dir/meow.txt"),
+                                      Glib::ustring("/dir/nesteddir"))))
+      .Times(Exactly(1));
+
+  mock_window_.CallFullDirectoryChange("/dir/");
+  mock_directory_files_view_.SimulateDeleteRequest();
+  mock_directory_files_view_.SimulateDeleteRequest();
+}
+
+// Mock directories are never modified, so their modification time is always
+// the Unix epoch.
+TEST_F(WindowTest, BackAndForwardRestoreFreshSnapshots) {
+  mock_window_.KeepSnapshots(absl::UnixEpoch());
+
+  mock_window_.CallFullDirectoryChange("/dir/");
+  EXPECT_EQ(mock_window_.CallTakeRestoredSnapshot(), nullptr);
+
+  mock_window_.CallGoBackDirectory();
+  std::unique_ptr<DirectorySnapshot> snapshot =
+      mock_window_.CallTakeRestoredSnapshot();
+  ASSERT_NE(snapshot, nullptr);
+  EXPECT_THAT(snapshot->files, ElementsAre("/"));
+  EXPECT_EQ(mock_window_.CallTakeRestoredSnapshot(), nullptr);
+
+  mock_window_.CallGoForwardDirectory();
+  snapshot = mock_window_.CallTakeRestoredSnapshot();
+  ASSERT_NE(snapshot, nullptr);
+  EXPECT_THAT(snapshot->files, ElementsAre("/dir/"));
+}
+
+// Whether the directory was modified since is left to the window to check off
+// the main loop, with the modification time the snapshot keeps.
+TEST_F(WindowTest, ModifiedDirectoryIsRestoredForWindowToCheck) {
+  mock_window_.KeepSnapshots(absl::FromUnixSeconds(1));
+
+  mock_window_.CallFullDirectoryChange("/dir/");
+  mock_window_.CallGoBackDirectory();
+
+  ASSERT_STREQ(mock_window_.GetCurrentDirectory().c_str(), "/");
+  std::unique_ptr<DirectorySnapshot> snapshot =
+      mock_window_.CallTakeRestoredSnapshot();
+  ASSERT_NE(snapshot, nullptr);
+  EXPECT_EQ(snapshot->modification_time, absl::FromUnixSeconds(1));
+}
+
+TEST_F(WindowTest, LeavingRestoredDirectoryDropsItsSnapshot) {
+  mock_window_.KeepSnapshots(absl::UnixEpoch());
+
+  mock_window_.CallFullDirectoryChange("/dir/");
+  mock_window_.CallGoBackDirectory();
+  mock_window_.CallFullDirectoryChange("/meow/");
+  EXPECT_EQ(mock_window_.CallTakeRestoredSnapshot(), nullptr);
+
+  // The forward history was cleared along with its snapshots.
+  mock_window_.CallGoForwardDirectory();
+  ASSERT_STREQ(mock_window_.GetCurrentDirectory().c_str(), "/meow/");
+  EXPECT_EQ(mock_window_.CallTakeRestoredSnapshot(), nullptr);
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
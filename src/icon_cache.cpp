@@ -0,0 +1,79 @@
+#include "icon_cache.hpp"
+
+#include <gdk/gdkpixbuf.h>
+#include <glibmm/fileutils.h>
+
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace {
+
+Glib::RefPtr<Gdk::Pixbuf> DecodeIconFile(const std::string &path, int width,
+                                         int height) {
+  try {
+    return Gdk::Pixbuf::create_from_file(path, width, height);
+  } catch (const Glib::FileError &file_error) {
+    std::cerr << "Caught Glib::FileError: " << std::string(file_error.what())
+              << std::endl;
+  } catch (const Gdk::PixbufError &pixbuf_error) {
+    std::cerr << "Caught Gdk::PixbufError: " << std::string(pixbuf_error.what())
+              << std::endl;
+  }
+  return Glib::RefPtr<Gdk::Pixbuf>();
+}
+
+}  // namespace
+
+IconCache::IconCache(IconDecoder decoder) : decoder_(std::move(decoder)) {}
+
+IconCache &IconCache::GetInstance() {
+  static IconCache *const instance = new IconCache(DecodeIconFile);
+  return *instance;
+}
+
+Glib::RefPtr<Gdk::Pixbuf> IconCache::GetIcon(const std::string &path,
+                                             int width, int height,
+                                             Gdk::PixbufRotation rotation) {
+  IconKey key(path, width, height, rotation);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto icon = icons_.find(key);
+    if (icon != icons_.end()) {
+      ++hit_count_;
+      return icon->second;
+    }
+    ++miss_count_;
+  }
+
+  // Decode without holding the lock, so other icons can be handed out
+  // meanwhile. Two threads missing the same icon both make it, and the first
+  // one cached wins.
+  Glib::RefPtr<Gdk::Pixbuf> icon;
+  if (rotation == Gdk::PixbufRotation::PIXBUF_ROTATE_NONE) {
+    icon = decoder_(path, width, height);
+  } else if (Glib::RefPtr<Gdk::Pixbuf> upright_icon =
+                 GetIcon(path, width, height,
+                         Gdk::PixbufRotation::PIXBUF_ROTATE_NONE)) {
+    icon = upright_icon->rotate_simple(rotation);
+    if (!icon) {
+      std::cerr << "Failed to rotate " << path
+                << ". Returning non-rotated image\n";
+      icon = upright_icon;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  return icons_.emplace(std::move(key), icon).first->second;
+}
+
+uint64_t IconCache::GetHitCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hit_count_;
+}
+
+uint64_t IconCache::GetMissCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return miss_count_;
+}
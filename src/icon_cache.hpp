@@ -0,0 +1,59 @@
+#ifndef ICON_CACHE_HPP
+#define ICON_CACHE_HPP
+
+#include <gdkmm/pixbuf.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+// Decodes every icon once and hands out shared references to it afterwards.
+// Icons are keyed by their path, size and rotation. A rotated icon is made from
+// the cached upright icon of the same path and size, so an image file is
+// decoded at most once per size no matter how many rotations are asked for.
+//
+// Icons are never evicted, since a file manager only ever shows a handful of
+// them. Safe to use from multiple threads.
+class IconCache {
+ public:
+  // Decodes the image at path scaled to width and height. Returns an empty
+  // pointer if it cannot be decoded.
+  using IconDecoder = std::function<Glib::RefPtr<Gdk::Pixbuf>(
+      const std::string &path, int width, int height)>;
+
+  explicit IconCache(IconDecoder decoder);
+
+  IconCache(const IconCache &) = delete;
+  IconCache &operator=(const IconCache &) = delete;
+
+  // The cache shared by the whole process, which decodes icons from disk.
+  static IconCache &GetInstance();
+
+  // Returns the icon at path scaled to width and height and rotated by
+  // rotation. Returns an empty pointer if it cannot be decoded. Failures are
+  // cached as well, so a missing icon is only looked for once.
+  Glib::RefPtr<Gdk::Pixbuf> GetIcon(const std::string &path, int width,
+                                    int height,
+                                    Gdk::PixbufRotation rotation);
+
+  // Number of GetIcon() calls answered from the cache, or that had to make the
+  // icon, since construction. Making a rotated icon also looks up its upright
+  // icon, which counts as a call of its own.
+  uint64_t GetHitCount() const;
+  uint64_t GetMissCount() const;
+
+ private:
+  using IconKey = std::tuple<std::string, int, int, Gdk::PixbufRotation>;
+
+  IconDecoder decoder_;
+
+  mutable std::mutex mutex_;
+  std::map<IconKey, Glib::RefPtr<Gdk::Pixbuf>> icons_;
+  uint64_t hit_count_ = 0;
+  uint64_t miss_count_ = 0;
+};
+
+#endif  // ICON_CACHE_HPP
@@ -0,0 +1,93 @@
+#include "icon_cache.hpp"
+
+#include <gdkmm/pixbuf.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+using ::testing::ElementsAre;
+
+// Makes an IconCache whose decoder records every path it decodes, and fails
+// to decode paths containing "missing".
+class IconCacheTest : public ::testing::Test {
+ protected:
+  IconCacheTest()
+      : icon_cache_([this](const std::string& path, int width, int height) {
+          decoded_paths_.push_back(path);
+          if (path.find("missing") != std::string::npos)
+            return Glib::RefPtr<Gdk::Pixbuf>();
+          return Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, /*has_alpha=*/false,
+                                     /*bits_per_sample=*/8, width, height);
+        }) {}
+
+  std::vector<std::string> decoded_paths_;
+  IconCache icon_cache_;
+};
+
+TEST_F(IconCacheTest, DecodesIconOnlyOnce) {
+  Glib::RefPtr<Gdk::Pixbuf> first_icon = icon_cache_.GetIcon(
+      "folder.png", 16, 16, Gdk::PixbufRotation::PIXBUF_ROTATE_NONE);
+  Glib::RefPtr<Gdk::Pixbuf> second_icon = icon_cache_.GetIcon(
+      "folder.png", 16, 16, Gdk::PixbufRotation::PIXBUF_ROTATE_NONE);
+
+  ASSERT_TRUE(first_icon);
+  EXPECT_EQ(first_icon, second_icon);
+  EXPECT_THAT(decoded_paths_, ElementsAre("folder.png"));
+  EXPECT_EQ(icon_cache_.GetHitCount(), 1);
+  EXPECT_EQ(icon_cache_.GetMissCount(), 1);
+}
+
+TEST_F(IconCacheTest, RepopulatingDecodesNothing) {
+  for (int i = 0; i < 1000; i++) {
+    icon_cache_.GetIcon(i % 2 ? "folder.png" : "empty.png", 16, 16,
+                        Gdk::PixbufRotation::PIXBUF_ROTATE_NONE);
+  }
+
+  EXPECT_THAT(decoded_paths_, ElementsAre("empty.png", "folder.png"));
+  EXPECT_EQ(icon_cache_.GetHitCount(), 998);
+  EXPECT_EQ(icon_cache_.GetMissCount(), 2);
+}
+
+TEST_F(IconCacheTest, CachesEachSizeSeparately) {
+  Glib::RefPtr<Gdk::Pixbuf> small_icon = icon_cache_.GetIcon(
+      "folder.png", 16, 16, Gdk::PixbufRotation::PIXBUF_ROTATE_NONE);
+  Glib::RefPtr<Gdk::Pixbuf> large_icon = icon_cache_.GetIcon(
+      "folder.png", 32, 32, Gdk::PixbufRotation::PIXBUF_ROTATE_NONE);
+
+  EXPECT_NE(small_icon, large_icon);
+  EXPECT_THAT(decoded_paths_, ElementsAre("folder.png", "folder.png"));
+}
+
+TEST_F(IconCacheTest, RotatesCachedUprightIcon) {
+  Glib::RefPtr<Gdk::Pixbuf> upright_icon = icon_cache_.GetIcon(
+      "arrow.png", 16, 16, Gdk::PixbufRotation::PIXBUF_ROTATE_NONE);
+  Glib::RefPtr<Gdk::Pixbuf> rotated_icon = icon_cache_.GetIcon(
+      "arrow.png", 16, 16, Gdk::PixbufRotation::PIXBUF_ROTATE_CLOCKWISE);
+  Glib::RefPtr<Gdk::Pixbuf> upside_down_icon = icon_cache_.GetIcon(
+      "arrow.png", 16, 16, Gdk::PixbufRotation::PIXBUF_ROTATE_UPSIDEDOWN);
+
+  ASSERT_TRUE(rotated_icon);
+  EXPECT_NE(rotated_icon, upright_icon);
+  EXPECT_NE(rotated_icon, upside_down_icon);
+  EXPECT_EQ(rotated_icon,
+            icon_cache_.GetIcon("arrow.png", 16, 16,
+                                Gdk::PixbufRotation::PIXBUF_ROTATE_CLOCKWISE));
+  EXPECT_THAT(decoded_paths_, ElementsAre("arrow.png"));
+}
+
+TEST_F(IconCacheTest, RemembersIconsThatFailedToDecode) {
+  EXPECT_FALSE(icon_cache_.GetIcon("missing.png", 16, 16,
+                                   Gdk::PixbufRotation::PIXBUF_ROTATE_NONE));
+  EXPECT_FALSE(icon_cache_.GetIcon("missing.png", 16, 16,
+                                   Gdk::PixbufRotation::PIXBUF_ROTATE_NONE));
+  EXPECT_FALSE(icon_cache_.GetIcon(
+      "missing.png", 16, 16, Gdk::PixbufRotation::PIXBUF_ROTATE_CLOCKWISE));
+
+  EXPECT_THAT(decoded_paths_, ElementsAre("missing.png"));
+}
+
+}  // namespace
@@ -0,0 +1,231 @@
+#include "listing_filter.hpp"
+
+#include <absl/strings/ascii.h>
+#include <glibmm/ustring.h>
+#include <limits.h>
+#include <string.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "filesystem.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// How far ahead of the file being matched names are asked to be loaded into
+// the cache.
+constexpr size_t kPrefetchedFileCount = 8;
+
+char FoldCase(char c) { return absl::ascii_tolower(static_cast<uint8_t>(c)); }
+
+bool IsASCII(std::string_view text) {
+  // Without an early return, the loop is vectorized.
+  uint8_t bits = 0;
+  for (char c : text) bits |= static_cast<uint8_t>(c);
+  return bits < 0x80;
+}
+
+// Case folds text as UTF-8, the way GLib compares strings ignoring case.
+// Text that is not valid UTF-8 only has its ASCII letters folded.
+std::string FoldUTF8(std::string_view text) {
+  Glib::ustring unicode_text(text.data(), text.size());
+  if (!unicode_text.validate()) {
+    std::string folded(text);
+    for (char &c : folded) c = FoldCase(c);
+    return folded;
+  }
+  return unicode_text.casefold();
+}
+
+// Whether a name contains a query, folding only its ASCII letters. A name that
+// does not, but holds other characters, may still contain the query once
+// those are folded too.
+enum class ASCIIMatch { kFound, kNotFound, kNotASCII };
+
+ASCIIMatch GetNotFound(std::string_view name) {
+  return IsASCII(name) ? ASCIIMatch::kNotFound : ASCIIMatch::kNotASCII;
+}
+
+// Looks for folded_query, which is not empty, in name one byte at a time.
+ASCIIMatch ContainsASCIIScalar(std::string_view name,
+                               std::string_view folded_query) {
+  for (size_t i = 0; i + folded_query.size() <= name.size(); i++) {
+    size_t j = 0;
+    while (j < folded_query.size() && FoldCase(name[i + j]) == folded_query[j])
+      j++;
+    if (j == folded_query.size()) return ASCIIMatch::kFound;
+  }
+  return GetNotFound(name);
+}
+
+#if defined(__x86_64__)
+
+// SSE2 is part of x86-64, so this needs no check.
+__m128i FoldCaseSSE2(__m128i bytes) {
+  // Bytes of 0x80 and up are negative, and so never taken for letters.
+  const __m128i is_upper =
+      _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('A' - 1)),
+                    _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), bytes));
+  return _mm_or_si128(bytes, _mm_and_si128(is_upper, _mm_set1_epi8(0x20)));
+}
+
+// Same as ContainsASCIIScalar(), for a name followed by readable memory up to
+// readable_end. Only compares the whole query where a vector of the name and
+// another one query length - 1 bytes further hold its first and last
+// character at the same offset. Bytes of other characters are found along
+// the way, from the sign bits of the first vector.
+ASCIIMatch ContainsASCII(std::string_view name, const char *readable_end,
+                         std::string_view folded_query) {
+  if (folded_query.size() > name.size()) return GetNotFound(name);
+
+  // Loads reach up to 15 bytes past the end of the name.
+  char buffer[PATH_MAX + 16];
+  const char *bytes = name.data();
+  if (readable_end - bytes < static_cast<ptrdiff_t>(name.size() + 16)) {
+    if (name.size() > PATH_MAX)
+      return ContainsASCIIScalar(name, folded_query);
+    memset(buffer, 0, name.size() + 16);
+    memcpy(buffer, name.data(), name.size());
+    bytes = buffer;
+  }
+
+  const size_t last = folded_query.size() - 1;
+  const size_t start_count = name.size() - last;
+  const __m128i first_character = _mm_set1_epi8(folded_query.front());
+  const __m128i last_character = _mm_set1_epi8(folded_query.back());
+  uint32_t non_ascii = 0;
+  for (size_t i = 0; i < name.size(); i += 16) {
+    const __m128i firsts =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i));
+    uint32_t high_bits = _mm_movemask_epi8(firsts);
+    if (name.size() - i < 16) high_bits &= (1u << (name.size() - i)) - 1;
+    non_ascii |= high_bits;
+    if (i >= start_count) continue;
+
+    const __m128i lasts = FoldCaseSSE2(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i + last)));
+    uint32_t found = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(FoldCaseSSE2(firsts), first_character),
+                      _mm_cmpeq_epi8(lasts, last_character)));
+    if (start_count - i < 16) found &= (1u << (start_count - i)) - 1;
+
+    for (; found != 0; found &= found - 1) {
+      const size_t start = i + __builtin_ctz(found);
+      size_t j = 1;
+      while (j < last && FoldCase(bytes[start + j]) == folded_query[j]) j++;
+      if (j >= last) return ASCIIMatch::kFound;
+    }
+  }
+  return non_ascii != 0 ? ASCIIMatch::kNotASCII : ASCIIMatch::kNotFound;
+}
+
+#else
+
+ASCIIMatch ContainsASCII(std::string_view name, const char * /*readable_end*/,
+                         std::string_view folded_query) {
+  if (folded_query.size() > name.size()) return GetNotFound(name);
+  return ContainsASCIIScalar(name, folded_query);
+}
+
+#endif
+
+}  // namespace
+
+bool ListingFilter::Matches(std::string_view name) const {
+  return Matches(name, name.data() + name.size());
+}
+
+void ListingFilter::SetListing(const DirectoryListing &files) {
+  matches_.clear();
+  MatchAll(files, matches_);
+}
+
+DirectoryListingDiff ListingFilter::SetQuery(const DirectoryListing &files,
+                                             std::string_view query) {
+  // Every name holding the new query holds the old one, if the old one is
+  // part of it.
+  const std::string old_folded_query = std::move(folded_query_);
+  query_ = query;
+  if (IsASCII(query_)) {
+    folded_query_ = query_;
+    for (char &c : folded_query_) c = FoldCase(c);
+  } else {
+    folded_query_ = FoldUTF8(query_);
+  }
+  // Some characters fold to ASCII ones, such as the Kelvin sign to "k".
+  is_ascii_query_ = IsASCII(folded_query_);
+  const bool is_narrowed =
+      folded_query_.find(old_folded_query) != std::string::npos;
+
+  std::vector<size_t> matches;
+  if (is_narrowed) {
+    const char *names_end = files.GetNamesEnd();
+    for (size_t i = 0; i < matches_.size(); i++) {
+      if (i + kPrefetchedFileCount < matches_.size()) {
+        __builtin_prefetch(
+            files[matches_[i + kPrefetchedFileCount]].GetName().data());
+      }
+      if (Matches(files[matches_[i]].GetName(), names_end))
+        matches.push_back(matches_[i]);
+    }
+  } else {
+    MatchAll(files, matches);
+  }
+
+  // Both sets of matches are in increasing order, so one pass tells them
+  // apart.
+  DirectoryListingDiff diff;
+  size_t old_index = 0;
+  size_t new_index = 0;
+  while (old_index < matches_.size() || new_index < matches.size()) {
+    if (new_index == matches.size() ||
+        (old_index < matches_.size() &&
+         matches_[old_index] < matches[new_index])) {
+      diff.removed_files.push_back(matches_[old_index++]);
+    } else if (old_index == matches_.size() ||
+               matches[new_index] < matches_[old_index]) {
+      diff.added_files.push_back(matches[new_index++]);
+    } else {
+      old_index++;
+      new_index++;
+    }
+  }
+  matches_ = std::move(matches);
+  return diff;
+}
+
+void ListingFilter::MatchAll(const DirectoryListing &files,
+                             std::vector<size_t> &matches) const {
+  const char *names_end = files.GetNamesEnd();
+  for (size_t i = 0; i < files.size(); i++) {
+    // Sorted listings have their names all over the buffer, so most names
+    // are not cached yet. Asking for the ones a few files ahead overlaps the
+    // waits.
+    if (i + kPrefetchedFileCount < files.size())
+      __builtin_prefetch(files[i + kPrefetchedFileCount].GetName().data());
+    if (Matches(files[i].GetName(), names_end)) matches.push_back(i);
+  }
+}
+
+bool ListingFilter::Matches(std::string_view name,
+                            const char *readable_end) const {
+  if (folded_query_.empty()) return true;
+  if (is_ascii_query_) {
+    const ASCIIMatch match = ContainsASCII(name, readable_end, folded_query_);
+    // Whatever matches with only ASCII letters folded also matches with every
+    // character folded, since the matched bytes are all ASCII. Names only
+    // holding ASCII fold to themselves.
+    if (match != ASCIIMatch::kNotASCII) return match == ASCIIMatch::kFound;
+  } else if (IsASCII(name)) {
+    return false;
+  }
+  return FoldUTF8(name).find(folded_query_) != std::string::npos;
+}
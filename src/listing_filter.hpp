@@ -0,0 +1,60 @@
+#ifndef LISTING_FILTER_HPP
+#define LISTING_FILTER_HPP
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "filesystem.hpp"
+
+// Narrows a directory listing down to the files whose name contains a query,
+// ignoring case, as the query is typed. Keeps the indices of the files that
+// matched the last query, so a query that only grew, as it does with every
+// keystroke, only looks at those again instead of at the whole listing.
+//
+// Names are scanned 16 bytes at a time with SSE2, looking for where both the
+// first and the last character of the query are at once, and only comparing
+// the rest of the query there. Only ASCII letters are folded on that path,
+// which is exact unless a name or the query holds other characters, in which
+// case both are folded as UTF-8 the way GLib does instead.
+class ListingFilter {
+ public:
+  const std::string &GetQuery() const { return query_; }
+
+  // Indices of the files that match the query in the listing last passed in,
+  // in increasing order.
+  const std::vector<size_t> &GetMatches() const { return matches_; }
+
+  // Whether name contains the query. Every name contains the empty query.
+  bool Matches(std::string_view name) const;
+
+  // Matches files against the query again, for a listing that replaced the
+  // one last passed in.
+  void SetListing(const DirectoryListing &files);
+
+  // Changes the query, returning the changes to make to a view showing the
+  // files that matched the old one so it only shows the ones that match the
+  // new one. files must be the listing last passed in, so both sets of
+  // indices are into it.
+  DirectoryListingDiff SetQuery(const DirectoryListing &files,
+                                std::string_view query);
+
+ private:
+  // Appends the index of every file of files matching the query.
+  void MatchAll(const DirectoryListing &files,
+                std::vector<size_t> &matches) const;
+  // Same as Matches(name), for a name followed by readable memory up to
+  // readable_end.
+  bool Matches(std::string_view name, const char *readable_end) const;
+
+  std::string query_;
+  // Query folded the way names are folded before looking for it.
+  std::string folded_query_;
+  // Whether folded_query_ only holds ASCII, so names can be matched folding
+  // only their ASCII letters.
+  bool is_ascii_query_ = true;
+  std::vector<size_t> matches_;
+};
+
+#endif  // LISTING_FILTER_HPP
@@ -0,0 +1,118 @@
+#include "listing_filter.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "filesystem.hpp"
+
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+DirectoryListing MakeListing(std::initializer_list<std::string> names) {
+  DirectoryListing files;
+  for (const std::string &name : names) files.Add(name, /*is_dir=*/false);
+  return files;
+}
+
+TEST(ListingFilterTest, MatchesNamesContainingQueryIgnoringCase) {
+  ListingFilter filter;
+  DirectoryListing files = MakeListing(
+      {"Makefile", "main.cpp", "README.md", "remake.sh", "mAKe", "mak"});
+  filter.SetListing(files);
+
+  filter.SetQuery(files, "MAKE");
+
+  EXPECT_THAT(filter.GetMatches(), ElementsAre(0, 3, 4));
+  EXPECT_EQ(filter.GetQuery(), "MAKE");
+  EXPECT_TRUE(filter.Matches("CMakeLists.txt"));
+  EXPECT_FALSE(filter.Matches("mak.e"));
+}
+
+TEST(ListingFilterTest, MatchesEveryFileForEmptyQuery) {
+  ListingFilter filter;
+  DirectoryListing files = MakeListing({"a", "b", "c"});
+
+  filter.SetListing(files);
+
+  EXPECT_THAT(filter.GetMatches(), ElementsAre(0, 1, 2));
+  EXPECT_TRUE(filter.Matches(""));
+}
+
+TEST(ListingFilterTest, FindsQueryAnywhereInLongNames) {
+  // Names longer than a vector, with the query across vector boundaries, and
+  // a last name that ends right at the end of the buffer of names.
+  const std::string padding(40, 'x');
+  DirectoryListing files = MakeListing(
+      {padding + "needle", "needle" + padding, padding.substr(0, 14) + "needle",
+       padding.substr(0, 15) + "needl", padding + "NeEdLe" + padding,
+       padding + "needle"});
+  ListingFilter filter;
+  filter.SetListing(files);
+
+  filter.SetQuery(files, "needle");
+
+  EXPECT_THAT(filter.GetMatches(), ElementsAre(0, 1, 2, 4, 5));
+}
+
+TEST(ListingFilterTest, LongerQueryOnlyRemovesFiles) {
+  ListingFilter filter;
+  DirectoryListing files = MakeListing({"cat", "cart", "dog", "scatter"});
+  filter.SetListing(files);
+  filter.SetQuery(files, "ca");
+
+  DirectoryListingDiff diff = filter.SetQuery(files, "cat");
+
+  EXPECT_THAT(diff.removed_files, ElementsAre(1));
+  EXPECT_THAT(diff.added_files, IsEmpty());
+  EXPECT_THAT(filter.GetMatches(), ElementsAre(0, 3));
+}
+
+TEST(ListingFilterTest, ShorterOrOtherQueryAddsFilesBack) {
+  ListingFilter filter;
+  DirectoryListing files = MakeListing({"cat", "cart", "dog", "scatter"});
+  filter.SetListing(files);
+  filter.SetQuery(files, "cat");
+
+  DirectoryListingDiff diff = filter.SetQuery(files, "c");
+
+  EXPECT_THAT(diff.removed_files, IsEmpty());
+  EXPECT_THAT(diff.added_files, ElementsAre(1));
+
+  diff = filter.SetQuery(files, "o");
+
+  EXPECT_THAT(diff.removed_files, ElementsAre(0, 1, 3));
+  EXPECT_THAT(diff.added_files, ElementsAre(2));
+}
+
+TEST(ListingFilterTest, KeepsQueryForNewListing) {
+  ListingFilter filter;
+  DirectoryListing files = MakeListing({"cat", "dog"});
+  filter.SetListing(files);
+  filter.SetQuery(files, "DOG");
+
+  files = MakeListing({"bulldog", "cat", "dog", "hotdog"});
+  filter.SetListing(files);
+
+  EXPECT_THAT(filter.GetMatches(), ElementsAre(0, 2, 3));
+}
+
+TEST(ListingFilterTest, FoldsCaseOfOtherCharactersAsUTF8) {
+  ListingFilter filter;
+  DirectoryListing files =
+      MakeListing({"ÉCOLE.txt", "école", "ecole", "Straße", "strasse"});
+  filter.SetListing(files);
+
+  filter.SetQuery(files, "éco");
+  EXPECT_THAT(filter.GetMatches(), ElementsAre(0, 1));
+
+  filter.SetQuery(files, "STRASSE");
+  EXPECT_THAT(filter.GetMatches(), ElementsAre(3, 4));
+}
+
+}  // namespace
@@ -0,0 +1,420 @@
+#include "listing_sorter.hpp"
+
+#include <absl/strings/ascii.h>
+#include <absl/time/time.h>
+#include <absl/types/span.h>
+#include <glib.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "filesystem.hpp"
+
+namespace {
+
+// Bits of the keys sorted by in each pass of RadixSort(). Covers 64-bit keys
+// in 6 passes, while the counters of a pass still fit in the L1 cache.
+constexpr int kRadixBits = 11;
+constexpr int kRadixPassCount = (64 + kRadixBits - 1) / kRadixBits;
+constexpr uint64_t kRadixBucketCount = uint64_t{1} << kRadixBits;
+
+struct KeyedFile {
+  uint64_t key;
+  uint32_t index;
+};
+
+uint64_t GetDigit(uint64_t key, int pass) {
+  return (key >> (pass * kRadixBits)) & (kRadixBucketCount - 1);
+}
+
+using DigitCounts = std::array<uint32_t, kRadixBucketCount>;
+
+// Counts how many of files have each value of every digit at once, which
+// takes a single pass over the keys instead of one per digit.
+void CountDigits(absl::Span<const KeyedFile> files,
+                 std::vector<DigitCounts> &counts) {
+  for (const KeyedFile &file : files) {
+    for (int pass = 0; pass < kRadixPassCount; pass++)
+      counts[pass][GetDigit(file.key, pass)]++;
+  }
+}
+
+// Turns the counts of the digit of pass into the position of the first file
+// with each value. Returns false if all file_count files, any_key among them,
+// share the digit, such as the high ones of sizes, since the pass would leave
+// the order as it is.
+bool StartPass(DigitCounts &counts, uint64_t any_key, int pass,
+               size_t file_count) {
+  if (counts[GetDigit(any_key, pass)] == file_count) return false;
+
+  uint32_t position = 0;
+  for (uint32_t &count : counts) {
+    const uint32_t bucket_size = count;
+    count = position;
+    position += bucket_size;
+  }
+  return true;
+}
+
+// Moves files to their position in sorted for pass, in order, so files with
+// the same digit stay in the order they are in.
+void ScatterFiles(absl::Span<const KeyedFile> files, int pass,
+                  DigitCounts &positions, std::vector<KeyedFile> &sorted) {
+  for (const KeyedFile &file : files)
+    sorted[positions[GetDigit(file.key, pass)]++] = file;
+}
+
+// Stably sorts files by key, from the lowest digit to the highest.
+void RadixSort(std::vector<KeyedFile> &files) {
+  if (files.empty()) return;
+
+  std::vector<DigitCounts> counts(kRadixPassCount);
+  CountDigits(files, counts);
+  std::vector<KeyedFile> sorted(files.size());
+  for (int pass = 0; pass < kRadixPassCount; pass++) {
+    if (!StartPass(counts[pass], files[0].key, pass, files.size())) continue;
+    ScatterFiles(files, pass, counts[pass], sorted);
+    files.swap(sorted);
+  }
+}
+
+// First 8 bytes of key, in an integer that orders the same way strcmp()
+// orders keys.
+uint64_t GetKeyPrefix(std::string_view key) {
+  uint64_t prefix = 0;
+  for (size_t i = 0; i < sizeof(prefix); i++) {
+    prefix <<= 8;
+    if (i < key.size()) prefix |= static_cast<uint8_t>(key[i]);
+  }
+  return prefix;
+}
+
+// Key of name to compare with strcmp(). Names that are not valid UTF-8 are
+// compared as if their invalid bytes were replacement characters.
+std::string GetCollationKey(std::string_view name) {
+  gchar *key;
+  if (g_utf8_validate(name.data(), name.size(), nullptr)) {
+    key = g_utf8_collate_key_for_filename(name.data(), name.size());
+  } else {
+    gchar *valid_name = g_utf8_make_valid(name.data(), name.size());
+    key = g_utf8_collate_key_for_filename(valid_name, -1);
+    g_free(valid_name);
+  }
+  std::string result(key);
+  g_free(key);
+  return result;
+}
+
+std::string_view GetExtension(std::string_view name) {
+  // Names such as ".bashrc" are hidden files without an extension.
+  const size_t dot = name.rfind('.');
+  if (dot == std::string_view::npos || dot == 0) return {};
+  return name.substr(dot + 1);
+}
+
+}  // namespace
+
+FileMetadataMask ListingSorter::GetRequiredMetadata(SortColumn column) {
+  switch (column) {
+    case SortColumn::kSize:
+      return kFileMetadataSize;
+    case SortColumn::kModificationTime:
+      return kFileMetadataModificationTime;
+    case SortColumn::kName:
+    case SortColumn::kType:
+      break;
+  }
+  return 0;
+}
+
+void ListingSorter::SetListing(const DirectoryListing &files) {
+  // Keys are mostly told apart by their first bytes, so those are radix
+  // sorted, and only files whose keys share them are compared in full.
+  std::string keys;
+  std::vector<size_t> key_offsets;
+  key_offsets.reserve(files.size() + 1);
+  std::vector<KeyedFile> files_by_name(files.size());
+  for (uint32_t i = 0; i < files.size(); i++) {
+    const std::string key = GetCollationKey(files[i].GetName());
+    key_offsets.push_back(keys.size());
+    keys += key;
+    files_by_name[i] = {GetKeyPrefix(key), i};
+  }
+  key_offsets.push_back(keys.size());
+  RadixSort(files_by_name);
+
+  auto get_key = [&](uint32_t index) {
+    return std::string_view(keys).substr(
+        key_offsets[index], key_offsets[index + 1] - key_offsets[index]);
+  };
+  // Files start out in the order of the bytes of their names, which breaks
+  // ties between different names with the same key.
+  for (size_t start = 0; start < files_by_name.size();) {
+    size_t end = start + 1;
+    while (end < files_by_name.size() &&
+           files_by_name[end].key == files_by_name[start].key)
+      end++;
+    if (end - start > 1) {
+      std::stable_sort(files_by_name.begin() + start,
+                       files_by_name.begin() + end,
+                       [&](const KeyedFile &a, const KeyedFile &b) {
+                         return get_key(a.index) < get_key(b.index);
+                       });
+    }
+    start = end;
+  }
+  name_ranks_.resize(files.size());
+  for (uint32_t rank = 0; rank < files_by_name.size(); rank++)
+    name_ranks_[files_by_name[rank].index] = rank;
+
+  // Directories get the first rank, and files without an extension the next,
+  // since the empty extension sorts first.
+  std::unordered_map<std::string, uint32_t> extension_ids;
+  std::vector<uint32_t> file_extension_ids(files.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    if (files[i].IsDirectory()) continue;
+    std::string extension(GetExtension(files[i].GetName()));
+    absl::AsciiStrToLower(&extension);
+    file_extension_ids[i] =
+        extension_ids.try_emplace(extension, extension_ids.size())
+            .first->second;
+  }
+  std::vector<const std::string *> extensions(extension_ids.size());
+  for (const auto &[extension, id] : extension_ids)
+    extensions[id] = &extension;
+  std::vector<uint32_t> extension_ids_by_rank(extensions.size());
+  for (uint32_t id = 0; id < extensions.size(); id++)
+    extension_ids_by_rank[id] = id;
+  std::sort(extension_ids_by_rank.begin(), extension_ids_by_rank.end(),
+            [&](uint32_t a, uint32_t b) {
+              return *extensions[a] < *extensions[b];
+            });
+  std::vector<uint32_t> extension_ranks(extensions.size());
+  for (uint32_t rank = 0; rank < extension_ids_by_rank.size(); rank++)
+    extension_ranks[extension_ids_by_rank[rank]] = rank;
+
+  type_ranks_.resize(files.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    type_ranks_[i] = files[i].IsDirectory()
+                         ? 0
+                         : 1 + extension_ranks[file_extension_ids[i]];
+  }
+}
+
+std::vector<uint32_t> ListingSorter::Sort(const DirectoryListing &files,
+                                          SortOrder order) const {
+  const size_t count = name_ranks_.size();
+  std::vector<uint32_t> sorted(count);
+  if (order.column == SortColumn::kName) {
+    for (uint32_t i = 0; i < count; i++) {
+      sorted[order.is_descending ? count - 1 - name_ranks_[i]
+                                 : name_ranks_[i]] = i;
+    }
+    return sorted;
+  }
+
+  // Laid out by name to begin with, so files with the same key stay in that
+  // order.
+  std::vector<KeyedFile> keyed_files(count);
+  for (uint32_t i = 0; i < count; i++)
+    keyed_files[name_ranks_[i]] = {GetSortKey(files, i, order), i};
+  RadixSort(keyed_files);
+  for (size_t position = 0; position < count; position++)
+    sorted[position] = keyed_files[position].index;
+  return sorted;
+}
+
+std::vector<uint32_t> ListingSorter::SortFirst(
+    const DirectoryListing &files, absl::Span<const size_t> indices,
+    SortOrder order, size_t count) const {
+  struct RankedFile {
+    uint64_t key;
+    uint32_t name_rank;
+    uint32_t index;
+
+    // Same order as Sort(), which leaves ties in name order.
+    bool operator<(const RankedFile &other) const {
+      return key != other.key ? key < other.key : name_rank < other.name_rank;
+    }
+  };
+  const bool is_name_descending =
+      order.column == SortColumn::kName && order.is_descending;
+  std::vector<RankedFile> ranked_files(indices.size());
+  for (size_t i = 0; i < indices.size(); i++) {
+    const uint32_t index = indices[i];
+    const uint32_t name_rank = name_ranks_[index];
+    ranked_files[i] = {GetSortKey(files, index, order),
+                       is_name_descending ? ~name_rank : name_rank, index};
+  }
+
+  count = std::min(count, ranked_files.size());
+  std::nth_element(ranked_files.begin(), ranked_files.begin() + count,
+                   ranked_files.end());
+  std::sort(ranked_files.begin(), ranked_files.begin() + count);
+  std::vector<uint32_t> first(count);
+  for (size_t position = 0; position < count; position++)
+    first[position] = ranked_files[position].index;
+  return first;
+}
+
+struct ListingSorter::StepwiseSort::State {
+  enum class Phase { kKeying, kCounting, kScattering, kCollecting, kDone };
+
+  const ListingSorter *sorter;
+  const DirectoryListing *files;
+  SortOrder order;
+  Phase phase = Phase::kKeying;
+  // Position of the next file the current phase goes through.
+  size_t next_file = 0;
+  int pass = -1;
+  // Laid out by name to begin with, like in Sort().
+  std::vector<KeyedFile> keyed_files;
+  std::vector<KeyedFile> sorted;
+  std::vector<DigitCounts> counts;
+  std::vector<uint32_t> order_indices;
+
+  // Moves on to the next phase once every file went through this one.
+  void FinishPhase() {
+    next_file = 0;
+    switch (phase) {
+      case Phase::kKeying:
+        // Names are in order once every file was put at its rank.
+        if (order.column == SortColumn::kName) {
+          phase = Phase::kDone;
+        } else {
+          phase = Phase::kCounting;
+          counts.resize(kRadixPassCount);
+        }
+        break;
+      case Phase::kCounting:
+        sorted.resize(keyed_files.size());
+        StartNextPass();
+        break;
+      case Phase::kScattering:
+        keyed_files.swap(sorted);
+        StartNextPass();
+        break;
+      case Phase::kCollecting:
+      case Phase::kDone:
+        phase = Phase::kDone;
+        break;
+    }
+  }
+
+  void StartNextPass() {
+    while (++pass < kRadixPassCount && !keyed_files.empty()) {
+      if (StartPass(counts[pass], keyed_files[0].key, pass,
+                    keyed_files.size())) {
+        phase = Phase::kScattering;
+        return;
+      }
+    }
+    phase = Phase::kCollecting;
+    order_indices.resize(keyed_files.size());
+  }
+};
+
+ListingSorter::StepwiseSort::StepwiseSort(std::unique_ptr<State> state)
+    : state_(std::move(state)) {}
+ListingSorter::StepwiseSort::StepwiseSort(StepwiseSort &&other) = default;
+ListingSorter::StepwiseSort &ListingSorter::StepwiseSort::operator=(
+    StepwiseSort &&other) = default;
+ListingSorter::StepwiseSort::~StepwiseSort() = default;
+
+bool ListingSorter::StepwiseSort::Step(size_t step_size) {
+  State &state = *state_;
+  const std::vector<uint32_t> &name_ranks = state.sorter->name_ranks_;
+  const size_t count = name_ranks.size();
+  const bool is_descending = state.order.is_descending;
+  size_t steps_left = std::max<size_t>(step_size, 1);
+  while (steps_left > 0 && state.phase != State::Phase::kDone) {
+    const size_t begin = state.next_file;
+    const size_t end = std::min(count, begin + steps_left);
+    switch (state.phase) {
+      case State::Phase::kKeying:
+        for (uint32_t i = begin; i < end; i++) {
+          if (state.order.column == SortColumn::kName) {
+            state.order_indices[is_descending ? count - 1 - name_ranks[i]
+                                              : name_ranks[i]] = i;
+          } else {
+            state.keyed_files[name_ranks[i]] = {
+                state.sorter->GetSortKey(*state.files, i, state.order), i};
+          }
+        }
+        break;
+      case State::Phase::kCounting:
+        CountDigits(
+            absl::MakeConstSpan(&state.keyed_files[begin], end - begin),
+            state.counts);
+        break;
+      case State::Phase::kScattering:
+        ScatterFiles(
+            absl::MakeConstSpan(&state.keyed_files[begin], end - begin),
+            state.pass, state.counts[state.pass], state.sorted);
+        break;
+      case State::Phase::kCollecting:
+        for (size_t position = begin; position < end; position++)
+          state.order_indices[position] = state.keyed_files[position].index;
+        break;
+      case State::Phase::kDone:
+        break;
+    }
+    steps_left -= end - begin;
+    state.next_file = end;
+    if (end == count) state.FinishPhase();
+  }
+  return state.phase != State::Phase::kDone;
+}
+
+std::vector<uint32_t> ListingSorter::StepwiseSort::TakeOrder() {
+  return std::move(state_->order_indices);
+}
+
+ListingSorter::StepwiseSort ListingSorter::StartSort(
+    const DirectoryListing &files, SortOrder order) const {
+  auto state = std::make_unique<StepwiseSort::State>();
+  state->sorter = this;
+  state->files = &files;
+  state->order = order;
+  if (order.column == SortColumn::kName)
+    state->order_indices.resize(name_ranks_.size());
+  else
+    state->keyed_files.resize(name_ranks_.size());
+  return StepwiseSort(std::move(state));
+}
+
+size_t ListingSorter::GetMemoryUsage() const {
+  return (name_ranks_.capacity() + type_ranks_.capacity()) * sizeof(uint32_t);
+}
+
+uint64_t ListingSorter::GetSortKey(const DirectoryListing &files,
+                                   uint32_t index, SortOrder order) const {
+  uint64_t key = 0;
+  switch (order.column) {
+    case SortColumn::kName:
+      return 0;
+    case SortColumn::kSize:
+      key = files[index].GetMetadata().size;
+      break;
+    case SortColumn::kModificationTime:
+      // Flipping the sign bit orders times before 1970 first.
+      key = static_cast<uint64_t>(absl::ToUnixNanos(
+                files[index].GetMetadata().modification_time)) ^
+            (uint64_t{1} << 63);
+      break;
+    case SortColumn::kType:
+      key = type_ranks_[index];
+      break;
+  }
+  // Flipping every bit reverses the order of keys, but not the order of
+  // ties.
+  return order.is_descending ? ~key : key;
+}
@@ -0,0 +1,105 @@
+#ifndef LISTING_SORTER_HPP
+#define LISTING_SORTER_HPP
+
+#include <absl/types/span.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "filesystem.hpp"
+
+// What files can be sorted by.
+enum class SortColumn {
+  // Names in the order of the user's locale, with numbers in them compared by
+  // their value, so "file2" comes before "file10".
+  kName,
+  kSize,
+  kModificationTime,
+  // Directories, then files without an extension, then files grouped by
+  // their extension, ignoring the case of its ASCII letters.
+  kType,
+};
+
+struct SortOrder {
+  SortColumn column = SortColumn::kName;
+  bool is_descending = false;
+
+  bool operator==(const SortOrder &other) const {
+    return column == other.column && is_descending == other.is_descending;
+  }
+  bool operator!=(const SortOrder &other) const { return !(*this == other); }
+};
+
+// Sorts a directory listing by any column, as often as the user picks another
+// one. Whatever only depends on the files, above all the collation keys of
+// their names, is worked out once per listing and kept as a rank per file,
+// which is what makes the sorts themselves cheap.
+//
+// Sorting packs each file's key for the column into 64 bits and radix sorts
+// those 11 bits at a time, skipping digits every key has the same value of,
+// instead of comparing names or metadata. Ties are broken by name, in
+// ascending order whatever the direction.
+class ListingSorter {
+ public:
+  // Metadata files must have filled in to be sorted by column. Files missing
+  // it are sorted as if it was zero.
+  static FileMetadataMask GetRequiredMetadata(SortColumn column);
+
+  // Ranks files by name and type. Collation keys take about a microsecond per
+  // file, so large listings are better passed in off the main loop.
+  void SetListing(const DirectoryListing &files);
+
+  // Indices of files in order. files must be the listing last passed in,
+  // though its metadata may have been filled in since.
+  std::vector<uint32_t> Sort(const DirectoryListing &files,
+                             SortOrder order) const;
+  // The first count of indices, which index files, in the order Sort() puts
+  // them in. Only sorts those, after picking them out in linear time, so
+  // the start of a huge listing can be shown before the rest is sorted.
+  std::vector<uint32_t> SortFirst(const DirectoryListing &files,
+                                  absl::Span<const size_t> indices,
+                                  SortOrder order, size_t count) const;
+
+  // Sorts files into the order Sort() puts them in, a step at a time, so the
+  // main loop can sort a huge listing without stalling on it. Neither files
+  // nor the sorter may change until it is done.
+  class StepwiseSort {
+   public:
+    StepwiseSort(StepwiseSort &&other);
+    StepwiseSort &operator=(StepwiseSort &&other);
+    ~StepwiseSort();
+
+    // Does about step_size files' worth of the sort, which takes a few
+    // passes over every file. Returns whether any of it is left.
+    bool Step(size_t step_size);
+    // Indices of files in order, once no step is left.
+    std::vector<uint32_t> TakeOrder();
+
+   private:
+    friend class ListingSorter;
+    struct State;
+
+    explicit StepwiseSort(std::unique_ptr<State> state);
+
+    std::unique_ptr<State> state_;
+  };
+  StepwiseSort StartSort(const DirectoryListing &files, SortOrder order) const;
+
+  // Bytes of heap memory held by the sorter.
+  size_t GetMemoryUsage() const;
+
+ private:
+  // Key files[index] is ordered by before its name, with the bits flipped if
+  // order is descending. Zero for every file when sorting by name.
+  uint64_t GetSortKey(const DirectoryListing &files, uint32_t index,
+                      SortOrder order) const;
+
+  // Position of each file of the listing once sorted by name.
+  std::vector<uint32_t> name_ranks_;
+  // Position of each file's type among the types of the listing, sorted.
+  std::vector<uint32_t> type_ranks_;
+};
+
+#endif  // LISTING_SORTER_HPP
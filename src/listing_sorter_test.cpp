@@ -0,0 +1,201 @@
+#include "listing_sorter.hpp"
+
+#include <absl/time/time.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "filesystem.hpp"
+
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+DirectoryListing MakeListing(std::initializer_list<std::string> names) {
+  DirectoryListing files;
+  for (const std::string &name : names) files.Add(name, /*is_dir=*/false);
+  files.SortByName();
+  return files;
+}
+
+void SetSize(DirectoryListing &files, size_t index, uint64_t size) {
+  FileMetadata metadata;
+  metadata.filled_fields = kFileMetadataSize;
+  metadata.size = size;
+  files.SetMetadata(index, metadata);
+}
+
+std::vector<std::string> GetNames(const DirectoryListing &files,
+                                  const std::vector<uint32_t> &order) {
+  std::vector<std::string> names;
+  for (uint32_t index : order) names.emplace_back(files[index].GetName());
+  return names;
+}
+
+TEST(ListingSorterTest, SortsNumbersInNamesByValue) {
+  DirectoryListing files =
+      MakeListing({"file10", "file2", "file1", "file20", "a", "b"});
+  ListingSorter sorter;
+  sorter.SetListing(files);
+
+  EXPECT_THAT(GetNames(files, sorter.Sort(files, {SortColumn::kName})),
+              ElementsAre("a", "b", "file1", "file2", "file10", "file20"));
+  EXPECT_THAT(GetNames(files, sorter.Sort(files, {SortColumn::kName,
+                                                  /*is_descending=*/true})),
+              ElementsAre("file20", "file10", "file2", "file1", "b", "a"));
+}
+
+TEST(ListingSorterTest, SortsNamesThatAreNotUTF8) {
+  DirectoryListing files = MakeListing({"b\xff", "a\xfe", "c"});
+  ListingSorter sorter;
+  sorter.SetListing(files);
+
+  EXPECT_THAT(GetNames(files, sorter.Sort(files, {SortColumn::kName})),
+              ElementsAre("a\xfe", "b\xff", "c"));
+}
+
+TEST(ListingSorterTest, SortsBySizeWithTiesInNameOrder) {
+  DirectoryListing files = MakeListing({"a", "b", "c", "d"});
+  SetSize(files, 0, 300);
+  SetSize(files, 1, 5);
+  SetSize(files, 2, uint64_t{1} << 40);
+  SetSize(files, 3, 5);
+  ListingSorter sorter;
+  sorter.SetListing(files);
+
+  EXPECT_THAT(GetNames(files, sorter.Sort(files, {SortColumn::kSize})),
+              ElementsAre("b", "d", "a", "c"));
+  EXPECT_THAT(GetNames(files, sorter.Sort(files, {SortColumn::kSize,
+                                                  /*is_descending=*/true})),
+              ElementsAre("c", "a", "b", "d"));
+}
+
+TEST(ListingSorterTest, SortsByModificationTimeBeforeAndAfter1970) {
+  DirectoryListing files = MakeListing({"new", "old", "older"});
+  const absl::Time times[] = {absl::FromUnixSeconds(1700000000),
+                              absl::FromUnixSeconds(-5),
+                              absl::FromUnixSeconds(-1000000000)};
+  for (size_t i = 0; i < files.size(); i++) {
+    FileMetadata metadata;
+    metadata.filled_fields = kFileMetadataModificationTime;
+    metadata.modification_time = times[files[i] == "new"  ? 0
+                                       : files[i] == "old" ? 1
+                                                           : 2];
+    files.SetMetadata(i, metadata);
+  }
+  ListingSorter sorter;
+  sorter.SetListing(files);
+
+  EXPECT_THAT(
+      GetNames(files, sorter.Sort(files, {SortColumn::kModificationTime})),
+      ElementsAre("older", "old", "new"));
+}
+
+TEST(ListingSorterTest, SortsDirectoriesFirstThenByExtension) {
+  DirectoryListing files;
+  files.Add("zeta", /*is_dir=*/true);
+  files.Add("b.txt", /*is_dir=*/false);
+  files.Add("a.TXT", /*is_dir=*/false);
+  files.Add("c.jpg", /*is_dir=*/false);
+  files.Add("Makefile", /*is_dir=*/false);
+  files.Add(".bashrc", /*is_dir=*/false);
+  files.SortByName();
+  ListingSorter sorter;
+  sorter.SetListing(files);
+
+  EXPECT_THAT(GetNames(files, sorter.Sort(files, {SortColumn::kType})),
+              ElementsAre("zeta", ".bashrc", "Makefile", "c.jpg", "a.TXT",
+                          "b.txt"));
+  EXPECT_THAT(GetNames(files, sorter.Sort(files, {SortColumn::kType,
+                                                  /*is_descending=*/true})),
+              ElementsAre("a.TXT", "b.txt", "c.jpg", ".bashrc", "Makefile",
+                          "zeta"));
+}
+
+TEST(ListingSorterTest, SortsManyFilesLikeStableSort) {
+  // Sizes spread over many radix digits, with plenty of ties.
+  std::mt19937_64 random(7);
+  DirectoryListing files;
+  for (int i = 0; i < 5000; i++) files.Add("f" + std::to_string(i), false);
+  files.SortByName();
+  std::vector<uint64_t> sizes(files.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    sizes[i] = random() >> (random() % 64);
+    if (i % 3 == 0) sizes[i] = 42;
+    SetSize(files, i, sizes[i]);
+  }
+  ListingSorter sorter;
+  sorter.SetListing(files);
+
+  std::vector<uint32_t> expected = sorter.Sort(files, {SortColumn::kName});
+  std::stable_sort(expected.begin(), expected.end(),
+                   [&](uint32_t a, uint32_t b) { return sizes[a] > sizes[b]; });
+
+  EXPECT_EQ(sorter.Sort(files, {SortColumn::kSize, /*is_descending=*/true}),
+            expected);
+}
+
+TEST(ListingSorterTest, SortsFirstFilesLikeWholeSort) {
+  std::mt19937_64 random(11);
+  DirectoryListing files;
+  for (int i = 0; i < 3000; i++) files.Add("f" + std::to_string(i), false);
+  files.SortByName();
+  for (size_t i = 0; i < files.size(); i++) SetSize(files, i, random() % 50);
+  ListingSorter sorter;
+  sorter.SetListing(files);
+  // Only every third file, as if the rest were filtered out.
+  std::vector<size_t> indices;
+  for (size_t i = 0; i < files.size(); i += 3) indices.push_back(i);
+
+  for (SortOrder order : {SortOrder{SortColumn::kSize, false},
+                          SortOrder{SortColumn::kSize, true},
+                          SortOrder{SortColumn::kName, true}}) {
+    std::vector<uint32_t> expected;
+    for (uint32_t index : sorter.Sort(files, order)) {
+      if (index % 3 == 0 && expected.size() < 100) expected.push_back(index);
+    }
+
+    EXPECT_EQ(sorter.SortFirst(files, indices, order, 100), expected);
+  }
+  EXPECT_EQ(sorter.SortFirst(files, indices, {}, 5000).size(), 1000);
+}
+
+TEST(ListingSorterTest, SortsStepByStepLikeWholeSort) {
+  std::mt19937_64 random(13);
+  DirectoryListing files;
+  for (int i = 0; i < 3000; i++) files.Add("f" + std::to_string(i), false);
+  files.SortByName();
+  for (size_t i = 0; i < files.size(); i++)
+    SetSize(files, i, random() >> (random() % 64));
+  ListingSorter sorter;
+  sorter.SetListing(files);
+
+  for (SortOrder order : {SortOrder{SortColumn::kSize, false},
+                          SortOrder{SortColumn::kSize, true},
+                          SortOrder{SortColumn::kName, true},
+                          SortOrder{SortColumn::kType, false}}) {
+    ListingSorter::StepwiseSort sort = sorter.StartSort(files, order);
+    int step_count = 0;
+    while (sort.Step(700)) step_count++;
+
+    EXPECT_GT(step_count, 1);
+    EXPECT_EQ(sort.TakeOrder(), sorter.Sort(files, order));
+  }
+
+  DirectoryListing empty_files;
+  ListingSorter empty_sorter;
+  empty_sorter.SetListing(empty_files);
+  ListingSorter::StepwiseSort empty_sort =
+      empty_sorter.StartSort(empty_files, {SortColumn::kSize});
+  EXPECT_FALSE(empty_sort.Step(700));
+  EXPECT_THAT(empty_sort.TakeOrder(), IsEmpty());
+}
+
+}  // namespace
@@ -0,0 +1,56 @@
+#ifndef TEMP_DIRECTORY_TEST_HPP
+#define TEMP_DIRECTORY_TEST_HPP
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+// Fixture for tests on real files. Creates a directory under the test
+// temporary directory before each test, and removes it along with everything
+// left inside it afterwards.
+class TempDirectoryTest : public ::testing::Test {
+ protected:
+  ~TempDirectoryTest() override {
+    std::error_code error;
+    if (!root_.empty()) std::filesystem::remove_all(root_, error);
+  }
+
+  void SetUp() override {
+    std::string path_template = ::testing::TempDir() + "e7fmgr_XXXXXX";
+    const char* root = mkdtemp(path_template.data());
+    ASSERT_NE(root, nullptr) << "mkdtemp(): " << strerror(errno);
+    root_ = root;
+  }
+
+  // Returns the path of name below root_, without creating anything.
+  std::string GetPath(const std::string& name) const {
+    return root_ + "/" + name;
+  }
+
+  std::string CreateFile(const std::string& name,
+                         const std::string& contents = "a",
+                         mode_t mode = 0644) {
+    const std::string path = GetPath(name);
+    std::ofstream(path) << contents;
+    chmod(path.c_str(), mode);
+    return path;
+  }
+
+  // The mode is set with chmod() afterwards, so the umask does not apply.
+  std::string CreateDirectory(const std::string& name, mode_t mode = 0755) {
+    const std::string path = GetPath(name);
+    mkdir(path.c_str(), 0700);
+    chmod(path.c_str(), mode);
+    return path;
+  }
+
+  std::string root_;
+};
+
+#endif  // TEMP_DIRECTORY_TEST_HPP
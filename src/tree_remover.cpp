@@ -0,0 +1,236 @@
+#include "tree_remover.hpp"
+
+#include <absl/status/status.h>
+#include <absl/strings/str_cat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glibmm/ustring.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "file_copier.hpp"
+
+namespace {
+
+// Size of the buffer each thread reads directory entries into with
+// getdents64(). The files of each buffer are removed before the next is read.
+constexpr size_t kDirectoryReadBufferSize = 64 * 1024;
+
+}  // namespace
+
+// State of one call to Remove(), shared by its threads.
+class TreeRemover::RemoveState {
+ public:
+  RemoveState(size_t thread_count, const ProgressCallback &on_progress)
+      : thread_count_(std::max<size_t>(thread_count, 1)),
+        on_progress_(on_progress) {}
+
+  absl::Status Run(const Glib::ustring &path) {
+    std::string full_path = path;
+    while (full_path.size() > 1 && full_path.back() == '/')
+      full_path.pop_back();
+    const size_t name_start = full_path.rfind('/') + 1;
+    if (name_start == 0 || name_start == full_path.size())
+      return absl::InvalidArgumentError(
+          absl::StrCat("Only full paths below / can be removed: ", path));
+
+    parent_.fd = open(full_path.substr(0, name_start).c_str(),
+                      O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (parent_.fd == -1) return MakeFileError("open()", errno);
+    auto root = std::make_unique<Directory>();
+    root->parent = &parent_;
+    root->name = full_path.substr(name_start);
+
+    struct stat info;
+    if (fstatat(parent_.fd, root->name.c_str(), &info, AT_SYMLINK_NOFOLLOW) ==
+        -1) {
+      close(parent_.fd);
+      return MakeFileError("fstatat()", errno);
+    }
+    if (!S_ISDIR(info.st_mode)) {
+      const int result = unlinkat(parent_.fd, root->name.c_str(), 0);
+      const int error = errno;
+      close(parent_.fd);
+      if (result == -1) return MakeFileError("unlinkat()", error);
+      ReportRemoved(1);
+      return absl::OkStatus();
+    }
+
+    to_list_.push_back(root.release());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < thread_count_; i++)
+      threads.emplace_back(&RemoveState::RunThread, this);
+    RunThread();
+    for (std::thread &thread : threads) thread.join();
+    close(parent_.fd);
+
+    if (!status_.ok()) return status_;
+    if (is_cancelled_) return absl::CancelledError("Removal was cancelled!");
+    return absl::OkStatus();
+  }
+
+ private:
+  struct Directory {
+    // Holds this directory, and stays open until it is removed.
+    Directory *parent = nullptr;
+    std::string name;
+    // Open once listed, until removed.
+    int fd = -1;
+    // Subdirectories not removed yet, plus one until this directory was
+    // listed. Removed once it drops to zero.
+    std::atomic<size_t> pending_count = 1;
+  };
+
+  void RunThread() {
+    std::vector<char> entries(kDirectoryReadBufferSize);
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      changed_.wait(lock, [this]() { return !to_list_.empty() || is_done_; });
+      if (to_list_.empty()) return;
+      Directory *directory = to_list_.back();
+      to_list_.pop_back();
+      lock.unlock();
+
+      // Directories left once stopped are only let go of.
+      std::vector<std::unique_ptr<Directory>> subdirectories;
+      if (!is_stopped_) {
+        absl::Status status = List(*directory, entries, subdirectories);
+        if (!status.ok()) Fail(std::move(status));
+      }
+
+      lock.lock();
+      if (!is_stopped_ && !subdirectories.empty()) {
+        directory->pending_count += subdirectories.size();
+        for (std::unique_ptr<Directory> &subdirectory : subdirectories)
+          to_list_.push_back(subdirectory.release());
+        changed_.notify_all();
+      }
+      lock.unlock();
+      Release(directory);
+      lock.lock();
+    }
+  }
+
+  // Opens directory, removes every file in it, and hands back its
+  // subdirectories.
+  absl::Status List(Directory &directory, std::vector<char> &entries,
+                    std::vector<std::unique_ptr<Directory>> &subdirectories) {
+    directory.fd =
+        openat(directory.parent->fd, directory.name.c_str(),
+               O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (directory.fd == -1) return MakeFileError("openat()", errno);
+
+    while (!is_stopped_) {
+      const ssize_t bytes_read =
+          getdents64(directory.fd, entries.data(), entries.size());
+      if (bytes_read == -1) return MakeFileError("getdents64()", errno);
+      if (bytes_read == 0) break;
+
+      uint64_t removed_count = 0;
+      for (ssize_t offset = 0; offset < bytes_read;) {
+        const auto *entry =
+            reinterpret_cast<const dirent64 *>(&entries[offset]);
+        offset += entry->d_reclen;
+        const std::string_view name = entry->d_name;
+        if (name == "." || name == "..") continue;
+
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+          struct stat info;
+          if (fstatat(directory.fd, entry->d_name, &info,
+                      AT_SYMLINK_NOFOLLOW) == -1)
+            return MakeFileError("fstatat()", errno);
+          type = IFTODT(info.st_mode);
+        }
+        if (type == DT_DIR) {
+          auto subdirectory = std::make_unique<Directory>();
+          subdirectory->parent = &directory;
+          subdirectory->name = name;
+          subdirectories.push_back(std::move(subdirectory));
+          continue;
+        }
+        if (unlinkat(directory.fd, entry->d_name, 0) == -1)
+          return MakeFileError("unlinkat()", errno);
+        removed_count++;
+      }
+      ReportRemoved(removed_count);
+    }
+    return absl::OkStatus();
+  }
+
+  // Lets go of one thing directory waits for. Removes it once it has nothing
+  // left to wait for, which lets go of its parent in turn.
+  void Release(Directory *directory) {
+    while (directory != &parent_ && --directory->pending_count == 0) {
+      Directory *parent = directory->parent;
+      if (directory->fd != -1) close(directory->fd);
+      if (!is_stopped_) {
+        if (unlinkat(parent->fd, directory->name.c_str(), AT_REMOVEDIR) == -1)
+          Fail(MakeFileError("unlinkat()", errno));
+        else
+          ReportRemoved(1);
+      }
+      delete directory;
+      directory = parent;
+    }
+    if (directory != &parent_) return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_done_ = true;
+    changed_.notify_all();
+  }
+
+  void Fail(absl::Status status) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (status_.ok()) status_ = std::move(status);
+    is_stopped_ = true;
+  }
+
+  void ReportRemoved(uint64_t count) {
+    std::lock_guard<std::mutex> lock(progress_mutex_);
+    removed_count_ += count;
+    if (on_progress_ && !is_stopped_ && !on_progress_(removed_count_)) {
+      is_cancelled_ = true;
+      is_stopped_ = true;
+    }
+  }
+
+  const size_t thread_count_;
+  const ProgressCallback &on_progress_;
+  // Stands in for the parent of the root, which waits for the root alone.
+  Directory parent_;
+
+  std::mutex mutex_;
+  // Signals threads that directories were queued, or the removal is over.
+  std::condition_variable changed_;
+  // Directories waiting to be listed, newest last.
+  std::vector<Directory *> to_list_;
+  bool is_done_ = false;
+  absl::Status status_;
+  std::atomic<bool> is_stopped_ = false;
+
+  // Serializes calls to on_progress_.
+  std::mutex progress_mutex_;
+  uint64_t removed_count_ = 0;
+  std::atomic<bool> is_cancelled_ = false;
+};
+
+TreeRemover::TreeRemover(size_t thread_count) : thread_count_(thread_count) {}
+
+absl::Status TreeRemover::Remove(const Glib::ustring &path,
+                                 const ProgressCallback &on_progress) const {
+  return RemoveState(thread_count_, on_progress).Run(path);
+}
@@ -0,0 +1,46 @@
+#ifndef TREE_REMOVER_HPP
+#define TREE_REMOVER_HPP
+
+#include <absl/status/status.h>
+#include <glibmm/ustring.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// Removes whole trees of files. Every directory is opened relative to its
+// parent with openat(), and its entries are removed with unlinkat() relative to
+// it, so the kernel never resolves a full path past the root. Directories are
+// listed on several threads at once, each removing the files of the directory
+// it listed. A directory is removed by whichever thread finishes the last
+// subdirectory below it.
+//
+// Directories waiting to be listed are taken newest first, which works
+// through the tree mostly depth first. That keeps the number of directories
+// held open, those listed whose subdirectories are not all removed yet, close
+// to the depth of the tree times the thread count.
+//
+// Symbolic links are removed, never followed.
+class TreeRemover {
+ public:
+  // Called with the number of files and directories removed so far. Returning
+  // false stops the removal. Calls never overlap.
+  using ProgressCallback = std::function<bool(uint64_t removed_count)>;
+
+  // thread_count includes the thread calling Remove().
+  explicit TreeRemover(size_t thread_count);
+
+  // Removes the file or directory at path, which must be a full path, along
+  // with everything below it. Stops at the first error, leaving whatever was
+  // not removed yet in place, and returns it. Returns an absl::CancelledError
+  // if on_progress stopped it.
+  absl::Status Remove(const Glib::ustring &path,
+                      const ProgressCallback &on_progress = nullptr) const;
+
+ private:
+  class RemoveState;
+
+  size_t thread_count_;
+};
+
+#endif  // TREE_REMOVER_HPP
@@ -0,0 +1,133 @@
+#include "tree_remover.hpp"
+
+#include <absl/status/status.h>
+#include <dirent.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "temp_directory_test.hpp"
+
+namespace {
+
+// Removes trees of real files.
+class TreeRemoverTest : public TempDirectoryTest {
+ protected:
+  // Creates tree/ with width directories, each holding width files and one
+  // more level of the same, down to depth levels. Returns the number of files
+  // and directories created, tree/ included.
+  uint64_t CreateTree(const std::string& path, int width, int depth) {
+    CreateDirectory(path);
+    uint64_t count = 1;
+    for (int i = 0; i < width; i++) CreateFile(path + "/f" + std::to_string(i));
+    count += width;
+    if (depth == 0) return count;
+    for (int i = 0; i < width; i++)
+      count += CreateTree(path + "/d" + std::to_string(i), width, depth - 1);
+    return count;
+  }
+
+  bool Exists(const std::string& path) {
+    struct stat info;
+    return lstat(GetPath(path).c_str(), &info) == 0;
+  }
+
+  static int CountOpenFiles() {
+    int count = 0;
+    DIR* directory = opendir("/proc/self/fd");
+    while (readdir(directory) != nullptr) count++;
+    closedir(directory);
+    return count;
+  }
+
+};
+
+TEST_F(TreeRemoverTest, RemovesTreeAndReportsEverythingRemoved) {
+  const uint64_t count = CreateTree("tree", /*width=*/4, /*depth=*/3);
+  CreateFile("kept");
+  const int open_file_count = CountOpenFiles();
+  std::vector<uint64_t> progress;
+
+  absl::Status status =
+      TreeRemover(/*thread_count=*/4)
+          .Remove(GetPath("tree/"), [&progress](uint64_t removed_count) {
+            progress.push_back(removed_count);
+            return true;
+          });
+
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_FALSE(Exists("tree"));
+  EXPECT_TRUE(Exists("kept"));
+  ASSERT_FALSE(progress.empty());
+  EXPECT_TRUE(std::is_sorted(progress.begin(), progress.end()));
+  EXPECT_EQ(progress.back(), count);
+  EXPECT_EQ(CountOpenFiles(), open_file_count);
+}
+
+TEST_F(TreeRemoverTest, RemovesSingleFilesAndEmptyDirectories) {
+  CreateFile("file");
+  CreateDirectory("empty");
+  TreeRemover remover(/*thread_count=*/2);
+
+  EXPECT_TRUE(remover.Remove(GetPath("file")).ok());
+  EXPECT_TRUE(remover.Remove(GetPath("empty")).ok());
+
+  EXPECT_FALSE(Exists("file"));
+  EXPECT_FALSE(Exists("empty"));
+}
+
+TEST_F(TreeRemoverTest, RemovesSymbolicLinksWithoutFollowingThem) {
+  CreateDirectory("tree");
+  CreateDirectory("target");
+  CreateFile("target/file");
+  ASSERT_EQ(symlink(GetPath("target").c_str(), GetPath("tree/link").c_str()),
+            0);
+  ASSERT_EQ(symlink(GetPath("target").c_str(), GetPath("link").c_str()), 0);
+  TreeRemover remover(/*thread_count=*/2);
+
+  EXPECT_TRUE(remover.Remove(GetPath("tree")).ok());
+  EXPECT_TRUE(remover.Remove(GetPath("link")).ok());
+
+  EXPECT_FALSE(Exists("tree"));
+  EXPECT_FALSE(Exists("link"));
+  EXPECT_TRUE(Exists("target/file"));
+}
+
+TEST_F(TreeRemoverTest, StopsWhenProgressSaysSo) {
+  CreateTree("tree", /*width=*/4, /*depth=*/3);
+  const int open_file_count = CountOpenFiles();
+
+  absl::Status status = TreeRemover(/*thread_count=*/4)
+                            .Remove(GetPath("tree"),
+                                    [](uint64_t /*removed_count*/) {
+                                      return false;
+                                    });
+
+  EXPECT_EQ(status.code(), absl::StatusCode::kCancelled);
+  EXPECT_TRUE(Exists("tree"));
+  EXPECT_EQ(CountOpenFiles(), open_file_count);
+}
+
+TEST_F(TreeRemoverTest, ReturnsErrors) {
+  TreeRemover remover(/*thread_count=*/2);
+  EXPECT_EQ(remover.Remove(GetPath("missing")).code(),
+            absl::StatusCode::kNotFound);
+  EXPECT_EQ(remover.Remove("relative").code(),
+            absl::StatusCode::kInvalidArgument);
+
+  if (geteuid() == 0) GTEST_SKIP() << "Root can remove read-only files.";
+  CreateTree("tree", /*width=*/2, /*depth=*/1);
+  chmod(GetPath("tree/d1").c_str(), 0555);
+
+  EXPECT_EQ(remover.Remove(GetPath("tree")).code(),
+            absl::StatusCode::kPermissionDenied);
+  EXPECT_TRUE(Exists("tree/d1/f0"));
+  chmod(GetPath("tree/d1").c_str(), 0755);
+}
+
+}  // namespace
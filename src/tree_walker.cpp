@@ -0,0 +1,304 @@
+#include "tree_walker.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <glibmm/ustring.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// State of one call to Walk(), shared by its threads.
+class TreeWalker::WalkState {
+ public:
+  WalkState(const TreeWalker &walker, const Glib::ustring &root,
+            const DirectoryCallback &on_directory)
+      : file_system_(walker.file_system_),
+        options_(walker.options_),
+        root_(root),
+        on_directory_(on_directory),
+        queues_(std::max<size_t>(options_.thread_count, 1)) {
+    if (root_.empty() || root_.back() != '/') root_ += '/';
+  }
+
+  absl::StatusOr<Stats> Run() {
+    Item root = {"", 0, nullptr, std::nullopt};
+    if (options_.is_ordered) {
+      root_node_ = std::make_unique<Node>();
+      root.node = root_node_.get();
+      unhanded_nodes_.push_back(root.node);
+    }
+    queues_[0].items.push_back(std::move(root));
+    queued_count_ = 1;
+    unfinished_count_ = 1;
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < queues_.size(); i++)
+      threads.emplace_back(&WalkState::RunThread, this, i);
+    RunThread(0);
+    for (std::thread &thread : threads) thread.join();
+
+    if (IsCancelled()) return absl::CancelledError("Tree walk was cancelled!");
+    if (!root_status_.ok()) return root_status_;
+    return Stats{directory_count_, file_count_, skipped_directory_count_,
+                 stolen_directory_count_};
+  }
+
+ private:
+  // Directory of an ordered walk, kept until it and every directory below it
+  // were handed over.
+  struct Node {
+    // Set along with is_read, unless the directory could not be read.
+    std::optional<DirectoryListing> files;
+    std::string path;
+    size_t depth = 0;
+    bool is_read = false;
+    bool is_handed_over = false;
+    // Subdirectories being walked, in the order they were listed.
+    std::vector<std::unique_ptr<Node>> children;
+    size_t next_child = 0;
+  };
+
+  // Directory waiting to be read.
+  struct Item {
+    std::string path;
+    size_t depth;
+    // Only set for ordered walks.
+    Node *node;
+    // From get_known_files, to be handed over instead of reading the
+    // directory.
+    std::optional<DirectoryListing> known_files;
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Item> items;
+  };
+
+  bool IsCancelled() const {
+    return options_.is_cancelled != nullptr && *options_.is_cancelled;
+  }
+
+  void RunThread(size_t thread_index) {
+    while (!IsCancelled()) {
+      std::optional<Item> item = PopItem(thread_index);
+      if (!item.has_value()) item = StealItems(thread_index);
+      if (item.has_value()) {
+        ReadDirectory(std::move(*item), thread_index);
+        continue;
+      }
+
+      // Only registered as sleeping before checking for work again, so a
+      // thread queueing work either sees this one sleeping and wakes it, or
+      // its work is seen here.
+      std::unique_lock<std::mutex> lock(idle_mutex_);
+      sleeping_count_++;
+      work_queued_.wait(lock, [this]() {
+        return queued_count_ > 0 || unfinished_count_ == 0 || IsCancelled();
+      });
+      sleeping_count_--;
+      if (unfinished_count_ == 0) break;
+    }
+
+    // Threads still waiting have to find out about the end too, which does
+    // not queue anything.
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    work_queued_.notify_all();
+  }
+
+  std::optional<Item> PopItem(size_t thread_index) {
+    Queue &queue = queues_[thread_index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.items.empty()) return std::nullopt;
+
+    Item item = std::move(queue.items.back());
+    queue.items.pop_back();
+    queued_count_--;
+    return item;
+  }
+
+  // Moves the older half of the first other queue with anything in it to the
+  // queue of thread_index, and returns one of the directories moved.
+  std::optional<Item> StealItems(size_t thread_index) {
+    for (size_t i = 1; i < queues_.size(); i++) {
+      Queue &victim = queues_[(thread_index + i) % queues_.size()];
+      std::vector<Item> stolen_items;
+      {
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        const size_t stolen_count = (victim.items.size() + 1) / 2;
+        for (size_t j = 0; j < stolen_count; j++) {
+          stolen_items.push_back(std::move(victim.items.front()));
+          victim.items.pop_front();
+        }
+      }
+      if (stolen_items.empty()) continue;
+
+      stolen_directory_count_ += stolen_items.size();
+      queued_count_--;
+      Item item = std::move(stolen_items.front());
+      Queue &queue = queues_[thread_index];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      for (size_t j = stolen_items.size(); j-- > 1;)
+        queue.items.push_back(std::move(stolen_items[j]));
+      return item;
+    }
+    return std::nullopt;
+  }
+
+  void ReadDirectory(Item item, size_t thread_index) {
+    absl::StatusOr<DirectoryListing> files =
+        item.known_files.has_value()
+            ? *std::move(item.known_files)
+            : file_system_.GetDirectoryFiles(root_ + item.path);
+    if (!files.ok()) {
+      if (item.depth == 0) {
+        root_status_ = files.status();
+      } else {
+        skipped_directory_count_++;
+      }
+    } else {
+      if (options_.metadata_fields != 0) {
+        file_system_
+            .FillFileMetadata(root_ + item.path, *files,
+                              options_.metadata_fields)
+            .IgnoreError();
+      }
+      directory_count_++;
+      file_count_ += files->size();
+      QueueSubdirectories(item, *files, thread_index);
+    }
+
+    if (options_.is_ordered) {
+      std::lock_guard<std::mutex> lock(ordered_mutex_);
+      if (files.ok()) item.node->files = *std::move(files);
+      item.node->is_read = true;
+      HandOverReadNodes(thread_index);
+    } else if (files.ok()) {
+      on_directory_({item.path, item.depth, *files, thread_index});
+    }
+
+    if (--unfinished_count_ == 0) {
+      std::lock_guard<std::mutex> lock(idle_mutex_);
+      work_queued_.notify_all();
+    }
+  }
+
+  void QueueSubdirectories(const Item &item, const DirectoryListing &files,
+                           size_t thread_index) {
+    if (item.depth >= options_.max_depth) return;
+
+    std::vector<Item> subdirectories;
+    for (File file : files) {
+      if (!file.IsDirectory()) continue;
+
+      std::string path = item.path + std::string(file.GetName()) + '/';
+      if (options_.should_descend && !options_.should_descend(path, file))
+        continue;
+      Node *node = nullptr;
+      if (options_.is_ordered) {
+        item.node->children.push_back(std::make_unique<Node>());
+        node = item.node->children.back().get();
+        node->path = path;
+        node->depth = item.depth + 1;
+      }
+      std::optional<DirectoryListing> known_files;
+      if (options_.get_known_files)
+        known_files = options_.get_known_files(path, file);
+      subdirectories.push_back(
+          {std::move(path), item.depth + 1, node, std::move(known_files)});
+    }
+    if (subdirectories.empty()) return;
+
+    // Counted as unfinished before the directory holding them is finished, so
+    // the count never drops to zero while directories remain.
+    unfinished_count_ += subdirectories.size();
+    {
+      Queue &queue = queues_[thread_index];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      // Reversed, so the first subdirectory is read next.
+      for (auto subdirectory = subdirectories.rbegin();
+           subdirectory != subdirectories.rend(); ++subdirectory)
+        queue.items.push_back(std::move(*subdirectory));
+    }
+    queued_count_ += subdirectories.size();
+
+    if (sleeping_count_ == 0) return;
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    for (size_t i = 0; i < subdirectories.size(); i++)
+      work_queued_.notify_one();
+  }
+
+  // Hands over every read directory that comes next in depth first order,
+  // freeing the ones whose whole subtree was handed over. Must hold
+  // ordered_mutex_.
+  void HandOverReadNodes(size_t thread_index) {
+    while (!unhanded_nodes_.empty()) {
+      Node *node = unhanded_nodes_.back();
+      if (!node->is_read) return;
+
+      if (!node->is_handed_over) {
+        node->is_handed_over = true;
+        if (node->files.has_value())
+          on_directory_({node->path, node->depth, *node->files, thread_index});
+        node->files.reset();
+      }
+      if (node->next_child < node->children.size()) {
+        unhanded_nodes_.push_back(
+            node->children[node->next_child++].get());
+        continue;
+      }
+
+      unhanded_nodes_.pop_back();
+      if (!unhanded_nodes_.empty()) {
+        Node *parent = unhanded_nodes_.back();
+        parent->children[parent->next_child - 1].reset();
+      }
+    }
+  }
+
+  const FileSystem &file_system_;
+  const Options &options_;
+  std::string root_;
+  const DirectoryCallback &on_directory_;
+
+  std::vector<Queue> queues_;
+  // Directories in any queue.
+  std::atomic<size_t> queued_count_ = 0;
+  // Directories queued or being read.
+  std::atomic<size_t> unfinished_count_ = 0;
+
+  // Lets threads without work wait for more.
+  std::mutex idle_mutex_;
+  std::condition_variable work_queued_;
+  std::atomic<size_t> sleeping_count_ = 0;
+
+  // Only written by the thread reading the root.
+  absl::Status root_status_;
+  std::atomic<size_t> directory_count_ = 0;
+  std::atomic<size_t> file_count_ = 0;
+  std::atomic<size_t> skipped_directory_count_ = 0;
+  std::atomic<size_t> stolen_directory_count_ = 0;
+
+  // Guards the nodes of ordered walks.
+  std::mutex ordered_mutex_;
+  std::unique_ptr<Node> root_node_;
+  // Path from the root to the next node to hand over.
+  std::vector<Node *> unhanded_nodes_;
+};
+
+TreeWalker::TreeWalker(const FileSystem &file_system, Options options)
+    : file_system_(file_system), options_(std::move(options)) {}
+
+absl::StatusOr<TreeWalker::Stats> TreeWalker::Walk(
+    const Glib::ustring &root, const DirectoryCallback &on_directory) const {
+  WalkState state(*this, root, on_directory);
+  return state.Run();
+}
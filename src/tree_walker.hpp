@@ -0,0 +1,105 @@
+#ifndef TREE_WALKER_HPP
+#define TREE_WALKER_HPP
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <glibmm/ustring.h>
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <string_view>
+
+#include "filesystem.hpp"
+
+// Lists every directory below a root, reading directories on several threads
+// at once so slow disks and network file systems have many reads in flight.
+//
+// Each thread keeps its own queue of directories waiting to be read. It adds
+// the subdirectories it finds to the back of its queue and reads from the back
+// too, so each thread works depth first through its own part of the tree. A
+// thread that runs out of directories steals half of another thread's queue
+// from the front, where the directories closest to the root are, which tend to
+// hold the most work. Threads only wait on each other when one has nothing
+// left to read and nothing to steal.
+class TreeWalker {
+ public:
+  struct Options {
+    // Threads reading directories, including the one calling Walk().
+    size_t thread_count = 1;
+    // Directories this many levels below the root are listed, but not
+    // descended into. Zero only lists the root.
+    size_t max_depth = std::numeric_limits<size_t>::max();
+    // Metadata filled in for the files of every directory before they are
+    // handed over. Files removed in the meantime are left without it.
+    FileMetadataMask metadata_fields = 0;
+    // Whether to descend into the subdirectory at path, relative to the root
+    // and ending with a slash, which is directory in the listing of its
+    // parent, metadata included. Descends into every subdirectory if null.
+    // Called from several threads at once, before the directory holding it is
+    // handed over.
+    std::function<bool(std::string_view path, const File &directory)>
+        should_descend;
+    // Files to hand over for the subdirectory at path, with the same arguments
+    // as should_descend, instead of reading it, if any are returned. Metadata
+    // is still filled in for them, and the subdirectories among them are
+    // walked like those of any other directory. Reads every directory if null.
+    // Called from several threads at once, right after should_descend.
+    std::function<std::optional<DirectoryListing>(std::string_view path,
+                                                  const File &directory)>
+        get_known_files;
+    // Whether directories are handed over in the order a single thread walking
+    // depth first would find them, rather than as soon as they are read.
+    // Directories read early wait in memory until every one before them was
+    // handed over.
+    bool is_ordered = false;
+    // Stops the walk once set, if given.
+    const std::atomic<bool> *is_cancelled = nullptr;
+  };
+
+  struct Directory {
+    // Relative to the root, ending with a slash. Empty for the root itself.
+    std::string_view path;
+    // Levels below the root.
+    size_t depth;
+    const DirectoryListing &files;
+    // Of the thread handing the directory over, from zero up to the thread
+    // count. Threads never share an index, so callers can keep per-thread
+    // state without locking.
+    size_t thread_index;
+  };
+
+  // Receives every directory read. Called from several threads at once unless
+  // the walk is ordered, in which case calls never overlap.
+  using DirectoryCallback = std::function<void(const Directory &directory)>;
+
+  struct Stats {
+    size_t directory_count = 0;
+    size_t file_count = 0;
+    // Directories below the root that could not be read.
+    size_t skipped_directory_count = 0;
+    // Directories a thread took from the queue of another thread.
+    size_t stolen_directory_count = 0;
+  };
+
+  // file_system must outlive the walker, and be safe to use from multiple
+  // threads.
+  TreeWalker(const FileSystem &file_system, Options options);
+
+  // Lists root, which must be a full path, and every directory below it,
+  // handing each to on_directory. Directories below root that cannot be read
+  // are skipped. Returns the error from reading root itself if that fails, or
+  // an absl::CancelledError once cancelled.
+  absl::StatusOr<Stats> Walk(const Glib::ustring &root,
+                             const DirectoryCallback &on_directory) const;
+
+ private:
+  class WalkState;
+
+  const FileSystem &file_system_;
+  Options options_;
+};
+
+#endif  // TREE_WALKER_HPP
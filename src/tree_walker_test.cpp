@@ -0,0 +1,237 @@
+#include "tree_walker.hpp"
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <glibmm/ustring.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <initializer_list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "filesystem.hpp"
+
+namespace {
+
+using ::testing::Each;
+using ::testing::ElementsAre;
+using ::testing::Lt;
+using ::testing::UnorderedElementsAre;
+
+// Fails to read one directory, besides reading a MockFileSystem.
+class FailingFileSystem : public MockFileSystem {
+ public:
+  FailingFileSystem(const std::string& failing_directory,
+                    std::initializer_list<MockFile*> files)
+      : MockFileSystem(files), failing_directory_(failing_directory) {}
+
+  absl::StatusOr<DirectoryListing> GetDirectoryFiles(
+      const Glib::ustring& directory) const override {
+    if (directory == Glib::ustring(failing_directory_))
+      return absl::PermissionDeniedError("Nope!");
+    return MockFileSystem::GetDirectoryFiles(directory);
+  }
+
+ private:
+  std::string failing_directory_;
+};
+
+class TreeWalkerTest : public ::testing::Test {
+ protected:
+  TreeWalkerTest()
+      : file_system_(
+            {new MockFile("a.txt"),
+             new MockDirectory(
+                 "b", {new MockFile("b.txt"),
+                       new MockDirectory("c", {new MockDirectory("d", {})}),
+                       new MockDirectory("e", {new MockFile("e.txt")})}),
+             new MockDirectory("f", {new MockDirectory("g", {})}),
+             new MockDirectory("h", {})}) {}
+
+  // Walks the root with options, returning the path of every directory in the
+  // order they were handed over.
+  std::vector<std::string> Walk(const TreeWalker::Options& options) {
+    std::vector<std::string> paths;
+    std::mutex mutex;
+    absl::StatusOr<TreeWalker::Stats> stats =
+        TreeWalker(file_system_, options)
+            .Walk("/", [&](const TreeWalker::Directory& directory) {
+              std::lock_guard<std::mutex> lock(mutex);
+              paths.emplace_back(directory.path);
+            });
+    EXPECT_TRUE(stats.ok());
+    return paths;
+  }
+
+  MockFileSystem file_system_;
+};
+
+TEST_F(TreeWalkerTest, ListsEveryDirectoryOnce) {
+  TreeWalker::Options options;
+  options.thread_count = 4;
+  std::mutex mutex;
+  std::vector<std::string> paths;
+  std::vector<size_t> thread_indices;
+  absl::StatusOr<TreeWalker::Stats> stats =
+      TreeWalker(file_system_, options)
+          .Walk("/", [&](const TreeWalker::Directory& directory) {
+            std::lock_guard<std::mutex> lock(mutex);
+            paths.emplace_back(directory.path);
+            thread_indices.push_back(directory.thread_index);
+          });
+
+  ASSERT_TRUE(stats.ok());
+  EXPECT_THAT(paths, UnorderedElementsAre("", "b/", "b/c/", "b/c/d/", "b/e/",
+                                          "f/", "f/g/", "h/"));
+  EXPECT_THAT(thread_indices, Each(Lt(4)));
+  EXPECT_EQ(stats->directory_count, 8);
+  EXPECT_EQ(stats->file_count, 10);
+  EXPECT_EQ(stats->skipped_directory_count, 0);
+}
+
+TEST_F(TreeWalkerTest, OrderedWalkIsDepthFirstWithAnyThreadCount) {
+  for (size_t thread_count : {1, 2, 8}) {
+    TreeWalker::Options options;
+    options.thread_count = thread_count;
+    options.is_ordered = true;
+
+    EXPECT_THAT(Walk(options), ElementsAre("", "b/", "b/c/", "b/c/d/", "b/e/",
+                                           "f/", "f/g/", "h/"));
+  }
+}
+
+TEST_F(TreeWalkerTest, StopsAtMaxDepth) {
+  TreeWalker::Options options;
+  options.thread_count = 2;
+  options.max_depth = 1;
+
+  EXPECT_THAT(Walk(options), UnorderedElementsAre("", "b/", "f/", "h/"));
+}
+
+TEST_F(TreeWalkerTest, OnlyDescendsIntoDirectoriesPassingFilter) {
+  TreeWalker::Options options;
+  options.thread_count = 2;
+  options.is_ordered = true;
+  options.should_descend = [](std::string_view path, const File& directory) {
+    return path != "b/";
+  };
+
+  EXPECT_THAT(Walk(options), ElementsAre("", "f/", "f/g/", "h/"));
+}
+
+TEST_F(TreeWalkerTest, FillsMetadataBeforeDescending) {
+  TreeWalker::Options options;
+  options.thread_count = 2;
+  options.metadata_fields = kFileMetadataType;
+  std::atomic<int> directories_without_metadata = 0;
+  options.should_descend = [&](std::string_view path, const File& directory) {
+    if (!S_ISDIR(directory.GetMetadata().mode)) directories_without_metadata++;
+    return true;
+  };
+  std::atomic<int> files_without_metadata = 0;
+
+  absl::StatusOr<TreeWalker::Stats> stats =
+      TreeWalker(file_system_, options)
+          .Walk("/", [&](const TreeWalker::Directory& directory) {
+            for (File file : directory.files) {
+              if (!(file.GetMetadata().filled_fields & kFileMetadataType))
+                files_without_metadata++;
+            }
+          });
+
+  ASSERT_TRUE(stats.ok());
+  EXPECT_EQ(directories_without_metadata, 0);
+  EXPECT_EQ(files_without_metadata, 0);
+}
+
+TEST_F(TreeWalkerTest, SkipsSubdirectoriesThatCannotBeRead) {
+  FailingFileSystem file_system(
+      "/b/", {new MockDirectory("b", {new MockDirectory("c", {})}),
+              new MockDirectory("f", {})});
+  TreeWalker::Options options;
+  options.thread_count = 2;
+  options.is_ordered = true;
+  std::vector<std::string> paths;
+
+  absl::StatusOr<TreeWalker::Stats> stats =
+      TreeWalker(file_system, options)
+          .Walk("/", [&](const TreeWalker::Directory& directory) {
+            paths.emplace_back(directory.path);
+          });
+
+  ASSERT_TRUE(stats.ok());
+  EXPECT_THAT(paths, ElementsAre("", "f/"));
+  EXPECT_EQ(stats->skipped_directory_count, 1);
+}
+
+TEST_F(TreeWalkerTest, HandsOverKnownFilesWithoutReadingDirectory) {
+  FailingFileSystem file_system(
+      "/b/", {new MockDirectory("b", {new MockDirectory("c", {}),
+                                      new MockDirectory("e", {})}),
+              new MockDirectory("f", {})});
+  TreeWalker::Options options;
+  options.thread_count = 2;
+  options.is_ordered = true;
+  options.metadata_fields = kFileMetadataType;
+  options.get_known_files = [](std::string_view path, const File&) {
+    std::optional<DirectoryListing> files;
+    if (path == "b/") {
+      files.emplace();
+      files->Add("c", /*is_dir=*/true);
+    }
+    return files;
+  };
+  std::vector<std::string> paths;
+
+  absl::StatusOr<TreeWalker::Stats> stats =
+      TreeWalker(file_system, options)
+          .Walk("/", [&](const TreeWalker::Directory& directory) {
+            paths.emplace_back(directory.path);
+            if (directory.path != "b/") return;
+            ASSERT_EQ(directory.files.size(), 1);
+            EXPECT_TRUE(S_ISDIR(directory.files[0].GetMetadata().mode));
+          });
+
+  ASSERT_TRUE(stats.ok());
+  EXPECT_THAT(paths, ElementsAre("", "b/", "b/c/", "f/"));
+  EXPECT_EQ(stats->skipped_directory_count, 0);
+}
+
+TEST_F(TreeWalkerTest, FailsIfRootCannotBeRead) {
+  TreeWalker::Options options;
+  options.thread_count = 2;
+
+  absl::StatusOr<TreeWalker::Stats> stats =
+      TreeWalker(file_system_, options)
+          .Walk("/nope/", [](const TreeWalker::Directory& directory) {
+            FAIL() << "Nothing should be listed";
+          });
+
+  EXPECT_EQ(stats.status().code(), absl::StatusCode::kNotFound);
+}
+
+TEST_F(TreeWalkerTest, StopsOnceCancelled) {
+  std::atomic<bool> is_cancelled = false;
+  TreeWalker::Options options;
+  options.thread_count = 1;
+  options.is_cancelled = &is_cancelled;
+  std::vector<std::string> paths;
+
+  absl::StatusOr<TreeWalker::Stats> stats =
+      TreeWalker(file_system_, options)
+          .Walk("/", [&](const TreeWalker::Directory& directory) {
+            paths.emplace_back(directory.path);
+            is_cancelled = true;
+          });
+
+  EXPECT_EQ(stats.status().code(), absl::StatusCode::kCancelled);
+  EXPECT_THAT(paths, ElementsAre(""));
+}
+
+}  // namespace